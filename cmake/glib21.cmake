@@ -9,6 +9,7 @@ if (BUILD_MONOLITHIC OR BUILD_DAEMON)
 	check_include_file (fcntl.h HAVE_FCNTL_H)
 	check_include_file (sys/resource.h HAVE_SYS_RESOURCE_H)
 	check_include_file (sys/statvfs.h HAVE_SYS_STATVFS_H)
+	check_include_file (sys/inotify.h HAVE_SYS_INOTIFY_H)
 
 	set (TEST_APP "#include <features.h>
 		#ifdef __GNU_LIBRARY__
@@ -8,8 +8,10 @@ if (BUILD_MONOLITHIC OR BUILD_DAEMON)
 		kademlia/net/PacketTracking.cpp
 		kademlia/routing/Contact.cpp
 		kademlia/routing/RoutingZone.cpp
+		AICHHashIndex.cpp
 		amule.cpp
 		BaseClient.cpp
+		ClientCreditsFile.cpp
 		ClientCreditsList.cpp
 		ClientList.cpp
 		ClientTCPSocket.cpp
@@ -26,7 +28,10 @@ if (BUILD_MONOLITHIC OR BUILD_DAEMON)
 		IPFilter.cpp
 		KnownFileList.cpp
 		ListenSocket.cpp
+		Metrics.cpp
+		MetricsServer.cpp
 		MuleUDPSocket.cpp
+		PartFileLoader.cpp
 		SearchFile.cpp
 		SearchList.cpp
 		ServerConnect.cpp
@@ -34,11 +39,16 @@ if (BUILD_MONOLITHIC OR BUILD_DAEMON)
 		ServerSocket.cpp
 		ServerUDPSocket.cpp
 		SHAHashSet.cpp
+		SharedDirScanner.cpp
+		SharedDirWatcher.cpp
 		SharedFileList.cpp
+		StartupLoader.cpp
+		StatsHistory.cpp
 		UploadBandwidthThrottler.cpp
 		UploadClient.cpp
 		UploadQueue.cpp
 		ThreadTasks.cpp
+		TimerWheel.cpp
 	)
 endif()
 
@@ -0,0 +1,296 @@
+//
+// This file is part of the aMule Project.
+//
+// Copyright (c) 2003-2011 aMule Team ( admin@amule.org / http://www.amule.org )
+//
+// Any parts of this program derived from the xMule, lMule or eMule project,
+// or contributed by third-party developers are copyrighted by their
+// respective authors.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA
+//
+
+#include "AICHHashIndex.h"	// Interface declarations
+
+#include "CFile.h"		// Needed for CFile
+#include "MemFile.h"		// Needed for CMemFile
+#include "Logger.h"		// Needed for AddDebugLogLine{C,N}
+#include <common/Format.h>	// Needed for CFormat
+
+#include <vector>
+
+#define KNOWN2_INDEX_VERSION	0x01
+//! Version and covered length
+#define KNOWN2_INDEX_HEADERSIZE	(1 + 8)
+//! Master hash and offset
+#define KNOWN2_INDEX_ENTRYSIZE	(HASHSIZE + 8)
+
+
+CAICHHashIndex::CAICHHashIndex()
+	: m_metLength(0),
+	  m_loaded(false)
+{
+}
+
+
+bool CAICHHashIndex::Load(const CPath& metPath, const CPath& indexPath)
+{
+	m_entries.clear();
+	m_metLength = 0;
+	m_indexPath = indexPath;
+	m_loaded = false;
+
+	try {
+		CFile metFile;
+		if (!metPath.FileExists()) {
+			// Try to create it to see if it can be created at all
+			if (!metFile.Open(metPath, CFile::write)) {
+				AddDebugLogLineC(logSHAHashSet, wxT("Error, failed to create 'known2_64.met' file!"));
+				return false;
+			}
+
+			metFile.WriteUInt8(KNOWN2_MET_VERSION);
+			m_metLength = 1;
+			m_loaded = true;
+			WriteIndex();
+			return true;
+		}
+
+		if (!metFile.Open(metPath, CFile::read)) {
+			AddDebugLogLineC(logSHAHashSet, wxT("Error, failed to open 'known2_64.met' file!"));
+			return false;
+		}
+
+		bool upToDate = ReadIndex(metFile);
+		if (!upToDate) {
+			AddDebugLogLineN(logSHAHashSet, wxT("Rebuilding index of 'known2_64.met'."));
+			m_entries.clear();
+			m_metLength = 0;
+		}
+
+		if (ScanMetFile(metFile)) {
+			upToDate = false;
+		}
+
+		m_loaded = true;
+		if (!upToDate) {
+			WriteIndex();
+		}
+	} catch (const CIOFailureException& e) {
+		AddDebugLogLineC(logSHAHashSet, wxT("IO failure while indexing 'known2_64.met': ") + e.what());
+		m_entries.clear();
+		m_metLength = 0;
+		return false;
+	}
+
+	AddDebugLogLineN(logSHAHashSet, CFormat(wxT("Indexed %u hashsets in 'known2_64.met'.")) % m_entries.size());
+
+	return true;
+}
+
+
+bool CAICHHashIndex::Find(const CAICHHash& hash, uint64& offset) const
+{
+	EntryMap::const_iterator it = m_entries.find(hash);
+	if (it == m_entries.end()) {
+		return false;
+	}
+
+	offset = it->second;
+	return true;
+}
+
+
+void CAICHHashIndex::Add(const CAICHHash& hash, uint64 offset, uint64 metLength)
+{
+	m_entries.insert(EntryMap::value_type(hash, offset));
+	m_metLength = metLength;
+
+	try {
+		CFile indexFile;
+		if (!m_indexPath.FileExists() || !indexFile.Open(m_indexPath, CFile::read_write)) {
+			WriteIndex();
+			return;
+		} else if (indexFile.GetLength() < KNOWN2_INDEX_HEADERSIZE) {
+			indexFile.Close();
+			WriteIndex();
+			return;
+		}
+
+		// The entry goes first, so that an interrupted update leaves an
+		// entry past the covered length, which is detected on loading.
+		indexFile.Seek(0, wxFromEnd);
+		hash.Write(&indexFile);
+		indexFile.WriteUInt64(offset);
+
+		indexFile.Seek(1);
+		indexFile.WriteUInt64(metLength);
+	} catch (const CIOFailureException& e) {
+		AddDebugLogLineC(logSHAHashSet, wxT("IO failure while updating index of 'known2_64.met': ") + e.what());
+	}
+}
+
+
+void CAICHHashIndex::GetMasterHashes(std::list<CAICHHash>& hashes) const
+{
+	for (EntryMap::const_iterator it = m_entries.begin(); it != m_entries.end(); ++it) {
+		hashes.push_back(it->first);
+	}
+}
+
+
+bool CAICHHashIndex::ReadIndex(CFile& metFile)
+{
+	CFile indexFile;
+	if (!m_indexPath.FileExists() || !indexFile.Open(m_indexPath, CFile::read)) {
+		return false;
+	}
+
+	try {
+		const uint64 length = indexFile.GetLength();
+		if (length < KNOWN2_INDEX_HEADERSIZE || (length - KNOWN2_INDEX_HEADERSIZE) % KNOWN2_INDEX_ENTRYSIZE) {
+			AddDebugLogLineN(logSHAHashSet, wxT("Index of 'known2_64.met' has an invalid size."));
+			return false;
+		}
+
+		// Read everything at once, rather than doing two reads per entry
+		std::vector<uint8> buffer(length);
+		indexFile.Read(&buffer[0], length);
+		CMemFile data(&buffer[0], length);
+
+		if (data.ReadUInt8() != KNOWN2_INDEX_VERSION) {
+			AddDebugLogLineN(logSHAHashSet, wxT("Index of 'known2_64.met' has an unknown version."));
+			return false;
+		}
+
+		const uint64 covered = data.ReadUInt64();
+		if (covered < 1 || covered > metFile.GetLength()) {
+			AddDebugLogLineN(logSHAHashSet, wxT("Index of 'known2_64.met' covers more than the file."));
+			return false;
+		}
+
+		CAICHHash lastHash;
+		uint64 lastOffset = 0;
+		const uint64 count = (length - KNOWN2_INDEX_HEADERSIZE) / KNOWN2_INDEX_ENTRYSIZE;
+		for (uint64 i = 0; i < count; ++i) {
+			CAICHHash hash(&data);
+			const uint64 offset = data.ReadUInt64();
+
+			// A record needs at least the master hash and the hash count
+			if (offset < 1 || offset + HASHSIZE + 4 > covered) {
+				AddDebugLogLineN(logSHAHashSet, wxT("Index of 'known2_64.met' contains invalid offsets."));
+				return false;
+			}
+
+			m_entries.insert(EntryMap::value_type(hash, offset));
+			if (offset >= lastOffset) {
+				lastHash = hash;
+				lastOffset = offset;
+			}
+		}
+
+		// Check that the index belongs to this met-file
+		if (lastOffset) {
+			metFile.Seek(lastOffset);
+			if (CAICHHash(&metFile) != lastHash) {
+				AddDebugLogLineN(logSHAHashSet, wxT("Index of 'known2_64.met' does not match the file."));
+				return false;
+			}
+		}
+
+		m_metLength = covered;
+	} catch (const CSafeIOException& e) {
+		AddDebugLogLineN(logSHAHashSet, wxT("Error while reading index of 'known2_64.met': ") + e.what());
+		return false;
+	}
+
+	return true;
+}
+
+
+bool CAICHHashIndex::ScanMetFile(CFile& metFile)
+{
+	const uint64 startLength = m_metLength;
+	const uint64 nExistingSize = metFile.GetLength();
+	uint64 nLastVerifiedPos = m_metLength;
+
+	if (m_metLength == nExistingSize) {
+		return false;
+	}
+
+	try {
+		if (m_metLength == 0) {
+			if (metFile.ReadUInt8() != KNOWN2_MET_VERSION) {
+				throw CEOFException(wxT("Invalid met-file header found, removing file."));
+			}
+			nLastVerifiedPos = 1;
+		} else {
+			metFile.Seek(m_metLength);
+		}
+
+		while (metFile.GetPosition() < nExistingSize) {
+			const uint64 offset = metFile.GetPosition();
+			CAICHHash hash(&metFile);
+
+			uint32 nHashCount = metFile.ReadUInt32();
+			if (metFile.GetPosition() + nHashCount * CAICHHash::GetHashSize() > nExistingSize) {
+				throw CEOFException(wxT("Hashlist ends past end of file."));
+			}
+
+			// skip the rest of this hashset
+			nLastVerifiedPos = metFile.Seek(nHashCount * HASHSIZE, wxFromCurrent);
+			// The first record wins, like it did for linear searches
+			m_entries.insert(EntryMap::value_type(hash, offset));
+		}
+	} catch (const CEOFException&) {
+		AddDebugLogLineC(logSHAHashSet, wxT("Hashlist corrupted, truncating file."));
+		metFile.Close();
+		metFile.Reopen(CFile::read_write);
+		metFile.SetLength(nLastVerifiedPos);
+	}
+
+	m_metLength = nLastVerifiedPos;
+
+	return m_metLength != startLength;
+}
+
+
+void CAICHHashIndex::WriteIndex()
+{
+	CMemFile data(KNOWN2_INDEX_HEADERSIZE + m_entries.size() * KNOWN2_INDEX_ENTRYSIZE);
+	data.WriteUInt8(KNOWN2_INDEX_VERSION);
+	data.WriteUInt64(m_metLength);
+
+	for (EntryMap::const_iterator it = m_entries.begin(); it != m_entries.end(); ++it) {
+		it->first.Write(&data);
+		data.WriteUInt64(it->second);
+	}
+
+	try {
+		CFile indexFile;
+		if (!indexFile.Open(m_indexPath, CFile::write_safe)) {
+			AddDebugLogLineC(logSHAHashSet, wxT("Failed to save index of 'known2_64.met'."));
+			return;
+		}
+
+		indexFile.Write(data.GetRawBuffer(), data.GetLength());
+		if (!indexFile.Close()) {
+			AddDebugLogLineC(logSHAHashSet, wxT("Failed to save index of 'known2_64.met'."));
+		}
+	} catch (const CIOFailureException& e) {
+		AddDebugLogLineC(logSHAHashSet, wxT("IO failure while saving index of 'known2_64.met': ") + e.what());
+	}
+}
+// File_checked_for_headers
@@ -0,0 +1,128 @@
+//
+// This file is part of the aMule Project.
+//
+// Copyright (c) 2003-2011 aMule Team ( admin@amule.org / http://www.amule.org )
+//
+// Any parts of this program derived from the xMule, lMule or eMule project,
+// or contributed by third-party developers are copyrighted by their
+// respective authors.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA
+//
+
+#ifndef AICHHASHINDEX_H
+#define AICHHASHINDEX_H
+
+#include "SHAHashSet.h"		// Needed for CAICHHash
+#include <common/Path.h>	// Needed for CPath
+
+#include <list>
+#include <map>
+
+class CFile;
+
+
+/**
+ * Index of the hashsets stored in known2_64.met.
+ *
+ * known2_64.met is a plain sequence of records (master hash, hash count,
+ * hashes), so finding the hashset of a file used to mean walking every
+ * record in front of it. This class maps master hashes to the offsets of
+ * their records instead.
+ *
+ * The index is stored in a sidecar file (known2_64.idx), so it does not
+ * have to be rebuilt from known2_64.met on every start:
+ *
+ *   uint8	version
+ *   uint64	length of known2_64.met covered by the index
+ *   n times:
+ *     hash	master hash
+ *     uint64	offset of the record in known2_64.met
+ *
+ * Records appended to known2_64.met are appended to the sidecar as well.
+ * Records past the covered length (for example after a crash) are picked
+ * up by scanning only the tail of known2_64.met, and a sidecar that does
+ * not match known2_64.met is rebuilt from scratch.
+ *
+ * The class does no locking of its own.
+ */
+class CAICHHashIndex
+{
+public:
+	CAICHHashIndex();
+
+	/**
+	 * Loads the index, creating known2_64.met if it does not exist.
+	 *
+	 * Corrupt records at the end of known2_64.met are truncated, and the
+	 * sidecar is rewritten if it was missing or out of date.
+	 *
+	 * @return False if known2_64.met could not be opened or created.
+	 */
+	bool	Load(const CPath& metPath, const CPath& indexPath);
+
+	//! Returns true if Load succeeded.
+	bool	IsLoaded() const	{ return m_loaded; }
+
+	/**
+	 * Looks up the offset of the record of a master hash.
+	 */
+	bool	Find(const CAICHHash& hash, uint64& offset) const;
+
+	/**
+	 * Registers a record appended to known2_64.met.
+	 *
+	 * @param hash The master hash of the record.
+	 * @param offset The offset of the record.
+	 * @param metLength The length of known2_64.met including the record.
+	 */
+	void	Add(const CAICHHash& hash, uint64 offset, uint64 metLength);
+
+	//! Returns the master hashes of all stored hashsets.
+	void	GetMasterHashes(std::list<CAICHHash>& hashes) const;
+
+	//! Returns the number of stored hashsets.
+	uint32	GetCount() const	{ return m_entries.size(); }
+
+private:
+	/**
+	 * Reads the sidecar and checks it against known2_64.met.
+	 *
+	 * @return False if the sidecar is missing or does not match.
+	 */
+	bool	ReadIndex(CFile& metFile);
+
+	/**
+	 * Indexes the records of known2_64.met past the covered length.
+	 *
+	 * @return True if the covered length changed.
+	 */
+	bool	ScanMetFile(CFile& metFile);
+
+	//! Rewrites the sidecar from the in-memory index.
+	void	WriteIndex();
+
+	typedef std::map<CAICHHash, uint64> EntryMap;
+	//! Master hash -> offset of the record.
+	EntryMap	m_entries;
+	//! Length of known2_64.met covered by m_entries.
+	uint64		m_metLength;
+	//! Path of the sidecar.
+	CPath		m_indexPath;
+	bool		m_loaded;
+};
+
+#endif // AICHHASHINDEX_H
+// File_checked_for_headers
@@ -2108,14 +2108,28 @@ void CUpDownClient::SendSignaturePacket()
 		}
 	}
 	//end v2
-	uint8_t achBuffer[250];
 
-	uint8 siglen = theApp->clientcredits->CreateSignature(credits, achBuffer,  250, ChallengeIP, byChaIPKind );
-	wxCHECK2(siglen != 0, return);
+	// Signing is done on the crypto worker, and continues in OnSignatureCreated.
+	// The state is updated right away, so that no second signature is requested
+	// for the same challenge meanwhile.
+	m_SecureIdentState = IS_ALLREQUESTSSEND;
+	theApp->clientcredits->CreateSignatureAsync(this, credits, ChallengeIP, byChaIPKind);
+}
+
+
+void CUpDownClient::OnSignatureCreated(const uint8_t* pachSignature, uint8 nSignatureLen, uint8 byChaIPKind)
+{
+	if (m_socket == NULL) {
+		// Disconnected while the signature was created
+		return;
+	}
+
+	// v1 signatures carry no challenge IP
+	bool bUseV2 = (byChaIPKind != 0);
 
 	CMemFile data;
-	data.WriteUInt8(siglen);
-	data.Write(achBuffer, siglen);
+	data.WriteUInt8(nSignatureLen);
+	data.Write(pachSignature, nSignatureLen);
 	if (bUseV2) {
 		data.WriteUInt8(byChaIPKind);
 	}
@@ -2125,7 +2139,6 @@ void CUpDownClient::SendSignaturePacket()
 	theStats::AddUpOverheadOther(packet->GetPacketSize());
 	AddDebugLogLineN( logLocalClient, wxT("Local Client: OP_SIGNATURE to ") + GetFullIP() );
 	SendPacket(packet,true,true);
-	m_SecureIdentState = IS_ALLREQUESTSSEND;
 }
 
 
@@ -2210,15 +2223,21 @@ void CUpDownClient::ProcessSignaturePacket(const uint8_t* pachPacket, uint32 nSi
 		return;
 	}
 
+	// Verified on the crypto worker, the result is saved in the credits and
+	// reported to OnIdentVerified
+	m_dwLastSignatureIP = GetIP();
+	theApp->clientcredits->VerifyIdentAsync(this, credits, pachPacket+1, pachPacket[0], GetIP(), byChaIPKind);
+}
+
+
+void CUpDownClient::OnIdentVerified(bool bResult, uint8 byChaIPKind)
+{
 	// cppcheck-suppress duplicateBranch
-	if (theApp->clientcredits->VerifyIdent(credits, pachPacket+1, pachPacket[0], GetIP(), byChaIPKind ) ) {
-		// result is saved in function above
+	if (bResult) {
 		AddDebugLogLineN( logClient, CFormat( wxT("'%s' has passed the secure identification, V2 State: %i") ) % GetUserName() % byChaIPKind );
 	} else {
 		AddDebugLogLineN( logClient, CFormat( wxT("'%s' has failed the secure identification, V2 State: %i") ) % GetUserName() % byChaIPKind );
 	}
-
-	m_dwLastSignatureIP = GetIP();
 }
 
 void CUpDownClient::SendSecIdentStatePacket()
@@ -39,6 +39,27 @@ public:
 		m_vector = NULL;
 	}
 
+	BitVector(const BitVector& other)
+	{
+		m_bits	= 0;
+		m_bytes = 0;
+		m_allTrue = 0;
+		m_vector = NULL;
+		*this = other;
+	}
+
+	BitVector& operator=(const BitVector& other)
+	{
+		if (this != &other) {
+			setsize(other.m_bits, false);
+			if (m_bytes) {
+				memcpy(m_vector, other.m_vector, m_bytes);
+			}
+			m_allTrue = other.m_allTrue;
+		}
+		return *this;
+	}
+
 	~BitVector() { clear();	}
 
 	// number of bits
@@ -0,0 +1,155 @@
+//
+// This file is part of the aMule Project.
+//
+// Copyright (c) 2003-2011 aMule Team ( admin@amule.org / http://www.amule.org )
+//
+// Any parts of this program derived from the xMule, lMule or eMule project,
+// or contributed by third-party developers are copyrighted by their
+// respective authors.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA
+//
+
+#ifndef BOUNDEDQUEUE_H
+#define BOUNDEDQUEUE_H
+
+#include "Types.h"		// Needed for uint32
+#include "MuleAtomic.h"		// Needed for CAtomic
+
+
+
+/**
+ * Fixed size queue for handing items from any number of threads to a
+ * single consumer thread without locking.
+ *
+ * Every slot carries a sequence number, which tells producers whether
+ * the slot is free for the position they claimed and the consumer
+ * whether the item in it has been completely written (the bounded queue
+ * described by Dmitry Vyukov). Producers claim positions with a single
+ * compare-and-swap and never wait for each other; Push fails instead of
+ * blocking when the queue is full, leaving the policy to the caller.
+ *
+ * Items are copied in and out, so T should be a plain structure.
+ */
+template <typename T>
+class CBoundedQueue
+{
+public:
+	/**
+	 * Constructor.
+	 *
+	 * @param size The number of slots, rounded up to a power of two.
+	 */
+	CBoundedQueue(uint32 size)
+		: m_dequeuePos(0),
+		  m_enqueuePos(0)
+	{
+		uint32 capacity = 2;
+		while (capacity < size) {
+			capacity *= 2;
+		}
+
+		m_mask = capacity - 1;
+		m_slots = new Slot[capacity];
+		for (uint32 i = 0; i < capacity; ++i) {
+			m_slots[i].sequence.Store(i);
+		}
+	}
+
+	~CBoundedQueue()
+	{
+		delete [] m_slots;
+	}
+
+	/**
+	 * Adds an item, can be called by any thread.
+	 *
+	 * @return False if the queue is full.
+	 */
+	bool Push(const T& item)
+	{
+		uint32 pos = m_enqueuePos.Load();
+		Slot* slot;
+
+		while (true) {
+			slot = &m_slots[pos & m_mask];
+			const sint32 diff = static_cast<sint32>(slot->sequence.Load() - pos);
+
+			if (diff == 0) {
+				// The slot is free, try to claim the position
+				if (m_enqueuePos.CompareExchange(pos, pos + 1)) {
+					break;
+				}
+			} else if (diff < 0) {
+				// The consumer has not taken the item one lap ago yet
+				return false;
+			} else {
+				// Another producer claimed the position
+				pos = m_enqueuePos.Load();
+			}
+		}
+
+		slot->item = item;
+		slot->sequence.Store(pos + 1);
+
+		return true;
+	}
+
+	/**
+	 * Removes the oldest item, must only be called by the consumer.
+	 *
+	 * @return False if the queue is empty, or the oldest item is still being written.
+	 */
+	bool Pop(T& item)
+	{
+		Slot* slot = &m_slots[m_dequeuePos & m_mask];
+		if (slot->sequence.Load() != m_dequeuePos + 1) {
+			return false;
+		}
+
+		item = slot->item;
+		// Free the slot for the producer one lap ahead
+		slot->sequence.Store(m_dequeuePos + m_mask + 1);
+		++m_dequeuePos;
+
+		return true;
+	}
+
+	//! Returns the number of slots.
+	uint32 GetCapacity() const	{ return m_mask + 1; }
+
+	//! Returns the number of items queued, must only be called by the consumer.
+	uint32 GetCount() const		{ return m_enqueuePos.Load() - m_dequeuePos; }
+
+private:
+	struct Slot
+	{
+		CAtomic<uint32>	sequence;
+		T		item;
+	};
+
+	Slot*		m_slots;
+	uint32		m_mask;
+	//! Only used by the consumer.
+	uint32		m_dequeuePos;
+	CAtomic<uint32>	m_enqueuePos;
+
+	//! A CBoundedQueue is neither copyable nor assignable.
+	CBoundedQueue(const CBoundedQueue&);
+	CBoundedQueue& operator=(const CBoundedQueue&);
+};
+
+#endif // BOUNDEDQUEUE_H
+// File_checked_for_headers
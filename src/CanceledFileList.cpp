@@ -35,7 +35,6 @@
 CCanceledFileList::CCanceledFileList()
 {
 	m_filename = wxT("canceled.met");
-	Init();
 }
 
 
@@ -35,8 +35,10 @@
 class CCanceledFileList
 {
 public:
-	// Ctor, calls Init()
+	// Ctor, the list is loaded by Init()
 	CCanceledFileList();
+	// Load list from file (if it exists)
+	bool	Init();
 	// Save list
 	void	Save();
 	// Check if hash belongs to a canceled file
@@ -52,9 +54,6 @@ private:
 	CanceledFileList m_canceledFileList;
 	// The filename "canceled.met"
 	wxString	m_filename;
-
-	// Load list from file (if it exists)
-	bool	Init();
 };
 
 #endif // CANCELEDFILELIST_H
@@ -0,0 +1,377 @@
+//
+// This file is part of the aMule Project.
+//
+// Copyright (c) 2003-2011 aMule Team ( admin@amule.org / http://www.amule.org )
+//
+// Any parts of this program derived from the xMule, lMule or eMule project,
+// or contributed by third-party developers are copyrighted by their
+// respective authors.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA
+//
+
+#include "ClientCreditsFile.h"	// Interface declarations
+
+#include <common/DataFileVersion.h>	// Needed for CREDITFILE_VERSION
+#include <common/Format.h>	// Needed for CFormat
+
+#include "ArchSpecific.h"	// Needed for PeekUInt32
+#include "ClientCredits.h"	// Needed for CreditStruct
+#include "CFile.h"		// Needed for CFile
+#include "MemFile.h"		// Needed for CMemFile
+#include "Logger.h"		// Needed for AddDebugLogLineC
+
+#include <algorithm>		// Needed for std::stable_sort
+#include <functional>		// Needed for std::greater
+
+
+//! Version and number of records.
+#define CREDIT_HEADER_SIZE	5
+//! Hash, up- and download split in halves, last seen, reserved, key size and key.
+#define CREDIT_RECORD_SIZE	(16 + 4 + 4 + 4 + 4 + 4 + 2 + 1 + MAXPUBKEYSIZE)
+//! Offsets of the fields looked at while indexing.
+#define CREDIT_LASTSEEN_OFFSET	24
+#define CREDIT_KEYSIZE_OFFSET	38
+
+
+/** Orders index entries by user hash only, keeping the file order of duplicates. */
+static bool CompareKeys(const std::pair<CMD4Hash, uint32>& a, const std::pair<CMD4Hash, uint32>& b)
+{
+	return a.first < b.first;
+}
+
+
+/** Parses a record in the format of clients.met. */
+static void ParseRecord(const uint8* buffer, CreditStruct& record)
+{
+	const CMemFile data(buffer, CREDIT_RECORD_SIZE);
+
+	record.key		= data.ReadHash();
+	record.uploaded		= data.ReadUInt32();
+	record.downloaded	= data.ReadUInt32();
+	record.nLastSeen	= data.ReadUInt32();
+	record.uploaded		+= static_cast<uint64>(data.ReadUInt32()) << 32;
+	record.downloaded	+= static_cast<uint64>(data.ReadUInt32()) << 32;
+	record.nReserved3	= data.ReadUInt16();
+	record.nKeySize		= data.ReadUInt8();
+	data.Read(record.abySecureIdent, MAXPUBKEYSIZE);
+}
+
+
+CClientCreditsFile::CClientCreditsFile()
+	: m_count(0),
+	  m_slots(0),
+	  m_savedSlots(0),
+	  m_expired(0)
+{
+}
+
+
+CClientCreditsFile::~CClientCreditsFile()
+{
+	Close();
+}
+
+
+bool CClientCreditsFile::Open(const CPath& path, uint32 expiredBefore)
+{
+	Close();
+	m_path = path;
+
+	if (path.FileExists()) {
+		bool indexed = false;
+		try {
+			indexed = m_file.Open(path, CFile::read_write) && Index(expiredBefore);
+		} catch (const CSafeIOException& e) {
+			AddDebugLogLineC(logCredits, wxT("IO error while loading clients.met file: ") + e.what());
+		}
+
+		if (indexed) {
+			// Keep the file from growing with peers which are gone for good
+			if (m_freeSlots.size() > m_count) {
+				try {
+					if (!Compact()) {
+						AddDebugLogLineC(logCredits, wxT("Failed to compact creditfile"));
+					}
+				} catch (const CSafeIOException& e) {
+					AddDebugLogLineC(logCredits, wxT("IO error while compacting clients.met file: ") + e.what());
+				}
+			}
+
+			// A failed compaction leaves either the indexed file or the
+			// compacted one in place, never start over on top of them.
+			return m_file.IsOpened();
+		}
+	}
+
+	if (!Create()) {
+		AddDebugLogLineC(logCredits, wxT("Failed to create creditfile"));
+	}
+
+	return false;
+}
+
+
+void CClientCreditsFile::Close()
+{
+	m_area.Close();
+	if (m_file.IsOpened()) {
+		m_file.Close();
+	}
+
+	m_index.clear();
+	m_added.clear();
+	m_freeSlots.clear();
+	m_count = 0;
+	m_slots = 0;
+	m_savedSlots = 0;
+	m_expired = 0;
+}
+
+
+bool CClientCreditsFile::Read(const CMD4Hash& key, CreditStruct& record)
+{
+	std::map<CMD4Hash, uint32>::const_iterator it = m_added.find(key);
+	if (it != m_added.end()) {
+		// Written since the file was mapped
+		uint8 buffer[CREDIT_RECORD_SIZE];
+		m_file.ReadAt(buffer, CREDIT_HEADER_SIZE + static_cast<uint64>(it->second) * CREDIT_RECORD_SIZE, CREDIT_RECORD_SIZE);
+		ParseRecord(buffer, record);
+
+		return true;
+	}
+
+	SlotIndex::const_iterator slot = std::lower_bound(m_index.begin(), m_index.end(),
+		std::make_pair(key, 0u), CompareKeys);
+	if (slot == m_index.end() || slot->first != key) {
+		return false;
+	}
+
+	ParseRecord(m_area.GetBuffer() + static_cast<size_t>(slot->second) * CREDIT_RECORD_SIZE, record);
+	m_area.CheckError();
+
+	return true;
+}
+
+
+void CClientCreditsFile::Write(const CreditStruct& record)
+{
+	uint32 slot;
+	const bool found = FindSlot(record.key, slot);
+	if (!found) {
+		slot = m_freeSlots.empty() ? m_slots : m_freeSlots.back();
+	}
+
+	uint8 buffer[CREDIT_RECORD_SIZE];
+	CMemFile data(buffer, CREDIT_RECORD_SIZE);
+	data.WriteHash(record.key);
+	data.WriteUInt32(static_cast<uint32>(record.uploaded));
+	data.WriteUInt32(static_cast<uint32>(record.downloaded));
+	data.WriteUInt32(record.nLastSeen);
+	data.WriteUInt32(static_cast<uint32>(record.uploaded >> 32));
+	data.WriteUInt32(static_cast<uint32>(record.downloaded >> 32));
+	data.WriteUInt16(record.nReserved3);
+	data.WriteUInt8(record.nKeySize);
+	// Doesn't matter if this saves garbage, will be fixed on load.
+	data.Write(record.abySecureIdent, MAXPUBKEYSIZE);
+
+	m_file.WriteAt(buffer, CREDIT_HEADER_SIZE + static_cast<uint64>(slot) * CREDIT_RECORD_SIZE, CREDIT_RECORD_SIZE);
+
+	if (!found) {
+		if (slot == m_slots) {
+			++m_slots;
+		} else {
+			m_freeSlots.pop_back();
+		}
+		++m_count;
+	}
+
+	// The mapping may be a copy, so later reads have to go to the file
+	m_added[record.key] = slot;
+}
+
+
+void CClientCreditsFile::Flush()
+{
+	if (m_slots != m_savedSlots) {
+		uint8 count[4];
+		PokeUInt32(count, m_slots);
+		m_file.WriteAt(count, 1, sizeof(count));
+		m_savedSlots = m_slots;
+	}
+}
+
+
+bool CClientCreditsFile::Index(uint32 expiredBefore)
+{
+	const uint64 length = m_file.GetLength();
+	if (length < CREDIT_HEADER_SIZE) {
+		return false;
+	}
+
+	uint8 header[CREDIT_HEADER_SIZE];
+	m_file.ReadAt(header, 0, CREDIT_HEADER_SIZE);
+	if (header[0] != CREDITFILE_VERSION) {
+		AddDebugLogLineC( logCredits, wxT("Creditfile is outdated and will be replaced") );
+		return false;
+	}
+
+	// Records past the end of a truncated file are lost
+	m_slots = std::min<uint64>(PeekUInt32(header + 1), (length - CREDIT_HEADER_SIZE) / CREDIT_RECORD_SIZE);
+	m_savedSlots = m_slots;
+	if (!m_slots) {
+		return true;
+	}
+
+	m_area.ReadAt(m_file, CREDIT_HEADER_SIZE, static_cast<size_t>(m_slots) * CREDIT_RECORD_SIZE);
+	const uint8* records = m_area.GetBuffer();
+
+	m_index.reserve(m_slots);
+	for (uint32 slot = 0; slot < m_slots; ++slot) {
+		const uint8* record = records + static_cast<size_t>(slot) * CREDIT_RECORD_SIZE;
+
+		if (record[CREDIT_KEYSIZE_OFFSET] > MAXPUBKEYSIZE) {
+			// Oh dear, this is bad mojo, the file is most likely corrupt
+			// We can no longer assume that any of the clients in the file are valid
+			// and will have to discard it.
+			AddDebugLogLineC( logCredits,
+				wxT("WARNING: Corruptions found while reading Creditfile!") );
+			return false;
+		}
+
+		if (PeekUInt32(record + CREDIT_LASTSEEN_OFFSET) < expiredBefore) {
+			m_freeSlots.push_back(slot);
+			++m_expired;
+		} else {
+			m_index.push_back(std::make_pair(CMD4Hash(record), slot));
+		}
+	}
+
+	// Throws if a page of the mapping could not be read
+	m_area.CheckError();
+
+	std::stable_sort(m_index.begin(), m_index.end(), CompareKeys);
+
+	// The last record of a user wins, like it did when all records were
+	// loaded into a map. The slots of the earlier ones are free.
+	SlotIndex::iterator last = m_index.begin();
+	for (SlotIndex::iterator it = m_index.begin(); it != m_index.end(); ++it) {
+		if (last != m_index.begin() && (last - 1)->first == it->first) {
+			m_freeSlots.push_back((last - 1)->second);
+			*(last - 1) = *it;
+		} else {
+			*last++ = *it;
+		}
+	}
+	m_index.erase(last, m_index.end());
+	m_count = m_index.size();
+
+	// Reuse the slots at the start of the file first
+	std::sort(m_freeSlots.begin(), m_freeSlots.end(), std::greater<uint32>());
+
+	return true;
+}
+
+
+bool CClientCreditsFile::Compact()
+{
+	AddDebugLogLineN(logCredits, CFormat(wxT("Compacting creditfile, %u of %u records are free"))
+		% m_freeSlots.size() % m_slots);
+
+	// Keep the order of the file
+	std::vector<uint32> slots;
+	slots.reserve(m_index.size());
+	for (SlotIndex::const_iterator it = m_index.begin(); it != m_index.end(); ++it) {
+		slots.push_back(it->second);
+	}
+	std::sort(slots.begin(), slots.end());
+
+	CMemFile data(CREDIT_HEADER_SIZE + slots.size() * CREDIT_RECORD_SIZE);
+	data.WriteUInt8(CREDITFILE_VERSION);
+	data.WriteUInt32(slots.size());
+	for (size_t i = 0; i < slots.size(); ++i) {
+		data.Write(m_area.GetBuffer() + static_cast<size_t>(slots[i]) * CREDIT_RECORD_SIZE, CREDIT_RECORD_SIZE);
+	}
+	m_area.CheckError();
+
+	// Written next to the old file, which is only replaced once all is written
+	CFile file;
+	if (!file.Open(m_path, CFile::write_safe)) {
+		return false;
+	}
+	file.Write(data.GetRawBuffer(), data.GetLength());
+	if (!file.Close()) {
+		return false;
+	}
+
+	const uint32 expired = m_expired;
+	Close();
+
+	// The old file is gone, so from here on failures leave the store closed
+	bool reopened = false;
+	try {
+		reopened = m_file.Open(m_path, CFile::read_write) && Index(0);
+	} catch (const CSafeIOException& e) {
+		AddDebugLogLineC(logCredits, wxT("IO error while reopening compacted clients.met file: ") + e.what());
+	}
+	if (!reopened) {
+		Close();
+		return false;
+	}
+	m_expired = expired;
+
+	return true;
+}
+
+
+bool CClientCreditsFile::Create()
+{
+	Close();
+
+	CFile file;
+	if (!file.Create(m_path, true)) {
+		return false;
+	}
+
+	try {
+		file.WriteUInt8(CREDITFILE_VERSION);
+		file.WriteUInt32(0);
+	} catch (const CIOFailureException& e) {
+		AddDebugLogLineC(logCredits, wxT("IO failure while saving clients.met: ") + e.what());
+		return false;
+	}
+
+	return file.Close() && m_file.Open(m_path, CFile::read_write);
+}
+
+
+bool CClientCreditsFile::FindSlot(const CMD4Hash& key, uint32& slot) const
+{
+	std::map<CMD4Hash, uint32>::const_iterator it = m_added.find(key);
+	if (it != m_added.end()) {
+		slot = it->second;
+		return true;
+	}
+
+	SlotIndex::const_iterator entry = std::lower_bound(m_index.begin(), m_index.end(),
+		std::make_pair(key, 0u), CompareKeys);
+	if (entry != m_index.end() && entry->first == key) {
+		slot = entry->second;
+		return true;
+	}
+
+	return false;
+}
+// File_checked_for_headers
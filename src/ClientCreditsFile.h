@@ -0,0 +1,133 @@
+//
+// This file is part of the aMule Project.
+//
+// Copyright (c) 2003-2011 aMule Team ( admin@amule.org / http://www.amule.org )
+//
+// Any parts of this program derived from the xMule, lMule or eMule project,
+// or contributed by third-party developers are copyrighted by their
+// respective authors.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA
+//
+
+#ifndef CLIENTCREDITSFILE_H
+#define CLIENTCREDITSFILE_H
+
+#include "FileAutoClose.h"	// Needed for CFileAutoClose
+#include "FileArea.h"		// Needed for CFileArea
+#include "MD4Hash.h"		// Needed for CMD4Hash
+
+#include <map>
+#include <vector>
+
+class CreditStruct;
+
+
+/**
+ * Record store on top of clients.met.
+ *
+ * clients.met consists of fixed size records, so a record can be found
+ * by its slot and updated in place. On opening, the file is mapped and
+ * only an index of user hashes to slots is built; records are parsed
+ * when they are asked for. Slots of expired records are reused for new
+ * ones, and the file is compacted when most of it has expired.
+ *
+ * The file stays readable by older versions: the header still counts
+ * all records, and readers drop the expired ones themselves.
+ */
+class CClientCreditsFile
+{
+public:
+	CClientCreditsFile();
+	~CClientCreditsFile();
+
+	/**
+	 * Opens and indexes the file.
+	 *
+	 * @param path The full path of clients.met.
+	 * @param expiredBefore Records last seen before this time are dropped.
+	 * @return False if the file was missing, outdated or corrupt, in which
+	 *         case an empty one is started, or if it could not be reopened
+	 *         after compaction, in which case it is left as it is.
+	 */
+	bool	Open(const CPath& path, uint32 expiredBefore);
+
+	/**
+	 * Closes the file.
+	 */
+	void	Close();
+
+	/**
+	 * Reads the record of a user.
+	 *
+	 * @return False if there is no record for the user.
+	 */
+	bool	Read(const CMD4Hash& key, CreditStruct& record);
+
+	/**
+	 * Writes a record in place, or into a free slot if the user has none yet.
+	 *
+	 * Throws CIOFailureException on errors.
+	 */
+	void	Write(const CreditStruct& record);
+
+	/**
+	 * Updates the header after records were added.
+	 */
+	void	Flush();
+
+	//! Returns the number of live records.
+	uint32	GetCount() const	{ return m_count; }
+	//! Returns the number of records which expired when the file was opened.
+	uint32	GetExpiredCount() const	{ return m_expired; }
+
+private:
+	//! Builds the index from the mapped records.
+	bool	Index(uint32 expiredBefore);
+	/**
+	 * Rewrites the file without the free slots.
+	 *
+	 * Errors while writing are thrown with the old file still indexed. If
+	 * the compacted file cannot be reopened, false is returned and the
+	 * store is left closed.
+	 */
+	bool	Compact();
+	//! Starts an empty file.
+	bool	Create();
+	//! Returns the slot of a user, or false if it has none.
+	bool	FindSlot(const CMD4Hash& key, uint32& slot) const;
+
+	CPath		m_path;
+	CFileAutoClose	m_file;
+	//! The records as they were when the file was opened.
+	CFileArea	m_area;
+
+	typedef std::vector<std::pair<CMD4Hash, uint32> > SlotIndex;
+	//! User hash -> slot of the mapped records, sorted by hash.
+	SlotIndex	m_index;
+	//! User hash -> slot of the records written since.
+	std::map<CMD4Hash, uint32>	m_added;
+	//! Slots which can be reused, the last one is used first.
+	std::vector<uint32>	m_freeSlots;
+	//! Number of live records.
+	uint32		m_count;
+	//! Number of slots in the file, and in its header.
+	uint32		m_slots;
+	uint32		m_savedSlots;
+	uint32		m_expired;
+};
+
+#endif // CLIENTCREDITSFILE_H
+// File_checked_for_headers
@@ -36,27 +36,178 @@
 #include "Preferences.h"	// Needed for thePrefs
 #include "ClientCredits.h"	// Needed for CClientCredits
 #include "amule.h"		// Needed for theApp
-#include "CFile.h"		// Needed for CFile
+#include "SafeFile.h"		// Needed for CSafeIOException
 #include "Logger.h"		// Needed for Add(Debug)LogLine
 #include "CryptoPP_Inc.h"	// Needed for Crypto functions
+#include "MuleThread.h"		// Needed for CMuleThread
+#include "InternalEvents.h"	// Needed for CMuleInternalEvent
+#include "updownclient.h"	// Needed for CUpDownClient
+
+#include <wx/app.h>		// Needed for wxTheApp
 
 
 #define CLIENTS_MET_FILENAME		wxT("clients.met")
 #define CLIENTS_MET_BAK_FILENAME	wxT("clients.met.bak")
 #define CRYPTKEY_FILENAME		wxT("cryptkey.dat")
 
+//! Number of parsed public keys kept by the crypto worker.
+#define VERIFIER_CACHE_SIZE		4096
+
+
+/**
+ * A signature to create or verify on the crypto worker.
+ *
+ * Everything the worker needs is copied into the job, so that it
+ * never touches the client or its credits.
+ */
+struct CClientCreditsList::CCryptoJob
+{
+	//! Identifies the client waiting for the job.
+	uint32		id;
+	//! Sign the message, rather than verifying the signature.
+	bool		sign;
+	//! Credits are never deleted while the list exists.
+	CClientCredits*	credits;
+	//! User hash of the client, the cached public key belongs to it.
+	CMD4Hash	key;
+	uint8_t		publicKey[MAXPUBKEYSIZE];
+	uint8		publicKeyLen;
+	uint8_t		message[MAXPUBKEYSIZE + 9];
+	uint8		messageLen;
+	//! The signature to verify, or the one created.
+	uint8_t		signature[256];
+	uint8		signatureLen;
+	uint32		dwForIP;
+	uint8		byChaIPKind;
+	bool		result;
+};
+
+
+/**
+ * The public key of a client, parsed once for all its verifications.
+ */
+struct CCachedVerifier
+{
+	uint8_t		publicKey[MAXPUBKEYSIZE];
+	uint8		publicKeyLen;
+	CryptoPP::RSASSA_PKCS1v15_SHA_Verifier verifier;
+	//! Position of the user hash in the use order of the cache.
+	std::list<CMD4Hash>::iterator	use;
+};
+
+
+/**
+ * Creates and verifies secure ident signatures off the core thread.
+ */
+class CClientCreditsList::CCryptoWorker : public CMuleThread
+{
+public:
+	CCryptoWorker(CClientCreditsList* owner)
+		: CMuleThread(wxTHREAD_JOINABLE),
+		  m_owner(owner)
+	{
+	}
+
+	~CCryptoWorker()
+	{
+		DeleteContents(m_verifiers);
+	}
+
+	//! Runs a job. Also called on the core thread if the worker could not be started.
+	void RunJob(CCryptoJob& job)
+	{
+		job.result = false;
+
+		try {
+			if (job.sign) {
+				const CryptoPP::RSASSA_PKCS1v15_SHA_Signer* signer =
+					static_cast<CryptoPP::RSASSA_PKCS1v15_SHA_Signer *>(m_owner->m_pSignkey);
+				wxCHECK_RET(signer->SignatureLength() <= sizeof(job.signature), wxT("Signature too large"));
+
+				job.signatureLen = signer->SignMessage(m_rng, job.message, job.messageLen, job.signature);
+				job.result = true;
+			} else {
+				job.result = GetVerifier(job).VerifyMessage(job.message, job.messageLen, job.signature, job.signatureLen);
+			}
+		} catch (const CryptoPP::Exception& e) {
+			AddDebugLogLineC(logCredits, wxString(job.sign ? wxT("Error while creating signature: ") : wxT("Error while verifying identity: ")) + wxString(char2unicode(e.what())));
+		}
+	}
+
+protected:
+	virtual void* Entry()
+	{
+		m_owner->CryptoWorkerLoop(this);
+		return NULL;
+	}
+
+private:
+	//! Returns the parsed public key of the client, parsing it if needed.
+	const CryptoPP::RSASSA_PKCS1v15_SHA_Verifier& GetVerifier(const CCryptoJob& job)
+	{
+		VerifierMap::iterator it = m_verifiers.find(job.key);
+		if (it != m_verifiers.end()) {
+			CCachedVerifier* cached = it->second;
+			if (cached->publicKeyLen == job.publicKeyLen && !memcmp(cached->publicKey, job.publicKey, job.publicKeyLen)) {
+				m_useOrder.splice(m_useOrder.end(), m_useOrder, cached->use);
+				return cached->verifier;
+			}
+
+			// The credits of this user hash were recreated with another key
+			m_useOrder.erase(cached->use);
+			delete cached;
+			m_verifiers.erase(it);
+		} else if (m_verifiers.size() >= VERIFIER_CACHE_SIZE) {
+			// Drop the least recently used key
+			VerifierMap::iterator oldest = m_verifiers.find(m_useOrder.front());
+			delete oldest->second;
+			m_verifiers.erase(oldest);
+			m_useOrder.pop_front();
+		}
+
+		CScopedPtr<CCachedVerifier> cached;
+		CryptoPP::StringSource source(job.publicKey, job.publicKeyLen, true, 0);
+		cached->verifier.AccessKey().Load(source);
+		memcpy(cached->publicKey, job.publicKey, job.publicKeyLen);
+		cached->publicKeyLen = job.publicKeyLen;
+
+		cached->use = m_useOrder.insert(m_useOrder.end(), job.key);
+
+		CCachedVerifier* result = cached.release();
+		m_verifiers[job.key] = result;
+
+		return result->verifier;
+	}
+
+	CClientCreditsList*	m_owner;
+	//! Seeding is expensive, so the generator is kept.
+	CryptoPP::AutoSeededX917RNG<CryptoPP::DES_EDE3> m_rng;
+	//! Only used on the thread running the jobs.
+	typedef std::map<CMD4Hash, CCachedVerifier*> VerifierMap;
+	VerifierMap		m_verifiers;
+	//! The user hashes of m_verifiers, least recently used first.
+	std::list<CMD4Hash>	m_useOrder;
+};
+
 
 CClientCreditsList::CClientCreditsList()
+	: m_cryptoWake(m_cryptoLock),
+	  m_cryptoAbort(false),
+	  m_cryptoWorker(NULL),
+	  m_cryptoRunning(false),
+	  m_nextCryptoJob(0)
 {
 	m_nLastSaved = ::GetTickCount();
-	LoadList();
 
-	InitalizeCrypting();
+	// The list and the keys are loaded at startup by LoadList and InitalizeCrypting
+	m_nMyPublicKeyLen = 0;
+	m_pSignkey = NULL;
 }
 
 
 CClientCreditsList::~CClientCreditsList()
 {
+	StopCryptoWorker();
 	DeleteContents(m_mapClients);
 	delete static_cast<CryptoPP::RSASSA_PKCS1v15_SHA_Signer *>(m_pSignkey);
 }
@@ -64,104 +215,34 @@ CClientCreditsList::~CClientCreditsList()
 
 void CClientCreditsList::LoadList()
 {
-	CFile file;
 	CPath fileName = CPath(thePrefs::GetConfigDir() + CLIENTS_MET_FILENAME);
 
-	if (!fileName.FileExists()) {
-		return;
-	}
-
-	try {
-		file.Open(fileName, CFile::read);
-
-		if (file.ReadUInt8() != CREDITFILE_VERSION) {
-			AddDebugLogLineC( logCredits, wxT("Creditfile is outdated and will be replaced") );
-			file.Close();
-			return;
-		}
-
-		// everything is ok, lets see if the backup exist...
+	if (fileName.FileExists()) {
+		// Make a backup first, unless the backup is larger than the
+		// file itself, which means something is wrong with the file.
 		CPath bakFileName = CPath(thePrefs::GetConfigDir() + CLIENTS_MET_BAK_FILENAME);
 
-		bool bCreateBackup = TRUE;
-		if (bakFileName.FileExists()) {
-			// Ok, the backup exist, get the size
-			CFile hBakFile(bakFileName);
-			if ( hBakFile.GetLength() > file.GetLength()) {
-				// the size of the backup was larger then the
-				// org. file, something is wrong here, don't
-				// overwrite old backup..
-				bCreateBackup = FALSE;
-			}
-			// else: backup is smaller or the same size as org.
-			// file, proceed with copying of file
-		}
-
-		//else: the backup doesn't exist, create it
-		if (bCreateBackup) {
-			file.Close(); // close the file before copying
+		if (!bakFileName.FileExists() || bakFileName.GetFileSize() <= fileName.GetFileSize()) {
 			if (!CPath::CloneFile(fileName, bakFileName, true)) {
 				AddDebugLogLineC(logCredits,
 					CFormat(wxT("Could not create backup file '%s'")) % fileName);
 			}
-			// reopen file
-			if (!file.Open(fileName, CFile::read)) {
-				AddDebugLogLineC( logCredits,
-					wxT("Failed to load creditfile") );
-				return;
-			}
-
-			file.Seek(1);
 		}
+	}
 
+	// Only an index is built, credits are read when their clients show up
+	const uint32 dwExpired = time(NULL) - 12960000; // today - 150 day
+	if (!m_store.Open(fileName, dwExpired)) {
+		return;
+	}
 
-		uint32 count = file.ReadUInt32();
-
-		const uint32 dwExpired = time(NULL) - 12960000; // today - 150 day
-		uint32 cDeleted = 0;
-		for (uint32 i = 0; i < count; i++){
-			CreditStruct* newcstruct = new CreditStruct();
-
-			newcstruct->key					= file.ReadHash();
-			newcstruct->uploaded            = file.ReadUInt32();
-			newcstruct->downloaded          = file.ReadUInt32();
-			newcstruct->nLastSeen           = file.ReadUInt32();
-			newcstruct->uploaded            += static_cast<uint64>(file.ReadUInt32()) << 32;
-			newcstruct->downloaded          += static_cast<uint64>(file.ReadUInt32()) << 32;
-			newcstruct->nReserved3          = file.ReadUInt16();
-			newcstruct->nKeySize            = file.ReadUInt8();
-			file.Read(newcstruct->abySecureIdent, MAXPUBKEYSIZE);
-
-			if ( newcstruct->nKeySize > MAXPUBKEYSIZE ) {
-				// Oh dear, this is bad mojo, the file is most likely corrupt
-				// We can no longer assume that any of the clients in the file are valid
-				// and will have to discard it.
-				delete newcstruct;
-
-				DeleteContents(m_mapClients);
-
-				AddDebugLogLineC( logCredits,
-					wxT("WARNING: Corruptions found while reading Creditfile!") );
-				return;
-			}
-
-			if (newcstruct->nLastSeen < dwExpired){
-				cDeleted++;
-				delete newcstruct;
-				continue;
-			}
-
-			CClientCredits* newcredits = new CClientCredits(newcstruct);
-			m_mapClients[newcredits->GetKey()] = newcredits;
-		}
+	const uint32 count = m_store.GetCount();
+	const uint32 cDeleted = m_store.GetExpiredCount();
 
-		AddLogLineN(CFormat(wxPLURAL("Creditfile loaded, %u client is known", "Creditfile loaded, %u clients are known", count - cDeleted)) % (count - cDeleted));
+	AddLogLineN(CFormat(wxPLURAL("Creditfile loaded, %u client is known", "Creditfile loaded, %u clients are known", count)) % count);
 
-		if (cDeleted) {
-			AddLogLineN(CFormat(wxPLURAL(" - Credits expired for %u client!", " - Credits expired for %u clients!", cDeleted)) % cDeleted);
-		}
-	} catch (const CSafeIOException& e) {
-		AddDebugLogLineC(logCredits, wxT("IO error while loading clients.met file: ") + e.what());
+	if (cDeleted) {
+		AddLogLineN(CFormat(wxPLURAL(" - Credits expired for %u client!", " - Credits expired for %u clients!", cDeleted)) % cDeleted);
 	}
 }
 
@@ -171,50 +252,20 @@ void CClientCreditsList::SaveList()
 	AddDebugLogLineN( logCredits, wxT("Saved Credit list"));
 	m_nLastSaved = ::GetTickCount();
 
-	wxString name(thePrefs::GetConfigDir() + CLIENTS_MET_FILENAME);
-	CFile file;
-
-	if ( !file.Create(name, true) ) {
-		AddDebugLogLineC( logCredits, wxT("Failed to create creditfile") );
-		return;
-	}
+	// Records are updated in place, only credits used this session can have changed
+	try {
+		ClientMap::iterator it = m_mapClients.begin();
+		for ( ; it != m_mapClients.end(); ++it ) {
+			CClientCredits* cur_credit = it->second;
 
-	if ( file.Open(name, CFile::write) ) {
-		try {
-			uint32 count = 0;
-
-			file.WriteUInt8( CREDITFILE_VERSION );
-			// Temporary place-holder for number of stucts
-			file.WriteUInt32( 0 );
-
-			ClientMap::iterator it = m_mapClients.begin();
-			for ( ; it != m_mapClients.end(); ++it ) {
-				CClientCredits* cur_credit = it->second;
-
-				if ( cur_credit->GetUploadedTotal() || cur_credit->GetDownloadedTotal() ) {
-					const CreditStruct* const cstruct = cur_credit->GetDataStruct();
-					file.WriteHash(cstruct->key);
-					file.WriteUInt32(static_cast<uint32>(cstruct->uploaded));
-					file.WriteUInt32(static_cast<uint32>(cstruct->downloaded));
-					file.WriteUInt32(cstruct->nLastSeen);
-					file.WriteUInt32(static_cast<uint32>(cstruct->uploaded >> 32));
-					file.WriteUInt32(static_cast<uint32>(cstruct->downloaded >> 32));
-					file.WriteUInt16(cstruct->nReserved3);
-					file.WriteUInt8(cstruct->nKeySize);
-					// Doesn't matter if this saves garbage, will be fixed on load.
-					file.Write(cstruct->abySecureIdent, MAXPUBKEYSIZE);
-					count++;
-				}
+			if ( cur_credit->GetUploadedTotal() || cur_credit->GetDownloadedTotal() ) {
+				m_store.Write(*cur_credit->GetDataStruct());
 			}
-
-			// Write the actual number of structs
-			file.Seek( 1 );
-			file.WriteUInt32( count );
-		} catch (const CIOFailureException& e) {
-			AddDebugLogLineC(logCredits, wxT("IO failure while saving clients.met: ") + e.what());
 		}
-	} else {
-		AddDebugLogLineC(logCredits, wxT("Failed to open existing creditfile!"));
+
+		m_store.Flush();
+	} catch (const CIOFailureException& e) {
+		AddDebugLogLineC(logCredits, wxT("IO failure while saving clients.met: ") + e.what());
 	}
 }
 
@@ -227,7 +278,21 @@ CClientCredits* CClientCreditsList::GetCredit(const CMD4Hash& key)
 
 
 	if ( it == m_mapClients.end() ){
-		result = new CClientCredits(key);
+		CreditStruct* cstruct = new CreditStruct();
+
+		bool stored = false;
+		try {
+			stored = m_store.Read(key, *cstruct);
+		} catch (const CSafeIOException& e) {
+			AddDebugLogLineC(logCredits, wxT("IO error while reading clients.met file: ") + e.what());
+		}
+
+		if (stored) {
+			result = new CClientCredits(cstruct);
+		} else {
+			delete cstruct;
+			result = new CClientCredits(key);
+		}
 		m_mapClients[result->GetKey()] = result;
 	} else {
 		result = it->second;
@@ -315,6 +380,8 @@ void CClientCreditsList::InitalizeCrypting()
 		pubkey.GetMaterial().Save(asink);
 		m_nMyPublicKeyLen = asink.TotalPutLength();
 		asink.MessageEnd();
+
+		StartCryptoWorker();
 	} catch (const CryptoPP::Exception& e) {
 		delete static_cast<CryptoPP::RSASSA_PKCS1v15_SHA_Signer *>(m_pSignkey);
 		m_pSignkey = NULL;
@@ -326,6 +393,26 @@ void CClientCreditsList::InitalizeCrypting()
 }
 
 
+uint8 CClientCreditsList::GetSignatureMessage(CClientCredits* pTarget, uint8_t* pachOutput, uint32 ChallengeIP, uint8 byChaIPKind) const
+{
+	uint32 keylen = pTarget->GetSecIDKeyLen();
+	memcpy(pachOutput,pTarget->GetSecureIdent(),keylen);
+	// 4 additional bytes random data send from this client
+	uint32 challenge = pTarget->m_dwCryptRndChallengeFrom;
+	wxASSERT ( challenge != 0 );
+	PokeUInt32(pachOutput+keylen,challenge);
+
+	uint16 ChIpLen = 0;
+	if ( byChaIPKind != 0){
+		ChIpLen = 5;
+		PokeUInt32(pachOutput+keylen+4, ChallengeIP);
+		PokeUInt8(pachOutput+keylen+4+4,byChaIPKind);
+	}
+
+	return keylen+4+ChIpLen;
+}
+
+
 uint8 CClientCreditsList::CreateSignature(CClientCredits* pTarget, uint8_t* pachOutput, uint8 nMaxSize, uint32 ChallengeIP, uint8 byChaIPKind, void* sigkey)
 {
 	CryptoPP::RSASSA_PKCS1v15_SHA_Signer* signer =
@@ -346,20 +433,8 @@ uint8 CClientCreditsList::CreateSignature(CClientCredits* pTarget, uint8_t* pach
 		CryptoPP::SecByteBlock sbbSignature(signer->SignatureLength());
 		CryptoPP::AutoSeededX917RNG<CryptoPP::DES_EDE3> rng;
 		uint8_t abyBuffer[MAXPUBKEYSIZE+9];
-		uint32 keylen = pTarget->GetSecIDKeyLen();
-		memcpy(abyBuffer,pTarget->GetSecureIdent(),keylen);
-		// 4 additional bytes random data send from this client
-		uint32 challenge = pTarget->m_dwCryptRndChallengeFrom;
-		wxASSERT ( challenge != 0 );
-		PokeUInt32(abyBuffer+keylen,challenge);
-
-		uint16 ChIpLen = 0;
-		if ( byChaIPKind != 0){
-			ChIpLen = 5;
-			PokeUInt32(abyBuffer+keylen+4, ChallengeIP);
-			PokeUInt8(abyBuffer+keylen+4+4,byChaIPKind);
-		}
-		signer->SignMessage(rng, abyBuffer ,keylen+4+ChIpLen , sbbSignature.begin());
+		uint8 nMessageLen = GetSignatureMessage(pTarget, abyBuffer, ChallengeIP, byChaIPKind);
+		signer->SignMessage(rng, abyBuffer, nMessageLen, sbbSignature.begin());
 		CryptoPP::ArraySink asink(pachOutput, nMaxSize);
 		asink.Put(sbbSignature.begin(), sbbSignature.size());
 
@@ -373,6 +448,61 @@ uint8 CClientCreditsList::CreateSignature(CClientCredits* pTarget, uint8_t* pach
 }
 
 
+uint8 CClientCreditsList::GetIdentMessage(CClientCredits* pTarget, uint8_t* pachOutput, uint32 dwForIP, uint8 byChaIPKind) const
+{
+	// 4 additional bytes random data send from this client +5 bytes v2
+	memcpy(pachOutput,m_abyMyPublicKey,m_nMyPublicKeyLen);
+	uint32 challenge = pTarget->m_dwCryptRndChallengeFor;
+	wxASSERT ( challenge != 0 );
+	PokeUInt32(pachOutput+m_nMyPublicKeyLen, challenge);
+
+	// v2 security improvments (not supported by 29b, not used as default by 29c)
+	uint8 nChIpSize = 0;
+	if (byChaIPKind != 0){
+		nChIpSize = 5;
+		uint32 ChallengeIP = 0;
+		switch (byChaIPKind) {
+			case CRYPT_CIP_LOCALCLIENT:
+				ChallengeIP = dwForIP;
+				break;
+			case CRYPT_CIP_REMOTECLIENT:
+				// Ignore local ip...
+				if (!theApp->GetPublicIP(true)) {
+					if (::IsLowID(theApp->GetED2KID())){
+						AddDebugLogLineN(logCredits, wxT("Warning: Maybe SecureHash Ident fails because LocalIP is unknown"));
+						// Fallback to local ip...
+						ChallengeIP = theApp->GetPublicIP();
+					} else {
+						ChallengeIP = theApp->GetED2KID();
+					}
+				} else {
+					ChallengeIP = theApp->GetPublicIP();
+				}
+				break;
+			case CRYPT_CIP_NONECLIENT: // maybe not supported in future versions
+				ChallengeIP = 0;
+				break;
+		}
+		PokeUInt32(pachOutput+m_nMyPublicKeyLen+4, ChallengeIP);
+		PokeUInt8(pachOutput+m_nMyPublicKeyLen+4+4, byChaIPKind);
+	}
+	//v2 end
+
+	return m_nMyPublicKeyLen+4+nChIpSize;
+}
+
+
+void CClientCreditsList::SetIdentResult(CClientCredits* pTarget, bool bResult, uint32 dwForIP)
+{
+	if (!bResult){
+		if (pTarget->GetIdentState() == IS_IDNEEDED)
+			pTarget->SetIdentState(IS_IDFAILED);
+	} else {
+		pTarget->Verified(dwForIP);
+	}
+}
+
+
 bool CClientCreditsList::VerifyIdent(CClientCredits* pTarget, const uint8_t* pachSignature, uint8 nInputSize, uint32 dwForIP, uint8 byChaIPKind)
 {
 	wxASSERT( pTarget );
@@ -385,59 +515,194 @@ bool CClientCreditsList::VerifyIdent(CClientCredits* pTarget, const uint8_t* pac
 	try {
 		CryptoPP::StringSource ss_Pubkey((uint8_t*)pTarget->GetSecureIdent(),pTarget->GetSecIDKeyLen(),true,0);
 		CryptoPP::RSASSA_PKCS1v15_SHA_Verifier pubkey(ss_Pubkey);
-		// 4 additional bytes random data send from this client +5 bytes v2
 		uint8_t abyBuffer[MAXPUBKEYSIZE+9];
-		memcpy(abyBuffer,m_abyMyPublicKey,m_nMyPublicKeyLen);
-		uint32 challenge = pTarget->m_dwCryptRndChallengeFor;
-		wxASSERT ( challenge != 0 );
-		PokeUInt32(abyBuffer+m_nMyPublicKeyLen, challenge);
-
-		// v2 security improvments (not supported by 29b, not used as default by 29c)
-		uint8 nChIpSize = 0;
-		if (byChaIPKind != 0){
-			nChIpSize = 5;
-			uint32 ChallengeIP = 0;
-			switch (byChaIPKind) {
-				case CRYPT_CIP_LOCALCLIENT:
-					ChallengeIP = dwForIP;
-					break;
-				case CRYPT_CIP_REMOTECLIENT:
-					// Ignore local ip...
-					if (!theApp->GetPublicIP(true)) {
-						if (::IsLowID(theApp->GetED2KID())){
-							AddDebugLogLineN(logCredits, wxT("Warning: Maybe SecureHash Ident fails because LocalIP is unknown"));
-							// Fallback to local ip...
-							ChallengeIP = theApp->GetPublicIP();
-						} else {
-							ChallengeIP = theApp->GetED2KID();
-						}
-					} else {
-						ChallengeIP = theApp->GetPublicIP();
-					}
-					break;
-				case CRYPT_CIP_NONECLIENT: // maybe not supported in future versions
-					ChallengeIP = 0;
-					break;
-			}
-			PokeUInt32(abyBuffer+m_nMyPublicKeyLen+4, ChallengeIP);
-			PokeUInt8(abyBuffer+m_nMyPublicKeyLen+4+4, byChaIPKind);
-		}
-		//v2 end
+		uint8 nMessageLen = GetIdentMessage(pTarget, abyBuffer, dwForIP, byChaIPKind);
 
-		bResult = pubkey.VerifyMessage(abyBuffer, m_nMyPublicKeyLen+4+nChIpSize, pachSignature, nInputSize);
+		bResult = pubkey.VerifyMessage(abyBuffer, nMessageLen, pachSignature, nInputSize);
 	} catch (const CryptoPP::Exception& e) {
 		AddDebugLogLineC(logCredits, wxString(wxT("Error while verifying identity: ")) + wxString(char2unicode(e.what())));
 		bResult = false;
 	}
 
-	if (!bResult){
-		if (pTarget->GetIdentState() == IS_IDNEEDED)
-			pTarget->SetIdentState(IS_IDFAILED);
+	SetIdentResult(pTarget, bResult, dwForIP);
+
+	return bResult;
+}
+
+
+void CClientCreditsList::CreateSignatureAsync(CUpDownClient* client, CClientCredits* pTarget, uint32 ChallengeIP, uint8 byChaIPKind)
+{
+	wxASSERT( pTarget );
+
+	if (!CryptoAvailable()) {
+		return;
+	}
+
+	CScopedPtr<CCryptoJob> job;
+	job->sign = true;
+	job->credits = pTarget;
+	job->key = pTarget->GetKey();
+	job->publicKeyLen = 0;
+	job->messageLen = GetSignatureMessage(pTarget, job->message, ChallengeIP, byChaIPKind);
+	job->signatureLen = 0;
+	job->dwForIP = ChallengeIP;
+	job->byChaIPKind = byChaIPKind;
+
+	QueueCryptoJob(job.release(), client);
+}
+
+
+void CClientCreditsList::VerifyIdentAsync(CUpDownClient* client, CClientCredits* pTarget, const uint8_t* pachSignature, uint8 nInputSize, uint32 dwForIP, uint8 byChaIPKind)
+{
+	wxASSERT( pTarget );
+	wxASSERT( pachSignature );
+
+	if (!CryptoAvailable()) {
+		pTarget->SetIdentState(IS_NOTAVAILABLE);
+		client->OnIdentVerified(false, byChaIPKind);
+		return;
+	}
+
+	CScopedPtr<CCryptoJob> job;
+	job->sign = false;
+	job->credits = pTarget;
+	job->key = pTarget->GetKey();
+	job->publicKeyLen = pTarget->GetSecIDKeyLen();
+	memcpy(job->publicKey, pTarget->GetSecureIdent(), job->publicKeyLen);
+	job->messageLen = GetIdentMessage(pTarget, job->message, dwForIP, byChaIPKind);
+	memcpy(job->signature, pachSignature, nInputSize);
+	job->signatureLen = nInputSize;
+	job->dwForIP = dwForIP;
+	job->byChaIPKind = byChaIPKind;
+
+	QueueCryptoJob(job.release(), client);
+}
+
+
+void CClientCreditsList::QueueCryptoJob(CCryptoJob* job, CUpDownClient* client)
+{
+	job->id = ++m_nextCryptoJob;
+	m_cryptoClients[job->id] = CCLIENTREF(client, wxT("CClientCreditsList::QueueCryptoJob"));
+
+	if (!m_cryptoRunning) {
+		m_cryptoWorker->RunJob(*job);
+		// Delivered from the event loop like the results of the worker,
+		// the caller is not ready for the callbacks of its client yet
+		AddCryptoResult(job);
 	} else {
-		pTarget->Verified(dwForIP);
+		wxMutexLocker lock(m_cryptoLock);
+		m_cryptoQueue.push_back(job);
+		m_cryptoWake.Signal();
 	}
+}
 
-	return bResult;
+
+void CClientCreditsList::CryptoWorkerLoop(CCryptoWorker* worker)
+{
+	while (true) {
+		CCryptoJob* job;
+		{
+			wxMutexLocker lock(m_cryptoLock);
+			while (m_cryptoQueue.empty() && !m_cryptoAbort) {
+				m_cryptoWake.Wait();
+			}
+
+			if (m_cryptoAbort) {
+				return;
+			}
+
+			job = m_cryptoQueue.front();
+			m_cryptoQueue.pop_front();
+		}
+
+		worker->RunJob(*job);
+		AddCryptoResult(job);
+	}
+}
+
+
+void CClientCreditsList::AddCryptoResult(CCryptoJob* job)
+{
+	bool notify;
+	{
+		wxMutexLocker lock(m_cryptoLock);
+		// A single event for all jobs finished until it is handled
+		notify = m_cryptoDone.empty();
+		m_cryptoDone.push_back(job);
+	}
+
+	if (notify) {
+		CMuleInternalEvent evt(wxEVT_CORE_SECIDENT_DONE);
+		wxPostEvent(wxTheApp, evt);
+	}
+}
+
+
+void CClientCreditsList::ProcessCryptoResults()
+{
+	std::list<CCryptoJob*> done;
+	{
+		wxMutexLocker lock(m_cryptoLock);
+		done.swap(m_cryptoDone);
+	}
+
+	for (std::list<CCryptoJob*>::iterator it = done.begin(); it != done.end(); ++it) {
+		CScopedPtr<CCryptoJob> job(*it);
+
+		if (!job->sign) {
+			// The result belongs to the credits, whatever became of the client
+			SetIdentResult(job->credits, job->result, job->dwForIP);
+		}
+
+		std::map<uint32, CClientRef>::iterator itClient = m_cryptoClients.find(job->id);
+		wxCHECK2(itClient != m_cryptoClients.end(), continue);
+		CUpDownClient* client = itClient->second.GetClientChecked();
+		m_cryptoClients.erase(itClient);
+
+		if (!client) {
+			// Deleted in the meantime
+			continue;
+		}
+
+		if (!job->sign) {
+			client->OnIdentVerified(job->result, job->byChaIPKind);
+		} else if (job->result) {
+			client->OnSignatureCreated(job->signature, job->signatureLen, job->byChaIPKind);
+		}
+	}
+}
+
+
+void CClientCreditsList::StartCryptoWorker()
+{
+	m_cryptoWorker = new CCryptoWorker(this);
+	if (m_cryptoWorker->Create() == wxTHREAD_NO_ERROR && m_cryptoWorker->Run() == wxTHREAD_NO_ERROR) {
+		m_cryptoRunning = true;
+	} else {
+		AddDebugLogLineC(logCredits, wxT("Cannot start the crypto worker, secure ident runs on the core thread."));
+	}
+}
+
+
+void CClientCreditsList::StopCryptoWorker()
+{
+	if (m_cryptoRunning) {
+		{
+			wxMutexLocker lock(m_cryptoLock);
+			m_cryptoAbort = true;
+			m_cryptoWake.Signal();
+		}
+
+		m_cryptoWorker->Stop();
+		m_cryptoRunning = false;
+	}
+
+	delete m_cryptoWorker;
+	m_cryptoWorker = NULL;
+
+	DeleteContents(m_cryptoQueue);
+	DeleteContents(m_cryptoDone);
+	m_cryptoClients.clear();
 }
 
 
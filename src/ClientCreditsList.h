@@ -26,11 +26,17 @@
 #ifndef CLIENTCREDITSLIST_H
 #define CLIENTCREDITSLIST_H
 
+#include <wx/thread.h>	// Needed for wxMutex and wxCondition
+
 #include "MD4Hash.h"	// Needed for CMD4Hash
+#include "ClientRef.h"	// Needed for CClientRef
+#include "ClientCreditsFile.h"	// Needed for CClientCreditsFile
 
+#include <list>
 #include <map>
 
 class CClientCredits;
+class CUpDownClient;
 
 class CClientCreditsList
 {
@@ -42,27 +48,89 @@ public:
 	uint8	CreateSignature(CClientCredits* pTarget, uint8_t* pachOutput, uint8 nMaxSize, uint32 ChallengeIP, uint8 byChaIPKind, void* sigkey = NULL);
 	bool	VerifyIdent(CClientCredits* pTarget, const uint8_t* pachSignature, uint8 nInputSize, uint32 dwForIP, uint8 byChaIPKind);
 
+	/**
+	 * Signs the challenge of a client on the crypto worker.
+	 *
+	 * The signature is handed to CUpDownClient::OnSignatureCreated,
+	 * unless the client was deleted in the meantime.
+	 */
+	void	CreateSignatureAsync(CUpDownClient* client, CClientCredits* pTarget, uint32 ChallengeIP, uint8 byChaIPKind);
+
+	/**
+	 * Verifies the signature sent by a client on the crypto worker.
+	 *
+	 * The result is stored in the credits of the client like VerifyIdent
+	 * does, and is then handed to CUpDownClient::OnIdentVerified.
+	 */
+	void	VerifyIdentAsync(CUpDownClient* client, CClientCredits* pTarget, const uint8_t* pachSignature, uint8 nInputSize, uint32 dwForIP, uint8 byChaIPKind);
+
+	/**
+	 * Hands the finished crypto jobs back to their clients.
+	 *
+	 * Called on the core thread when the finished jobs are signalled.
+	 */
+	void	ProcessCryptoResults();
+
 	CClientCredits* GetCredit(const CMD4Hash& key);
 	void	Process();
 	uint8	GetPubKeyLen() const			{return m_nMyPublicKeyLen;}
 	const uint8_t*	GetPublicKey() const	{return m_abyMyPublicKey;}
 	bool	CryptoAvailable() const;
-	void	SaveList();
-protected:
 	void	LoadList();
+	void	SaveList();
 	void	InitalizeCrypting();
+protected:
 	bool	CreateKeyPair();
 #ifdef _DEBUG
 	bool	Debug_CheckCrypting();
 #endif
 private:
+	class CCryptoWorker;
+	friend class CCryptoWorker;
+	struct CCryptoJob;
+
+	//! Builds the message signed for a client, returns its length.
+	uint8	GetSignatureMessage(CClientCredits* pTarget, uint8_t* pachOutput, uint32 ChallengeIP, uint8 byChaIPKind) const;
+	//! Builds the message a client has signed, returns its length.
+	uint8	GetIdentMessage(CClientCredits* pTarget, uint8_t* pachOutput, uint32 dwForIP, uint8 byChaIPKind) const;
+	//! Updates the ident state of the credits after a verification.
+	void	SetIdentResult(CClientCredits* pTarget, bool bResult, uint32 dwForIP);
+	//! Queues a job for the given client, or runs it at once without worker.
+	//! Either way the result is delivered by ProcessCryptoResults later.
+	void	QueueCryptoJob(CCryptoJob* job, CUpDownClient* client);
+	//! Runs jobs until stopped, called by the worker.
+	void	CryptoWorkerLoop(CCryptoWorker* worker);
+	//! Hands a finished job to ProcessCryptoResults, from any thread.
+	void	AddCryptoResult(CCryptoJob* job);
+	//! Starts the crypto worker.
+	void	StartCryptoWorker();
+	//! Stops the crypto worker and drops all pending jobs.
+	void	StopCryptoWorker();
+
+	//! The credits used this session, the others stay in m_store until needed.
 	typedef std::map<CMD4Hash, CClientCredits*> ClientMap;
 	ClientMap	m_mapClients;
+	CClientCreditsFile	m_store;
 	uint32		m_nLastSaved;
 	// A void* to avoid having to include the large CryptoPP.h file
 	void*		m_pSignkey;
 	uint8_t		m_abyMyPublicKey[80];
 	uint8		m_nMyPublicKeyLen;
+
+	//! Guards the two queues and m_cryptoAbort.
+	wxMutex		m_cryptoLock;
+	//! Signalled when a job is queued or the worker should stop.
+	wxCondition	m_cryptoWake;
+	std::list<CCryptoJob*>	m_cryptoQueue;
+	std::list<CCryptoJob*>	m_cryptoDone;
+	bool		m_cryptoAbort;
+	//! NULL if crypting is not available.
+	CCryptoWorker*	m_cryptoWorker;
+	//! False if the worker thread could not be started, jobs are run when queued then.
+	bool		m_cryptoRunning;
+	//! The clients waiting for a job, by job id. Only used on the core thread.
+	std::map<uint32, CClientRef>	m_cryptoClients;
+	uint32		m_nextCryptoJob;
 };
 
 #endif // CLIENTCREDITSLIST_H
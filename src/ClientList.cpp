@@ -42,6 +42,7 @@
 #include "Logger.h"
 #include "GuiEvents.h"		// Needed for Notify_*
 #include "Packet.h"
+#include "TimerWheel.h"		// Needed for CTimerWheel
 
 #include <common/Format.h>
 
@@ -86,15 +87,19 @@ public:
 CClientList::CClientList()
 	: m_deadSources( true )
 {
-	m_dwLastBannCleanUp = 0;
-	m_dwLastTrackedCleanUp = 0;
 	m_dwLastClientCleanUp = 0;
 	m_nBuddyStatus = Disconnected;
+
+	m_bannCleanUpTimer = theApp->timerwheel->AddPeriodicTimer(MakeTimerWheelTask(this, &CClientList::CleanUpBannedList), BAN_CLEANUP_TIME);
+	m_trackedCleanUpTimer = theApp->timerwheel->AddPeriodicTimer(MakeTimerWheelTask(this, &CClientList::CleanUpTrackedList), TRACKED_CLEANUP_TIME);
 }
 
 
 CClientList::~CClientList()
 {
+	theApp->timerwheel->RemoveTimer(m_bannCleanUpTimer);
+	theApp->timerwheel->RemoveTimer(m_trackedCleanUpTimer);
+
 	DeleteContents(m_trackedClientsList);
 
 	wxASSERT(m_clientList.empty());
@@ -111,16 +116,16 @@ void CClientList::AddClient( CUpDownClient* toadd )
 		//Notify_ClientCtrlAddClient( toadd );
 
 		// We always add the ID/ptr pair, regardles of the actual ID value
-		m_clientList.insert( IDMapPair( toadd->GetUserIDHybrid(), CCLIENTREF(toadd, wxT("CClientList::AddClient m_clientList.insert"))) );
+		m_clientList.insert( toadd->GetUserIDHybrid(), CCLIENTREF(toadd, wxT("CClientList::AddClient m_clientList.insert")) );
 
 		// We only add the IP if it is valid
 		if ( toadd->GetIP() ) {
-			m_ipList.insert( IDMapPair( toadd->GetIP(), CCLIENTREF(toadd, wxT("CClientList::AddClient m_ipList.insert")) ) );
+			m_ipList.insert( toadd->GetIP(), CCLIENTREF(toadd, wxT("CClientList::AddClient m_ipList.insert")) );
 		}
 
 		// We only add the hash if it is valid
 		if ( toadd->HasValidHash() ) {
-			m_hashList.insert( HashMapPair( toadd->GetUserHash(), CCLIENTREF(toadd, wxT("CClientList::AddClient m_hashList.insert")) ) );
+			m_hashList.insert( toadd->GetUserHash(), CCLIENTREF(toadd, wxT("CClientList::AddClient m_hashList.insert")) );
 		}
 
 		toadd->UpdateStats();
@@ -151,7 +156,7 @@ void CClientList::UpdateClientID( CUpDownClient* client, uint32 newID )
 	RemoveIDFromList( client );
 
 	// Add the new entry
-	m_clientList.insert( IDMapPair( newID, CCLIENTREF(client, wxT("CClientList::UpdateClientID")) ) );
+	m_clientList.insert( newID, CCLIENTREF(client, wxT("CClientList::UpdateClientID")) );
 }
 
 
@@ -165,7 +170,7 @@ void CClientList::UpdateClientIP( CUpDownClient* client, uint32 newIP )
 	RemoveIPFromList( client );
 
 	if ( newIP ) {
-		m_ipList.insert( IDMapPair( newIP, CCLIENTREF(client, wxT("CClientList::UpdateClientIP")) ) );
+		m_ipList.insert( newIP, CCLIENTREF(client, wxT("CClientList::UpdateClientIP")) );
 	}
 }
 
@@ -182,30 +187,26 @@ void CClientList::UpdateClientHash( CUpDownClient* client, const CMD4Hash& newHa
 
 	// And add the new one if valid
 	if ( !newHash.IsEmpty() ) {
-		m_hashList.insert( HashMapPair( newHash, CCLIENTREF(client, wxT("CClientList::UpdateClientHash")) ) );
+		m_hashList.insert( newHash, CCLIENTREF(client, wxT("CClientList::UpdateClientHash")) );
 	}
 }
 
 
 bool CClientList::RemoveIDFromList( CUpDownClient* client )
 {
-	bool result = false;
-
-	// First remove the ID entry
-	std::pair<IDMap::iterator, IDMap::iterator> range = m_clientList.equal_range( client->GetUserIDHybrid() );
+	// Remove the ID entry
+	IDMap::const_iterator it = m_clientList.find( client->GetUserIDHybrid() );
 
-	for ( ; range.first != range.second; ++range.first ) {
-		if ( client == range.first->second.GetClient() ) {
+	for ( ; it != m_clientList.end(); it = m_clientList.find_next( it ) ) {
+		if ( client == it->second.GetClient() ) {
 			/* erase() will invalidate the iterator, but we're not using it anymore
-			    anyway (notice the break;) */
-			m_clientList.erase( range.first );
-			result = true;
-
-			break;
+			    anyway (notice the return) */
+			m_clientList.erase( it );
+			return true;
 		}
 	}
 
-	return result;
+	return false;
 }
 
 
@@ -217,13 +218,13 @@ void CClientList::RemoveIPFromList( CUpDownClient* client )
 	}
 
 	// Remove the IP entry
-	std::pair<IDMap::iterator, IDMap::iterator> range = m_ipList.equal_range( client->GetIP() );
+	IDMap::const_iterator it = m_ipList.find( client->GetIP() );
 
-	for ( ; range.first != range.second; ++range.first ) {
-		if ( client == range.first->second.GetClient() ) {
+	for ( ; it != m_ipList.end(); it = m_ipList.find_next( it ) ) {
+		if ( client == it->second.GetClient() ) {
 			/* erase() will invalidate the iterator, but we're not using it anymore
 			    anyway (notice the break;) */
-			m_ipList.erase( range.first );
+			m_ipList.erase( it );
 			break;
 		}
 	}
@@ -237,13 +238,13 @@ void CClientList::RemoveHashFromList( CUpDownClient* client )
 	}
 
 	// Find all items with the specified hash
-	std::pair<HashMap::iterator, HashMap::iterator> range = m_hashList.equal_range( client->GetUserHash() );
+	HashMap::const_iterator it = m_hashList.find( client->GetUserHash() );
 
-	for ( ; range.first != range.second; ++range.first ) {
-		if ( client == range.first->second.GetClient() ) {
+	for ( ; it != m_hashList.end(); it = m_hashList.find_next( it ) ) {
+		if ( client == it->second.GetClient() ) {
 			/* erase() will invalidate the iterator, but we're not using it anymore
 			    anyway (notice the break;) */
-			m_hashList.erase( range.first );
+			m_hashList.erase( it );
 			break;
 		}
 	}
@@ -252,7 +253,6 @@ void CClientList::RemoveHashFromList( CUpDownClient* client )
 
 CUpDownClient* CClientList::FindMatchingClient( CUpDownClient* client )
 {
-	typedef std::pair<IDMap::const_iterator, IDMap::const_iterator> IDMapIteratorPair;
 	wxCHECK(client, NULL);
 
 	const uint32 userIP = client->GetIP();
@@ -265,10 +265,10 @@ CUpDownClient* CClientList::FindMatchingClient( CUpDownClient* client )
 	if (client->HasLowID()) {
 		// User is firewalled ... Must do two checks.
 		if (userIP && (userPort || userKadPort)) {
-			IDMapIteratorPair range = m_ipList.equal_range(userIP);
+			IDMap::const_iterator it = m_ipList.find(userIP);
 
-			for ( ; range.first != range.second; ++range.first ) {
-				CUpDownClient* other = range.first->second.GetClient();
+			for ( ; it != m_ipList.end(); it = m_ipList.find_next(it) ) {
+				CUpDownClient* other = it->second.GetClient();
 				wxASSERT(userIP == other->GetIP());
 
 				if (userPort && (userPort == other->GetUserPort())) {
@@ -282,10 +282,10 @@ CUpDownClient* CClientList::FindMatchingClient( CUpDownClient* client )
 		const uint32 serverIP = client->GetServerIP();
 		const uint32 serverPort = client->GetServerPort();
 		if (userID && serverIP && serverPort) {
-			IDMapIteratorPair range = m_clientList.equal_range(userID);
+			IDMap::const_iterator it = m_clientList.find(userID);
 
-			for (; range.first != range.second; ++range.first) {
-				CUpDownClient* other = range.first->second.GetClient();
+			for (; it != m_clientList.end(); it = m_clientList.find_next(it)) {
+				CUpDownClient* other = it->second.GetClient();
 				wxASSERT(userID == other->GetUserIDHybrid());
 
 				// For lowid, we also have to check the server
@@ -308,11 +308,12 @@ CUpDownClient* CClientList::FindMatchingClient( CUpDownClient* client )
 				continue;
 			}
 
-			IDMapIteratorPair range = toCheck[i].map.equal_range(toCheck[i].value);
+			const IDMap& map = toCheck[i].map;
+			const IDMap::const_iterator first = map.find(toCheck[i].value);
 
 			if (userPort) {
-				IDMap::const_iterator it = range.first;
-				for (; it != range.second; ++it) {
+				IDMap::const_iterator it = first;
+				for (; it != map.end(); it = map.find_next(it)) {
 					if (userPort == it->second.GetUserPort()) {
 						return it->second.GetClient();
 					}
@@ -320,8 +321,8 @@ CUpDownClient* CClientList::FindMatchingClient( CUpDownClient* client )
 			}
 
 			if (userKadPort) {
-				IDMap::const_iterator it = range.first;
-				for (; it != range.second; ++it) {
+				IDMap::const_iterator it = first;
+				for (; it != map.end(); it = map.find_next(it)) {
 					if (userKadPort == it->second.GetClient()->GetKadPort()) {
 						return it->second.GetClient();
 					}
@@ -333,12 +334,11 @@ CUpDownClient* CClientList::FindMatchingClient( CUpDownClient* client )
 
 	// If anything else fails, then we look at hashes
 	if ( client->HasValidHash() ) {
-		// Find all items with the specified hash
-		std::pair<HashMap::iterator, HashMap::iterator> range = m_hashList.equal_range( client->GetUserHash() );
+		// Just return the first item with the specified hash, if any
+		HashMap::const_iterator it = m_hashList.find( client->GetUserHash() );
 
-		// Just return the first item if any
-		if ( range.first != range.second ) {
-			return range.first->second.GetClient();
+		if ( it != m_hashList.end() ) {
+			return it->second.GetClient();
 		}
 	}
 
@@ -359,7 +359,7 @@ void CClientList::DeleteAll()
 	m_hashList.clear();
 
 	while ( !m_clientList.empty() ) {
-		IDMap::iterator it = m_clientList.begin();
+		IDMap::const_iterator it = m_clientList.begin();
 
 		// Will call the removal of the item on this same class
 		it->second.GetClient()->Disconnected(wxT("Removed while deleting all from ClientList."));
@@ -415,10 +415,10 @@ bool CClientList::AttachToAlreadyKnown(CUpDownClient** client, CClientTCPSocket*
 CUpDownClient* CClientList::FindClientByIP( uint32 clientip, uint16 port )
 {
 	// Find all items with the specified ip
-	std::pair<IDMap::iterator, IDMap::iterator> range = m_ipList.equal_range( clientip );
+	IDMap::const_iterator it = m_ipList.find( clientip );
 
-	for ( ; range.first != range.second; ++range.first ) {
-		CUpDownClient* cur_client = range.first->second.GetClient();
+	for ( ; it != m_ipList.end(); it = m_ipList.find_next( it ) ) {
+		CUpDownClient* cur_client = it->second.GetClient();
 		// Check if it's actually the client we want
 		if ( cur_client->GetUserPort() == port ) {
 			return cur_client;
@@ -431,10 +431,10 @@ CUpDownClient* CClientList::FindClientByIP( uint32 clientip, uint16 port )
 
 CUpDownClient* CClientList::FindClientByIP( uint32 clientip )
 {
-	// Find all items with the specified ip
-	std::pair<IDMap::iterator, IDMap::iterator> range = m_ipList.equal_range( clientip );
+	// Find the first item with the specified ip
+	IDMap::const_iterator it = m_ipList.find( clientip );
 
-	return (range.first != range.second) ? range.first->second.GetClient() : NULL;
+	return (it != m_ipList.end()) ? it->second.GetClient() : NULL;
 }
 
 
@@ -452,9 +452,7 @@ CUpDownClient* CClientList::FindClientByECID(uint32 ecid) const
 
 bool CClientList::IsIPAlreadyKnown(uint32_t ip)
 {
-	// Find all items with the specified ip
-	std::pair<IDMap::iterator, IDMap::iterator> range = m_ipList.equal_range(ip);
-	return range.first != range.second;
+	return m_ipList.find(ip) != m_ipList.end();
 }
 
 
@@ -519,41 +517,46 @@ uint16 CClientList::GetClientsFromIP(uint32 dwIP)
 }
 
 
-void CClientList::Process()
+void CClientList::CleanUpBannedList()
 {
 	const uint32 cur_tick = ::GetTickCount();
 
-	if (m_dwLastBannCleanUp + BAN_CLEANUP_TIME < cur_tick) {
-		m_dwLastBannCleanUp = cur_tick;
-
-		ClientMap::iterator it = m_bannedList.begin();
-		while ( it != m_bannedList.end() ) {
-			if ( it->second + CLIENTBANTIME < cur_tick ) {
-				ClientMap::iterator tmp = it++;
+	ClientMap::iterator it = m_bannedList.begin();
+	while ( it != m_bannedList.end() ) {
+		if ( it->second + CLIENTBANTIME < cur_tick ) {
+			ClientMap::iterator tmp = it++;
 
-				m_bannedList.erase( tmp );
-				theStats::RemoveBannedClient();
-			} else {
-				++it;
-			}
+			m_bannedFilter.Remove( tmp->first );
+			m_bannedList.erase( tmp );
+			theStats::RemoveBannedClient();
+		} else {
+			++it;
 		}
 	}
 
+	AddDebugLogLineN( logClient, CFormat( wxT("Banned client prefilter: %u bans, %u lookups, %u answered by the filter, %.2f%% false positives") )
+		% m_bannedList.size() % m_bannedFilter.GetChecks() % m_bannedFilter.GetRejected() % ( m_bannedFilter.GetFalsePositiveRate() * 100.0 ) );
+}
 
-	if ( m_dwLastTrackedCleanUp + TRACKED_CLEANUP_TIME < cur_tick ) {
-		m_dwLastTrackedCleanUp = cur_tick;
 
-		std::map<uint32, CDeletedClient*>::iterator it = m_trackedClientsList.begin();
-		while ( it != m_trackedClientsList.end() ) {
-			std::map<uint32, CDeletedClient*>::iterator cur_src = it++;
+void CClientList::CleanUpTrackedList()
+{
+	const uint32 cur_tick = ::GetTickCount();
 
-			if ( cur_src->second->m_dwInserted + KEEPTRACK_TIME < cur_tick ) {
-				delete cur_src->second;
-				m_trackedClientsList.erase( cur_src );
-			}
+	std::map<uint32, CDeletedClient*>::iterator it = m_trackedClientsList.begin();
+	while ( it != m_trackedClientsList.end() ) {
+		std::map<uint32, CDeletedClient*>::iterator cur_src = it++;
+
+		if ( cur_src->second->m_dwInserted + KEEPTRACK_TIME < cur_tick ) {
+			delete cur_src->second;
+			m_trackedClientsList.erase( cur_src );
 		}
 	}
+}
 
+
+void CClientList::Process()
+{
 	//We need to try to connect to the clients in m_KadList
 	//If connected, remove them from the list and send a message back to Kad so we can send a ACK.
 	//If we don't connect, we need to remove the client..
@@ -726,16 +729,38 @@ void CClientList::Process()
 
 void CClientList::AddBannedClient(uint32 dwIP)
 {
-	m_bannedList[dwIP] = ::GetTickCount();
+	std::pair<ClientMap::iterator, bool> result = m_bannedList.insert( ClientMap::value_type( dwIP, ::GetTickCount() ) );
+
+	if ( result.second ) {
+		m_bannedFilter.Add( dwIP );
+
+		if ( m_bannedFilter.IsOverloaded() ) {
+			// Make room for twice as many bans
+			m_bannedFilter.Reset( m_bannedList.size() * 2 );
+			for ( ClientMap::iterator it = m_bannedList.begin(); it != m_bannedList.end(); ++it ) {
+				m_bannedFilter.Add( it->first );
+			}
+		}
+	} else {
+		result.first->second = ::GetTickCount();
+	}
+
 	theStats::AddBannedClient();
 }
 
 
 bool CClientList::IsBannedClient(uint32 dwIP)
 {
+	// Most clients are not banned, so avoid searching the map if possible
+	if ( !m_bannedFilter.MayContain( dwIP ) ) {
+		return false;
+	}
+
 	ClientMap::iterator it = m_bannedList.find( dwIP );
 
-	if ( it != m_bannedList.end() ) {
+	if ( it == m_bannedList.end() ) {
+		m_bannedFilter.ReportFalsePositive();
+	} else {
 		if ( it->second + CLIENTBANTIME > ::GetTickCount() ) {
 			return true;
 		} else {
@@ -748,22 +773,29 @@ bool CClientList::IsBannedClient(uint32 dwIP)
 
 void CClientList::RemoveBannedClient(uint32 dwIP)
 {
-	m_bannedList.erase(dwIP);
+	if (m_bannedList.erase(dwIP)) {
+		m_bannedFilter.Remove(dwIP);
+	}
 	theStats::RemoveBannedClient();
 }
 
 
 void CClientList::FilterQueues()
 {
-	// Filter client list
-	for ( IDMap::iterator it = m_ipList.begin(); it != m_ipList.end(); ) {
-		IDMap::iterator tmp = it++; // Don't change this to a ++it!
-		CUpDownClient* client = tmp->second.GetClient();
-		if ( theApp->ipfilter->IsFiltered(client->GetConnectIP())) {
-			client->Disconnected(wxT("Filtered by IPFilter"));
-			client->Safe_Delete();
+	// Collect the clients first, as deleting them modifies the list
+	SourceList filtered;
+	for ( IDMap::const_iterator it = m_ipList.begin(); it != m_ipList.end(); ++it ) {
+		if ( theApp->ipfilter->IsFiltered(it->second.GetClient()->GetConnectIP())) {
+			filtered.push_back( it->second );
 		}
 	}
+
+	// Filter client list
+	for ( SourceList::iterator it = filtered.begin(); it != filtered.end(); ++it ) {
+		CUpDownClient* client = it->GetClient();
+		client->Disconnected(wxT("Filtered by IPFilter"));
+		client->Safe_Delete();
+	}
 }
 
 
@@ -772,10 +804,10 @@ CClientList::SourceList	CClientList::GetClientsByHash( const CMD4Hash& hash )
 	SourceList results;
 
 	// Find all items with the specified hash
-	std::pair<HashMap::iterator, HashMap::iterator> range = m_hashList.equal_range( hash );
+	HashMap::const_iterator it = m_hashList.find( hash );
 
-	for ( ; range.first != range.second; ++range.first)  {
-		results.push_back( range.first->second );
+	for ( ; it != m_hashList.end(); it = m_hashList.find_next( it ) )  {
+		results.push_back( it->second );
 	}
 
 	return results;
@@ -786,11 +818,11 @@ CClientList::SourceList	CClientList::GetClientsByIP( unsigned long ip )
 {
 	SourceList results;
 
-	// Find all items with the specified hash
-	std::pair<IDMap::iterator, IDMap::iterator> range = m_ipList.equal_range( ip );
+	// Find all items with the specified ip
+	IDMap::const_iterator it = m_ipList.find( ip );
 
-	for ( ; range.first != range.second; range.first++ )  {
-		results.push_back( range.first->second );
+	for ( ; it != m_ipList.end(); it = m_ipList.find_next( it ) )  {
+		results.push_back( it->second );
 	}
 
 	return results;
@@ -987,10 +1019,14 @@ void CClientList::CleanUpClientList()
 	if (m_dwLastClientCleanUp + CLIENTLIST_CLEANUP_TIME < cur_tick ){
 		m_dwLastClientCleanUp = cur_tick;
 		DEBUG_ONLY( uint32 cDeleted = 0; )
-		IDMap::iterator current_it = m_clientList.begin();
-		while (current_it != m_clientList.end()) {
-			CUpDownClient* pCurClient = current_it->second.GetClient();
-			++current_it; // Won't be used till while loop again
+		// Work on a copy, as deleting clients modifies the list
+		SourceList clients;
+		for (IDMap::const_iterator it = m_clientList.begin(); it != m_clientList.end(); ++it) {
+			clients.push_back(it->second);
+		}
+
+		for (SourceList::iterator current_it = clients.begin(); current_it != clients.end(); ++current_it) {
+			CUpDownClient* pCurClient = current_it->GetClient();
 			// Don't delete sources coming from source seeds for 10 mins,
 			// to give them a chance to connect and become a useful source.
 			if (pCurClient->GetSourceFrom() == SF_SOURCE_SEEDS && cur_tick - (uint32)theStats::GetStartTime() < MIN2MS(10)) continue;
@@ -28,6 +28,10 @@
 
 #include "DeadSourceList.h"	// Needed for CDeadSourceList
 #include "ClientRef.h"
+#include "MD4Hash.h"		// Needed for CMD4Hash
+#include "RobinHoodMap.h"	// Needed for CRobinHoodMultiMap
+#include "CountingBloomFilter.h"	// Needed for CCountingBloomFilter
+#include "TimerWheel.h"		// Needed for CTimerWheel::TimerID
 
 #include <deque>
 #include <set>
@@ -35,7 +39,6 @@
 class CUpDownClient;
 class CClientTCPSocket;
 class CDeletedClient;
-class CMD4Hash;
 namespace Kademlia {
 	class CContact;
 	class CUInt128;
@@ -243,8 +246,9 @@ public:
 	/**
 	 * Main loop.
 	 *
-	 * This function takes care of cleaning the various lists and deleting
-	 * pending clients on the deletion-queue.
+	 * This function takes care of the Kad related lists and deleting
+	 * pending clients on the deletion-queue. The banned and tracked
+	 * lists are pruned from the timer wheel instead.
 	 */
 	void	Process();
 
@@ -287,9 +291,7 @@ public:
 
 
 	//! The type of the lists used to store IPs and IDs.
-	typedef std::multimap<uint32, CClientRef> IDMap;
-	//! The pairs of the IP/ID list.
-	typedef std::pair<uint32, CClientRef> IDMapPair;
+	typedef CRobinHoodMultiMap<uint32, CClientRef, CRobinHoodUInt32Hash> IDMap;
 
 
 	/**
@@ -361,6 +363,16 @@ protected:
 
 	void	ProcessDirectCallbackList();
 
+	/**
+	 * Removes expired bans, run every BAN_CLEANUP_TIME.
+	 */
+	void	CleanUpBannedList();
+
+	/**
+	 * Removes expired tracked clients, run every TRACKED_CLEANUP_TIME.
+	 */
+	void	CleanUpTrackedList();
+
 private:
 	/**
 	 * Helperfunction which finds a client matching the specified client.
@@ -400,9 +412,7 @@ private:
 
 
 	//! The type of the list used to store user-hashes.
-	typedef std::multimap<CMD4Hash, CClientRef> HashMap;
-	//! The pairs of the Hash-list.
-	typedef std::pair<CMD4Hash, CClientRef> HashMapPair;
+	typedef CRobinHoodMultiMap<CMD4Hash, CClientRef, CRobinHoodMD4Hash> HashMap;
 
 
 	//! The map of clients with valid hashes
@@ -416,13 +426,15 @@ private:
 
 	//! This is the map of banned clients.
 	ClientMap m_bannedList;
-	//! This variable is used to keep track of the last time the banned-list was pruned.
-	uint32	m_dwLastBannCleanUp;
+	//! Contains the IPs of all banned clients, checked before the map.
+	CCountingBloomFilter m_bannedFilter;
+	//! The timer pruning the banned-list.
+	CTimerWheel::TimerID	m_bannCleanUpTimer;
 
 	//! This is the map of tracked clients.
 	std::map<uint32, CDeletedClient*> m_trackedClientsList;
-	//! This keeps track of the last time the tracked-list was pruned.
-	uint32	m_dwLastTrackedCleanUp;
+	//! The timer pruning the tracked-list.
+	CTimerWheel::TimerID	m_trackedCleanUpTimer;
 
 	//! This keeps track of the last time the client-list was pruned.
 	uint32 m_dwLastClientCleanUp;
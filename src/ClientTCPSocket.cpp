@@ -52,6 +52,7 @@
 #include "IPFilter.h"		// Needed for CIPFilter
 #include "ListenSocket.h"	// Needed for CListenSocket
 #include "GuiEvents.h"		// Needed for Notify_*
+#include "Metrics.h"		// Needed for CMetricsTimer
 
 
 //#define __PACKET_RECV_DUMP__
@@ -1959,6 +1960,8 @@ void CClientTCPSocket::OnError(int nErrorCode)
 
 bool CClientTCPSocket::PacketReceived(CPacket* packet)
 {
+	CMetricsTimer metricsTimer(CMetrics::SubsystemClientTCP);
+
 	// 0.42e
 	bool bResult = false;
 	uint32 uRawSize = packet->GetPacketSize();
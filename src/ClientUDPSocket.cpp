@@ -46,6 +46,7 @@
 #include "ClientTCPSocket.h"	// Needed for CClientTCPSocket
 #include "MemFile.h"			// Needed for CMemFile
 #include "Logger.h"
+#include "Metrics.h"			// Needed for CMetrics
 #include "kademlia/kademlia/Kademlia.h"
 #include "kademlia/utils/KadUDPKey.h"
 #include <zlib.h>
@@ -88,6 +89,10 @@ void CClientUDPSocket::OnPacketReceived(uint32 ip, uint16 port, uint8_t* buffer,
 	uint8_t opcode	 = decryptedBuffer[1];
 
 	if (packetLen >= 1) {
+		CMetrics::CountPacket(CMetrics::Received, CMetrics::TransportUDP, protocol, opcode);
+		const bool kad = protocol == OP_KADEMLIAHEADER || protocol == OP_KADEMLIAPACKEDPROT;
+		CMetricsTimer metricsTimer(kad ? CMetrics::SubsystemKad : CMetrics::SubsystemClientUDP);
+
 		try {
 			switch (protocol) {
 				case OP_EMULEPROT:
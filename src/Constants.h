@@ -50,7 +50,8 @@ enum Core_Event_ID
 
 	SOURCE_DNS_DONE,
 	UDP_DNS_DONE,
-	SERVER_DNS_DONE
+	SERVER_DNS_DONE,
+	SECIDENT_DONE
 };
 
 
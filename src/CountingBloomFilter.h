@@ -0,0 +1,207 @@
+//
+// This file is part of the aMule Project.
+//
+// Copyright (c) 2003-2011 aMule Team ( admin@amule.org / http://www.amule.org )
+//
+// Any parts of this program derived from the xMule, lMule or eMule project,
+// or contributed by third-party developers are copyrighted by their
+// respective authors.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA
+//
+
+#ifndef COUNTINGBLOOMFILTER_H
+#define COUNTINGBLOOMFILTER_H
+
+#include "Types.h"		// Needed for uint8, uint32, uint64
+#include "RobinHoodMap.h"	// Needed for CRobinHoodUInt32Hash
+
+#include <vector>
+
+
+/**
+ * Counting Bloom filter for 32 bit keys such as IPs and IDs.
+ *
+ * The filter is meant to sit in front of a map, so that lookups of keys
+ * which are not in the map (the common case for dead sources and banned
+ * clients) can be answered without touching the map at all. A negative
+ * answer is always correct, a positive answer means that the map has to
+ * be consulted.
+ *
+ * Each bucket holds an 8 bit counter rather than a single bit, so keys
+ * can be removed again when the matching map entry expires. Counters
+ * saturate instead of overflowing; a saturated counter is never
+ * decremented, which can only cause extra false positives.
+ *
+ * The filter also keeps track of how well it performs. Owners report
+ * positives that turned out not to be in the map using
+ * ReportFalsePositive(), so the false positive rate can be checked.
+ */
+class CCountingBloomFilter
+{
+public:
+	/**
+	 * Constructor.
+	 *
+	 * @param keys The number of keys to make room for.
+	 */
+	CCountingBloomFilter(uint32 keys = 0)
+		: m_keys(0),
+		  m_checks(0),
+		  m_rejected(0),
+		  m_falsePositives(0)
+	{
+		Reset(keys);
+	}
+
+	/**
+	 * Removes all keys and resizes the filter to make room for 'keys' keys.
+	 *
+	 * The statistics are kept, since they describe the use of the
+	 * filter rather than its current contents.
+	 */
+	void Reset(uint32 keys) {
+		uint64 size = BLOOM_MIN_BUCKETS;
+		while (size < (uint64)keys * BLOOM_BUCKETS_PER_KEY) {
+			size <<= 1;
+		}
+
+		std::vector<uint8> counters(size);
+		m_counters.swap(counters);
+		m_keys = 0;
+	}
+
+	/**
+	 * Adds a key. Keys may be added several times, but must then be
+	 * removed as many times.
+	 */
+	void Add(uint32 key) {
+		uint32 pos[BLOOM_HASHES];
+		GetPositions(key, pos);
+
+		for (uint32 i = 0; i < BLOOM_HASHES; ++i) {
+			if (m_counters[pos[i]] < BLOOM_SATURATED) {
+				++m_counters[pos[i]];
+			}
+		}
+
+		++m_keys;
+	}
+
+	/**
+	 * Removes a key which was previously added.
+	 */
+	void Remove(uint32 key) {
+		uint32 pos[BLOOM_HASHES];
+		GetPositions(key, pos);
+
+		for (uint32 i = 0; i < BLOOM_HASHES; ++i) {
+			if (m_counters[pos[i]] && m_counters[pos[i]] < BLOOM_SATURATED) {
+				--m_counters[pos[i]];
+			}
+		}
+
+		if (m_keys) {
+			--m_keys;
+		}
+	}
+
+	/**
+	 * Returns false if the key is certainly not present.
+	 */
+	bool MayContain(uint32 key) {
+		++m_checks;
+
+		uint32 pos[BLOOM_HASHES];
+		GetPositions(key, pos);
+
+		for (uint32 i = 0; i < BLOOM_HASHES; ++i) {
+			if (!m_counters[pos[i]]) {
+				++m_rejected;
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	/**
+	 * Called by the owner when MayContain returned true for a key that
+	 * was not found.
+	 */
+	void ReportFalsePositive()	{ ++m_falsePositives; }
+
+	/**
+	 * Returns true if the filter is too small for the number of keys.
+	 *
+	 * With three hashes, keeping at least eight counters per key keeps the
+	 * false positive rate around three percent.
+	 */
+	bool IsOverloaded() const	{ return (uint64)m_keys * BLOOM_BUCKETS_PER_KEY > m_counters.size(); }
+
+	//! Returns the number of counters.
+	uint32	GetBucketCount() const		{ return m_counters.size(); }
+	//! Returns the number of keys currently in the filter.
+	uint32	GetKeyCount() const		{ return m_keys; }
+	//! Returns the number of calls to MayContain.
+	uint64	GetChecks() const		{ return m_checks; }
+	//! Returns the number of lookups answered by the filter alone.
+	uint64	GetRejected() const		{ return m_rejected; }
+	//! Returns the number of positives that were not in the map.
+	uint64	GetFalsePositives() const	{ return m_falsePositives; }
+
+	/**
+	 * Returns the fraction of lookups of absent keys that were not rejected.
+	 */
+	double	GetFalsePositiveRate() const {
+		uint64 negatives = m_rejected + m_falsePositives;
+		return negatives ? (double)m_falsePositives / negatives : 0.0;
+	}
+
+private:
+	enum {
+		BLOOM_MIN_BUCKETS = 64,
+		BLOOM_HASHES = 3,
+		BLOOM_BUCKETS_PER_KEY = 8,
+		BLOOM_SATURATED = 0xFF
+	};
+
+	/**
+	 * Derives the counter positions of a key using double hashing.
+	 */
+	void GetPositions(uint32 key, uint32* pos) const {
+		const uint32 mask = m_counters.size() - 1;
+		CRobinHoodUInt32Hash hasher;
+		const uint32 h1 = hasher(key);
+		// Odd, so that all positions differ for power of two sizes
+		const uint32 h2 = hasher(key ^ 0x9e3779b9u) | 1;
+
+		for (uint32 i = 0; i < BLOOM_HASHES; ++i) {
+			pos[i] = (h1 + i * h2) & mask;
+		}
+	}
+
+	//! The counters.
+	std::vector<uint8>	m_counters;
+	//! The number of keys added and not removed.
+	uint32	m_keys;
+	//! Statistics.
+	uint64	m_checks;
+	uint64	m_rejected;
+	uint64	m_falsePositives;
+};
+
+#endif // COUNTINGBLOOMFILTER_H
+// File_checked_for_headers
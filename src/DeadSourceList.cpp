@@ -28,6 +28,8 @@
 #include <common/Macros.h>
 
 #include "updownclient.h"		// Needed for CUpDownClient
+#include "Logger.h"			// Needed for AddDebugLogLineN
+#include <common/Format.h>		// Needed for CFormat
 
 #define	CLEANUPTIME			MIN2MS(60)
 
@@ -94,6 +96,11 @@ uint32 CDeadSourceList::GetDeadSourcesCount() const
 
 bool CDeadSourceList::IsDeadSource(const CUpDownClient* client)
 {
+	// Most sources are not dead, so avoid searching the map if possible
+	if ( !m_filter.MayContain( client->GetUserIDHybrid() ) ) {
+		return false;
+	}
+
 	CDeadSource source(
 		client->GetUserIDHybrid(),
 		client->GetUserPort(),
@@ -103,6 +110,10 @@ bool CDeadSourceList::IsDeadSource(const CUpDownClient* client)
 
 
 	DeadSourcePair range = m_sources.equal_range( client->GetUserIDHybrid() );
+	if ( range.first == range.second ) {
+		m_filter.ReportFalsePositive();
+	}
+
 	for ( ; range.first != range.second; range.first++ ) {
 		if ( range.first->second == source ) {
 			// Check if the entry is still valid
@@ -112,6 +123,7 @@ bool CDeadSourceList::IsDeadSource(const CUpDownClient* client)
 
 			// The source is no longer dead, so remove it to reduce the size of the list
 			m_sources.erase( range.first );
+			m_filter.Remove( client->GetUserIDHybrid() );
 			break;
 		}
 	}
@@ -142,6 +154,11 @@ void CDeadSourceList::AddDeadSource( const CUpDownClient* client )
 	}
 
 	m_sources.insert( DeadSourceMap::value_type( client->GetUserIDHybrid(), source ) );
+	m_filter.Add( client->GetUserIDHybrid() );
+
+	if ( m_filter.IsOverloaded() ) {
+		RebuildFilter();
+	}
 
 	// Check if we should cleanup the list. This is
 	// done to avoid a buildup of stale entries.
@@ -159,8 +176,24 @@ void CDeadSourceList::CleanUp()
 	for ( ; it != m_sources.end(); ) {
 		DeadSourceIterator it1 = it++;
 		if ( it1->second.GetTimeout() < m_dwLastCleanUp ) {
+			m_filter.Remove( it1->first );
 			m_sources.erase( it1 );
 		}
 	}
+
+	if ( m_bGlobalList ) {
+		AddDebugLogLineN( logClient, CFormat( wxT("Dead source prefilter: %u sources, %u lookups, %u answered by the filter, %.2f%% false positives") )
+			% m_sources.size() % m_filter.GetChecks() % m_filter.GetRejected() % ( m_filter.GetFalsePositiveRate() * 100.0 ) );
+	}
+}
+
+
+void CDeadSourceList::RebuildFilter()
+{
+	m_filter.Reset( m_sources.size() * 2 );
+
+	for ( DeadSourceIterator it = m_sources.begin(); it != m_sources.end(); ++it ) {
+		m_filter.Add( it->first );
+	}
 }
 // File_checked_for_headers
@@ -30,6 +30,7 @@
 #include <map>
 
 #include "Types.h"
+#include "CountingBloomFilter.h"	// Needed for CCountingBloomFilter
 
 
 class CUpDownClient;
@@ -74,12 +75,22 @@ public:
 	 */
 	uint32		GetDeadSourcesCount() const;
 
+	/**
+	 * Returns the prefilter, for its statistics.
+	 */
+	const CCountingBloomFilter& GetFilter() const	{ return m_filter; }
+
 private:
 	/**
 	 * Removes too old entries from the list.
 	 */
 	void		CleanUp();
 
+	/**
+	 * Refills the prefilter from the list, with room for twice as many sources.
+	 */
+	void		RebuildFilter();
+
 
 	/**
 	 * Record of dead source.
@@ -139,6 +150,8 @@ private:
 	typedef std::pair<DeadSourceIterator, DeadSourceIterator> DeadSourcePair;
 	//! List of currently dead sources.
 	DeadSourceMap m_sources;
+	//! Contains the IDs of all sources in m_sources, checked before the map.
+	CCountingBloomFilter m_filter;
 
 
 	//! The timestamp of when the last cleanup was performed.
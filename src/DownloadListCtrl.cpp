@@ -214,6 +214,44 @@ void CDownloadListCtrl::AddFile( CPartFile* file )
 	}
 }
 
+void CDownloadListCtrl::AddFiles( const std::vector<CPartFile*>& files )
+{
+	int shown = 0;
+	bool completed = false;
+
+	Freeze();
+
+	for ( size_t i = 0; i < files.size(); ++i ) {
+		CPartFile* file = files[i];
+		wxASSERT( file );
+
+		// Avoid duplicate entries of files
+		if ( m_ListItems.find( file ) == m_ListItems.end() ) {
+			FileCtrlItem_Struct* newitem = new FileCtrlItem_Struct;
+			newitem->SetContents(file);
+
+			m_ListItems.insert( ListItemsPair( file, newitem ) );
+
+			// A new file is not displayed yet, no need to look for it
+			if ( file->CheckShowItemInGivenCat( m_category ) ) {
+				InsertFileItem( newitem );
+				++shown;
+				completed = completed || file->IsCompleted();
+			}
+		}
+	}
+
+	if ( shown ) {
+		if (completed) {
+			CastByID(ID_BTNCLRCOMPL, GetParent(), wxButton)->Enable(true);
+		}
+		SortList();
+		ShowFilesCount( shown );
+	}
+
+	Thaw();
+}
+
 void CDownloadListCtrl::RemoveFile( CPartFile* file )
 {
 	wxASSERT( file );
@@ -299,17 +337,7 @@ void CDownloadListCtrl::ShowFile( CPartFile* file, bool show )
 			// Check if the file is already being displayed
 			long index = FindItem( -1, reinterpret_cast<wxUIntPtr>(item) );
 			if ( index == -1 ) {
-				long newitem = InsertItem( GetItemCount(), wxEmptyString );
-
-				SetItemPtrData( newitem, reinterpret_cast<wxUIntPtr>(item) );
-
-				wxListItem myitem;
-				myitem.m_itemId = newitem;
-				myitem.SetBackgroundColour( GetBackgroundColour() );
-
-				SetItem(myitem);
-
-				RefreshItem( newitem );
+				InsertFileItem( item );
 
 				ShowFilesCount( 1 );
 			}
@@ -324,6 +352,21 @@ void CDownloadListCtrl::ShowFile( CPartFile* file, bool show )
 	}
 }
 
+void CDownloadListCtrl::InsertFileItem( FileCtrlItem_Struct* item )
+{
+	long newitem = InsertItem( GetItemCount(), wxEmptyString );
+
+	SetItemPtrData( newitem, reinterpret_cast<wxUIntPtr>(item) );
+
+	wxListItem myitem;
+	myitem.m_itemId = newitem;
+	myitem.SetBackgroundColour( GetBackgroundColour() );
+
+	SetItem(myitem);
+
+	RefreshItem( newitem );
+}
+
 void CDownloadListCtrl::ChangeCategory( int newCategory )
 {
 	Freeze();
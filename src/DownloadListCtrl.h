@@ -27,6 +27,7 @@
 #define DOWNLOADLISTCTRL_H
 
 #include <map>				// Needed for std::multimap
+#include <vector>			// Needed for std::vector
 #include <wx/brush.h>
 
 #include "Types.h"			// Needed for uint8
@@ -81,6 +82,15 @@ public:
 	 */
 	void AddFile( CPartFile* file );
 
+	/**
+	 * Adds a number of files to the list, like AddFile.
+	 *
+	 * @param files Valid pointers to new partfiles.
+	 *
+	 * The list is sorted and the filecount updated once for all files.
+	 */
+	void AddFiles( const std::vector<CPartFile*>& files );
+
 	/**
 	 * Removes the specified file from the list.
 	 *
@@ -145,6 +155,11 @@ private:
 	 */
 	void ShowFilesCount( int diff );
 
+	/**
+	 * Appends a file item, not yet shown, to the displayed lines.
+	 */
+	void InsertFileItem( FileCtrlItem_Struct* item );
+
 
 	/**
 	 * @see CMuleListCtrl::GetTTSText
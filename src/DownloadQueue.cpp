@@ -44,6 +44,7 @@
 #include "SearchList.h"		// Needed for CSearchFile
 #include "SharedFileList.h"	// Needed for CSharedFileList
 #include "PartFile.h"		// Needed for CPartFile
+#include "PartFileLoader.h"	// Needed for CPartFileLoader
 #include "Preferences.h"	// Needed for thePrefs
 #include "amule.h"		// Needed for theApp
 #include "AsyncDNS.h"		// Needed for CAsyncDNS
@@ -60,6 +61,7 @@
 
 #include "kademlia/kademlia/Kademlia.h"
 
+#include <algorithm>		// Needed for std::min
 #include <string>			// Do_not_auto_remove (mingw-gcc-3.4.5)
 
 
@@ -71,6 +73,9 @@
 
 #define MAX_FILES_PER_UDP_PACKET	31	// 2+16*31 = 498 ... is still less than 512 bytes!!
 #define MAX_REQUESTS_PER_SERVER		35
+// Limits on the number of queued sources turned into clients on each core tick
+#define MAX_PENDING_SOURCES_PER_TICK	100
+#define MAX_PENDING_SOURCES_PER_FILE	25
 
 
 CDownloadQueue::CDownloadQueue()
@@ -83,6 +88,7 @@ CDownloadQueue::CDownloadQueue()
 	m_lastudpsearchtime = 0;
 	m_lastudpstattime = 0;
 	m_udcounter = 0;
+	m_pendingSourcesStart = 0;
 	m_nLastED2KLinkCheck = 0;
 	m_dwNextTCPSrcReq = 0;
 	m_cRequestsSentToServer = 0;
@@ -118,39 +124,34 @@ void CDownloadQueue::LoadMetFiles(const CPath& path)
 	CDirIterator TempDir(path);
 	CPath fileName = TempDir.GetFirstFile(CDirIterator::File, wxT("*.part.met"));
 	while (fileName.IsOk()) {
-		files.push_back(path.JoinPaths(fileName));
+		files.push_back(fileName);
 
 		fileName = TempDir.GetNextFile();
 	}
 
-	// Loading in order makes it easier to figure which
-	// file is broken in case of crashes, or the like.
+	// Handing the files back in order makes it easier to figure
+	// which file is broken in case of crashes, or the like.
 	std::sort(files.begin(), files.end());
 
-	// Load part-files
-	for ( size_t i = 0; i < files.size(); i++ ) {
+	// The met-files are parsed on worker threads into detached part files
+	CPartFileLoader loader(path, files);
+	loader.Start();
+
+	std::vector<CPartFile*> loaded;
+	std::set<CMD4Hash> loadedHashes;
+	CPartFile* toadd = NULL;
+	for (size_t i = 0; loader.GetNextFile(toadd, fileName); i++) {
 		AddLogLineNS(CFormat(_("Loading PartFile %u of %u")) % (i + 1) % files.size());
-		fileName = files[i].GetFullName();
-		CPartFile *toadd = new CPartFile();
-		bool result = toadd->LoadPartFile(path, fileName) != 0;
-		if (!result) {
-			// Try from backup
-			result = toadd->LoadPartFile(path, fileName, true) != 0;
-		}
-		if (result && !IsFileExisting(toadd->GetFileHash())) {
-			{
-				wxMutexLocker lock(m_mutex);
-				m_filelist.push_back(toadd);
-			}
-			NotifyObservers(EventType(EventType::INSERTED, toadd));
-			Notify_DownloadCtrlAddFile(toadd);
+		// Files of this batch are not in the queue yet, so check them separately
+		if (toadd && !IsFileExisting(toadd->GetFileHash()) && loadedHashes.insert(toadd->GetFileHash()).second) {
+			loaded.push_back(toadd);
 		} else {
 			wxString msg;
-			if (result) {
+			if (toadd) {
 				msg << CFormat(wxT("WARNING: Duplicate partfile with hash '%s' found, skipping: %s"))
 					% toadd->GetFileHash().Encode() % fileName;
 			} else {
-				// If result is false, then reading of both the primary and the backup .met failed
+				// Reading of both the primary and the backup .met failed
 				AddLogLineN(_("ERROR: Failed to load backup file. Search http://forum.amule.org for .part.met recovery solutions."));
 				msg << CFormat(wxT("ERROR: Failed to load PartFile '%s'")) % fileName;
 			}
@@ -160,6 +161,23 @@ void CDownloadQueue::LoadMetFiles(const CPath& path)
 			delete toadd;
 		}
 	}
+
+	// Register them all at once
+	{
+		wxMutexLocker lock(m_mutex);
+		m_filelist.insert(m_filelist.end(), loaded.begin(), loaded.end());
+	}
+
+	for (size_t i = 0; i < loaded.size(); i++) {
+		NotifyInserted(loaded[i]);
+		Notify_DownloadCtrlAddFile(loaded[i]);
+	}
+
+	// Completing and rehashing goes through the thread scheduler,
+	// so the other downloads can start right away
+	for (size_t i = 0; i < loaded.size(); i++) {
+		loaded[i]->FinishLoading();
+	}
 	AddLogLineNS(_("All PartFiles Loaded."));
 
 	if ( GetFileCount() == 0 ) {
@@ -366,7 +384,7 @@ void CDownloadQueue::AddDownload(CPartFile* file, bool paused, uint8 category)
 		DoSortByPriority();
 	}
 
-	NotifyObservers( EventType( EventType::INSERTED, file ) );
+	NotifyInserted( file );
 	if (category < theApp->glob_prefs->GetCatCount()) {
 		file->SetCategory(category);
 	} else {
@@ -439,12 +457,25 @@ void CDownloadQueue::Process()
 		std::list<int> m_sourcecountlist;
 
 		bool mustPreventSleep = false;
+		uint32 pendingSourcesBudget = MAX_PENDING_SOURCES_PER_TICK;
+		// Start where the budget ran out last time, so that no file starves
+		const uint32 start = m_pendingSourcesStart;
+		bool budgetExhausted = false;
 
-		for ( uint16 i = 0; i < m_filelist.size(); i++ ) {
+		for ( uint32 n = 0; n < m_filelist.size(); n++ ) {
+			const uint32 i = (start + n) % m_filelist.size();
 			CPartFile* file = m_filelist[i];
 
+			if (!pendingSourcesBudget && !budgetExhausted) {
+				budgetExhausted = true;
+				m_pendingSourcesStart = i;
+			}
+
 			CMutexUnlocker unlocker(m_mutex);
 
+			// Add sources received since the last tick, in slices shared by all files
+			pendingSourcesBudget -= file->ProcessPendingSources(std::min<uint32>(pendingSourcesBudget, MAX_PENDING_SOURCES_PER_FILE));
+
 			uint8 status = file->GetStatus();
 			mustPreventSleep |= !(status == PS_ERROR || status == PS_INSUFFICIENT || status == PS_PAUSED || status == PS_COMPLETE);
 
@@ -805,7 +836,7 @@ void CDownloadQueue::RemoveFile(CPartFile* file, bool keepAsCompleted)
 {
 	RemoveLocalServerRequest( file );
 
-	NotifyObservers( EventType( EventType::REMOVED, file ) );
+	NotifyRemoved( file );
 
 	wxMutexLocker lock( m_mutex );
 
@@ -360,6 +360,8 @@ private:
 	uint32		m_dwNextTCPSrcReq;
 	uint8		m_udcounter;
 	CServer*	m_udpserver;
+	//! Index of the file which gets the pending sources budget first.
+	uint32		m_pendingSourcesStart;
 
 
 	/**
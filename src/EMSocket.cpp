@@ -32,6 +32,7 @@
 #include "Packet.h"		// Needed for CPacket
 #include "amule.h"
 #include "GetTickCount.h"
+#include "Metrics.h"		// Needed for CMetrics
 #include "UploadBandwidthThrottler.h"
 #include "Logger.h"
 #include "Preferences.h"
@@ -274,6 +275,7 @@ void CEMSocket::OnReceive(int nErrorCode)
 				}
 
 				// Process packet
+				CMetrics::CountPacket(CMetrics::Received, CMetrics::TransportTCP, packet->GetProtocol(), packet->GetOpCode());
 				PacketReceived(packet.get());
 			}
 		} else {
@@ -338,6 +340,8 @@ void CEMSocket::SendPacket(CPacket* packet, bool delpacket, bool controlpacket,
 			delete packet;
         }
     } else {
+		CMetrics::CountPacket(CMetrics::Sent, CMetrics::TransportTCP, packet->GetProtocol(), packet->GetOpCode());
+
         if (!delpacket){
             packet = new CPacket(*packet);
 	    }
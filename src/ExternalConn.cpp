@@ -54,21 +54,152 @@
 #include "kademlia/kademlia/Kademlia.h"
 #include "kademlia/kademlia/UDPFirewallTester.h"
 #include "Statistics.h"
+#include "GetTickCount.h"			// Needed for GetTickCount
+#include "Metrics.h"				// Needed for CMetricsTimer and CMetricsWriter
+#include "ArchSpecific.h"			// Needed for ENDIAN_HTONL
+#include <common/Macros.h>			// Needed for SEC2MS
+#include <cstring>				// Needed for memcpy
 
 
 //-------------------- File_Encoder --------------------
 
 
+// Shared state of a file is sampled at most this often
+#define EC_FILE_STATE_SAMPLE_TIME	SEC2MS(1)
+
+/*
+ * Part status, gaps and requested blocks of a file, sampled and
+ * RLE encoded once for all EC clients.
+ */
+class CFileEncoderState {
+	// time of the last sample
+	uint32 m_sampled;
+	bool m_sampledOnce;
+public:
+	CFileEncoderState() : m_sampled(0), m_sampledOnce(false) {}
+
+	// number of sources for each part for progress bar colouring
+	RLE_SharedData m_part_status;
+	// gap list
+	RLE_SharedData m_gap_status;
+	// blocks requested for download
+	RLE_SharedData m_req_status;
+
+	// take a new sample, unless the last one is recent enough
+	void Sample(const CKnownFile *file);
+};
+
+void CFileEncoderState::Sample(const CKnownFile *file)
+{
+	const uint32 now = GetTickCount();
+	if (m_sampledOnce && now - m_sampled < EC_FILE_STATE_SAMPLE_TIME) {
+		return;
+	}
+	m_sampled = now;
+	m_sampledOnce = true;
+
+	//
+	// Source part frequencies
+	//
+	// Reference to the availability list
+	const ArrayOfUInts16& list = file->IsPartFile() ?
+		static_cast<const CPartFile*>(file)->m_SrcpartFrequency :
+		file->m_AvailPartFrequency;
+	// Don't sample if available parts aren't populated yet.
+	if (!list.empty()) {
+		m_part_status.Update(list);
+	}
+
+	if (!file->IsCPartFile()) {
+		return;
+	}
+	const CPartFile *partfile = static_cast<const CPartFile *>(file);
+
+	//
+	// Gaps
+	//
+	const CGapList& gaplist = partfile->GetGapList();
+	ArrayOfUInts64 gaps;
+	gaps.reserve(gaplist.size() * 2);
+
+	for (CGapList::const_iterator curr_pos = gaplist.begin();
+			curr_pos != gaplist.end(); ++curr_pos) {
+		gaps.push_back(curr_pos.start());
+		gaps.push_back(curr_pos.end());
+	}
+	m_gap_status.Update(gaps);
+
+	//
+	// Requested blocks
+	//
+	ArrayOfUInts64 req_buffer;
+	const CPartFile::CReqBlockPtrList& requestedblocks = partfile->GetRequestedBlockList();
+	CPartFile::CReqBlockPtrList::const_iterator curr_pos2 = requestedblocks.begin();
+
+	for ( ; curr_pos2 != requestedblocks.end(); ++curr_pos2 ) {
+		Requested_Block_Struct* block = *curr_pos2;
+		req_buffer.push_back(block->StartOffset);
+		req_buffer.push_back(block->EndOffset);
+	}
+	m_req_status.Update(req_buffer);
+}
+
+/*
+ * Shared state of all files, by ECID. Owned by ExternalConn.
+ */
+class CFileEncoderStateMap : public std::map<uint32, CFileEncoderState*> {
+public:
+	~CFileEncoderStateMap();
+
+	// sampled state of a file
+	CFileEncoderState *Sample(const CKnownFile *file);
+	void Remove(uint32 id);
+};
+
+CFileEncoderStateMap::~CFileEncoderStateMap()
+{
+	for (iterator it = begin(); it != end(); ++it) {
+		delete it->second;
+	}
+}
+
+CFileEncoderState *CFileEncoderStateMap::Sample(const CKnownFile *file)
+{
+	CFileEncoderState *&state = (*this)[file->ECID()];
+	if (!state) {
+		state = new CFileEncoderState();
+	}
+	state->Sample(file);
+	return state;
+}
+
+void CFileEncoderStateMap::Remove(uint32 id)
+{
+	iterator it = find(id);
+	if (it != end()) {
+		delete it->second;
+		erase(it);
+	}
+}
+
+
 /*
  * Encode 'obtained parts' info to be sent to remote gui
  */
 class CKnownFile_Encoder {
 	// number of sources for each part for progress bar colouring
-	RLE_Data m_enc_data;
+	RLE_SharedData::Cursor m_part_status;
 protected:
 	const CKnownFile *m_file;
+	CFileEncoderStateMap *m_states;
+
+	void EncodeParts(CFileEncoderState *state, CECTag *parent_tag);
 public:
-	CKnownFile_Encoder(const CKnownFile *file = 0) { m_file = file; }
+	CKnownFile_Encoder(const CKnownFile *file, CFileEncoderStateMap *states)
+	{
+		m_file = file;
+		m_states = states;
+	}
 
 	virtual ~CKnownFile_Encoder() {}
 
@@ -76,7 +207,7 @@ public:
 
 	virtual void ResetEncoder()
 	{
-		m_enc_data.ResetEncoder();
+		m_part_status.Reset();
 	}
 
 	virtual void SetShared() { }
@@ -91,14 +222,17 @@ public:
  * Instead of sending each time full part-status string, send
  * RLE encoded difference from previous one.
  *
+ * The encoded state is shared by all clients (see CFileEncoderState),
+ * each encoder only remembers what its client was sent.
+ *
  * PartFileEncoderData class is used for decode only,
  * while CPartFile_Encoder is used for encode only.
  */
 class CPartFile_Encoder : public CKnownFile_Encoder {
 	// blocks requested for download
-	RLE_Data m_req_status;
+	RLE_SharedData::Cursor m_req_status;
 	// gap list
-	RLE_Data m_gap_status;
+	RLE_SharedData::Cursor m_gap_status;
 	// source names
 	SourcenameItemMap m_sourcenameItemMap;
 	// counter for unique source name ids
@@ -110,7 +244,7 @@ class CPartFile_Encoder : public CKnownFile_Encoder {
 	const CPartFile * m_PartFile() { wxCHECK(m_file->IsCPartFile(), NULL); return static_cast<const CPartFile *>(m_file); }
 public:
 	// encoder side
-	CPartFile_Encoder(const CPartFile *file = 0) : CKnownFile_Encoder(file)
+	CPartFile_Encoder(const CPartFile *file, CFileEncoderStateMap *states) : CKnownFile_Encoder(file, states)
 	{
 		m_sourcenameID = 0;
 		m_shared = false;
@@ -131,9 +265,15 @@ public:
 
 class CFileEncoderMap : public std::map<uint32, CKnownFile_Encoder*> {
 	typedef std::set<uint32> IDSet;
+	CFileEncoderStateMap *m_states;
 public:
+	CFileEncoderMap(CFileEncoderStateMap *states) : m_states(states) {}
 	~CFileEncoderMap();
 	void UpdateEncoders();
+	// forget the encoder of a single file, along with its shared state
+	void Remove(uint32 id);
+	// encoder for a single file, created if needed
+	CKnownFile_Encoder *GetEncoder(const CKnownFile *file, bool partfile);
 };
 
 CFileEncoderMap::~CFileEncoderMap()
@@ -144,6 +284,39 @@ CFileEncoderMap::~CFileEncoderMap()
 	}
 }
 
+CKnownFile_Encoder *CFileEncoderMap::GetEncoder(const CKnownFile *file, bool partfile)
+{
+	uint32 id = file->ECID();
+	iterator it = find(id);
+	if (it != end()) {
+		if (!partfile || it->second->IsPartFile_Encoder()) {
+			return it->second;
+		}
+		// pushed as shared file first, but it's a download
+		delete it->second;
+		erase(it);
+	}
+
+	CKnownFile_Encoder *enc;
+	if (partfile) {
+		enc = new CPartFile_Encoder(static_cast<const CPartFile *>(file), m_states);
+	} else {
+		enc = new CKnownFile_Encoder(file, m_states);
+	}
+	(*this)[id] = enc;
+	return enc;
+}
+
+void CFileEncoderMap::Remove(uint32 id)
+{
+	iterator it = find(id);
+	if (it != end()) {
+		delete it->second;
+		erase(it);
+	}
+	m_states->Remove(id);
+}
+
 // Check if encoder contains files that are no longer used
 // or if we have new files without encoder yet.
 void CFileEncoderMap::UpdateEncoders()
@@ -153,11 +326,8 @@ void CFileEncoderMap::UpdateEncoders()
 	std::vector<CPartFile*> downloads;
 	theApp->downloadqueue->CopyFileList(downloads, true);
 	for (uint32 i = downloads.size(); i--;) {
-		uint32 id = downloads[i]->ECID();
-		curr_files.insert(id);
-		if (!count(id)) {
-			(*this)[id] = new CPartFile_Encoder(downloads[i]);
-		}
+		curr_files.insert(downloads[i]->ECID());
+		GetEncoder(downloads[i], true);
 	}
 	// Shares
 	std::vector<CKnownFile*> shares;
@@ -171,9 +341,7 @@ void CFileEncoderMap::UpdateEncoders()
 			continue;
 		}
 		curr_files.insert(id);
-		if (!count(id)) {
-			(*this)[id] = new CKnownFile_Encoder(shares[i]);
-		}
+		GetEncoder(shares[i], false);
 	}
 	// Check for removed files, and store them in a set for deletion.
 	// (std::map documentation is unclear if a construct like
@@ -184,11 +352,12 @@ void CFileEncoderMap::UpdateEncoders()
 			dead_files.insert(it->first);
 		}
 	}
-	// then delete them
+	// then delete them, along with their shared state
 	for (IDSet::iterator it = dead_files.begin(); it != dead_files.end(); ++it) {
 		iterator it2 = find(*it);
 		delete it2->second;
 		erase(it2);
+		m_states->Remove(*it);
 	}
 }
 
@@ -207,6 +376,8 @@ public:
 	virtual void WriteDoneAndQueueEmpty();
 
 	void	ResetLog() { m_LoggerAccess.Reset(); }
+
+	CFileEncoderMap &GetFileEncoders() { return m_FileEncoder; }
 private:
 	ECNotifier *m_ec_notifier;
 
@@ -233,7 +404,8 @@ CECServerSocket::CECServerSocket(ECNotifier *notifier)
 :
 CECMuleSocket(true),
 m_conn_state(CONN_INIT),
-m_passwd_salt(GetRandomUint64())
+m_passwd_salt(GetRandomUint64()),
+m_FileEncoder(theApp->ECServerHandler->m_encoder_states)
 {
 	wxASSERT(theApp->ECServerHandler);
 	theApp->ECServerHandler->AddSocket(this);
@@ -250,6 +422,8 @@ CECServerSocket::~CECServerSocket()
 
 const CECPacket *CECServerSocket::OnPacketReceived(const CECPacket *packet, uint32 trueSize)
 {
+	CMetricsTimer metricsTimer(CMetrics::SubsystemEC);
+
 	packet->DebugPrint(true, trueSize);
 
 	const CECPacket *reply = NULL;
@@ -310,6 +484,7 @@ ExternalConn::ExternalConn(amuleIPV4Address addr, wxString *msg)
 {
 	wxString msgLocal;
 	m_ECServer = NULL;
+	m_encoder_states = new CFileEncoderStateMap();
 	// Are we allowed to accept External Connections?
 	if ( thePrefs::AcceptExternalConnections() ) {
 		// We must have a valid password, otherwise we will not allow EC connections
@@ -351,6 +526,7 @@ ExternalConn::~ExternalConn()
 	KillAllSockets();
 	delete m_ECServer;
 	delete m_ec_notifier;
+	delete m_encoder_states;
 }
 
 
@@ -365,6 +541,28 @@ void ExternalConn::RemoveSocket(CECServerSocket *s)
 {
 	wxASSERT(s);
 	socket_list.erase(s);
+	m_closed_stats.Add(s->GetCompressionStats());
+}
+
+
+void ExternalConn::WriteMetrics(CMetricsWriter& writer) const
+{
+	CECCompressionStats stats = m_closed_stats;
+	for (SocketSet::const_iterator it = socket_list.begin(); it != socket_list.end(); ++it) {
+		stats.Add((*it)->GetCompressionStats());
+	}
+
+	writer.Family("amule_ec_compressed_packets_total", "counter", "Compressed EC packets.");
+	writer.Sample("amule_ec_compressed_packets_total", "direction=\"sent\"", (uint64)stats.packetsDeflated);
+	writer.Sample("amule_ec_compressed_packets_total", "direction=\"received\"", (uint64)stats.packetsInflated);
+	writer.Family("amule_ec_compression_bytes_total", "counter", "Size of the compressed EC packets, compressed and not.");
+	writer.Sample("amule_ec_compression_bytes_total", "direction=\"sent\",encoding=\"plain\"", stats.bytesDeflatedIn);
+	writer.Sample("amule_ec_compression_bytes_total", "direction=\"sent\",encoding=\"deflate\"", stats.bytesDeflatedOut);
+	writer.Sample("amule_ec_compression_bytes_total", "direction=\"received\",encoding=\"plain\"", stats.bytesInflatedOut);
+	writer.Sample("amule_ec_compression_bytes_total", "direction=\"received\",encoding=\"deflate\"", stats.bytesInflatedIn);
+	writer.Family("amule_ec_compression_cpu_seconds_total", "counter", "Processor time of the core thread spent on EC compression.");
+	writer.Sample("amule_ec_compression_cpu_seconds_total", "direction=\"sent\"", stats.deflateMicros / 1e6);
+	writer.Sample("amule_ec_compression_cpu_seconds_total", "direction=\"received\"", stats.inflateMicros / 1e6);
 }
 
 
@@ -1154,51 +1352,30 @@ static CECPacket *Get_EC_Response_Set_SharedFile_Prio(const CECPacket *request)
 
 void CPartFile_Encoder::Encode(CECTag *parent)
 {
+	CFileEncoderState *state = m_states->Sample(m_file);
+
 	//
 	// Source part frequencies
 	//
-	CKnownFile_Encoder::Encode(parent);
+	EncodeParts(state, parent);
 
 	//
 	// Gaps
 	//
-	const CGapList& gaplist = m_PartFile()->GetGapList();
-	const size_t gap_list_size = gaplist.size();
-	ArrayOfUInts64 gaps;
-	gaps.reserve(gap_list_size * 2);
-
-	for (CGapList::const_iterator curr_pos = gaplist.begin();
-			curr_pos != gaplist.end(); ++curr_pos) {
-		gaps.push_back(curr_pos.start());
-		gaps.push_back(curr_pos.end());
-	}
-
-	int gap_enc_size = 0;
-	bool changed;
-	const uint8 *gap_enc_data = m_gap_status.Encode(gaps, gap_enc_size, changed);
-	if (changed) {
-		parent->AddTag(CECTag(EC_TAG_PARTFILE_GAP_STATUS, gap_enc_size, (void *)gap_enc_data));
+	const uint8 *gap_enc_data;
+	int gap_enc_size;
+	if (state->m_gap_status.GetDelta(m_gap_status, gap_enc_data, gap_enc_size)) {
+		parent->AddTag(CECTag(EC_TAG_PARTFILE_GAP_STATUS, gap_enc_size, gap_enc_data));
 	}
-	delete[] gap_enc_data;
 
 	//
 	// Requested blocks
 	//
-	ArrayOfUInts64 req_buffer;
-	const CPartFile::CReqBlockPtrList& requestedblocks = m_PartFile()->GetRequestedBlockList();
-	CPartFile::CReqBlockPtrList::const_iterator curr_pos2 = requestedblocks.begin();
-
-	for ( ; curr_pos2 != requestedblocks.end(); ++curr_pos2 ) {
-		Requested_Block_Struct* block = *curr_pos2;
-		req_buffer.push_back(block->StartOffset);
-		req_buffer.push_back(block->EndOffset);
-	}
-	int req_enc_size = 0;
-	const uint8 *req_enc_data = m_req_status.Encode(req_buffer, req_enc_size, changed);
-	if (changed) {
-		parent->AddTag(CECTag(EC_TAG_PARTFILE_REQ_STATUS, req_enc_size, (void *)req_enc_data));
+	const uint8 *req_enc_data;
+	int req_enc_size;
+	if (state->m_req_status.GetDelta(m_req_status, req_enc_data, req_enc_size)) {
+		parent->AddTag(CECTag(EC_TAG_PARTFILE_REQ_STATUS, req_enc_size, req_enc_data));
 	}
-	delete[] req_enc_data;
 
 	//
 	// Source names
@@ -1268,28 +1445,24 @@ void CPartFile_Encoder::Encode(CECTag *parent)
 void CPartFile_Encoder::ResetEncoder()
 {
 	CKnownFile_Encoder::ResetEncoder();
-	m_gap_status.ResetEncoder();
-	m_req_status.ResetEncoder();
+	m_gap_status.Reset();
+	m_req_status.Reset();
 }
 
 void CKnownFile_Encoder::Encode(CECTag *parent)
+{
+	EncodeParts(m_states->Sample(m_file), parent);
+}
+
+void CKnownFile_Encoder::EncodeParts(CFileEncoderState *state, CECTag *parent)
 {
 	//
 	// Source part frequencies
 	//
-	// Reference to the availability list
-	const ArrayOfUInts16& list = m_file->IsPartFile() ?
-		static_cast<const CPartFile*>(m_file)->m_SrcpartFrequency :
-		m_file->m_AvailPartFrequency;
-	// Don't add tag if available parts aren't populated yet.
-	if (!list.empty()) {
-		int part_enc_size;
-		bool changed;
-		const uint8 *part_enc_data = m_enc_data.Encode(list, part_enc_size, changed);
-		if (changed) {
-			parent->AddTag(CECTag(EC_TAG_PARTFILE_PART_STATUS, part_enc_size, part_enc_data));
-		}
-		delete[] part_enc_data;
+	const uint8 *part_enc_data;
+	int part_enc_size;
+	if (state->m_part_status.GetDelta(m_part_status, part_enc_data, part_enc_size)) {
+		parent->AddTag(CECTag(EC_TAG_PARTFILE_PART_STATUS, part_enc_size, part_enc_data));
 	}
 }
 
@@ -1335,6 +1508,38 @@ static CECPacket *GetStatsGraphs(const CECPacket *request)
 	return response;
 }
 
+static CECPacket *GetStatsHistory(const CECPacket *request)
+{
+	uint8 tier = request->GetTagByNameSafe(EC_TAG_STATSHISTORY_TIER)->GetInt();
+	uint32 from = request->GetTagByNameSafe(EC_TAG_STATSHISTORY_FROM)->GetInt();
+	uint32 to = request->GetTagByNameSafe(EC_TAG_STATSHISTORY_TO)->GetInt();
+
+	if (tier >= CStatsHistory::TierCount) {
+		CECPacket *response = new CECPacket(EC_OP_FAILED);
+		response->AddTag(CECTag(EC_TAG_STRING, wxTRANSLATE("Invalid statistics history tier.")));
+		return response;
+	}
+
+	std::vector<float> rows;
+	uint32 start = theApp->m_statistics->GetStatsHistory().GetRange((CStatsHistory::Tier)tier, from, to, rows);
+
+	CECPacket *response = new CECPacket(EC_OP_STATSHISTORY);
+	response->AddTag(CECTag(EC_TAG_STATSHISTORY_TIER, tier));
+	response->AddTag(CECTag(EC_TAG_STATSHISTORY_FROM, start));
+	if (!rows.empty()) {
+		// Rows of CStatsHistory::ColCount floats, sent as their bits in network byte order
+		std::vector<uint32> data(rows.size());
+		for (size_t i = 0; i < rows.size(); ++i) {
+			uint32 bits;
+			memcpy(&bits, &rows[i], sizeof(bits));
+			data[i] = ENDIAN_HTONL(bits);
+		}
+		response->AddTag(CECTag(EC_TAG_STATSHISTORY_DATA, data.size() * sizeof(uint32), &data[0]));
+	}
+
+	return response;
+}
+
 CECPacket *CECServerSocket::ProcessRequest2(const CECPacket *request)
 {
 
@@ -1423,6 +1628,19 @@ CECPacket *CECServerSocket::ProcessRequest2(const CECPacket *request)
 		case EC_OP_GET_ULOAD_QUEUE:
 			response = Get_EC_Response_GetClientQueue(request, m_obj_tagmap, EC_OP_ULOAD_QUEUE);
 			break;
+		//
+		// Pushed updates
+		//
+		case EC_OP_SUBSCRIBE:
+			if (HaveNotificationSupport()) {
+				const CECTag *classes = request->GetTagByName(EC_TAG_SUBSCRIPTION);
+				m_ec_notifier->Subscribe(this, classes ? classes->GetInt() : (uint32)EC_SUBSCRIBE_ALL);
+				response = new CECPacket(EC_OP_NOOP);
+			} else {
+				response = new CECPacket(EC_OP_FAILED);
+				response->AddTag(CECTag(EC_TAG_STRING, wxTRANSLATE("Notifications were not requested at login.")));
+			}
+			break;
 		case EC_OP_PARTFILE_SWAP_A4AF_THIS:
 		case EC_OP_PARTFILE_SWAP_A4AF_THIS_AUTO:
 		case EC_OP_PARTFILE_SWAP_A4AF_OTHERS:
@@ -1735,6 +1953,9 @@ CECPacket *CECServerSocket::ProcessRequest2(const CECPacket *request)
 		case EC_OP_GET_STATSGRAPHS:
 			response = GetStatsGraphs(request);
 			break;
+		case EC_OP_GET_STATSHISTORY:
+			response = GetStatsHistory(request);
+			break;
 		case EC_OP_GET_STATSTREE: {
 			theApp->m_statistics->UpdateStatsTree();
 			response = new CECPacket(EC_OP_STATSTREE);
@@ -1908,11 +2129,12 @@ CECPacket *ECStatusMsgSource::GetNextPacket()
 /*
  * Downloading files
 */
-ECPartFileMsgSource::ECPartFileMsgSource()
+ECPartFileMsgSource::ECPartFileMsgSource(CFileEncoderMap *encoders)
+	: m_encoders(encoders)
 {
 	for (unsigned int i = 0; i < theApp->downloadqueue->GetFileCount(); i++) {
 		CPartFile *cur_file = theApp->downloadqueue->GetFileByIndex(i);
-		PARTFILE_STATUS status = { true, false, false, false, true, cur_file };
+		PARTFILE_STATUS status = { true, false, false, false, true, cur_file, cur_file->ECID() };
 		m_dirty_status[cur_file->GetFileHash()] = status;
 	}
 }
@@ -1929,7 +2151,7 @@ void ECPartFileMsgSource::SetNew(const CPartFile *file)
 {
 	CMD4Hash filehash = file->GetFileHash();
 	wxASSERT ( m_dirty_status.find(filehash) == m_dirty_status.end() );
-	PARTFILE_STATUS status = { true, false, false, false, true, file };
+	PARTFILE_STATUS status = { true, false, false, false, true, file, file->ECID() };
 	m_dirty_status[filehash] = status;
 }
 
@@ -1946,7 +2168,13 @@ void ECPartFileMsgSource::SetRemoved(const CPartFile *file)
 	CMD4Hash filehash = file->GetFileHash();
 	wxASSERT ( m_dirty_status.find(filehash) != m_dirty_status.end() );
 
-	m_dirty_status[filehash].m_removed = true;
+	PARTFILE_STATUS &status = m_dirty_status[filehash];
+	status.m_removed = true;
+	// Forget the encoder while the file is still alive, unless the
+	// shared files list keeps using it under the same EC ID.
+	if (file->ECID() != status.m_ecid || theApp->sharedfiles->GetFileByID(filehash) != file) {
+		m_encoders->Remove(status.m_ecid);
+	}
 }
 
 CECPacket *ECPartFileMsgSource::GetNextPacket()
@@ -1965,6 +2193,12 @@ CECPacket *ECPartFileMsgSource::GetNextPacket()
 				m_dirty_status.erase(it);
 			} else {
 				CEC_PartFile_Tag tag(partfile, it->second.m_new ? EC_DETAIL_FULL : EC_DETAIL_UPDATE);
+				// Part status, gaps and requested blocks as shared deltas
+				CKnownFile_Encoder *enc = m_encoders->GetEncoder(partfile, true);
+				if ( it->second.m_new ) {
+					enc->ResetEncoder();
+				}
+				enc->Encode(&tag);
 				packet->AddTag(tag);
 			}
 			m_dirty_status[filehash].m_new = false;
@@ -1979,11 +2213,12 @@ CECPacket *ECPartFileMsgSource::GetNextPacket()
 /*
  * Shared files - similar to downloading
  */
-ECKnownFileMsgSource::ECKnownFileMsgSource()
+ECKnownFileMsgSource::ECKnownFileMsgSource(CFileEncoderMap *encoders)
+	: m_encoders(encoders)
 {
 	for (unsigned int i = 0; i < theApp->sharedfiles->GetFileCount(); i++) {
 		const CKnownFile *cur_file = theApp->sharedfiles->GetFileByIndex(i);
-		KNOWNFILE_STATUS status = { true, false, false, true, cur_file };
+		KNOWNFILE_STATUS status = { true, false, false, true, cur_file, cur_file->ECID() };
 		m_dirty_status[cur_file->GetFileHash()] = status;
 	}
 }
@@ -2000,7 +2235,7 @@ void ECKnownFileMsgSource::SetNew(const CKnownFile *file)
 {
 	CMD4Hash filehash = file->GetFileHash();
 	wxASSERT ( m_dirty_status.find(filehash) == m_dirty_status.end() );
-	KNOWNFILE_STATUS status = { true, false, false, true, file };
+	KNOWNFILE_STATUS status = { true, false, false, true, file, file->ECID() };
 	m_dirty_status[filehash] = status;
 }
 
@@ -2009,7 +2244,12 @@ void ECKnownFileMsgSource::SetRemoved(const CKnownFile *file)
 	CMD4Hash filehash = file->GetFileHash();
 	wxASSERT ( m_dirty_status.find(filehash) != m_dirty_status.end() );
 
-	m_dirty_status[filehash].m_removed = true;
+	KNOWNFILE_STATUS &status = m_dirty_status[filehash];
+	status.m_removed = true;
+	// same as for downloads, the download queue may still use the encoder
+	if (file->ECID() != status.m_ecid || !theApp->downloadqueue->IsPartFile(file)) {
+		m_encoders->Remove(status.m_ecid);
+	}
 }
 
 CECPacket *ECKnownFileMsgSource::GetNextPacket()
@@ -2028,6 +2268,12 @@ CECPacket *ECKnownFileMsgSource::GetNextPacket()
 				m_dirty_status.erase(it);
 			} else {
 				CEC_SharedFile_Tag tag(partfile, it->second.m_new ? EC_DETAIL_FULL : EC_DETAIL_UPDATE);
+				// Part status as shared delta
+				CKnownFile_Encoder *enc = m_encoders->GetEncoder(partfile, theApp->downloadqueue->IsPartFile(partfile));
+				if ( it->second.m_new ) {
+					enc->ResetEncoder();
+				}
+				enc->Encode(&tag);
 				packet->AddTag(tag);
 			}
 			m_dirty_status[filehash].m_new = false;
@@ -2048,21 +2294,36 @@ ECSearchMsgSource::ECSearchMsgSource()
 
 CECPacket *ECSearchMsgSource::GetNextPacket()
 {
-	if ( m_dirty_status.empty() ) {
-		return 0;
-	}
-
-	CECPacket *response = new CECPacket(EC_OP_SEARCH_RESULTS);
+	// Only the results which changed since the last packet are sent
+	CECPacket *response = 0;
 	for(std::map<CMD4Hash, SEARCHFILE_STATUS>::iterator it = m_dirty_status.begin();
 		it != m_dirty_status.end(); it++) {
 
-		if ( it->second.m_new ) {
-			response->AddTag(CEC_SearchFile_Tag(it->second.m_file, EC_DETAIL_FULL));
-			it->second.m_new = false;
-		} else if ( it->second.m_dirty ) {
-			response->AddTag(CEC_SearchFile_Tag(it->second.m_file, EC_DETAIL_UPDATE));
+		SEARCHFILE_STATUS &status = it->second;
+		if ( !status.m_new && !status.m_dirty && !status.m_child_dirty ) {
+			continue;
+		}
+
+		if ( !response ) {
+			response = new CECPacket(EC_OP_SEARCH_RESULTS);
+		}
+
+		if ( status.m_new ) {
+			response->AddTag(CEC_SearchFile_Tag(status.m_file, EC_DETAIL_FULL));
+		} else if ( status.m_dirty ) {
+			response->AddTag(CEC_SearchFile_Tag(status.m_file, EC_DETAIL_UPDATE));
 		}
 
+		if ( status.m_child_dirty ) {
+			const CSearchResultList& children = status.m_file->GetChildren();
+			for (size_t i = 0; i < children.size(); ++i) {
+				response->AddTag(CEC_SearchFile_Tag(children.at(i), EC_DETAIL_FULL));
+			}
+		}
+
+		status.m_new = false;
+		status.m_dirty = false;
+		status.m_child_dirty = false;
 	}
 
 	return response;
@@ -2080,14 +2341,20 @@ void ECSearchMsgSource::SetDirty(const CSearchFile *file)
 	} else {
 		m_dirty_status[file->GetFileHash()].m_new = true;
 		m_dirty_status[file->GetFileHash()].m_dirty = true;
-		m_dirty_status[file->GetFileHash()].m_child_dirty = true;
+		m_dirty_status[file->GetFileHash()].m_child_dirty = file->HasChildren();
 		m_dirty_status[file->GetFileHash()].m_file = file;
 	}
 }
 
 void ECSearchMsgSource::SetChildDirty(const CSearchFile *file)
 {
-	m_dirty_status[file->GetFileHash()].m_child_dirty = true;
+	// Children share the hash of their parent
+	const CSearchFile *parent = file->GetParent();
+	if ( m_dirty_status.count(parent->GetFileHash()) ) {
+		m_dirty_status[parent->GetFileHash()].m_child_dirty = true;
+	} else {
+		SetDirty(parent);
+	}
 }
 
 /*
@@ -2111,13 +2378,28 @@ ECNotifier::~ECNotifier()
 		Remove_EC_Client(m_msg_source.begin()->first);
 }
 
-CECPacket *ECNotifier::GetNextPacket(ECUpdateMsgSource *msg_source_array[])
+bool ECNotifier::IsSubscribed(uint32 subscriptions, int prio)
+{
+	switch (prio) {
+		case EC_PARTFILE:	return (subscriptions & EC_SUBSCRIBE_DOWNLOADS) != 0;
+		case EC_SEARCH:		return (subscriptions & EC_SUBSCRIBE_SEARCH) != 0;
+		case EC_STATUS:		return (subscriptions & EC_SUBSCRIBE_STATUS) != 0;
+		case EC_KNOWN:		return (subscriptions & EC_SUBSCRIBE_SHARED) != 0;
+		// uploading clients are not pushed (yet)
+		default:		return false;
+	}
+}
+
+CECPacket *ECNotifier::GetNextPacket(ECUpdateMsgSource *msg_source_array[], uint32 subscriptions)
 {
 	CECPacket *packet = 0;
 	//
 	// priority 0 is highest
 	//
 	for(int i = 0; i < EC_STATUS_LAST_PRIO; i++) {
+		if ( !IsSubscribed(subscriptions, i) ) {
+			continue;
+		}
 		if ( (packet = msg_source_array[i]->GetNextPacket()) != 0 ) {
 			break;
 		}
@@ -2136,7 +2418,7 @@ CECPacket *ECNotifier::GetNextPacket(CECServerSocket *sock)
 		if ( !notifier_array ) {
 			return 0;
 		}
-		CECPacket *packet = GetNextPacket(notifier_array);
+		CECPacket *packet = GetNextPacket(notifier_array, m_subscriptions[sock]);
 		//printf("[EC] next update packet; opcode=%x\n",packet ? packet->GetOpCode() : 0xff);
 		return packet;
 	} else {
@@ -2152,7 +2434,7 @@ void ECNotifier::DownloadFile_SetDirty(const CPartFile *file)
 	for(std::map<CECServerSocket *, ECUpdateMsgSource **>::iterator i = m_msg_source.begin();
 		i != m_msg_source.end(); ++i) {
 		CECServerSocket *sock = i->first;
-		if ( sock->HaveNotificationSupport() ) {
+		if ( sock->HaveNotificationSupport() && IsSubscribed(m_subscriptions[sock], EC_PARTFILE) ) {
 			ECUpdateMsgSource **notifier_array = i->second;
 			static_cast<ECPartFileMsgSource *>(notifier_array[EC_PARTFILE])->SetDirty(file);
 		}
@@ -2215,16 +2497,87 @@ void ECNotifier::SharedFile_RemoveAllFiles()
 	// need to figure out what to do here
 }
 
+void ECNotifier::Search_AddResult(const CSearchFile *file)
+{
+	// EC clients only see the results of their own search
+	if ( file->GetSearchID() != 0xffffffff ) {
+		return;
+	}
+
+	for(std::map<CECServerSocket *, ECUpdateMsgSource **>::iterator i = m_msg_source.begin();
+		i != m_msg_source.end(); ++i) {
+		CECServerSocket *sock = i->first;
+		if ( sock->HaveNotificationSupport() && IsSubscribed(m_subscriptions[sock], EC_SEARCH) ) {
+			ECSearchMsgSource *source = static_cast<ECSearchMsgSource *>(i->second[EC_SEARCH]);
+			if ( file->GetParent() ) {
+				source->SetChildDirty(file);
+			} else {
+				source->SetDirty(file);
+			}
+		}
+	}
+	NextPacketToSocket();
+}
+
+void ECNotifier::Search_UpdateResult(const CSearchFile *file)
+{
+	// The status of a result is sent the same way as the result itself
+	Search_AddResult(file);
+}
+
+void ECNotifier::Search_RemoveResults(long searchID)
+{
+	if ( searchID != 0xffffffff ) {
+		return;
+	}
+
+	for(std::map<CECServerSocket *, ECUpdateMsgSource **>::iterator i = m_msg_source.begin();
+		i != m_msg_source.end(); ++i) {
+		static_cast<ECSearchMsgSource *>(i->second[EC_SEARCH])->FlushStatus();
+	}
+}
+
+ECUpdateMsgSource *ECNotifier::CreateMsgSource(CECServerSocket *sock, int prio)
+{
+	switch (prio) {
+		case EC_STATUS:		return new ECStatusMsgSource();
+		case EC_SEARCH:		return new ECSearchMsgSource();
+		case EC_PARTFILE:	return new ECPartFileMsgSource(&sock->GetFileEncoders());
+		case EC_CLIENT:		return new ECClientMsgSource();
+		case EC_KNOWN:		return new ECKnownFileMsgSource(&sock->GetFileEncoders());
+		default:		wxFAIL; return 0;
+	}
+}
+
 void ECNotifier::Add_EC_Client(CECServerSocket *sock)
 {
 	ECUpdateMsgSource **notifier_array = new ECUpdateMsgSource *[EC_STATUS_LAST_PRIO];
-	notifier_array[EC_STATUS] = new ECStatusMsgSource();
-	notifier_array[EC_SEARCH] = new ECSearchMsgSource();
-	notifier_array[EC_PARTFILE] = new ECPartFileMsgSource();
-	notifier_array[EC_CLIENT] = new ECClientMsgSource();
-	notifier_array[EC_KNOWN] = new ECKnownFileMsgSource();
+	for(int i = 0; i < EC_STATUS_LAST_PRIO; i++) {
+		notifier_array[i] = CreateMsgSource(sock, i);
+	}
 
 	m_msg_source[sock] = notifier_array;
+	m_subscriptions[sock] = EC_SUBSCRIBE_ALL;
+}
+
+void ECNotifier::Subscribe(CECServerSocket *sock, uint32 classes)
+{
+	if (!m_msg_source.count(sock)) {
+		return;
+	}
+
+	ECUpdateMsgSource **notifier_array = m_msg_source[sock];
+	uint32 &subscriptions = m_subscriptions[sock];
+	for(int i = 0; i < EC_STATUS_LAST_PRIO; i++) {
+		// Updates missed while unsubscribed are not tracked,
+		// so start over with the full state
+		if ( IsSubscribed(classes, i) && !IsSubscribed(subscriptions, i) ) {
+			delete notifier_array[i];
+			notifier_array[i] = CreateMsgSource(sock, i);
+		}
+	}
+	subscriptions = classes;
+	// Updates are pushed once the reply to the request has been sent
 }
 
 void ECNotifier::Remove_EC_Client(CECServerSocket *sock)
@@ -2233,6 +2586,7 @@ void ECNotifier::Remove_EC_Client(CECServerSocket *sock)
 		ECUpdateMsgSource **notifier_array = m_msg_source[sock];
 
 		m_msg_source.erase(sock);
+		m_subscriptions.erase(sock);
 
 		for(int i = 0; i < EC_STATUS_LAST_PRIO; i++) {
 			delete notifier_array[i];
@@ -2248,7 +2602,7 @@ void ECNotifier::NextPacketToSocket()
 		CECServerSocket *sock = i->first;
 		if ( sock->HaveNotificationSupport() && !sock->DataPending() ) {
 			ECUpdateMsgSource **notifier_array = i->second;
-			CECPacket *packet = GetNextPacket(notifier_array);
+			CECPacket *packet = GetNextPacket(notifier_array, m_subscriptions[sock]);
 			if ( packet ) {
 				//printf("[EC] sending update packet; opcode=%x\n",packet->GetOpCode());
 				sock->SendPacket(packet);
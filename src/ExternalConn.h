@@ -30,6 +30,7 @@
 
 
 #include <ec/cpp/ECSpecialTags.h>
+#include <ec/cpp/ECSocket.h>	// for CECCompressionStats
 
 #include "amuleIPV4Address.h"	// for amuleIPV4Address
 #include "RLE.h"	// for RLE
@@ -79,8 +80,11 @@ class CObjTagMap {
 
 
 class CECServerSocket;
+class CMetricsWriter;
 class ECNotifier;
 class ExternalConn;
+class CFileEncoderMap;
+class CFileEncoderStateMap;
 
 class CExternalConnListener : public CLibSocketServer
 {
@@ -98,6 +102,8 @@ class ExternalConn : public wxEvtHandler
 private:
 	typedef std::set<CECServerSocket *> SocketSet;
 	SocketSet socket_list;
+	// compression counters of the sockets already closed
+	CECCompressionStats m_closed_stats;
 
 public:
 	ExternalConn(amuleIPV4Address addr, wxString *msg);
@@ -105,11 +111,15 @@ public:
 
 	CExternalConnListener *m_ECServer;
 	ECNotifier *m_ec_notifier;
+	// encoded file state, shared by all sockets
+	CFileEncoderStateMap *m_encoder_states;
 
 	void AddSocket(CECServerSocket *s);
 	void RemoveSocket(CECServerSocket *s);
 	void KillAllSockets();
 	void ResetAllLogs();
+	// compression counters of all connections of this session
+	void WriteMetrics(CMetricsWriter& writer) const;
 
 #ifndef ASIO_SOCKETS
 private:
@@ -135,10 +145,14 @@ class ECPartFileMsgSource : public ECUpdateMsgSource {
 			bool m_finished;
 			bool m_dirty;
 			const CPartFile *m_file;
+			// EC ID the encoder was created under, it may be renewed later
+			uint32 m_ecid;
 		} PARTFILE_STATUS;
 		std::map<CMD4Hash, PARTFILE_STATUS> m_dirty_status;
+		// encoders of the socket, for part status and gaps
+		CFileEncoderMap *m_encoders;
 	public:
-		ECPartFileMsgSource();
+		ECPartFileMsgSource(CFileEncoderMap *encoders);
 
 		void SetDirty(const CPartFile *file);
 		void SetNew(const CPartFile *file);
@@ -156,10 +170,14 @@ class ECKnownFileMsgSource : public ECUpdateMsgSource {
 			bool m_removed;
 			bool m_dirty;
 			const CKnownFile *m_file;
+			// EC ID the encoder was created under, it may be renewed later
+			uint32 m_ecid;
 		} KNOWNFILE_STATUS;
 		std::map<CMD4Hash, KNOWNFILE_STATUS> m_dirty_status;
+		// encoders of the socket, for part status
+		CFileEncoderMap *m_encoders;
 	public:
-		ECKnownFileMsgSource();
+		ECKnownFileMsgSource(CFileEncoderMap *encoders);
 
 		void SetDirty(const CKnownFile *file);
 		void SetNew(const CKnownFile *file);
@@ -221,10 +239,15 @@ class ECNotifier {
 
 		//ECUpdateMsgSource *m_msg_source[EC_STATUS_LAST_PRIO];
 		std::map<CECServerSocket *, ECUpdateMsgSource **> m_msg_source;
+		// EcSubscription flags of each socket
+		std::map<CECServerSocket *, uint32> m_subscriptions;
 
 		void NextPacketToSocket();
 
-		CECPacket *GetNextPacket(ECUpdateMsgSource *msg_source_array[]);
+		ECUpdateMsgSource *CreateMsgSource(CECServerSocket *sock, int prio);
+		static bool IsSubscribed(uint32 subscriptions, int prio);
+
+		CECPacket *GetNextPacket(ECUpdateMsgSource *msg_source_array[], uint32 subscriptions);
 		// Make class non assignable
 		void operator=(const ECNotifier&);
 		ECNotifier(const ECNotifier&);
@@ -235,6 +258,13 @@ class ECNotifier {
 		void Add_EC_Client(CECServerSocket *sock);
 		void Remove_EC_Client(CECServerSocket *sock);
 
+		//
+		// Only push updates of the given EcSubscription classes to the
+		// socket. Classes not subscribed before start over with their
+		// full state. All classes are pushed until this is called.
+		//
+		void Subscribe(CECServerSocket *sock, uint32 classes);
+
 		CECPacket *GetNextPacket(CECServerSocket *sock);
 
 		//
@@ -250,6 +280,10 @@ class ECNotifier {
 		void SharedFile_RemoveFile(const CKnownFile *file);
 		void SharedFile_RemoveAllFiles();
 
+		void Search_AddResult(const CSearchFile *file);
+		void Search_UpdateResult(const CSearchFile *file);
+		void Search_RemoveResults(long searchID);
+
 };
 
 
@@ -46,6 +46,10 @@ uint32 GetTickCountFullRes();
 
 uint64 GetTickCount64();
 
+// Monotonic time in microseconds, for measuring short durations
+
+uint64 GetTickCountMicro();
+
 // Functions used to init the timer on GUI
 
 void StartTickTimer();
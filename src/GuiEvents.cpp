@@ -34,6 +34,7 @@
 #include "IPFilter.h"
 #include "Friend.h"
 #include "Logger.h"
+#include "NotificationBatch.h"
 
 #ifndef AMULE_DAEMON
 #	include "ChatWnd.h"
@@ -332,18 +333,114 @@ namespace MuleNotify
 
 #else
 
-	void SharedFilesShowFile(CKnownFile* NOT_ON_DAEMON(file))
-	{
 #ifndef AMULE_DAEMON
+	// The number of items handed to a list control per flush at most
+	static const size_t LIST_NOTIFICATIONS_PER_FLUSH = 500;
+
+	static void SharedFilesShowFiles(const std::vector<CKnownFile*>& files)
+	{
 		if (theApp->amuledlg->m_sharedfileswnd && theApp->amuledlg->m_sharedfileswnd->sharedfilesctrl) {
-			theApp->amuledlg->m_sharedfileswnd->sharedfilesctrl->ShowFile(file);
+			theApp->amuledlg->m_sharedfileswnd->sharedfilesctrl->ShowFiles(files);
+		}
+	}
+
+	static void SharedFilesUpdateItems(const std::vector<CKnownFile*>& files)
+	{
+		if (theApp->amuledlg->m_sharedfileswnd && theApp->amuledlg->m_sharedfileswnd->sharedfilesctrl) {
+			theApp->amuledlg->m_sharedfileswnd->sharedfilesctrl->UpdateItems(files);
+		}
+	}
+
+	static void DownloadCtrlAddFiles(const std::vector<CPartFile*>& files)
+	{
+		if (theApp->amuledlg->m_transferwnd && theApp->amuledlg->m_transferwnd->downloadlistctrl) {
+			theApp->amuledlg->m_transferwnd->downloadlistctrl->AddFiles(files);
+		}
+	}
+
+	static void ServerAddServers(const std::vector<CServer*>& servers)
+	{
+		if (theApp->amuledlg->m_serverwnd && theApp->amuledlg->m_serverwnd->serverlistctrl) {
+			theApp->amuledlg->m_serverwnd->serverlistctrl->AddServers(servers);
+		}
+	}
+
+	static void Search_Add_Results(const std::vector<CSearchFile*>& results)
+	{
+		if (theApp->amuledlg->m_searchwnd) {
+			theApp->amuledlg->m_searchwnd->AddResults(results);
+		}
+	}
+
+	static void Search_Update_Results(const std::vector<CSearchFile*>& results)
+	{
+		if (theApp->amuledlg->m_searchwnd) {
+			theApp->amuledlg->m_searchwnd->UpdateResults(results);
+		}
+	}
+
+	// Additions and updates for the list controls, which are handed over
+	// in ranges by FlushListNotifications.
+	static CNotificationBatch<CKnownFile*> s_sharedFiles(SharedFilesShowFiles, SharedFilesUpdateItems, LIST_NOTIFICATIONS_PER_FLUSH);
+	static CNotificationBatch<CPartFile*> s_downloads(DownloadCtrlAddFiles, NULL, LIST_NOTIFICATIONS_PER_FLUSH);
+	static CNotificationBatch<CServer*> s_servers(ServerAddServers, NULL, LIST_NOTIFICATIONS_PER_FLUSH);
+	static CNotificationBatch<CSearchFile*> s_searchResults(Search_Add_Results, Search_Update_Results, LIST_NOTIFICATIONS_PER_FLUSH);
+
+	//! Matches the results of one search.
+	struct CSameSearchID
+	{
+		CSameSearchID(long id)
+			: m_id(id)
+		{
+		}
+
+		bool operator()(const CSearchFile* result) const
+		{
+			return static_cast<long>(result->GetSearchID()) == m_id;
 		}
+
+		long	m_id;
+	};
+#endif
+
+	bool FlushListNotifications()
+	{
+#ifndef AMULE_DAEMON
+		if (!theApp->amuledlg) {
+			// Gone while shutting down
+			s_sharedFiles.Clear();
+			s_downloads.Clear();
+			s_servers.Clear();
+			s_searchResults.Clear();
+
+			return false;
+		}
+
+		// Each batch has a go, rather than the first keeping the others
+		// waiting until it is done.
+		bool more = s_sharedFiles.Flush();
+		more = s_downloads.Flush() || more;
+		more = s_servers.Flush() || more;
+		more = s_searchResults.Flush() || more;
+
+		return more;
+#else
+		return false;
+#endif
+	}
+
+	void SharedFilesShowFile(CKnownFile* NOT_ON_DAEMON(file))
+	{
+#ifndef AMULE_DAEMON
+		s_sharedFiles.Add(file);
 #endif
 	}
 
 	void SharedFilesRemoveFile(CKnownFile* NOT_ON_DAEMON(file))
 	{
 #ifndef AMULE_DAEMON
+		s_sharedFiles.Remove(file);
+
 		if (theApp->amuledlg->m_sharedfileswnd && theApp->amuledlg->m_sharedfileswnd->sharedfilesctrl) {
 			theApp->amuledlg->m_sharedfileswnd->sharedfilesctrl->RemoveFile(file);
 		}
@@ -353,6 +450,8 @@ namespace MuleNotify
 	void SharedFilesRemoveAllFiles()
 	{
 #ifndef AMULE_DAEMON
+		s_sharedFiles.Clear();
+
 		if (theApp->amuledlg->m_sharedfileswnd) {
 			theApp->amuledlg->m_sharedfileswnd->RemoveAllSharedFiles();
 		}
@@ -363,6 +462,9 @@ namespace MuleNotify
 	void SharedFilesShowFileList()
 	{
 #ifndef AMULE_DAEMON
+		// The whole list is shown as it is now
+		s_sharedFiles.Clear();
+
 		if (theApp->amuledlg->m_sharedfileswnd && theApp->amuledlg->m_sharedfileswnd->sharedfilesctrl) {
 			theApp->amuledlg->m_sharedfileswnd->sharedfilesctrl->ShowFileList();
 		}
@@ -373,9 +475,7 @@ namespace MuleNotify
 	void SharedFilesUpdateItem(CKnownFile* NOT_ON_DAEMON(file))
 	{
 #ifndef AMULE_DAEMON
-		if (theApp->amuledlg->m_sharedfileswnd && theApp->amuledlg->m_sharedfileswnd->sharedfilesctrl) {
-			theApp->amuledlg->m_sharedfileswnd->sharedfilesctrl->UpdateItem(file);
-		}
+		s_sharedFiles.Update(file);
 #endif
 	}
 
@@ -384,9 +484,7 @@ namespace MuleNotify
 	{
 		theApp->ECServerHandler->m_ec_notifier->DownloadFile_AddFile(file);
 #ifndef AMULE_DAEMON
-		if (theApp->amuledlg->m_transferwnd && theApp->amuledlg->m_transferwnd->downloadlistctrl ) {
-			theApp->amuledlg->m_transferwnd->downloadlistctrl->AddFile(file);
-		}
+		s_downloads.Add(file);
 #endif
 	}
 
@@ -394,6 +492,8 @@ namespace MuleNotify
 	{
 		theApp->ECServerHandler->m_ec_notifier->DownloadFile_RemoveFile(file);
 #ifndef AMULE_DAEMON
+		s_downloads.Remove(file);
+
 		if (theApp->amuledlg->m_transferwnd && theApp->amuledlg->m_transferwnd->downloadlistctrl) {
 			theApp->amuledlg->m_transferwnd->downloadlistctrl->RemoveFile(file);
 		}
@@ -412,15 +512,15 @@ namespace MuleNotify
 	void ServerAdd(CServer* NOT_ON_DAEMON(server))
 	{
 #ifndef AMULE_DAEMON
-		if (theApp->amuledlg->m_serverwnd && theApp->amuledlg->m_serverwnd->serverlistctrl) {
-			theApp->amuledlg->m_serverwnd->serverlistctrl->AddServer(server);
-		}
+		s_servers.Add(server);
 #endif
 	}
 
 	void ServerRemove(CServer* NOT_ON_DAEMON(server))
 	{
 #ifndef AMULE_DAEMON
+		s_servers.Remove(server);
+
 		if (theApp->amuledlg->m_serverwnd && theApp->amuledlg->m_serverwnd->serverlistctrl) {
 			theApp->amuledlg->m_serverwnd->serverlistctrl->RemoveServer(server);
 		}
@@ -437,6 +537,8 @@ namespace MuleNotify
 	void ServerRemoveAll()
 	{
 #ifndef AMULE_DAEMON
+		s_servers.Clear();
+
 		if (theApp->amuledlg->m_serverwnd && theApp->amuledlg->m_serverwnd->serverlistctrl) {
 			theApp->amuledlg->m_serverwnd->serverlistctrl->DeleteAllItems();
 		}
@@ -498,6 +600,24 @@ namespace MuleNotify
 #endif
 	}
 
+	void SearchFreeze()
+	{
+#ifndef AMULE_DAEMON
+		if (theApp->amuledlg->m_searchwnd) {
+			theApp->amuledlg->m_searchwnd->Freeze();
+		}
+#endif
+	}
+
+	void SearchThaw()
+	{
+#ifndef AMULE_DAEMON
+		if (theApp->amuledlg->m_searchwnd) {
+			theApp->amuledlg->m_searchwnd->Thaw();
+		}
+#endif
+	}
+
 	void SearchLocalEnd()
 	{
 #ifndef AMULE_DAEMON
@@ -520,19 +640,28 @@ namespace MuleNotify
 	void Search_Update_Sources(CSearchFile* result)
 	{
 		result->SetDownloadStatus();
+#ifndef CLIENT_GUI
+		theApp->ECServerHandler->m_ec_notifier->Search_UpdateResult(result);
+#endif
 #ifndef AMULE_DAEMON
-		if (theApp->amuledlg && theApp->amuledlg->m_searchwnd) {
-			theApp->amuledlg->m_searchwnd->UpdateResult(result);
-		}
+		s_searchResults.Update(result);
 #endif
 	}
 
-	void Search_Add_Result(CSearchFile* NOT_ON_DAEMON(result))
+	void Search_Add_Result(CSearchFile* result)
 	{
+#ifndef CLIENT_GUI
+		theApp->ECServerHandler->m_ec_notifier->Search_AddResult(result);
+#endif
 #ifndef AMULE_DAEMON
-		if (theApp->amuledlg && theApp->amuledlg->m_searchwnd) {
-			theApp->amuledlg->m_searchwnd->AddResult(result);
-		}
+		s_searchResults.Add(result);
+#endif
+	}
+
+	void Search_Remove_Results(long NOT_ON_DAEMON(searchID))
+	{
+#ifndef AMULE_DAEMON
+		s_searchResults.RemoveIf(CSameSearchID(searchID));
 #endif
 	}
 
@@ -114,10 +114,13 @@ namespace MuleNotify
 	void ServerUpdateKadKInfo();
 
 	void SearchCancel();
+	void SearchFreeze();
+	void SearchThaw();
 	void SearchLocalEnd();
 	void KadSearchEnd(uint32 id);
 	void Search_Update_Sources(CSearchFile* result);
 	void Search_Add_Result(CSearchFile* result);
+	void Search_Remove_Results(long searchID);
 
 	void ChatUpdateFriend(CFriend* Friend);
 	void ChatRemoveFriend(CFriend* Friend);
@@ -197,6 +200,19 @@ namespace MuleNotify
 	void IPFilter_Reload();
 	void IPFilter_Update(wxString url);
 
+	/**
+	 * Hands the queued list additions and updates to the list controls.
+	 *
+	 * The shared files, download, server and search result notifications
+	 * are not shown one at a time, but collected and shown in ranges by
+	 * this function, which is called once per core timer tick. The number
+	 * of items shown per call is limited, so that a burst such as a large
+	 * server.met being loaded doesn't block the GUI.
+	 *
+	 * @return True if more items are left for the next call.
+	 */
+	bool FlushListNotifications();
+
 	////////////////////////////////////////////////////////////
 	// Notification utilities
 
@@ -502,10 +518,13 @@ typedef void (wxEvtHandler::*MuleNotifyEventFunction)(CMuleGUIEvent&);
 
 // search
 #define Notify_SearchCancel()				MuleNotify::DoNotify(&MuleNotify::SearchCancel)
+#define Notify_SearchFreeze()				MuleNotify::DoNotify(&MuleNotify::SearchFreeze)
+#define Notify_SearchThaw()				MuleNotify::DoNotify(&MuleNotify::SearchThaw)
 #define Notify_SearchLocalEnd()				MuleNotify::DoNotify(&MuleNotify::SearchLocalEnd)
 #define Notify_KadSearchEnd(val)			MuleNotify::DoNotify(&MuleNotify::KadSearchEnd, val)
 #define Notify_Search_Update_Sources(ptr)		MuleNotify::DoNotify(&MuleNotify::Search_Update_Sources, ptr)
 #define Notify_Search_Add_Result(s)			MuleNotify::DoNotify(&MuleNotify::Search_Add_Result, s)
+#define Notify_Search_Remove_Results(id)		MuleNotify::DoNotify(&MuleNotify::Search_Remove_Results, id)
 
 // chat
 #define Notify_ChatUpdateFriend(ptr)			MuleNotify::DoNotify(&MuleNotify::ChatUpdateFriend, ptr)
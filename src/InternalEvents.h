@@ -35,6 +35,8 @@ DECLARE_LOCAL_EVENT_TYPE(wxEVT_CORE_SOURCE_DNS_DONE, wxEVT_USER_FIRST+SOURCE_DNS
 DECLARE_LOCAL_EVENT_TYPE(wxEVT_CORE_UDP_DNS_DONE, wxEVT_USER_FIRST+UDP_DNS_DONE)
 DECLARE_LOCAL_EVENT_TYPE(wxEVT_CORE_SERVER_DNS_DONE, wxEVT_USER_FIRST+SERVER_DNS_DONE)
 
+DECLARE_LOCAL_EVENT_TYPE(wxEVT_CORE_SECIDENT_DONE, wxEVT_USER_FIRST+SECIDENT_DONE)
+
 
 class CMuleInternalEvent : public wxEvent
 {
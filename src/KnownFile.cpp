@@ -56,10 +56,12 @@
 #include "FileArea.h"		// Needed for CFileArea
 #include "FileAutoClose.h"	// Needed for CFileAutoClose
 #include "Server.h"			// Needed for CServer
+#include "GetTickCount.h"	// Needed for GetTickCount
 
 #include "CryptoPP_Inc.h"       // Needed for MD4
 
 #include <common/Format.h>
+#include <common/Macros.h>	// Needed for SEC2MS
 
 CFileStatistic::CFileStatistic(CKnownFile *parent)
 	: fileParent(parent),
@@ -331,6 +333,8 @@ void CKnownFile::Init()
 
 #ifndef CLIENT_GUI
 	m_pAICHHashSet = new CAICHHashSet(this);
+	m_srcInfoCacheValid = false;
+	m_srcInfoCacheTime = 0;
 #endif
 }
 
@@ -432,6 +436,9 @@ void CKnownFile::SetFileSize(uint64 nFileSize)
 void CKnownFile::AddUploadingClient(CUpDownClient* client)
 {
 	m_ClientUploadList.insert(CCLIENTREF(client, wxT("CKnownFile::AddUploadingClient m_ClientUploadList")));
+#ifndef CLIENT_GUI
+	InvalidateSrcInfoCache();
+#endif
 
 	SourceItemType type = UNAVAILABLE_SOURCE;
 	switch (client->GetUploadState()) {
@@ -453,6 +460,9 @@ void CKnownFile::AddUploadingClient(CUpDownClient* client)
 void CKnownFile::RemoveUploadingClient(CUpDownClient* client)
 {
 	if (m_ClientUploadList.erase(CCLIENTREF(client, wxEmptyString))) {
+#ifndef CLIENT_GUI
+		InvalidateSrcInfoCache();
+#endif
 		Notify_SharedCtrlRemoveClient(client->ECID(), this);
 		UpdateAutoUpPriority();
 	}
@@ -482,6 +492,13 @@ void CKnownFile::UpdateAutoUpPriority()
 
 #else // ! CLIENT_GUI
 
+// How long a source exchange snapshot is used, unless the sources change
+#define SRCINFO_CACHE_TIME	SEC2MS(30)
+
+uint64 CKnownFile::s_srcInfoCacheHits = 0;
+uint64 CKnownFile::s_srcInfoCacheMisses = 0;
+
+
 CKnownFile::~CKnownFile()
 {
 	SourceSet::iterator it = m_ClientUploadList.begin();
@@ -959,43 +976,31 @@ CPacket* CKnownFile::CreateSrcInfoPacket(const CUpDownClient* forClient, uint8 b
 
 	data.WriteHash(forClient->GetUploadFileID());
 	data.WriteUInt16(nCount);
-	uint32 cDbgNoSrc = 0;
-
-	SourceSet::iterator it = m_ClientUploadList.begin();
-	for ( ; it != m_ClientUploadList.end(); ++it ) {
-		const CUpDownClient *cur_src = it->GetClient();
 
-		if (	cur_src->HasLowID() ||
-			cur_src == forClient ||
-			!(	cur_src->GetUploadState() == US_UPLOADING ||
-				cur_src->GetUploadState() == US_ONUPLOADQUEUE)) {
+	const SrcInfoCache& sources = GetSrcInfoCache();
+	SrcInfoCache::const_iterator it = sources.begin();
+	for ( ; it != sources.end(); ++it ) {
+		if (it->client == forClient) {
 			continue;
 		}
 
 		bool bNeeded = false;
-
-		if ( SupportsUploadChunksState ) {
-			const BitVector& srcstatus = cur_src->GetUpPartStatus();
-			if ( !srcstatus.empty() ) {
-				//wxASSERT(srcstatus.size() == GetPartCount()); // Obviously!
-				if (srcstatus.size() != GetPartCount()) {
-					continue;
-				}
-				if ( cur_src->GetUpPartCount() == forClient->GetUpPartCount() ) {
-					for (int x = 0; x < GetPartCount(); x++ ) {
-						if ( srcstatus.get(x) && !rcvstatus.get(x) ) {
-							// We know the receiving client needs
-							// a chunk from this client.
-							bNeeded = true;
-							break;
-						}
+		const BitVector& srcstatus = it->partStatus;
+
+		if ( srcstatus.empty() ) {
+			// This client doesn't support upload chunk status.
+			// So just send it and hope for the best.
+			bNeeded = true;
+		} else if ( SupportsUploadChunksState ) {
+			if ( it->upPartCount == forClient->GetUpPartCount() ) {
+				for (int x = 0; x < GetPartCount(); x++ ) {
+					if ( srcstatus.get(x) && !rcvstatus.get(x) ) {
+						// We know the receiving client needs
+						// a chunk from this client.
+						bNeeded = true;
+						break;
 					}
 				}
-			} else {
-				cDbgNoSrc++;
-				// This client doesn't support upload chunk status.
-				// So just send it and hope for the best.
-				bNeeded = true;
 			}
 		} else {
 			// remote client does not support upload chunk status,
@@ -1004,55 +1009,18 @@ CPacket* CKnownFile::CreateSrcInfoPacket(const CUpDownClient* forClient, uint8 b
 			// chunks to return as much sources as possible which
 			// have the most available chunks. but this could be
 			// a noticeable performance problem.
-			const BitVector& srcstatus = cur_src->GetUpPartStatus();
-			if ( !srcstatus.empty() ) {
-				//wxASSERT(srcstatus.size() == GetPartCount());
-				if (srcstatus.size() != GetPartCount()) {
-					continue;
+			for (int x = 0; x < GetPartCount(); x++ ) {
+				if ( srcstatus.get(x) ) {
+					// this client has at least one chunk
+					bNeeded = true;
+					break;
 				}
-				for (int x = 0; x < GetPartCount(); x++ ) {
-					if ( srcstatus.get(x) ) {
-						// this client has at least one chunk
-						bNeeded = true;
-						break;
-					}
-				}
-			} else {
-				// This client doesn't support upload chunk status.
-				// So just send it and hope for the best.
-				bNeeded = true;
 			}
 		}
 
 		if ( bNeeded ) {
 			nCount++;
-			uint32 dwID;
-			if(byUsedVersion >= 3) {
-				dwID = cur_src->GetUserIDHybrid();
-			} else {
-				dwID = cur_src->GetIP();
-			}
-			data.WriteUInt32(dwID);
-			data.WriteUInt16(cur_src->GetUserPort());
-			data.WriteUInt32(cur_src->GetServerIP());
-			data.WriteUInt16(cur_src->GetServerPort());
-
-			if (byUsedVersion >= 2) {
-			    data.WriteHash(cur_src->GetUserHash());
-			}
-
-			if (byUsedVersion >= 4){
-				// CryptSettings - SourceExchange V4
-				// 5 Reserved (!)
-				// 1 CryptLayer Required
-				// 1 CryptLayer Requested
-				// 1 CryptLayer Supported
-				const uint8 uSupportsCryptLayer	= cur_src->SupportsCryptLayer() ? 1 : 0;
-				const uint8 uRequestsCryptLayer	= cur_src->RequestsCryptLayer() ? 1 : 0;
-				const uint8 uRequiresCryptLayer	= cur_src->RequiresCryptLayer() ? 1 : 0;
-				const uint8 byCryptOptions = (uRequiresCryptLayer << 2) | (uRequestsCryptLayer << 1) | (uSupportsCryptLayer << 0);
-				data.WriteUInt8(byCryptOptions);
-			}
+			WriteSrcInfoEntry(data, *it, (byUsedVersion >= 3) ? it->userIDHybrid : it->userIP, byUsedVersion);
 
 			if (nCount > 500) {
 				break;
@@ -1077,6 +1045,94 @@ CPacket* CKnownFile::CreateSrcInfoPacket(const CUpDownClient* forClient, uint8 b
 }
 
 
+const CKnownFile::SrcInfoCache& CKnownFile::GetSrcInfoCache()
+{
+	// Sources change state all the time, so even without changes to
+	// the list itself the snapshot is only used for a short while.
+	if (m_srcInfoCacheValid && ::GetTickCount() - m_srcInfoCacheTime < SRCINFO_CACHE_TIME) {
+		++s_srcInfoCacheHits;
+	} else {
+		++s_srcInfoCacheMisses;
+
+		m_srcInfoCache.clear();
+		BuildSrcInfoCache(m_srcInfoCache);
+		m_srcInfoCacheValid = true;
+		m_srcInfoCacheTime = ::GetTickCount();
+
+		AddDebugLogLineN(logKnownFiles, CFormat(wxT("Rebuilt source exchange cache of %s with %u sources, %u of %u requests answered from cache"))
+			% GetFileName() % m_srcInfoCache.size() % s_srcInfoCacheHits % (s_srcInfoCacheHits + s_srcInfoCacheMisses));
+	}
+
+	return m_srcInfoCache;
+}
+
+
+void CKnownFile::BuildSrcInfoCache(SrcInfoCache& cache) const
+{
+	SourceSet::const_iterator it = m_ClientUploadList.begin();
+	for ( ; it != m_ClientUploadList.end(); ++it ) {
+		const CUpDownClient *cur_src = it->GetClient();
+
+		if (	cur_src->HasLowID() ||
+			!(	cur_src->GetUploadState() == US_UPLOADING ||
+				cur_src->GetUploadState() == US_ONUPLOADQUEUE)) {
+			continue;
+		}
+
+		const BitVector& srcstatus = cur_src->GetUpPartStatus();
+		//wxASSERT(srcstatus.size() == GetPartCount()); // Obviously!
+		if ( !srcstatus.empty() && srcstatus.size() != GetPartCount() ) {
+			continue;
+		}
+
+		cache.push_back(CSrcInfoEntry());
+		CSrcInfoEntry& entry = cache.back();
+		FillSrcInfoEntry(entry, cur_src);
+		entry.partStatus = srcstatus;
+	}
+}
+
+
+void CKnownFile::FillSrcInfoEntry(CSrcInfoEntry& entry, const CUpDownClient* client)
+{
+	entry.client = client;
+	entry.userIDHybrid = client->GetUserIDHybrid();
+	entry.userIP = client->GetIP();
+	entry.userPort = client->GetUserPort();
+	entry.serverIP = client->GetServerIP();
+	entry.serverPort = client->GetServerPort();
+	entry.userHash = client->GetUserHash();
+	entry.upPartCount = client->GetUpPartCount();
+
+	// CryptSettings - SourceExchange V4
+	// 5 Reserved (!)
+	// 1 CryptLayer Required
+	// 1 CryptLayer Requested
+	// 1 CryptLayer Supported
+	const uint8 uSupportsCryptLayer	= client->SupportsCryptLayer() ? 1 : 0;
+	const uint8 uRequestsCryptLayer	= client->RequestsCryptLayer() ? 1 : 0;
+	const uint8 uRequiresCryptLayer	= client->RequiresCryptLayer() ? 1 : 0;
+	entry.cryptOptions = (uRequiresCryptLayer << 2) | (uRequestsCryptLayer << 1) | (uSupportsCryptLayer << 0);
+}
+
+
+void CKnownFile::WriteSrcInfoEntry(CMemFile& data, const CSrcInfoEntry& entry, uint32 userID, uint8 byUsedVersion)
+{
+	data.WriteUInt32(userID);
+	data.WriteUInt16(entry.userPort);
+	data.WriteUInt32(entry.serverIP);
+	data.WriteUInt16(entry.serverPort);
+
+	if (byUsedVersion >= 2) {
+	    data.WriteHash(entry.userHash);
+	}
+
+	if (byUsedVersion >= 4) {
+		data.WriteUInt8(entry.cryptOptions);
+	}
+}
+
+
 void CKnownFile::CreateOfferedFilePacket(
 	CMemFile *files,
 	CServer *pServer,
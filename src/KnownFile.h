@@ -45,8 +45,10 @@
 
 #include "Constants.h"		// Needed for PS_*, PR_*
 #include "ClientRef.h"		// Needed for CClientRef
+#include "BitVector.h"		// Needed for BitVector
 
 class CFileDataIO;
+class CMemFile;
 class CPacket;
 class CTag;
 
@@ -322,8 +324,83 @@ protected:
 	CAICHHashSet* GetAICHHashset() const		{ return m_pAICHHashSet; }
 	void SetAICHHashset(CAICHHashSet* val)		{ m_pAICHHashSet = val; }
 
+	//! Returns the number of source exchange requests answered from the cache.
+	static uint64	GetSrcInfoCacheHits()		{ return s_srcInfoCacheHits; }
+	//! Returns the number of source exchange requests which rebuilt the cache.
+	static uint64	GetSrcInfoCacheMisses()		{ return s_srcInfoCacheMisses; }
+
 protected:
 	CAICHHashSet*	m_pAICHHashSet;
+
+	/**
+	 * A source as sent in source exchange answers.
+	 *
+	 * CreateSrcInfoPacket works on a snapshot of these rather than on the
+	 * clients, so that only the filtering for the requesting client has to
+	 * be done for every request. All fields used by any source exchange
+	 * version are kept, so one snapshot serves all versions.
+	 */
+	struct CSrcInfoEntry {
+		//! The source, only used for comparisons.
+		const CUpDownClient*	client;
+		uint32		userIDHybrid;
+		uint32		userIP;
+		uint16		userPort;
+		uint32		serverIP;
+		uint16		serverPort;
+		CMD4Hash	userHash;
+		//! SX v4 crypt settings.
+		uint8		cryptOptions;
+		uint16		upPartCount;
+		//! The part status of the source, empty if unknown.
+		BitVector	partStatus;
+	};
+	typedef std::vector<CSrcInfoEntry> SrcInfoCache;
+
+	/**
+	 * Returns the sources to consider for a source exchange answer.
+	 *
+	 * The snapshot is rebuilt if the sources changed or it has expired.
+	 */
+	const SrcInfoCache& GetSrcInfoCache();
+
+	/**
+	 * Creates the snapshot used by GetSrcInfoCache from the uploading clients.
+	 */
+	virtual void	BuildSrcInfoCache(SrcInfoCache& cache) const;
+
+	/**
+	 * Forces a rebuild of the source exchange snapshot on the next request.
+	 */
+	void	InvalidateSrcInfoCache()	{ m_srcInfoCacheValid = false; }
+
+	/**
+	 * Writes a source for a source exchange answer.
+	 *
+	 * @param data The packet data.
+	 * @param entry The source to write.
+	 * @param userID The ID to send, as expected by the requesting client.
+	 * @param byUsedVersion The source exchange version of the answer.
+	 */
+	static void	WriteSrcInfoEntry(CMemFile& data, const CSrcInfoEntry& entry, uint32 userID, uint8 byUsedVersion);
+
+	/**
+	 * Fills the fields of an entry which are taken directly from the client.
+	 */
+	static void	FillSrcInfoEntry(CSrcInfoEntry& entry, const CUpDownClient* client);
+
+private:
+	//! The snapshot returned by GetSrcInfoCache.
+	SrcInfoCache	m_srcInfoCache;
+	//! False if the sources changed since the snapshot was made.
+	bool		m_srcInfoCacheValid;
+	//! When the snapshot was made.
+	uint32		m_srcInfoCacheTime;
+
+	static uint64	s_srcInfoCacheHits;
+	static uint64	s_srcInfoCacheMisses;
+
+protected:
 #endif
 
 	bool	LoadTagsFromFile(const CFileDataIO* file);
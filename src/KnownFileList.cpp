@@ -37,6 +37,15 @@
 #include "SearchList.h"		// Needed for UpdateSearchFileByHash
 #include <common/Format.h>
 #include "Preferences.h"	// Needed for thePrefs
+#include "GetTickCount.h"	// Needed for GetTickCountFullRes
+#include "ThreadScheduler.h"	// Needed for CThreadScheduler
+#include "ThreadTasks.h"	// Needed for CKnownFilesCompactTask
+#include "Tag.h"		// Needed for CTag
+#include <tags/FileTags.h>	// Needed for FT_FILENAME and FT_FILESIZE
+#include <protocol/ed2k/Constants.h>	// Needed for OLD_MAX_FILE_SIZE
+
+#include <algorithm>		// Needed for std::max
+#include <list>
 
 
 // This function is inlined for performance
@@ -53,6 +62,107 @@ inline bool CKnownFileList::KnownFileMatches(
 }
 
 
+//! Version of the known.met journal.
+#define KNOWN_JOURNAL_VERSION		0x02
+//! Size of the journal header: version, size and date of known.met, and
+//! the number of duplicates at its start.
+#define KNOWN_JOURNAL_HEADER_SIZE	17
+//! Role of a journal record.
+#define KNOWN_JOURNAL_RECORD		0x00
+#define KNOWN_JOURNAL_DUPLICATE		0x01
+//! The journal is compacted once it reaches this size, or half the size of known.met.
+#define KNOWN_JOURNAL_COMPACT_SIZE	(4 * 1024 * 1024)
+//! Records are written in chunks of about this size.
+#define KNOWN_WRITE_CHUNK		(1024 * 1024)
+
+
+//! Guards the journal file and the two variables below.
+static wxMutex	s_journalLock;
+//! Incremented whenever known.met is replaced, invalidating pending compactions.
+static uint32	s_journalGeneration = 0;
+//! Set while a compaction is queued or running.
+static bool	s_compactionPending = false;
+
+
+/** Returns the path of the journal belonging to the given known.met. */
+static CPath GetJournalPath(const CPath& metPath)
+{
+	return CPath(metPath.GetRaw() + wxT(".journal"));
+}
+
+
+/** FNV-1a, used to tell if a record changed since it was last written. */
+static uint64 GetRecordDigest(const uint8* data, size_t length)
+{
+	uint64 digest = ULONGLONG(0xcbf29ce484222325);
+	for (size_t i = 0; i < length; ++i) {
+		digest = (digest ^ data[i]) * ULONGLONG(0x100000001b3);
+	}
+
+	return digest;
+}
+
+
+/** A record moving to or from the duplicates has to be written again. */
+static inline uint64 GetRoleDigest(uint64 digest, bool duplicate)
+{
+	return duplicate ? ~digest : digest;
+}
+
+
+/** Size and date of known.met, which tie the journal to it. */
+static bool GetMetStamp(const CPath& metPath, uint64& size, uint32& date)
+{
+	const sint64 length = metPath.GetFileSize();
+	const time_t mtime = CPath::GetModificationTime(metPath);
+	if (length == wxInvalidOffset || mtime == (time_t)-1) {
+		return false;
+	}
+
+	size = length;
+	date = mtime;
+	return true;
+}
+
+
+/**
+ * Replaces the journal by an empty one for the current known.met, followed
+ * by the given records. The caller must hold s_journalLock.
+ */
+static bool StartJournal(const CPath& journalPath, const CPath& metPath, uint32 duplicates, const std::vector<uint8>& records)
+{
+	uint64 size;
+	uint32 date;
+	if (GetMetStamp(metPath, size, date)) {
+		try {
+			CFile file(journalPath, CFile::write_safe);
+			if (file.IsOpened()) {
+				file.WriteUInt8(KNOWN_JOURNAL_VERSION);
+				file.WriteUInt64(size);
+				file.WriteUInt32(date);
+				file.WriteUInt32(duplicates);
+				if (!records.empty()) {
+					file.Write(&records[0], records.size());
+				}
+
+				if (file.Close()) {
+					return true;
+				}
+			}
+		} catch (const CIOFailureException& e) {
+			AddDebugLogLineC(logKnownFiles, CFormat(wxT("Error while writing %s: %s")) % journalPath % e.what());
+		}
+	}
+
+	// A stale journal must not be applied to the new known.met
+	if (journalPath.FileExists()) {
+		CPath::RemoveFile(journalPath);
+	}
+
+	return false;
+}
+
+
 CKnownFileList::CKnownFileList()
 {
 	accepted = 0;
@@ -61,7 +171,7 @@ CKnownFileList::CKnownFileList()
 	m_filename = wxT("known.met");
 	m_knownSizeMap = NULL;
 	m_duplicateSizeMap = NULL;
-	Init();
+	m_journalValid = false;
 }
 
 
@@ -87,28 +197,57 @@ bool CKnownFileList::Init()
 		return false;
 	}
 
+	const uint32 startTime = GetTickCountFullRes();
+
 	try {
-		uint8 version = file.ReadUInt8();
+		// Reading the records from disk field by field takes a system
+		// call for every field, so the whole file is read at once.
+		std::vector<uint8> buffer(file.GetLength());
+		if (buffer.empty()) {
+			AddLogLineC(_("WARNING: Known file list corrupted, contains invalid header."));
+			return false;
+		}
+
+		file.Read(&buffer[0], buffer.size());
+		file.Close();
+
+		const CMemFile data(&buffer[0], buffer.size());
+		uint8 version = data.ReadUInt8();
 		if ((version != MET_HEADER) && (version != MET_HEADER_WITH_LARGEFILES)) {
 			AddLogLineC(_("WARNING: Known file list corrupted, contains invalid header."));
 			return false;
 		}
 
 		wxMutexLocker sLock(list_mut);
-		uint32 RecordsNumber = file.ReadUInt32();
+		uint32 RecordsNumber = data.ReadUInt32();
 		AddDebugLogLineN(logKnownFiles, CFormat(wxT("Reading %i known files from file format 0x%2.2x."))
 			% RecordsNumber % version);
 		for (uint32 i = 0; i < RecordsNumber; i++) {
+			const uint64 recordStart = data.GetPosition();
 			CScopedPtr<CKnownFile> record;
-			if (record->LoadFromFile(&file)) {
+			if (record->LoadFromFile(&data)) {
 				AddDebugLogLineN(logKnownFiles,
 					CFormat(wxT("Known file read: %s")) % record->GetFileName());
-				Append(record.release());
+				CKnownFile* known = record.release();
+				if (Append(known)) {
+					m_savedDigests[known] = GetRecordDigest(&buffer[recordStart], data.GetPosition() - recordStart);
+				} else {
+					delete known;
+				}
 			} else {
 				AddLogLineC(_("Failed to load entry in known file list, file may be corrupt"));
 			}
 		}
-		AddDebugLogLineN(logKnownFiles, wxT("Finished reading known files"));
+
+		// Which records ended up as duplicates is only known now
+		for (KnownFileList::const_iterator it = m_duplicateFileList.begin(); it != m_duplicateFileList.end(); ++it) {
+			m_savedDigests[*it] = GetRoleDigest(m_savedDigests[*it], true);
+		}
+
+		m_journalValid = LoadJournal(fullpath, GetJournalPath(fullpath));
+
+		AddDebugLogLineN(logKnownFiles, CFormat(wxT("Finished reading %u known files in %u ms"))
+			% (m_knownFileMap.size() + m_duplicateFileList.size()) % (GetTickCountFullRes() - startTime));
 
 		return true;
 	} catch (const CInvalidPacket& e) {
@@ -121,50 +260,557 @@ bool CKnownFileList::Init()
 }
 
 
-void CKnownFileList::Save()
+bool CKnownFileList::LoadJournal(const CPath& metPath, const CPath& journalPath)
 {
-	CFile file(thePrefs::GetConfigDir() + m_filename, CFile::write_safe);
-	if (!file.IsOpened()) {
+	if (!journalPath.FileExists()) {
+		return false;
+	}
+
+	std::vector<uint8> buffer;
+	try {
+		CFile file(journalPath, CFile::read);
+		if (!file.IsOpened() || file.GetLength() < KNOWN_JOURNAL_HEADER_SIZE) {
+			return false;
+		}
+
+		buffer.resize(file.GetLength());
+		file.Read(&buffer[0], buffer.size());
+	} catch (const CSafeIOException& e) {
+		AddDebugLogLineC(logKnownFiles, CFormat(wxT("IO error while reading %s: %s")) % journalPath % e.what());
+		return false;
+	}
+
+	const CMemFile data(&buffer[0], buffer.size());
+	uint64 size;
+	uint32 date;
+	if (data.ReadUInt8() != KNOWN_JOURNAL_VERSION || !GetMetStamp(metPath, size, date)
+		|| data.ReadUInt64() != size || data.ReadUInt32() != date) {
+		// Left over from a known.met which has since been replaced
+		AddDebugLogLineN(logKnownFiles, CFormat(wxT("%s does not belong to %s, ignoring it")) % journalPath % metPath);
+		return false;
+	}
+	// Only needed for compacting
+	data.ReadUInt32();
+
+	uint32 count = 0;
+	uint64 validLength = data.GetPosition();
+	while (data.GetAvailable() >= 5) {
+		const uint32 length = data.ReadUInt32();
+		const uint8 role = data.ReadUInt8();
+		const uint64 recordStart = data.GetPosition();
+		if (length > data.GetAvailable()) {
+			// The last record was not written completely
+			break;
+		}
+
+		data.Seek(length, wxFromCurrent);
+		validLength = data.GetPosition();
+
+		bool loaded = false;
+		try {
+			const CMemFile recordData(&buffer[recordStart], length);
+			CScopedPtr<CKnownFile> record;
+			if (record->LoadFromFile(&recordData)) {
+				const bool duplicate = (role == KNOWN_JOURNAL_DUPLICATE);
+				const uint64 digest = GetRoleDigest(GetRecordDigest(&buffer[recordStart], length), duplicate);
+				ApplyJournalRecord(record.release(), duplicate, digest);
+				loaded = true;
+				++count;
+			}
+		} catch (const CInvalidPacket&) {
+		} catch (const CSafeIOException&) {
+		}
+
+		if (!loaded) {
+			AddLogLineC(_("Failed to load entry in known file list, file may be corrupt"));
+		}
+	}
+
+	if (validLength < buffer.size()) {
+		// Drop the incomplete record, or the next ones would be appended after it
+		CFile file(journalPath, CFile::read_write);
+		if (!file.IsOpened() || !file.SetLength(validLength)) {
+			return false;
+		}
+	}
+
+	AddDebugLogLineN(logKnownFiles, CFormat(wxT("Applied %u records from %s")) % count % journalPath);
+
+	return true;
+}
+
+
+void CKnownFileList::ApplyJournalRecord(CKnownFile* record, bool duplicate, uint64 digest)
+{
+	CKnownFileMap::iterator it = m_knownFileMap.find(record->GetFileHash());
+
+	if (duplicate) {
+		KnownFileList::iterator itDup = m_duplicateFileList.begin();
+		for (; itDup != m_duplicateFileList.end(); ++itDup) {
+			if (KnownFileMatches(*itDup, record->GetFileName(), record->GetLastChangeDatetime(), record->GetFileSize())) {
+				break;
+			}
+		}
+
+		if (itDup != m_duplicateFileList.end()) {
+			m_savedDigests.erase(*itDup);
+			delete *itDup;
+			*itDup = record;
+		} else {
+			if (it != m_knownFileMap.end() && KnownFileMatches(it->second, record->GetFileName(), record->GetLastChangeDatetime(), record->GetFileSize())) {
+				// The known file became a duplicate, the record replacing
+				// it follows in the journal.
+				m_savedDigests.erase(it->second);
+				delete it->second;
+				m_knownFileMap.erase(it);
+			}
+
+			m_duplicateFileList.push_back(record);
+		}
+	} else if (it != m_knownFileMap.end()) {
+		// Same file, possibly renamed or touched since
+		m_savedDigests.erase(it->second);
+		delete it->second;
+		it->second = record;
+	} else if (!Append(record)) {
+		delete record;
 		return;
 	}
 
+	m_savedDigests[record] = digest;
+}
+
+
+void CKnownFileList::GetRecords(RecordList& records) const
+{
+	records.reserve(m_knownFileMap.size() + m_duplicateFileList.size());
+
+	// Duplicates handling. Duplicates needs to be saved first,
+	// since it is the last entry that gets used.
+	KnownFileList::const_iterator itDup = m_duplicateFileList.begin();
+	for ( ; itDup != m_duplicateFileList.end(); ++itDup ) {
+		records.push_back(std::make_pair(*itDup, true));
+	}
+
+	CKnownFileMap::const_iterator it = m_knownFileMap.begin();
+	for (; it != m_knownFileMap.end(); ++it) {
+		records.push_back(std::make_pair(it->second, false));
+	}
+}
+
+
+void CKnownFileList::Save()
+{
+	const CPath metPath(thePrefs::GetConfigDir() + m_filename);
+	const CPath journalPath = GetJournalPath(metPath);
+
 	wxMutexLocker sLock(list_mut);
+
+	if (m_journalValid) {
+		m_journalValid = SaveJournal(metPath, journalPath);
+	}
+
+	if (!m_journalValid) {
+		m_journalValid = SaveFull(metPath, journalPath);
+	}
+}
+
+
+bool CKnownFileList::SaveFull(const CPath& metPath, const CPath& journalPath)
+{
+	const uint32 startTime = GetTickCountFullRes();
+
+	CFile file(metPath, CFile::write_safe);
+	if (!file.IsOpened()) {
+		return false;
+	}
+
 	AddDebugLogLineN(logKnownFiles, CFormat(wxT("start saving %s")) % m_filename);
 
+	RecordList records;
+	GetRecords(records);
+	DigestMap digests;
+
+	wxMutexLocker jLock(s_journalLock);
+
 	try {
 		// Kry - This is the version, but we don't know it till
 		// we know if any largefile is saved. This allows the list
 		// to be compatible with previous versions.
 		bool bContainsAnyLargeFiles = false;
-		file.WriteUInt8(0);
-
-		file.WriteUInt32(m_knownFileMap.size() + m_duplicateFileList.size());
+		CMemFile buffer(KNOWN_WRITE_CHUNK);
+		buffer.WriteUInt8(0);
+		buffer.WriteUInt32(records.size());
 
-		// Duplicates handling. Duplicates needs to be saved first,
-		// since it is the last entry that gets used.
-		KnownFileList::iterator itDup = m_duplicateFileList.begin();
-		for ( ; itDup != m_duplicateFileList.end(); ++itDup ) {
-			(*itDup)->WriteToFile(&file);
-			if ((*itDup)->IsLargeFile()) {
+		for (RecordList::const_iterator it = records.begin(); it != records.end(); ++it) {
+			const uint64 recordStart = buffer.GetPosition();
+			it->first->WriteToFile(&buffer);
+			digests[it->first] = GetRoleDigest(GetRecordDigest(buffer.GetRawBuffer() + recordStart, buffer.GetLength() - recordStart), it->second);
+			if (it->first->IsLargeFile()) {
 				bContainsAnyLargeFiles = true;
 			}
-		}
 
-		CKnownFileMap::iterator it = m_knownFileMap.begin();
-		for (; it != m_knownFileMap.end(); ++it) {
-			it->second->WriteToFile(&file);
-			if (it->second->IsLargeFile()) {
-				bContainsAnyLargeFiles = true;
+			// Written in chunks rather than field by field
+			if (buffer.GetLength() >= KNOWN_WRITE_CHUNK) {
+				file.Write(buffer.GetRawBuffer(), buffer.GetLength());
+				buffer.SetLength(0);
 			}
 		}
 
+		if (buffer.GetLength()) {
+			file.Write(buffer.GetRawBuffer(), buffer.GetLength());
+		}
+
 		file.Seek(0);
 		file.WriteUInt8(bContainsAnyLargeFiles ? MET_HEADER_WITH_LARGEFILES : MET_HEADER);
-		file.Close();
+		if (!file.Close()) {
+			return false;
+		}
 	} catch (const CIOFailureException& e) {
 		AddLogLineC(CFormat(_("Error while saving %s file: %s")) % m_filename % e.what());
+		return false;
 	}
-	AddDebugLogLineN(logKnownFiles, CFormat(wxT("finished saving %s")) % m_filename);
+
+	// Pending compactions were taken from the old known.met
+	++s_journalGeneration;
+	m_savedDigests.swap(digests);
+
+	AddDebugLogLineN(logKnownFiles, CFormat(wxT("finished saving %u known files to %s in %u ms"))
+		% records.size() % m_filename % (GetTickCountFullRes() - startTime));
+
+	return StartJournal(journalPath, metPath, m_duplicateFileList.size(), std::vector<uint8>());
+}
+
+
+bool CKnownFileList::SaveJournal(const CPath& metPath, const CPath& journalPath)
+{
+	const uint32 startTime = GetTickCountFullRes();
+
+	RecordList records;
+	GetRecords(records);
+
+	bool compact = false;
+	uint64 journalLength = 0;
+	uint32 generation = 0;
+	uint32 changed = 0;
+
+	{
+		wxMutexLocker jLock(s_journalLock);
+
+		const sint64 metSize = metPath.GetFileSize();
+		const sint64 journalSize = journalPath.GetFileSize();
+		if (metSize == wxInvalidOffset || journalSize == wxInvalidOffset) {
+			return false;
+		}
+
+		// The compaction reads known.met and the journal itself, so
+		// nothing but their state is handed over to the thread scheduler.
+		compact = wxThread::IsMain() && !s_compactionPending
+			&& (uint64)journalSize >= std::max<uint64>(KNOWN_JOURNAL_COMPACT_SIZE, metSize / 2);
+
+		CMemFile changes(KNOWN_WRITE_CHUNK);
+		CMemFile record;
+		std::vector<std::pair<const CKnownFile*, uint64> > digests;
+
+		for (RecordList::const_iterator it = records.begin(); it != records.end(); ++it) {
+			record.SetLength(0);
+			it->first->WriteToFile(&record);
+
+			const uint8* data = record.GetRawBuffer();
+			const size_t length = record.GetLength();
+			const uint64 digest = GetRoleDigest(GetRecordDigest(data, length), it->second);
+
+			DigestMap::const_iterator itDigest = m_savedDigests.find(it->first);
+			if (itDigest == m_savedDigests.end() || itDigest->second != digest) {
+				changes.WriteUInt32(length);
+				changes.WriteUInt8(it->second ? KNOWN_JOURNAL_DUPLICATE : KNOWN_JOURNAL_RECORD);
+				changes.Write(data, length);
+				digests.push_back(std::make_pair(it->first, digest));
+			}
+		}
+
+		if (changes.GetLength()) {
+			try {
+				CFile file(journalPath, CFile::write_append);
+				if (!file.IsOpened()) {
+					return false;
+				}
+
+				// All changed records at once
+				file.Write(changes.GetRawBuffer(), changes.GetLength());
+				if (!file.Close()) {
+					return false;
+				}
+			} catch (const CIOFailureException& e) {
+				AddLogLineC(CFormat(_("Error while saving %s file: %s")) % journalPath.GetFullName() % e.what());
+				return false;
+			}
+
+			for (size_t i = 0; i < digests.size(); ++i) {
+				m_savedDigests[digests[i].first] = digests[i].second;
+			}
+		}
+
+		changed = digests.size();
+
+		if (compact) {
+			journalLength = journalSize + changes.GetLength();
+			generation = s_journalGeneration;
+			s_compactionPending = true;
+		}
+	}
+
+	AddDebugLogLineN(logKnownFiles, CFormat(wxT("Saved %u of %u known files to %s in %u ms"))
+		% changed % records.size() % journalPath.GetFullName() % (GetTickCountFullRes() - startTime));
+
+	if (compact) {
+		AddDebugLogLineN(logKnownFiles, CFormat(wxT("Compacting %s")) % m_filename);
+		if (!CThreadScheduler::AddTask(new CKnownFilesCompactTask(metPath, journalLength, generation))) {
+			wxMutexLocker jLock(s_journalLock);
+			s_compactionPending = false;
+		}
+	}
+
+	return true;
+}
+
+
+/** A record of known.met or of its journal, with the fields identifying it. */
+struct CKnownRecord
+{
+	//! The record as written by CKnownFile::WriteToFile.
+	const uint8*	data;
+	uint32		length;
+	CMD4Hash	hash;
+	CPath		name;
+	uint32		date;
+	uint64		size;
+};
+
+
+/** Reads a record, taking the fields the same way as CKnownFile::LoadFromFile. */
+static void ParseKnownRecord(const CMemFile& data, const uint8* buffer, CKnownRecord& record)
+{
+	const uint64 start = data.GetPosition();
+
+	record.date = data.ReadUInt32();
+	record.hash = data.ReadHash();
+	// Part hashes are copied along with the rest
+	data.Seek(data.ReadUInt16() * 16, wxFromCurrent);
+
+	record.name = CPath();
+	record.size = 0;
+	const uint32 tagcount = data.ReadUInt32();
+	for (uint32 i = 0; i < tagcount; ++i) {
+		const CTag tag(data, true);
+		if (tag.GetNameID() == FT_FILENAME) {
+			if (record.name.IsOk()) {
+				// The second one is the 'universal' filename
+				const CPath path = CPath::FromUniv(tag.GetStr());
+				if (path.IsOk()) {
+					record.name = path;
+				}
+			} else {
+				record.name = CPath(tag.GetStr());
+			}
+		} else if (tag.GetNameID() == FT_FILESIZE) {
+			record.size = tag.GetInt();
+		}
+	}
+
+	record.data = buffer + start;
+	record.length = data.GetPosition() - start;
+}
+
+
+/** Same test as CKnownFileList::KnownFileMatches. */
+static bool KnownRecordMatches(const CKnownRecord& a, const CKnownRecord& b)
+{
+	return a.date == b.date && a.size == b.size && a.name == b.name;
+}
+
+
+/** Reads the start of a file, or all of it if length is zero. */
+static bool ReadFileStart(const CPath& path, std::vector<uint8>& buffer, uint64 length)
+{
+	CFile file(path, CFile::read);
+	if (!file.IsOpened() || file.GetLength() < length) {
+		return false;
+	}
+
+	buffer.resize(length ? length : file.GetLength());
+	if (!buffer.empty()) {
+		file.Read(&buffer[0], buffer.size());
+	}
+
+	return true;
+}
+
+
+/**
+ * Builds a known.met from the old one and its journal, with the records
+ * the list would have after loading both.
+ *
+ * @param met The old known.met, its duplicates are listed first.
+ * @param journal The journal, cut at the end of a record.
+ * @param image Receives the new known.met.
+ * @return The number of duplicates at the start of the new known.met.
+ */
+static uint32 MergeJournal(const std::vector<uint8>& met, const std::vector<uint8>& journal, CMemFile& image)
+{
+	if (met.size() < 5 || journal.size() < KNOWN_JOURNAL_HEADER_SIZE) {
+		throw CInvalidPacket(wxT("Truncated known.met or journal"));
+	}
+
+	const CMemFile journalData(&journal[0], journal.size());
+	journalData.Seek(KNOWN_JOURNAL_HEADER_SIZE - 4);
+	const uint32 metDuplicates = journalData.ReadUInt32();
+
+	std::list<CKnownRecord> duplicates;
+	std::map<CMD4Hash, CKnownRecord> records;
+
+	const CMemFile metData(&met[0], met.size());
+	metData.ReadUInt8();
+	const uint32 count = metData.ReadUInt32();
+	for (uint32 i = 0; i < count; ++i) {
+		CKnownRecord record;
+		ParseKnownRecord(metData, &met[0], record);
+		if (i < metDuplicates) {
+			duplicates.push_back(record);
+		} else {
+			records[record.hash] = record;
+		}
+	}
+
+	// Applied like CKnownFileList::ApplyJournalRecord does
+	while (journalData.GetAvailable() >= 5) {
+		const uint32 length = journalData.ReadUInt32();
+		const uint8 role = journalData.ReadUInt8();
+		const uint64 recordStart = journalData.GetPosition();
+		if (length > journalData.GetAvailable()) {
+			throw CInvalidPacket(wxT("Truncated journal record"));
+		}
+		journalData.Seek(length, wxFromCurrent);
+
+		const CMemFile recordData(&journal[recordStart], length);
+		CKnownRecord record;
+		ParseKnownRecord(recordData, &journal[recordStart], record);
+
+		if (role == KNOWN_JOURNAL_DUPLICATE) {
+			std::list<CKnownRecord>::iterator itDup = duplicates.begin();
+			while (itDup != duplicates.end() && !KnownRecordMatches(*itDup, record)) {
+				++itDup;
+			}
+
+			if (itDup != duplicates.end()) {
+				*itDup = record;
+			} else {
+				std::map<CMD4Hash, CKnownRecord>::iterator it = records.find(record.hash);
+				if (it != records.end() && KnownRecordMatches(it->second, record)) {
+					records.erase(it);
+				}
+				duplicates.push_back(record);
+			}
+		} else {
+			records[record.hash] = record;
+		}
+	}
+
+	// Same layout as CKnownFileList::SaveFull writes
+	bool bContainsAnyLargeFiles = false;
+	image.WriteUInt8(0);
+	image.WriteUInt32(duplicates.size() + records.size());
+	for (std::list<CKnownRecord>::const_iterator it = duplicates.begin(); it != duplicates.end(); ++it) {
+		image.Write(it->data, it->length);
+		bContainsAnyLargeFiles |= it->size > OLD_MAX_FILE_SIZE;
+	}
+	for (std::map<CMD4Hash, CKnownRecord>::const_iterator it = records.begin(); it != records.end(); ++it) {
+		image.Write(it->second.data, it->second.length);
+		bContainsAnyLargeFiles |= it->second.size > OLD_MAX_FILE_SIZE;
+	}
+	image.Seek(0);
+	image.WriteUInt8(bContainsAnyLargeFiles ? MET_HEADER_WITH_LARGEFILES : MET_HEADER);
+
+	return duplicates.size();
+}
+
+
+void CKnownFileList::CompactJournal(
+	const CPath& metPath,
+	uint64 journalOffset,
+	uint32 generation)
+{
+	const uint32 startTime = GetTickCountFullRes();
+	const CPath journalPath = GetJournalPath(metPath);
+	const CPath tempPath(metPath.GetRaw() + wxT(".compact"));
+
+	// Both files are only replaced under s_journalLock, and the generation
+	// below tells if that happened while they were read without it.
+	bool written = false;
+	uint32 duplicates = 0;
+	try {
+		std::vector<uint8> met;
+		std::vector<uint8> journal;
+		if (ReadFileStart(metPath, met, 0) && ReadFileStart(journalPath, journal, journalOffset)) {
+			CMemFile image(met.size() + journal.size());
+			duplicates = MergeJournal(met, journal, image);
+
+			CFile file(tempPath, CFile::write);
+			if (file.IsOpened()) {
+				file.Write(image.GetRawBuffer(), image.GetLength());
+				written = file.Close();
+			}
+		}
+	} catch (const CSafeIOException& e) {
+		AddDebugLogLineC(logKnownFiles, CFormat(wxT("IO error while compacting %s: %s")) % metPath % e.what());
+	} catch (const CInvalidPacket& e) {
+		AddDebugLogLineC(logKnownFiles, CFormat(wxT("Invalid record while compacting %s: %s")) % metPath % e.what());
+	}
+
+	wxMutexLocker jLock(s_journalLock);
+	s_compactionPending = false;
+
+	if (!written || generation != s_journalGeneration) {
+		// Failed, or known.met was rewritten in the meantime
+		if (tempPath.FileExists()) {
+			CPath::RemoveFile(tempPath);
+		}
+
+		return;
+	}
+
+	// Records appended while the image was written are kept
+	std::vector<uint8> tail;
+	try {
+		CFile journal(journalPath, CFile::read);
+		if (!journal.IsOpened()) {
+			CPath::RemoveFile(tempPath);
+			return;
+		}
+
+		if (journal.GetLength() > journalOffset) {
+			tail.resize(journal.GetLength() - journalOffset);
+			journal.Seek(journalOffset);
+			journal.Read(&tail[0], tail.size());
+		}
+	} catch (const CSafeIOException& e) {
+		AddDebugLogLineC(logKnownFiles, CFormat(wxT("IO error while reading %s: %s")) % journalPath % e.what());
+		CPath::RemoveFile(tempPath);
+		return;
+	}
+
+	if (!CPath::RenameFile(tempPath, metPath, true)) {
+		CPath::RemoveFile(tempPath);
+		return;
+	}
+
+	++s_journalGeneration;
+
+	// Should this fail, the journal is gone and the next save rewrites known.met
+	StartJournal(journalPath, metPath, duplicates, tail);
+
+	AddDebugLogLineN(logKnownFiles, CFormat(wxT("Compacted %s in %u ms, %u bytes of journal left"))
+		% metPath.GetFullName() % (GetTickCountFullRes() - startTime) % tail.size());
 }
 
 
@@ -174,6 +820,7 @@ void CKnownFileList::Clear()
 
 	DeleteContents(m_knownFileMap);
 	DeleteContents(m_duplicateFileList);
+	m_savedDigests.clear();
 	ReleaseIndex();
 }
 
@@ -185,6 +832,30 @@ CKnownFile* CKnownFileList::FindKnownFile(
 {
 	wxMutexLocker sLock(list_mut);
 
+	return FindKnownFileNoLock(filename, in_date, in_size);
+}
+
+
+void CKnownFileList::FindKnownFiles(
+	const std::vector<CSharedDirScanner::CScannedFile>& files,
+	std::vector<CKnownFile*>& found)
+{
+	found.resize(files.size());
+
+	// One lock for the whole directory rather than one per file
+	wxMutexLocker sLock(list_mut);
+
+	for (size_t i = 0; i < files.size(); ++i) {
+		found[i] = FindKnownFileNoLock(files[i].name, files[i].mtime, files[i].size);
+	}
+}
+
+
+CKnownFile* CKnownFileList::FindKnownFileNoLock(
+	const CPath& filename,
+	time_t in_date,
+	uint64 in_size) const
+{
 	if (m_knownSizeMap) {
 		std::pair<KnownFileSizeMap::const_iterator, KnownFileSizeMap::const_iterator> p;
 		p = m_knownSizeMap->equal_range((uint32) in_size);
@@ -278,6 +949,7 @@ bool CKnownFileList::Append(CKnownFile *Record, bool afterHashing)
 		CKnownFileMap::iterator it = m_knownFileMap.find(tkey);
 		if (it == m_knownFileMap.end()) {
 			m_knownFileMap[tkey] = Record;
+			IndexFile(m_knownSizeMap, Record);
 			return true;
 		} else {
 			CKnownFile *existing = it->second;
@@ -313,11 +985,13 @@ bool CKnownFileList::Append(CKnownFile *Record, bool afterHashing)
 				// The file is a duplicated hash. Add THE OLD ONE to the duplicates list.
 				// (This is used when reading the known file list where the duplicates are stored in front.)
 				m_duplicateFileList.push_back(existing);
+				IndexFile(m_duplicateSizeMap, existing);
 				if (theApp->sharedfiles) {
 					// Removing the old kad keywords created with the old filename
 					theApp->sharedfiles->RemoveKeywords(existing);
 				}
 				m_knownFileMap[tkey] = Record;
+				IndexFile(m_knownSizeMap, Record);
 				return true;
 			}
 		}
@@ -346,6 +1020,15 @@ void CKnownFileList::PrepareIndex()
 }
 
 
+void CKnownFileList::IndexFile(KnownFileSizeMap* index, CKnownFile* file)
+{
+	// A shared files reload may be using the index across several core timer ticks
+	if (index) {
+		index->insert(std::pair<uint32, CKnownFile*>((uint32) file->GetFileSize(), file));
+	}
+}
+
+
 void CKnownFileList::ReleaseIndex()
 {
 	delete m_knownSizeMap;
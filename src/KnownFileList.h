@@ -28,6 +28,10 @@
 
 
 #include "SharedFileList.h" // CKnownFileMap
+#include "SharedDirScanner.h" // Needed for CSharedDirScanner
+
+#include <map>
+#include <vector>
 
 
 class CKnownFile;
@@ -40,16 +44,46 @@ public:
 	~CKnownFileList();
 	bool	SafeAddKFile(CKnownFile* toadd, bool afterHashing = false);
 	bool	Init();
+	/**
+	 * Saves the known files.
+	 *
+	 * Only records which changed since they were last written are
+	 * appended to the journal, known.met itself is rewritten when the
+	 * journal has grown too large, in the background if possible.
+	 */
 	void	Save();
 	void	Clear();
 	CKnownFile* FindKnownFile(
 		const CPath& filename,
 		time_t in_date,
 		uint64 in_size);
+	/**
+	 * Looks up all files of a scanned directory at once.
+	 *
+	 * @param files The files to look up.
+	 * @param found Receives the known file for each file, or NULL.
+	 */
+	void	FindKnownFiles(
+		const std::vector<CSharedDirScanner::CScannedFile>& files,
+		std::vector<CKnownFile*>& found);
 	CKnownFile* FindKnownFileByID(const CMD4Hash& hash);
 	void	PrepareIndex();
 	void	ReleaseIndex();
 
+	/**
+	 * Merges the start of the journal into known.met, and drops it from
+	 * the journal. Called by CKnownFilesCompactTask, it works on the files
+	 * alone and leaves the list untouched.
+	 *
+	 * @param metPath The full path of known.met.
+	 * @param journalOffset The length of the journal to merge.
+	 * @param generation Identifies the known.met the journal belongs to.
+	 */
+	static void CompactJournal(
+		const CPath& metPath,
+		uint64 journalOffset,
+		uint32 generation);
+
 	uint16 requested;
 	uint32 transferred;
 	uint16 accepted;
@@ -59,6 +93,23 @@ private:
 
 	bool	Append(CKnownFile*, bool afterHashing = false);
 
+	typedef std::vector<std::pair<CKnownFile*, bool> > RecordList;
+	//! Lists the records in the order they are saved, duplicates first.
+	void	GetRecords(RecordList& records) const;
+	//! Rewrites known.met and starts a new journal.
+	bool	SaveFull(const CPath& metPath, const CPath& journalPath);
+	//! Appends the changed records to the journal.
+	bool	SaveJournal(const CPath& metPath, const CPath& journalPath);
+	//! Applies the journal written for known.met on top of the loaded records.
+	bool	LoadJournal(const CPath& metPath, const CPath& journalPath);
+	//! Replaces or adds a record read from the journal.
+	void	ApplyJournalRecord(CKnownFile* record, bool duplicate, uint64 digest);
+
+	CKnownFile *FindKnownFileNoLock(
+		const CPath& filename,
+		time_t in_date,
+		uint64 in_size) const;
+
 	CKnownFile *IsOnDuplicates(
 		const CPath& filename,
 		uint32 in_date,
@@ -79,6 +130,14 @@ private:
 	typedef std::multimap<uint32, CKnownFile*> KnownFileSizeMap;
 	KnownFileSizeMap * m_knownSizeMap;
 	KnownFileSizeMap * m_duplicateSizeMap;
+	//! Adds a file appended to the lists to the index, if there is one.
+	static void IndexFile(KnownFileSizeMap* index, CKnownFile* file);
+
+	//! Digest of each record as it was last written, to find changed records.
+	typedef std::map<const CKnownFile*, uint64> DigestMap;
+	DigestMap	m_savedDigests;
+	//! False if the journal does not match known.met, forcing a full save.
+	bool		m_journalValid;
 };
 
 #endif // KNOWNFILELIST_H
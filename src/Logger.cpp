@@ -25,9 +25,12 @@
 #include "Logger.h"
 #include "amule.h"
 #include "Preferences.h"
+#include "MuleThread.h"		// Needed for CMuleThread
+#include "BoundedQueue.h"	// Needed for CBoundedQueue
 #include <common/Macros.h>
 #include <common/MacrosProgramSpecific.h>
 #include <sstream>
+#include <ctime>		// Needed for time
 #include <wx/tokenzr.h>
 #include <wx/wfstream.h>
 #include <wx/sstream.h>
@@ -37,6 +40,62 @@
 DEFINE_LOCAL_EVENT_TYPE(MULE_EVT_LOGLINE)
 
 
+//! Number of lines the writer thread can fall behind.
+#define LOGQUEUE_SIZE		4096
+//! Characters stored in a queued line without allocating.
+#define LOGRECORD_TEXT_SIZE	120
+//! How long the writer thread sleeps when nothing is queued, in ms.
+#define LOGWRITER_IDLE_TIME	50
+//! Lines written and flushed at once by the writer thread.
+#define LOGWRITER_BATCH		256
+
+#define LOGRECORD_CRITICAL	0x01
+#define LOGRECORD_STDOUT	0x02
+#define LOGRECORD_GUI		0x04
+
+
+/**
+ * A line waiting for the writer thread.
+ *
+ * Only the message itself is copied by the thread logging it. The
+ * category name, prefix and timestamp are added by the writer.
+ */
+struct CLogger::CLogRecord
+{
+	time_t	time;
+	sint16	type;
+	uint8	flags;
+	uint32	length;
+	wxChar	text[LOGRECORD_TEXT_SIZE];
+	//! Longer messages are allocated instead, and freed by the writer.
+	wxChar*	longText;
+};
+
+
+/**
+ * Writes queued lines to the logfile.
+ */
+class CLogger::CLogWriter : public CMuleThread
+{
+public:
+	CLogWriter(CLogger* owner)
+		: CMuleThread(wxTHREAD_JOINABLE),
+		  m_owner(owner)
+	{
+	}
+
+protected:
+	virtual void* Entry()
+	{
+		m_owner->WriterLoop(this);
+		return NULL;
+	}
+
+private:
+	CLogger*	m_owner;
+};
+
+
 CDebugCategory g_debugcats[] = {
 	CDebugCategory( logGeneral,		wxT("General") ),
 	CDebugCategory( logHasher,		wxT("Hasher") ),
@@ -84,6 +143,59 @@ CDebugCategory g_debugcats[] = {
 const int categoryCount = itemsof(g_debugcats);
 
 
+static wxString GetCategoryPrefix(DebugType type)
+{
+	if (type == logStandard) {
+		return wxEmptyString;
+	}
+
+	int index = (int)type;
+
+	if ( index >= 0 && index < categoryCount ) {
+		const CDebugCategory& cat = g_debugcats[ index ];
+		wxASSERT(type == cat.GetType());
+
+		return cat.GetName() + wxT(": ");
+	}
+
+	wxFAIL;
+	return wxEmptyString;
+}
+
+
+/**
+ * Splits a message into lines and adds the prefix and timestamp to each.
+ */
+static void FormatLines(const wxString & lines, bool critical, bool toGUI, const wxDateTime & when, wxArrayString & result)
+{
+	// Remove newspace at end
+	wxString bufferline = lines.Strip(wxString::trailing);
+
+	// Create the timestamp
+	wxString stamp = when.FormatISODate() + wxT(" ") + when.FormatISOTime()
+#ifdef CLIENT_GUI
+					+ wxT(" (remote-GUI): ");
+#else
+					+ wxT(": ");
+#endif
+
+	// critical lines get a ! prepended, ordinary lines a blank
+	// logfile-only lines get a . to prevent transmission on EC
+	wxString prefix = !toGUI ? wxT(".") : (critical ? wxT("!") : wxT(" "));
+
+	if ( bufferline.IsEmpty() ) {
+		// If it's empty we just write a blank line with no timestamp.
+		result.Add(wxT(" \n"));
+	} else {
+		// Split multi-line messages into individual lines
+		wxStringTokenizer tokens( bufferline, wxT("\n") );
+		while ( tokens.HasMoreTokens() ) {
+			result.Add(prefix + stamp + tokens.GetNextToken() + wxT("\n"));
+		}
+	}
+}
+
+
 
 #ifdef __DEBUG__
 bool CLogger::IsEnabled( DebugType type ) const
@@ -137,24 +249,22 @@ void CLogger::AddLogLine(
 			// print non critical debug messages only to the logfile
 			toGUI = false;
 		}
-		int index = (int)type;
-
-		if ( index >= 0 && index < categoryCount ) {
-			const CDebugCategory& cat = g_debugcats[ index ];
-			wxASSERT(type == cat.GetType());
-
-			msg = cat.GetName() + wxT(": ") + msg;
-		} else {
-			wxFAIL;
-		}
 	}
 
 #ifdef __DEBUG__
 	if (line) {
-		msg = file.AfterLast(wxFileName::GetPathSeparator()).AfterLast(wxT('/')) << wxT("(") << line << wxT("): ") + msg;
+		// The location goes in front of the category name, so both are added here
+		msg = file.AfterLast(wxFileName::GetPathSeparator()).AfterLast(wxT('/')) << wxT("(") << line << wxT("): ") + GetCategoryPrefix(type) + msg;
+		type = logStandard;
 	}
 #endif
 
+	if (QueueLine(critical, type, msg, toStdout, toGUI)) {
+		return;
+	}
+
+	msg = GetCategoryPrefix(type) + msg;
+
 	if (toGUI && !wxThread::IsMain()) {
 		// put to background
 		CLoggingEvent Event(critical, toStdout, toGUI, msg);
@@ -193,13 +303,17 @@ unsigned int CLogger::GetDebugCategoryCount()
 
 bool CLogger::OpenLogfile(const wxString & name)
 {
+	wxMutexLocker lock(m_lineLock);
+
 	applog = new wxFFileOutputStream(name);
 	bool ret = applog->Ok();
 	if (ret) {
 		FlushApplog();
 		m_LogfileName = name;
 	} else {
-		CloseLogfile();
+		delete applog;
+		applog = NULL;
+		m_LogfileName.Clear();
 	}
 	return ret;
 }
@@ -207,6 +321,8 @@ bool CLogger::OpenLogfile(const wxString & name)
 
 void CLogger::CloseLogfile()
 {
+	wxMutexLocker lock(m_lineLock);
+
 	delete applog;
 	applog = NULL;
 	m_LogfileName.Clear();
@@ -215,37 +331,23 @@ void CLogger::CloseLogfile()
 
 void CLogger::OnLoggingEvent(class CLoggingEvent& evt)
 {
-	DoLines(evt.Message(), evt.IsCritical(), evt.ToStdout(), evt.ToGUI());
+	if (evt.IsWritten()) {
+#ifndef AMULE_DAEMON
+		theApp->AddGuiLogLine(evt.Message());
+#endif
+	} else {
+		DoLines(evt.Message(), evt.IsCritical(), evt.ToStdout(), evt.ToGUI());
+	}
 }
 
 
 void CLogger::DoLines(const wxString & lines, bool critical, bool toStdout, bool toGUI)
 {
-	// Remove newspace at end
-	wxString bufferline = lines.Strip(wxString::trailing);
+	wxArrayString result;
+	FormatLines(lines, critical, toGUI, wxDateTime::Now(), result);
 
-	// Create the timestamp
-	wxString stamp = wxDateTime::Now().FormatISODate() + wxT(" ") + wxDateTime::Now().FormatISOTime()
-#ifdef CLIENT_GUI
-					+ wxT(" (remote-GUI): ");
-#else
-					+ wxT(": ");
-#endif
-
-	// critical lines get a ! prepended, ordinary lines a blank
-	// logfile-only lines get a . to prevent transmission on EC
-	wxString prefix = !toGUI ? wxT(".") : (critical ? wxT("!") : wxT(" "));
-
-	if ( bufferline.IsEmpty() ) {
-		// If it's empty we just write a blank line with no timestamp.
-		DoLine(wxT(" \n"), toStdout, toGUI);
-	} else {
-		// Split multi-line messages into individual lines
-		wxStringTokenizer tokens( bufferline, wxT("\n") );
-		while ( tokens.HasMoreTokens() ) {
-			wxString fullline = prefix + stamp + tokens.GetNextToken() + wxT("\n");
-			DoLine(fullline, toStdout, toGUI);
-		}
+	for (size_t i = 0; i < result.GetCount(); ++i) {
+		DoLine(result[i], toStdout, toGUI);
 	}
 }
 
@@ -276,6 +378,12 @@ void CLogger::DoLine(const wxString & line, bool toStdout, bool GUI_ONLY(toGUI))
 
 void CLogger::EmergencyLog(const wxString &message, bool closeLog)
 {
+	// Don't wait for the writer thread, it may be the one that crashed
+	const bool locked = (m_lineLock.TryLock() == wxMUTEX_NO_ERROR);
+	if (locked && m_queue) {
+		while (WriteQueuedLines()) {}
+	}
+
 	fprintf(stderr, "%s", (const char*)unicode2char(message));
 	m_ApplogBuf += message;
 	FlushApplog();
@@ -283,6 +391,178 @@ void CLogger::EmergencyLog(const wxString &message, bool closeLog)
 		applog->Close();
 		applog = NULL;
 	}
+
+	if (locked) {
+		m_lineLock.Unlock();
+	}
+}
+
+
+CLogger::~CLogger()
+{
+	// The writer has been stopped by the app, anything left was queued afterwards
+	if (m_queue) {
+		CLogRecord record;
+		while (m_queue->Pop(record)) {
+			delete [] record.longText;
+		}
+		delete m_queue;
+	}
+}
+
+
+void CLogger::StartWriter()
+{
+	if (m_writer) {
+		return;
+	}
+
+	if (!m_queue) {
+		m_queue = new CBoundedQueue<CLogRecord>(LOGQUEUE_SIZE);
+	}
+
+	m_writer = new CLogWriter(this);
+	if (m_writer->Create() != wxTHREAD_NO_ERROR || m_writer->Run() != wxTHREAD_NO_ERROR) {
+		// Lines are still written by the threads logging them
+		delete m_writer;
+		m_writer = NULL;
+		return;
+	}
+
+	m_writerRunning.Store(1);
+}
+
+
+void CLogger::StopWriter()
+{
+	if (!m_writer) {
+		return;
+	}
+
+	m_writerRunning.Store(0);
+	m_writer->Stop();
+	delete m_writer;
+	m_writer = NULL;
+
+	// Lines queued while the writer was stopping
+	wxMutexLocker lock(m_lineLock);
+	while (WriteQueuedLines()) {}
+}
+
+
+bool CLogger::QueueLine(bool critical, DebugType type, const wxString &str, bool toStdout, bool toGUI)
+{
+	if (!m_writerRunning.Load()) {
+		return false;
+	}
+
+	CLogRecord record;
+	record.time = time(NULL);
+	record.type = type;
+	record.flags = (critical ? LOGRECORD_CRITICAL : 0) | (toStdout ? LOGRECORD_STDOUT : 0) | (toGUI ? LOGRECORD_GUI : 0);
+	record.length = str.length();
+
+	wxChar* text = record.text;
+	record.longText = NULL;
+	if (record.length > LOGRECORD_TEXT_SIZE) {
+		text = record.longText = new wxChar[record.length];
+	}
+	memcpy(text, static_cast<const wxChar*>(str.c_str()), record.length * sizeof(wxChar));
+
+	while (!m_queue->Push(record)) {
+		// The writer must not wait for itself, should it log anything
+		const bool drop = (m_overflowPolicy == logDropAll)
+			|| (m_overflowPolicy == logDropNonCritical && !critical)
+			|| wxThread::This() == m_writer
+			|| !m_writerRunning.Load();
+
+		if (drop) {
+			delete [] record.longText;
+			m_lostLines.FetchAdd(1);
+			return true;
+		}
+
+		wxMilliSleep(1);
+	}
+
+	return true;
+}
+
+
+uint32 CLogger::WriteQueuedLines()
+{
+	uint32 count = 0;
+	CLogRecord record;
+
+	while (count < LOGWRITER_BATCH && m_queue->Pop(record)) {
+		++count;
+
+		const bool critical = (record.flags & LOGRECORD_CRITICAL) != 0;
+		const bool toStdout = (record.flags & LOGRECORD_STDOUT) != 0;
+		const bool toGUI = (record.flags & LOGRECORD_GUI) != 0;
+
+		wxString msg(record.longText ? record.longText : record.text, record.length);
+		delete [] record.longText;
+
+		wxArrayString lines;
+		FormatLines(GetCategoryPrefix((DebugType)record.type) + msg, critical, toGUI, wxDateTime(record.time), lines);
+
+		for (size_t i = 0; i < lines.GetCount(); ++i) {
+			++m_count;
+			m_ApplogBuf += lines[i];
+
+			if (m_StdoutLog || toStdout) {
+				printf("%s", (const char*)unicode2char(lines[i]));
+			}
+
+#ifndef AMULE_DAEMON
+			// Lines still queued on exit only go to the logfile
+			if (toGUI && m_writerRunning.Load()) {
+				CLoggingEvent event(critical, toStdout, toGUI, lines[i], true);
+				AddPendingEvent(event);
+			}
+#endif
+		}
+	}
+
+	const uint32 lost = m_lostLines.Load();
+	if (lost != m_reportedLostLines) {
+		wxArrayString lines;
+		FormatLines(wxString::Format(wxT("%u log lines were dropped, the logfile could not keep up."), lost - m_reportedLostLines),
+			true, false, wxDateTime::Now(), lines);
+		for (size_t i = 0; i < lines.GetCount(); ++i) {
+			m_ApplogBuf += lines[i];
+		}
+		m_reportedLostLines = lost;
+	}
+
+	// One write and sync per batch instead of per line
+	if (!m_ApplogBuf.IsEmpty()) {
+		FlushApplog();
+	}
+
+	return count;
+}
+
+
+void CLogger::WriterLoop(CLogWriter* writer)
+{
+	while (true) {
+		uint32 count;
+		{
+			wxMutexLocker lock(m_lineLock);
+			count = WriteQueuedLines();
+		}
+
+		if (!count) {
+			// Stop only once everything queued so far is written
+			if (writer->TestDestroy()) {
+				break;
+			}
+
+			wxMilliSleep(LOGWRITER_IDLE_TIME);
+		}
+	}
 }
 
 
@@ -29,6 +29,10 @@
 #include <wx/event.h>
 #include <iosfwd>
 
+#include "MuleAtomic.h"		// Needed for CAtomic
+
+template <typename T> class CBoundedQueue;
+
 
 enum DebugType
 {
@@ -168,8 +172,28 @@ private:
 };
 
 
+/**
+ * What happens to a line when the queue of the log writer is full.
+ */
+enum LogOverflowPolicy
+{
+	//! Non-critical lines are dropped, critical ones wait for room.
+	logDropNonCritical,
+	//! All lines are dropped.
+	logDropAll,
+	//! All lines wait for room.
+	logWaitForRoom
+};
+
+
 /**
  * Functions for logging operations.
+ *
+ * Once the writer thread has been started, lines are not written by the
+ * thread logging them. They are copied into a lock-free queue together
+ * with their category, flags and time, and the writer adds the prefixes,
+ * formats the timestamps and writes them to the logfile in batches. Lines
+ * for the GUI are handed back to the main thread from there.
  */
 class CLogger: public wxEvtHandler
 {
@@ -239,9 +263,31 @@ public:
 
 	/**
 	 * Emergency log for crashes.
+	 *
+	 * Lines still queued for the writer thread are written first.
 	 */
 	void EmergencyLog(const wxString &message, bool closeLog = true);
 
+	/**
+	 * Starts the writer thread, lines are written synchronously until then.
+	 */
+	void StartWriter();
+
+	/**
+	 * Stops the writer thread after it has written all queued lines.
+	 */
+	void StopWriter();
+
+	/**
+	 * Sets what happens to lines when the writer thread falls behind.
+	 */
+	void SetOverflowPolicy(LogOverflowPolicy policy)	{ m_overflowPolicy = policy; }
+
+	/**
+	 * Returns the number of lines dropped because the writer thread fell behind.
+	 */
+	uint32 GetLostLines() const		{ return m_lostLines.Load(); }
+
 	/**
 	 * Returns a category specified by index.
 	 */
@@ -281,15 +327,38 @@ public:
 		applog = NULL;
 		m_StdoutLog = false;
 		m_count = 0;
+		m_queue = NULL;
+		m_writer = NULL;
+		m_overflowPolicy = logDropNonCritical;
+		m_reportedLostLines = 0;
 	}
 
+	/**
+	 * Destruct
+	 */
+	~CLogger();
+
 private:
 	class wxFFileOutputStream* applog;	// the logfile
 	wxString m_LogfileName;
 	wxString m_ApplogBuf;
 	bool m_StdoutLog;
 	int  m_count;			// output line counter
-	wxMutex m_lineLock;
+	wxMutex m_lineLock;		// also held by the writer thread while writing
+
+	class CLogWriter;
+	friend class CLogWriter;
+	struct CLogRecord;
+
+	//! Lines waiting for the writer thread, kept until exit once created.
+	CBoundedQueue<CLogRecord>* m_queue;
+	CLogWriter* m_writer;
+	//! Non-zero while lines are to be queued.
+	CAtomic<uint32> m_writerRunning;
+	LogOverflowPolicy m_overflowPolicy;
+	CAtomic<uint32> m_lostLines;
+	//! Lost lines already noted in the logfile, only used by the writer.
+	uint32 m_reportedLostLines;
 
 	/**
 	 * Write all waiting log info to the logfile
@@ -306,6 +375,25 @@ private:
 	 */
 	void DoLines(const wxString & lines, bool critical, bool toStdout, bool toGUI);
 
+	/**
+	 * Queues a line for the writer thread.
+	 *
+	 * @return False if the line was not queued and has to be written right away.
+	 */
+	bool QueueLine(bool critical, DebugType type, const wxString &str, bool toStdout, bool toGUI);
+
+	/**
+	 * Writes a batch of queued lines, must be called with m_lineLock held.
+	 *
+	 * @return The number of lines written.
+	 */
+	uint32 WriteQueuedLines();
+
+	/**
+	 * Writes queued lines until stopped, called by the writer thread.
+	 */
+	void WriterLoop(CLogWriter* writer);
+
 	DECLARE_EVENT_TABLE()
 };
 
@@ -337,11 +425,12 @@ DECLARE_LOCAL_EVENT_TYPE(MULE_EVT_LOGLINE, -1)
 class CLoggingEvent : public wxEvent
 {
 public:
-	CLoggingEvent(bool critical, bool toStdout, bool toGUI, const wxString& msg)
+	CLoggingEvent(bool critical, bool toStdout, bool toGUI, const wxString& msg, bool written = false)
 		: wxEvent(-1, MULE_EVT_LOGLINE)
 		, m_critical(critical)
 		, m_stdout(toStdout)
 		, m_GUI(toGUI)
+		, m_written(written)
 		// Deep copy, to avoid thread-unsafe reference counting. */
 		, m_msg(msg.c_str(), msg.Length())
 	{
@@ -363,14 +452,20 @@ public:
 		return m_GUI;
 	}
 
+	//! The line is already in the logfile and only has to be shown.
+	bool IsWritten() const {
+		return m_written;
+	}
+
 	wxEvent* Clone() const {
-		return new CLoggingEvent(m_critical, m_stdout, m_GUI, m_msg);
+		return new CLoggingEvent(m_critical, m_stdout, m_GUI, m_msg, m_written);
 	}
 
 private:
 	bool		m_critical;
 	bool		m_stdout;
 	bool		m_GUI;
+	bool		m_written;
 	wxString	m_msg;
 };
 
@@ -0,0 +1,204 @@
+//
+// This file is part of the aMule Project.
+//
+// Copyright (c) 2003-2011 aMule Team ( admin@amule.org / http://www.amule.org )
+//
+// Any parts of this program derived from the xMule, lMule or eMule project,
+// or contributed by third-party developers are copyrighted by their
+// respective authors.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA
+//
+
+#include "Metrics.h"		// Interface declarations
+
+#include <protocol/Protocols.h>	// Needed for OP_EDONKEYPROT etc.
+
+#include <cstdio>		// Needed for snprintf
+
+
+//! Known protocols, in the order of their counters.
+static const uint8 s_protocols[] = {
+	OP_EDONKEYPROT,
+	OP_PACKEDPROT,
+	OP_EMULEPROT,
+	OP_KADEMLIAHEADER,
+	OP_KADEMLIAPACKEDPROT,
+	OP_ED2KV2HEADER,
+	OP_ED2KV2PACKEDPROT
+};
+
+//! Label values of the protocols, the last one is for unknown protocols.
+static const char* const s_protocolNames[] = {
+	"edonkey",
+	"packed",
+	"emule",
+	"kad",
+	"kad_packed",
+	"ed2kv2",
+	"ed2kv2_packed",
+	"other"
+};
+
+static const char* const s_directionNames[CMetrics::DirectionCount] = { "received", "sent" };
+static const char* const s_transportNames[CMetrics::TransportCount] = { "tcp", "udp" };
+static const char* const s_subsystemNames[CMetrics::SubsystemCount] = {
+	"client_tcp",
+	"server_tcp",
+	"client_udp",
+	"server_udp",
+	"kad",
+	"ec",
+	"core_timer",
+	"part_flush"
+};
+
+
+CAtomic<uint64>		CMetrics::s_packets[CMetrics::DirectionCount][CMetrics::TransportCount][CMetrics::PROTOCOL_COUNT][256];
+CMetricsHistogram	CMetrics::s_latencies[CMetrics::SubsystemCount];
+
+
+//-------------------- CMetricsWriter --------------------
+
+void CMetricsWriter::Family(const char* name, const char* type, const char* help)
+{
+	m_out.append("# HELP ").append(name).append(" ").append(help).append("\n");
+	m_out.append("# TYPE ").append(name).append(" ").append(type).append("\n");
+}
+
+
+void CMetricsWriter::Sample(const char* name, const char* labels, uint64 value)
+{
+	// Digits in reverse order, uint64 has at most 20
+	char digits[20];
+	int count = 0;
+	do {
+		digits[count++] = '0' + (char)(value % 10);
+		value /= 10;
+	} while (value);
+
+	m_out.append(name);
+	if (labels && *labels) {
+		m_out.append("{").append(labels).append("}");
+	}
+	m_out.append(" ");
+	while (count) {
+		m_out.push_back(digits[--count]);
+	}
+	m_out.append("\n");
+}
+
+
+void CMetricsWriter::Sample(const char* name, const char* labels, double value)
+{
+	char buffer[32];
+	if (value != value) {
+		snprintf(buffer, sizeof(buffer), "NaN");
+	} else {
+		snprintf(buffer, sizeof(buffer), "%.10g", value);
+	}
+
+	m_out.append(name);
+	if (labels && *labels) {
+		m_out.append("{").append(labels).append("}");
+	}
+	m_out.append(" ").append(buffer).append("\n");
+}
+
+
+//-------------------- CMetricsHistogram --------------------
+
+void CMetricsHistogram::Observe(uint64 micros)
+{
+	unsigned bucket = 0;
+	while (bucket < BUCKET_COUNT && micros > GetBound(bucket)) {
+		++bucket;
+	}
+
+	m_buckets[bucket].FetchAdd(1);
+	m_sum.FetchAdd(micros);
+}
+
+
+void CMetricsHistogram::Write(CMetricsWriter& writer, const char* name, const char* labels) const
+{
+	const std::string prefix = (labels && *labels) ? std::string(labels) + "," : std::string();
+	const std::string bucketName = std::string(name) + "_bucket";
+	char buffer[256];
+
+	// Buckets are cumulative in the exposition
+	uint64 count = 0;
+	for (unsigned bucket = 0; bucket <= BUCKET_COUNT; ++bucket) {
+		count += m_buckets[bucket].Load();
+		if (bucket < BUCKET_COUNT) {
+			snprintf(buffer, sizeof(buffer), "%sle=\"%.10g\"", prefix.c_str(), GetBound(bucket) / 1000000.0);
+		} else {
+			snprintf(buffer, sizeof(buffer), "%sle=\"+Inf\"", prefix.c_str());
+		}
+		writer.Sample(bucketName.c_str(), buffer, count);
+	}
+
+	writer.Sample((std::string(name) + "_sum").c_str(), labels, m_sum.Load() / 1000000.0);
+	writer.Sample((std::string(name) + "_count").c_str(), labels, count);
+}
+
+
+//-------------------- CMetrics --------------------
+
+unsigned CMetrics::GetProtocolIndex(uint8 protocol)
+{
+	unsigned index = 0;
+	while (index < sizeof(s_protocols) && s_protocols[index] != protocol) {
+		++index;
+	}
+
+	return index;
+}
+
+
+void CMetrics::CountPacket(Direction direction, Transport transport, uint8 protocol, uint8 opcode)
+{
+	s_packets[direction][transport][GetProtocolIndex(protocol)][opcode].FetchAdd(1);
+}
+
+
+void CMetrics::Write(CMetricsWriter& writer)
+{
+	char labels[128];
+
+	// Only opcodes seen so far, most of them never are
+	writer.Family("amule_packets_total", "counter", "Packets by direction, transport, protocol and opcode.");
+	for (unsigned direction = 0; direction < DirectionCount; ++direction) {
+		for (unsigned transport = 0; transport < TransportCount; ++transport) {
+			for (unsigned protocol = 0; protocol < PROTOCOL_COUNT; ++protocol) {
+				for (unsigned opcode = 0; opcode < 256; ++opcode) {
+					const uint64 count = s_packets[direction][transport][protocol][opcode].Load();
+					if (count) {
+						snprintf(labels, sizeof(labels), "direction=\"%s\",transport=\"%s\",protocol=\"%s\",opcode=\"0x%02X\"",
+							s_directionNames[direction], s_transportNames[transport], s_protocolNames[protocol], opcode);
+						writer.Sample("amule_packets_total", labels, count);
+					}
+				}
+			}
+		}
+	}
+
+	writer.Family("amule_latency_seconds", "histogram", "Time spent handling packets, EC requests and core tasks.");
+	for (unsigned subsystem = 0; subsystem < SubsystemCount; ++subsystem) {
+		snprintf(labels, sizeof(labels), "subsystem=\"%s\"", s_subsystemNames[subsystem]);
+		s_latencies[subsystem].Write(writer, "amule_latency_seconds", labels);
+	}
+}
+// File_checked_for_headers
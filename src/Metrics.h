@@ -0,0 +1,189 @@
+//
+// This file is part of the aMule Project.
+//
+// Copyright (c) 2003-2011 aMule Team ( admin@amule.org / http://www.amule.org )
+//
+// Any parts of this program derived from the xMule, lMule or eMule project,
+// or contributed by third-party developers are copyrighted by their
+// respective authors.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA
+//
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include "Types.h"		// Needed for uint64
+#include "MuleAtomic.h"		// Needed for CAtomic
+#include "GetTickCount.h"	// Needed for GetTickCountMicro
+
+#include <string>
+
+
+/**
+ * Writes metrics in the Prometheus text exposition format.
+ */
+class CMetricsWriter
+{
+public:
+	CMetricsWriter(std::string& out)
+		: m_out(out)
+	{}
+
+	/**
+	 * Starts a metric family.
+	 *
+	 * @param name Name of the metric, without suffixes.
+	 * @param type "counter", "gauge" or "histogram".
+	 * @param help Description of the metric.
+	 */
+	void Family(const char* name, const char* type, const char* help);
+
+	/**
+	 * Adds a sample to the current family.
+	 *
+	 * @param name Name of the sample, with suffix if any.
+	 * @param labels Label pairs like 'a="x",b="y"', or NULL for none.
+	 * @param value The value.
+	 */
+	void Sample(const char* name, const char* labels, uint64 value);
+	void Sample(const char* name, const char* labels, double value);
+
+private:
+	std::string&	m_out;
+};
+
+
+/**
+ * A histogram of durations.
+ *
+ * The bucket bounds grow by powers of four from 1 microsecond to about
+ * 4 seconds. Observing a duration is two atomic additions, so it can be
+ * done from any thread.
+ */
+class CMetricsHistogram
+{
+public:
+	enum { BUCKET_COUNT = 12 };
+
+	//! Adds a duration in microseconds.
+	void Observe(uint64 micros);
+
+	/**
+	 * Writes the buckets, sum and count of the histogram.
+	 *
+	 * @param writer The family must be started already.
+	 * @param name Name of the metric, without suffixes.
+	 * @param labels Labels of the histogram, or NULL.
+	 */
+	void Write(CMetricsWriter& writer, const char* name, const char* labels) const;
+
+	//! Returns the upper bound of a bucket in microseconds.
+	static uint64 GetBound(unsigned bucket)	{ return (uint64)1 << (2 * bucket); }
+
+private:
+	//! Not cumulative, the last one counts all longer durations.
+	CAtomic<uint64>	m_buckets[BUCKET_COUNT + 1];
+	//! Sum of all durations in microseconds.
+	CAtomic<uint64>	m_sum;
+};
+
+
+/**
+ * Counters and latencies not kept by the statistics tree.
+ *
+ * Packets are counted by direction, transport, protocol and opcode, and
+ * the time spent on the core's main tasks is kept in a histogram for
+ * each. All of it is exported by the metrics server together with the
+ * statistics (see CStatistics::WriteMetrics).
+ */
+class CMetrics
+{
+public:
+	enum Direction {
+		Received = 0,
+		Sent,
+
+		DirectionCount
+	};
+
+	enum Transport {
+		TransportTCP = 0,
+		TransportUDP,
+
+		TransportCount
+	};
+
+	enum Subsystem {
+		//! Handling of a packet from a client
+		SubsystemClientTCP = 0,
+		//! Handling of a packet from the server
+		SubsystemServerTCP,
+		//! Handling of an eMule UDP packet
+		SubsystemClientUDP,
+		//! Handling of a server UDP packet
+		SubsystemServerUDP,
+		//! Handling of a Kad packet
+		SubsystemKad,
+		//! Handling of an EC request
+		SubsystemEC,
+		//! One run of the core timer
+		SubsystemCoreTimer,
+		//! Writing a part file buffer to disk
+		SubsystemPartFlush,
+
+		SubsystemCount
+	};
+
+	//! Counts a packet, can be called from any thread.
+	static void CountPacket(Direction direction, Transport transport, uint8 protocol, uint8 opcode);
+
+	//! Adds a duration in microseconds, can be called from any thread.
+	static void Observe(Subsystem subsystem, uint64 micros)	{ s_latencies[subsystem].Observe(micros); }
+
+	//! Writes packet counts and latencies.
+	static void Write(CMetricsWriter& writer);
+
+private:
+	enum { PROTOCOL_COUNT = 8 };
+
+	//! Returns the index of a protocol, unknown ones share the last one.
+	static unsigned GetProtocolIndex(uint8 protocol);
+
+	static CAtomic<uint64>		s_packets[DirectionCount][TransportCount][PROTOCOL_COUNT][256];
+	static CMetricsHistogram	s_latencies[SubsystemCount];
+};
+
+
+/**
+ * Observes the time from its construction to its destruction.
+ */
+class CMetricsTimer
+{
+public:
+	CMetricsTimer(CMetrics::Subsystem subsystem)
+		: m_subsystem(subsystem),
+		  m_start(GetTickCountMicro())
+	{}
+
+	~CMetricsTimer()	{ CMetrics::Observe(m_subsystem, GetTickCountMicro() - m_start); }
+
+private:
+	CMetrics::Subsystem	m_subsystem;
+	uint64			m_start;
+};
+
+#endif // METRICS_H
+// File_checked_for_headers
@@ -0,0 +1,339 @@
+//
+// This file is part of the aMule Project.
+//
+// Copyright (c) 2003-2011 aMule Team ( admin@amule.org / http://www.amule.org )
+//
+// Any parts of this program derived from the xMule, lMule or eMule project,
+// or contributed by third-party developers are copyrighted by their
+// respective authors.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA
+//
+
+
+#include "MetricsServer.h"	// Interface declarations
+
+#include <common/Format.h>	// Needed for CFormat
+
+#include "amule.h"		// Needed for theApp
+#include "amuleIPV4Address.h"	// Needed for amuleIPV4Address
+#include "ExternalConn.h"	// Needed for ExternalConn
+#include "GetTickCount.h"	// Needed for GetTickCount
+#include "Logger.h"		// Needed for AddLogLineN
+#include "Metrics.h"		// Needed for CMetricsWriter
+#include "Statistics.h"		// Needed for theStats
+#include <common/Macros.h>	// Needed for SEC2MS
+
+#include <cstdio>		// Needed for snprintf
+#include <vector>
+
+
+//! Requests are a few lines, anything longer is not a scrape.
+#define METRICS_MAX_REQUEST	8192
+//! Scrapes are expected to be done well within this time.
+#define METRICS_TIMEOUT		SEC2MS(30)
+//! Only a handful of scrapers are expected at once.
+#define METRICS_MAX_SOCKETS	16
+
+#ifndef ASIO_SOCKETS
+enum
+{	// ids for sockets
+	METRICS_SERVER_ID = 1000,
+	METRICS_SOCKET_ID
+};
+#endif
+
+
+//-------------------- CMetricsSocket --------------------
+
+CMetricsSocket::CMetricsSocket(CMetricsServer* server)
+	: CLibSocket(MULE_SOCKET_NOWAIT),
+	  m_server(server),
+	  m_started(GetTickCount()),
+	  m_sent(0),
+	  m_responding(false)
+{
+#ifdef ASIO_SOCKETS
+	Notify(true);
+#else
+	SetEventHandler(*server, METRICS_SOCKET_ID);
+	SetNotify(wxSOCKET_INPUT_FLAG | wxSOCKET_OUTPUT_FLAG | wxSOCKET_LOST_FLAG);
+	Notify(true);
+#endif
+}
+
+
+void CMetricsSocket::Finish()
+{
+	if (!IsDestroying()) {
+		m_server->RemoveSocket(this);
+		Destroy();
+	}
+}
+
+
+void CMetricsSocket::OnReceive(int errorCode)
+{
+	if (errorCode) {
+		Finish();
+		return;
+	}
+
+	char buffer[1024];
+	uint32 count;
+	while (!m_responding && (count = Read(buffer, sizeof(buffer))) > 0) {
+		m_request.append(buffer, count);
+
+		// The body of a GET, if any, is of no interest
+		if (m_request.size() > METRICS_MAX_REQUEST
+			|| m_request.find("\r\n\r\n") != std::string::npos
+			|| m_request.find("\n\n") != std::string::npos) {
+			Respond();
+		}
+	}
+}
+
+
+void CMetricsSocket::OnSend(int errorCode)
+{
+	if (errorCode) {
+		Finish();
+	} else if (m_responding) {
+		if (m_sent < m_response.size()) {
+			SendPending();
+		} else {
+			// Written in the background, and done now
+			Finish();
+		}
+	}
+}
+
+
+void CMetricsSocket::OnLost()
+{
+	Finish();
+}
+
+
+void CMetricsSocket::Respond()
+{
+	m_responding = true;
+
+	std::string body;
+	const char* status;
+	const char* type = "text/plain; charset=utf-8";
+	bool head = false;
+
+	const size_t lineEnd = m_request.find_first_of("\r\n");
+	const size_t methodEnd = m_request.find(' ');
+	if (m_request.size() > METRICS_MAX_REQUEST || methodEnd == std::string::npos || methodEnd > lineEnd) {
+		status = "400 Bad Request";
+		body = "Bad request\n";
+	} else {
+		const std::string method = m_request.substr(0, methodEnd);
+		const size_t pathEnd = m_request.find_first_of(" ?\r\n", methodEnd + 1);
+		const std::string path = m_request.substr(methodEnd + 1, pathEnd - methodEnd - 1);
+		head = method == "HEAD";
+
+		if (method != "GET" && !head) {
+			status = "405 Method Not Allowed";
+			body = "Only GET and HEAD are supported\n";
+		} else if (path != "/metrics" && path != "/") {
+			status = "404 Not Found";
+			body = "The metrics are at /metrics\n";
+		} else {
+			status = "200 OK";
+			type = "text/plain; version=0.0.4; charset=utf-8";
+			CMetricsWriter writer(body);
+			theStats::WriteMetrics(writer);
+			if (theApp->ECServerHandler) {
+				theApp->ECServerHandler->WriteMetrics(writer);
+			}
+		}
+	}
+
+	char header[256];
+	snprintf(header, sizeof(header),
+		"HTTP/1.1 %s\r\n"
+		"Content-Type: %s\r\n"
+		"Content-Length: %u\r\n"
+		"Cache-Control: no-cache\r\n"
+		"Connection: close\r\n"
+		"\r\n",
+		status, type, (unsigned)body.size());
+
+	m_response = header;
+	if (!head) {
+		m_response += body;
+	}
+	m_request.clear();
+
+	SendPending();
+}
+
+
+void CMetricsSocket::SendPending()
+{
+	uint32 count;
+	while (m_sent < m_response.size()
+		&& (count = Write(m_response.data() + m_sent, m_response.size() - m_sent)) > 0) {
+		m_sent += count;
+	}
+
+	if (LastError()) {
+		Finish();
+	}
+#ifndef ASIO_SOCKETS
+	// Asio writes in the background and calls OnSend when done
+	else if (m_sent == m_response.size()) {
+		Finish();
+	}
+#endif
+}
+
+
+//-------------------- CMetricsListener --------------------
+
+CMetricsListener::CMetricsListener(const amuleIPV4Address& addr, CMetricsServer* server)
+	: CLibSocketServer(addr, MULE_SOCKET_REUSEADDR),
+	  m_server(server)
+{
+}
+
+
+void CMetricsListener::OnAccept()
+{
+	while (SocketAvailable()) {
+		CMetricsSocket* socket = new CMetricsSocket(m_server);
+		if (!AcceptWith(*socket, false)) {
+			delete socket;
+			break;
+		}
+
+		if (!m_server->AddSocket(socket)) {
+			socket->Destroy();
+		}
+	}
+}
+
+
+//-------------------- CMetricsServer --------------------
+
+#ifndef ASIO_SOCKETS
+BEGIN_EVENT_TABLE(CMetricsServer, wxEvtHandler)
+	EVT_SOCKET(METRICS_SERVER_ID, CMetricsServer::OnServerEvent)
+	EVT_SOCKET(METRICS_SOCKET_ID, CMetricsServer::OnSocketEvent)
+END_EVENT_TABLE()
+#endif
+
+
+CMetricsServer::CMetricsServer(const amuleIPV4Address& addr)
+{
+	m_listener = new CMetricsListener(addr, this);
+#ifndef ASIO_SOCKETS
+	m_listener->SetEventHandler(*this, METRICS_SERVER_ID);
+	m_listener->SetNotify(wxSOCKET_CONNECTION_FLAG);
+#endif
+	m_listener->Notify(true);
+
+	if (m_listener->IsOk()) {
+		AddLogLineN(CFormat(wxT("*** TCP socket (Metrics) listening on %s:%d")) % addr.IPAddress() % addr.Service());
+	} else {
+		AddLogLineC(CFormat(_("Could not listen for metrics requests at %s:%d!")) % addr.IPAddress() % addr.Service());
+	}
+}
+
+
+CMetricsServer::~CMetricsServer()
+{
+	KillAllSockets();
+	delete m_listener;
+}
+
+
+bool CMetricsServer::IsOk() const
+{
+	return m_listener->IsOk();
+}
+
+
+bool CMetricsServer::AddSocket(CMetricsSocket* socket)
+{
+	// Drop scrapers that never finished their request
+	const uint32 now = GetTickCount();
+	std::vector<CMetricsSocket*> stale;
+	for (SocketSet::iterator it = m_sockets.begin(); it != m_sockets.end(); ++it) {
+		if (now - (*it)->GetStarted() > METRICS_TIMEOUT) {
+			stale.push_back(*it);
+		}
+	}
+	for (size_t i = 0; i < stale.size(); ++i) {
+		stale[i]->Finish();
+	}
+
+	if (m_sockets.size() >= METRICS_MAX_SOCKETS) {
+		return false;
+	}
+
+	m_sockets.insert(socket);
+	return true;
+}
+
+
+void CMetricsServer::RemoveSocket(CMetricsSocket* socket)
+{
+	m_sockets.erase(socket);
+}
+
+
+void CMetricsServer::KillAllSockets()
+{
+	SocketSet::iterator it = m_sockets.begin();
+	while (it != m_sockets.end()) {
+		CMetricsSocket* socket = *(it++);
+		socket->Destroy();
+	}
+	m_sockets.clear();
+}
+
+
+#ifndef ASIO_SOCKETS
+void CMetricsServer::OnServerEvent(wxSocketEvent& WXUNUSED(event))
+{
+	m_listener->OnAccept();
+}
+
+
+void CMetricsServer::OnSocketEvent(wxSocketEvent& event)
+{
+	CMetricsSocket* socket = dynamic_cast<CMetricsSocket*>(event.GetSocket());
+	wxCHECK_RET(socket, wxT("Metrics socket event with a NULL socket!"));
+
+	switch (event.GetSocketEvent()) {
+		case wxSOCKET_INPUT:
+			socket->OnReceive(0);
+			break;
+		case wxSOCKET_OUTPUT:
+			socket->OnSend(0);
+			break;
+		case wxSOCKET_LOST:
+			socket->OnLost();
+			break;
+		default:
+			break;
+	}
+}
+#endif
+// File_checked_for_headers
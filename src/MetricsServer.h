@@ -0,0 +1,131 @@
+//
+// This file is part of the aMule Project.
+//
+// Copyright (c) 2003-2011 aMule Team ( admin@amule.org / http://www.amule.org )
+//
+// Any parts of this program derived from the xMule, lMule or eMule project,
+// or contributed by third-party developers are copyrighted by their
+// respective authors.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA
+//
+
+
+#ifndef METRICSSERVER_H
+#define METRICSSERVER_H
+
+#include "LibSocket.h"		// Needed for CLibSocket
+
+#include <wx/event.h>		// Needed for wxEvtHandler
+
+#include <set>
+#include <string>
+
+class amuleIPV4Address;
+class CMetricsServer;
+
+#ifndef ASIO_SOCKETS
+class wxSocketEvent;
+#endif
+
+
+/**
+ * A scrape of the metrics endpoint.
+ *
+ * Reads one request, answers it and closes the connection.
+ */
+class CMetricsSocket : public CLibSocket
+{
+public:
+	CMetricsSocket(CMetricsServer* server);
+
+	//! Time the connection was accepted, in ms.
+	uint32 GetStarted() const	{ return m_started; }
+
+	//! Closes the connection and lets the server forget it.
+	void Finish();
+
+	virtual void OnReceive(int errorCode);
+	virtual void OnSend(int errorCode);
+	virtual void OnLost();
+
+private:
+	//! Builds the response once the request is complete.
+	void Respond();
+	//! Writes as much of the response as possible.
+	void SendPending();
+
+	CMetricsServer*	m_server;
+	uint32		m_started;
+	std::string	m_request;
+	std::string	m_response;
+	size_t		m_sent;
+	bool		m_responding;
+};
+
+
+/**
+ * Listener of the metrics endpoint.
+ */
+class CMetricsListener : public CLibSocketServer
+{
+public:
+	CMetricsListener(const amuleIPV4Address& addr, CMetricsServer* server);
+
+	void OnAccept();
+
+private:
+	CMetricsServer*	m_server;
+};
+
+
+/**
+ * Serves the core statistics in the Prometheus text format.
+ *
+ * Every GET of /metrics is answered with the statistics tree counters
+ * (see CStatistics::WriteMetrics), the packet and latency counters
+ * of CMetrics and the EC compression counters (see
+ * ExternalConn::WriteMetrics). The endpoint has no authentication, so it listens on the
+ * loopback interface unless configured otherwise.
+ */
+class CMetricsServer : public wxEvtHandler
+{
+public:
+	CMetricsServer(const amuleIPV4Address& addr);
+	~CMetricsServer();
+
+	//! False if the port could not be bound.
+	bool IsOk() const;
+
+	//! Takes a new connection, dropping stale ones to stay within limits.
+	bool AddSocket(CMetricsSocket* socket);
+	void RemoveSocket(CMetricsSocket* socket);
+	void KillAllSockets();
+
+private:
+	typedef std::set<CMetricsSocket*> SocketSet;
+	SocketSet		m_sockets;
+	CMetricsListener*	m_listener;
+
+#ifndef ASIO_SOCKETS
+	// event handlers (these functions should _not_ be virtual)
+	void OnServerEvent(wxSocketEvent& event);
+	void OnSocketEvent(wxSocketEvent& event);
+	DECLARE_EVENT_TABLE()
+#endif
+};
+
+#endif // METRICSSERVER_H
+// File_checked_for_headers
@@ -0,0 +1,119 @@
+//
+// This file is part of the aMule Project.
+//
+// Copyright (c) 2003-2011 aMule Team ( admin@amule.org / http://www.amule.org )
+//
+// Any parts of this program derived from the xMule, lMule or eMule project,
+// or contributed by third-party developers are copyrighted by their
+// respective authors.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA
+//
+
+#ifndef MULEATOMIC_H
+#define MULEATOMIC_H
+
+// Like SmartPtr.h, std::atomic is used when building as C++11 or later.
+// Older GCC compatible compilers get the __sync builtins, anything else
+// falls back to a mutex, which is correct but not lock-free.
+
+#if __cplusplus >= 201103L
+#	include <atomic>
+#	define MULE_ATOMIC_STD 1
+#elif defined(__GNUC__)
+#	define MULE_ATOMIC_SYNC 1
+#else
+#	include <wx/thread.h>	// Needed for wxMutex
+#endif
+
+
+/**
+ * An integer which can be accessed by several threads without a lock.
+ *
+ * Loads have acquire and stores have release semantics, so a value
+ * published with Store is seen together with everything written before.
+ */
+template <typename T>
+class CAtomic
+{
+public:
+	CAtomic(T value = T())
+		: m_value(value)
+	{}
+
+#if defined(MULE_ATOMIC_STD)
+	T	Load() const		{ return m_value.load(std::memory_order_acquire); }
+	void	Store(T value)		{ m_value.store(value, std::memory_order_release); }
+	T	FetchAdd(T value)	{ return m_value.fetch_add(value, std::memory_order_acq_rel); }
+
+	/**
+	 * Replaces the value with 'desired' if it equals 'expected'.
+	 *
+	 * @return True on success, otherwise 'expected' is set to the current value.
+	 */
+	bool	CompareExchange(T& expected, T desired)
+	{
+		return m_value.compare_exchange_weak(expected, desired, std::memory_order_acq_rel, std::memory_order_acquire);
+	}
+
+private:
+	std::atomic<T>	m_value;
+#elif defined(MULE_ATOMIC_SYNC)
+	T	Load() const		{ T value = m_value; __sync_synchronize(); return value; }
+	void	Store(T value)		{ __sync_synchronize(); m_value = value; }
+	T	FetchAdd(T value)	{ return __sync_fetch_and_add(&m_value, value); }
+
+	bool	CompareExchange(T& expected, T desired)
+	{
+		const T previous = __sync_val_compare_and_swap(&m_value, expected, desired);
+		if (previous == expected) {
+			return true;
+		}
+
+		expected = previous;
+		return false;
+	}
+
+private:
+	volatile T	m_value;
+#else
+	T	Load() const		{ wxMutexLocker lock(m_lock); return m_value; }
+	void	Store(T value)		{ wxMutexLocker lock(m_lock); m_value = value; }
+	T	FetchAdd(T value)	{ wxMutexLocker lock(m_lock); T previous = m_value; m_value += value; return previous; }
+
+	bool	CompareExchange(T& expected, T desired)
+	{
+		wxMutexLocker lock(m_lock);
+		if (m_value == expected) {
+			m_value = desired;
+			return true;
+		}
+
+		expected = m_value;
+		return false;
+	}
+
+private:
+	mutable wxMutex	m_lock;
+	T		m_value;
+#endif
+
+	//! A CAtomic is neither copyable nor assignable.
+	CAtomic(const CAtomic&);
+	CAtomic& operator=(const CAtomic&);
+};
+
+#endif // MULEATOMIC_H
+// File_checked_for_headers
@@ -35,6 +35,7 @@
 #include <common/StringFunctions.h>     // Needed for unicode2char
 #include "Proxy.h"                      // Needed for CDatagramSocketProxy
 #include "Logger.h"                     // Needed for AddDebugLogLine{C,N}
+#include "Metrics.h"                    // Needed for CMetrics
 #include "UploadBandwidthThrottler.h"
 #include "EncryptedDatagramSocket.h"
 #include "OtherFunctions.h"
@@ -226,6 +227,8 @@ void CMuleUDPSocket::SendPacket(CPacket* packet, uint32 IP, uint16 port, bool bE
 		return;
 	}
 
+	CMetrics::CountPacket(CMetrics::Sent, CMetrics::TransportUDP, packet->GetProtocol(), packet->GetOpCode());
+
 	AddDebugLogLineN(logMuleUDP, (m_name + wxT(": Packet queued ("))
 		<< Uint32_16toStringIP_Port(IP, port) << wxT("): ") << packet->GetPacketSize() << wxT("b"));
 
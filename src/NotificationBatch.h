@@ -0,0 +1,198 @@
+//
+// This file is part of the aMule Project.
+//
+// Copyright (c) 2003-2011 aMule Team ( admin@amule.org / http://www.amule.org )
+//
+// Any parts of this program derived from the xMule, lMule or eMule project,
+// or contributed by third-party developers are copyrighted by their
+// respective authors.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA
+//
+
+#ifndef NOTIFICATIONBATCH_H
+#define NOTIFICATIONBATCH_H
+
+#include "Types.h"		// Needed for uint32
+
+#include <deque>
+#include <map>
+#include <vector>
+
+
+/**
+ * Collects the additions and updates of the items of a list, to hand them
+ * to a slow receiver, such as a list control of the GUI, as ranges rather
+ * than one at a time.
+ *
+ * Add and Update queue an item, Flush delivers the queued additions as one
+ * range and then the queued updates as another. An item is queued at most
+ * once: an update of an item still queued for addition is dropped, since
+ * the item is shown as it is by then, and so are repeated updates. Remove
+ * drops an item, which is about to be deleted, from the queue.
+ *
+ * A flush delivers at most the given number of items, the oldest first.
+ * The receiver thus has a bounded amount of work per call, and the rest
+ * waits for the next flush.
+ *
+ * Not thread-safe, meant to be used from the core thread only.
+ */
+template <typename T>
+class CNotificationBatch
+{
+public:
+	typedef std::vector<T> ItemList;
+	//! Receives a range of items.
+	typedef void (*DeliverFunc)(const ItemList& items);
+
+	/**
+	 * Constructor.
+	 *
+	 * @param added Receives the added items.
+	 * @param updated Receives the updated items, may be NULL if Update is not used.
+	 * @param maxPerFlush The number of items delivered by a flush at most.
+	 */
+	CNotificationBatch(DeliverFunc added, DeliverFunc updated, size_t maxPerFlush)
+		: m_added(added),
+		  m_updated(updated),
+		  m_maxPerFlush(maxPerFlush),
+		  m_nextSequence(0)
+	{
+	}
+
+	//! Queues an addition of the item.
+	void Add(const T& item)
+	{
+		std::pair<typename QueuedMap::iterator, bool> result = m_queued.insert(std::make_pair(item, CQueued(true, m_nextSequence)));
+		if (result.second) {
+			m_order.push_back(std::make_pair(item, m_nextSequence++));
+		} else {
+			// An addition replaces a queued update
+			result.first->second.add = true;
+		}
+	}
+
+	//! Queues an update of the item, unless it is already queued.
+	void Update(const T& item)
+	{
+		if (m_queued.insert(std::make_pair(item, CQueued(false, m_nextSequence))).second) {
+			m_order.push_back(std::make_pair(item, m_nextSequence++));
+		}
+	}
+
+	//! Drops the item from the queue.
+	void Remove(const T& item)
+	{
+		// The entry in m_order is skipped by Flush
+		m_queued.erase(item);
+	}
+
+	/**
+	 * Drops the items for which the predicate returns true.
+	 *
+	 * This is meant for items about to be deleted as a group.
+	 */
+	template <typename PREDICATE>
+	void RemoveIf(PREDICATE predicate)
+	{
+		typename QueuedMap::iterator it = m_queued.begin();
+		while (it != m_queued.end()) {
+			if (predicate(it->first)) {
+				m_queued.erase(it++);
+			} else {
+				++it;
+			}
+		}
+	}
+
+	//! Drops all queued items.
+	void Clear()
+	{
+		m_queued.clear();
+		m_order.clear();
+	}
+
+	/**
+	 * Delivers the oldest queued items.
+	 *
+	 * @return True if more items are left for the next flush.
+	 */
+	bool Flush()
+	{
+		ItemList added;
+		ItemList updated;
+
+		// Taken out first, the receivers may queue new items
+		while (!m_order.empty() && added.size() + updated.size() < m_maxPerFlush) {
+			const OrderEntry entry = m_order.front();
+			m_order.pop_front();
+
+			// Skips removed items, and the old entries of items queued
+			// anew after a removal
+			typename QueuedMap::iterator it = m_queued.find(entry.first);
+			if (it == m_queued.end() || it->second.sequence != entry.second) {
+				continue;
+			}
+
+			(it->second.add ? added : updated).push_back(entry.first);
+			m_queued.erase(it);
+		}
+
+		if (!added.empty()) {
+			m_added(added);
+		}
+		if (!updated.empty()) {
+			m_updated(updated);
+		}
+
+		return !m_queued.empty();
+	}
+
+	//! Returns the number of queued items.
+	size_t GetCount() const	{ return m_queued.size(); }
+
+private:
+	struct CQueued
+	{
+		CQueued(bool a, uint32 s)
+			: add(a), sequence(s)
+		{
+		}
+
+		//! True if queued for addition, false for an update.
+		bool	add;
+		//! Identifies the entry of the item in m_order.
+		uint32	sequence;
+	};
+
+	typedef std::map<T, CQueued> QueuedMap;
+	typedef std::pair<T, uint32> OrderEntry;
+
+	QueuedMap	m_queued;
+	//! The queued items in the order they were queued.
+	std::deque<OrderEntry>	m_order;
+
+	DeliverFunc	m_added;
+	DeliverFunc	m_updated;
+	size_t		m_maxPerFlush;
+	uint32		m_nextSequence;
+
+	//! A CNotificationBatch is neither copyable nor assignable.
+	CNotificationBatch(const CNotificationBatch&);
+	CNotificationBatch& operator=(const CNotificationBatch&);
+};
+
+#endif // NOTIFICATIONBATCH_H
+// File_checked_for_headers
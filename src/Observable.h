@@ -141,6 +141,15 @@ protected:
 	void NotifyObservers( const EventType& e, ObserverType* o = NULL );
 
 
+	/**
+	 * Notifies all observers but one of an event.
+	 *
+	 * @param e The event to be sent.
+	 * @param skip The observer left out, or NULL to notify all of them.
+	 */
+	void NotifyObserversExcept( const EventType& e, ObserverType* skip );
+
+
 	/**
 	 * This function removes all observers from this object.
 	 *
@@ -283,6 +292,22 @@ void CObservable<EventType>::NotifyObservers( const EventType& e, ObserverType*
 }
 
 
+template <typename EventType>
+void CObservable<EventType>::NotifyObserversExcept( const EventType& e, ObserverType* skip )
+{
+	wxMutexLocker lock(m_mutex);
+
+	myIteratorType it = m_list.begin();
+	for ( ; it != m_list.end(); ) {
+		ObserverType* o = *it++;
+		if ( o != skip ) {
+			CMutexUnlocker unlocker(m_mutex);
+			o->ReceiveNotification( this, e );
+		}
+	}
+}
+
+
 template <typename EventType>
 void CObservable<EventType>::RemoveAllObservers()
 {
@@ -28,6 +28,9 @@
 
 #include "Observable.h"
 
+#include <algorithm>		// Needed for std::find
+#include <vector>		// Needed for std::vector
+
 
 
 template <typename ValueType>
@@ -142,6 +145,15 @@ private:
  * The main purpose of this class is to allow another class to follow
  * a list or queue, regardles of changes in actual order of the items
  * and regardles of changes to the contents.
+ *
+ * Insertions made through NotifyInserted are queued and delivered by
+ * FlushNotifications as one event, so that loading thousands of values
+ * results in a single event rather than one event per value. Removals
+ * are delivered right away, since the values are usually deleted right
+ * after, but cancel out with a still queued insertion.
+ *
+ * Queuing is not thread-safe, the Notify* and FlushNotifications
+ * functions are meant to be called from the core thread only.
  */
 template <typename ValueType>
 class CObservableQueue : public CObservable< CQueueEvent<ValueType> >
@@ -154,6 +166,15 @@ public:
 	 */
 	virtual ~CObservableQueue();
 
+	/**
+	 * Delivers the queued insertions.
+	 *
+	 * Meant to be called once per core tick. It is also called whenever
+	 * MAX_QUEUED values are waiting, to bound both the memory used and
+	 * the size of the batches observers have to handle at once.
+	 */
+	void FlushNotifications();
+
 protected:
 	typedef CQueueEvent< ValueType > EventType;
 	typedef CObserver< EventType > ObserverType;
@@ -162,6 +183,9 @@ protected:
 
 	/**
 	 * Sends a STARTING event to new observers.
+	 *
+	 * Queued events are delivered to the other observers first, since
+	 * the new one receives the current contents with INITIAL.
 	 */
 	virtual void ObserverAdded( ObserverType* );
 
@@ -169,6 +193,34 @@ protected:
 	 * Sends a STOPPING event to removed observers.
 	 */
 	virtual void ObserverRemoved( ObserverType* );
+
+	/**
+	 * Queues an INSERTED event for the value.
+	 */
+	void NotifyInserted( const ValueType& value );
+
+	/**
+	 * Sends a REMOVED event for the value.
+	 *
+	 * If the insertion of the value is still queued, both are dropped
+	 * instead, as the observers never learned of the value.
+	 */
+	void NotifyRemoved( const ValueType& value );
+
+	/**
+	 * Drops all queued events and sends a CLEARED event.
+	 */
+	void NotifyCleared();
+
+private:
+	//! Queued values are delivered early once there are this many.
+	enum { MAX_QUEUED = 1024 };
+
+	//! Delivers the queued events to all observers but 'skip'.
+	void DeliverQueued( ObserverType* skip );
+
+	//! Values with a queued INSERTED event, in order of insertion.
+	ValueList m_inserted;
 };
 
 
@@ -328,13 +380,67 @@ CObservableQueue<ValueType>::~CObservableQueue()
 }
 
 
+template <typename ValueType>
+void CObservableQueue<ValueType>::FlushNotifications()
+{
+	DeliverQueued( NULL );
+}
+
+
+template <typename ValueType>
+void CObservableQueue<ValueType>::DeliverQueued( ObserverType* skip )
+{
+	// Swapped out first, observers may cause new events
+	if ( !m_inserted.empty() ) {
+		ValueList inserted;
+		inserted.swap( m_inserted );
+		this->NotifyObserversExcept( EventType( EventType::INSERTED, &inserted ), skip );
+	}
+}
+
+
 template <typename ValueType>
 void CObservableQueue<ValueType>::ObserverAdded( ObserverType* o )
 {
+	DeliverQueued( o );
+
 	this->NotifyObservers( EventType( EventType::STARTING ), o );
 }
 
 
+template <typename ValueType>
+void CObservableQueue<ValueType>::NotifyInserted( const ValueType& value )
+{
+	m_inserted.push_back( value );
+
+	if ( m_inserted.size() >= MAX_QUEUED ) {
+		FlushNotifications();
+	}
+}
+
+
+template <typename ValueType>
+void CObservableQueue<ValueType>::NotifyRemoved( const ValueType& value )
+{
+	// Most likely the last one added, if it was added recently at all
+	typename ValueList::reverse_iterator it = std::find( m_inserted.rbegin(), m_inserted.rend(), value );
+	if ( it != m_inserted.rend() ) {
+		m_inserted.erase( it.base() - 1 );
+	} else {
+		this->NotifyObservers( EventType( EventType::REMOVED, value ) );
+	}
+}
+
+
+template <typename ValueType>
+void CObservableQueue<ValueType>::NotifyCleared()
+{
+	m_inserted.clear();
+
+	this->NotifyObservers( EventType( EventType::CLEARED ) );
+}
+
+
 template <typename ValueType>
 void CObservableQueue<ValueType>::ObserverRemoved( ObserverType* o )
 {
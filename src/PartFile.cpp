@@ -74,6 +74,8 @@
 #include "FileArea.h"		// Needed for CFileArea
 #include "ScopedPtr.h"		// Needed for CScopedArray
 #include "CorruptionBlackBox.h"
+#include "Metrics.h"		// Needed for CMetricsTimer
+#include "TimerWheel.h"		// Needed for CTimerWheel
 
 #include "kademlia/kademlia/Kademlia.h"
 #include "kademlia/kademlia/Search.h"
@@ -263,6 +265,9 @@ CPartFile::~CPartFile()
 		SavePartFile();
 	}
 
+	if (m_bufferFlushTimer) {
+		theApp->timerwheel->RemoveTimer(m_bufferFlushTimer);
+	}
 	DeleteContents(m_BufferedData_list);
 	delete m_CorruptionBlackBox;
 
@@ -321,6 +326,9 @@ uint8 CPartFile::LoadPartFile(const CPath& in_directory, const CPath& filename,
 	std::map<uint16, Gap_Struct*> gap_map; // Slugfiller
 	transferred = 0;
 
+	// Loading may happen on a worker thread, don't show the file yet
+	m_loading = true;
+
 	m_partmetfilename = filename;
 	m_CorruptionBlackBox->SetPartFileInfo(GetFileName().GetPrintable(), m_partmetfilename.RemoveAllExt().GetPrintable());
 	m_filePath = in_directory;
@@ -672,7 +680,7 @@ uint8 CPartFile::LoadPartFile(const CPath& in_directory, const CPath& filename,
 	try {
 		// SLUGFILLER: SafeHash - final safety, make sure any missing part of the file is gap
 		if (m_hpartfile.GetLength() < GetFileSize())
-			AddGap(m_hpartfile.GetLength(), GetFileSize()-1);
+			m_gaplist.AddGap(m_hpartfile.GetLength(), GetFileSize()-1);
 		// Goes both ways - Partfile should never be too large
 		if (m_hpartfile.GetLength() > GetFileSize()) {
 			AddDebugLogLineC(logPartFile, CFormat( wxT("Partfile \"%s\" is too large! Truncating %llu bytes.") ) % GetFileName() % (m_hpartfile.GetLength() - GetFileSize()));
@@ -701,7 +709,7 @@ uint8 CPartFile::LoadPartFile(const CPath& in_directory, const CPath& filename,
 	}
 
 	if (m_gaplist.IsComplete()) { // is this file complete already?
-		CompleteFile(false);
+		m_completeOnLoad = true;
 		return true;
 	}
 
@@ -714,11 +722,9 @@ uint8 CPartFile::LoadPartFile(const CPath& in_directory, const CPath& filename,
 				AddLogLineN(CFormat( _("WARNING: %s might be corrupted (%i)") )
 					% m_PartPath
 					% (m_lastDateChanged - file_date) );
-				// rehash
+				// rehash, once the file is in the download queue
 				SetStatus(PS_WAITINGFORHASH);
-
-				CPath partFileName = m_partmetfilename.RemoveExt();
-				CThreadScheduler::AddTask(new CHashingTask(m_filePath, partFileName, this));
+				m_rehashOnLoad = true;
 			}
 		}
 	}
@@ -734,6 +740,21 @@ uint8 CPartFile::LoadPartFile(const CPath& in_directory, const CPath& filename,
 }
 
 
+void CPartFile::FinishLoading()
+{
+	m_loading = false;
+
+	if (m_completeOnLoad) {
+		m_completeOnLoad = false;
+		CompleteFile(false);
+	} else if (m_rehashOnLoad) {
+		m_rehashOnLoad = false;
+		CPath partFileName = m_partmetfilename.RemoveExt();
+		CThreadScheduler::AddTask(new CHashingTask(m_filePath, partFileName, this));
+	}
+}
+
+
 bool CPartFile::SavePartFile(bool Initial)
 {
 	switch (status) {
@@ -1365,9 +1386,9 @@ uint32 CPartFile::Process(uint32 reducedownload/*in percent*/,uint8 m_icounter)
 	uint16 old_trans;
 	uint32 dwCurTick = ::GetTickCount();
 
-	// If buffer size exceeds limit, or if not written within time limit, flush data
-	if (	(m_nTotalBufferData > thePrefs::GetFileBufferSize()) ||
-		(dwCurTick > (m_nLastBufferFlushTime + BUFFER_TIME_LIMIT))) {
+	// If buffer size exceeds limit, flush data. Data not written within
+	// the time limit is flushed by m_bufferFlushTimer.
+	if (m_nTotalBufferData > thePrefs::GetFileBufferSize()) {
 		FlushBuffer();
 	}
 
@@ -1674,18 +1695,23 @@ void CPartFile::AddSources(CMemFile& sources,uint32 serverip, uint16 serverport,
 			continue;
 		}
 
-		if(thePrefs::GetMaxSourcePerFile() > GetSourceCount()) {
+		if(thePrefs::GetMaxSourcePerFile() > GetSourceCount() + m_pendingSources.size()) {
 			++debug_possiblesources;
-			CUpDownClient* newsource = new CUpDownClient(port,userid,serverip,serverport,this, true, true);
-
-			newsource->SetSourceFrom((ESourceFrom)origin);
-			newsource->SetConnectOptions(byCryptOptions, true, false);
-
-			if ((byCryptOptions & 0x80) != 0) {
-				newsource->SetUserHash(achUserHash);
+			CPendingSource source;
+			source.userID = userid;
+			source.port = port;
+			source.serverIP = serverip;
+			source.serverPort = serverport;
+			source.ed2kID = true;
+			source.sourceFrom = origin;
+			source.cryptOptions = byCryptOptions;
+			source.hasConnectOptions = true;
+			source.hasUserHash = (byCryptOptions & 0x80) != 0;
+			if (source.hasUserHash) {
+				source.userHash = achUserHash;
 			}
 
-			theApp->downloadqueue->CheckAndAddSource(this,newsource);
+			QueuePendingSource(source);
 		} else {
 			AddDebugLogLineN(logPartFile, wxT("Consuming a packet because of max sources reached"));
 			// Since we may receive multiple search source UDP results we have to "consume" all data of that packet
@@ -2200,6 +2226,9 @@ void CPartFile::PerformFileComplete()
 
 void  CPartFile::RemoveAllSources(bool bTryToSwap)
 {
+	m_pendingSources.clear();
+	m_pendingSourceKeys.clear();
+
 	for( SourceSet::iterator it = m_SrcList.begin(); it != m_SrcList.end();) {
 		CUpDownClient* cur_src = it++->GetClient();
 		if (bTryToSwap) {
@@ -2592,77 +2621,42 @@ CPacket *CPartFile::CreateSrcInfoPacket(const CUpDownClient* forClient, uint8 by
 
 	data.WriteHash(m_abyFileHash);
 	data.WriteUInt16(nCount);
-	bool bNeeded;
-	for (SourceSet::iterator it = m_SrcList.begin(); it != m_SrcList.end(); ++it ) {
-		bNeeded = false;
-		CUpDownClient* cur_src = it->GetClient();
-
-		int state = cur_src->GetDownloadState();
-		int valid = ( state == DS_DOWNLOADING ) || ( state == DS_ONQUEUE && !cur_src->IsRemoteQueueFull() );
 
-		if ( cur_src->HasLowID() || !valid ) {
-			continue;
-		}
+	const SrcInfoCache& sources = GetSrcInfoCache();
+	for (SrcInfoCache::const_iterator it = sources.begin(); it != sources.end(); ++it ) {
+		bool bNeeded = false;
+		const BitVector& srcstatus = it->partStatus;
 
 		// only send source which have needed parts for this client if possible
-		const BitVector& srcstatus = cur_src->GetPartStatus();
-		if ( !srcstatus.empty() ) {
-			//wxASSERT(srcstatus.size() == GetPartCount()); // Obviously!
-			if (srcstatus.size() != GetPartCount()) {
-				continue;
-			}
-			if ( KnowNeededParts ) {
-				// only send sources which have needed parts for this client
-				for (int x = 0; x < GetPartCount(); ++x) {
-					if (srcstatus.get(x) && !reqstatus.get(x)) {
-						bNeeded = true;
-						break;
-					}
-				}
-			} else {
-				// if we don't know the need parts for this client,
-				// return any source currently a client sends it's
-				// file status only after it has at least one complete part
-				if (srcstatus.size() != GetPartCount()) {
-					continue;
+		if ( KnowNeededParts ) {
+			// only send sources which have needed parts for this client
+			for (int x = 0; x < GetPartCount(); ++x) {
+				if (srcstatus.get(x) && !reqstatus.get(x)) {
+					bNeeded = true;
+					break;
 				}
-				for (int x = 0; x < GetPartCount(); ++x){
-					if (srcstatus.get(x)) {
-						bNeeded = true;
-						break;
-					}
+			}
+		} else {
+			// if we don't know the need parts for this client,
+			// return any source currently a client sends it's
+			// file status only after it has at least one complete part
+			for (int x = 0; x < GetPartCount(); ++x){
+				if (srcstatus.get(x)) {
+					bNeeded = true;
+					break;
 				}
 			}
 		}
+
 		if(bNeeded) {
 			++nCount;
 			uint32 dwID;
 			if(forClient->GetSourceExchange1Version() > 2) {
-				dwID = cur_src->GetUserIDHybrid();
+				dwID = it->userIDHybrid;
 			} else {
-				dwID = wxUINT32_SWAP_ALWAYS(cur_src->GetUserIDHybrid());
-			}
-			data.WriteUInt32(dwID);
-			data.WriteUInt16(cur_src->GetUserPort());
-			data.WriteUInt32(cur_src->GetServerIP());
-			data.WriteUInt16(cur_src->GetServerPort());
-
-			if (byUsedVersion >= 2) {
-			    data.WriteHash(cur_src->GetUserHash());
-			}
-
-			if (byUsedVersion >= 4){
-				// CryptSettings - SourceExchange V4
-				// 5 Reserved (!)
-				// 1 CryptLayer Required
-				// 1 CryptLayer Requested
-				// 1 CryptLayer Supported
-				const uint8 uSupportsCryptLayer	= cur_src->SupportsCryptLayer() ? 1 : 0;
-				const uint8 uRequestsCryptLayer	= cur_src->RequestsCryptLayer() ? 1 : 0;
-				const uint8 uRequiresCryptLayer	= cur_src->RequiresCryptLayer() ? 1 : 0;
-				const uint8 byCryptOptions = (uRequiresCryptLayer << 2) | (uRequestsCryptLayer << 1) | (uSupportsCryptLayer << 0);
-				data.WriteUInt8(byCryptOptions);
+				dwID = wxUINT32_SWAP_ALWAYS(it->userIDHybrid);
 			}
+			WriteSrcInfoEntry(data, *it, dwID, byUsedVersion);
 
 			if (nCount > 500) {
 				break;
@@ -2685,6 +2679,38 @@ CPacket *CPartFile::CreateSrcInfoPacket(const CUpDownClient* forClient, uint8 by
 	return result;
 }
 
+void CPartFile::BuildSrcInfoCache(SrcInfoCache& cache) const
+{
+	if (!IsPartFile()) {
+		CKnownFile::BuildSrcInfoCache(cache);
+		return;
+	}
+
+	for (SourceSet::const_iterator it = m_SrcList.begin(); it != m_SrcList.end(); ++it ) {
+		const CUpDownClient* cur_src = it->GetClient();
+
+		int state = cur_src->GetDownloadState();
+		int valid = ( state == DS_DOWNLOADING ) || ( state == DS_ONQUEUE && !cur_src->IsRemoteQueueFull() );
+
+		if ( cur_src->HasLowID() || !valid ) {
+			continue;
+		}
+
+		// Sources which haven't sent their file status yet are never sent
+		const BitVector& srcstatus = cur_src->GetPartStatus();
+		//wxASSERT(srcstatus.size() == GetPartCount()); // Obviously!
+		if ( srcstatus.size() != GetPartCount() ) {
+			continue;
+		}
+
+		cache.push_back(CSrcInfoEntry());
+		CSrcInfoEntry& entry = cache.back();
+		FillSrcInfoEntry(entry, cur_src);
+		entry.partStatus = srcstatus;
+	}
+}
+
+
 void CPartFile::AddClientSources(CMemFile* sources, unsigned nSourceFrom, uint8 uClientSXVersion, bool bSourceExchange2, const CUpDownClient* /*pClient*/)
 {
 	// Kad reviewed
@@ -2811,23 +2837,73 @@ void CPartFile::AddClientSources(CMemFile* sources, unsigned nSourceFrom, uint8
 			continue;
 		}
 
-		if(thePrefs::GetMaxSourcePerFile() > GetSourceCount()) {
-			CUpDownClient* newsource = new CUpDownClient(nPort,dwID,dwServerIP,nServerPort,this, (uPacketSXVersion < 3), true);
-			if (uPacketSXVersion > 1) {
-				newsource->SetUserHash(userHash);
+		if(thePrefs::GetMaxSourcePerFile() > GetSourceCount() + m_pendingSources.size()) {
+			CPendingSource source;
+			source.userID = dwID;
+			source.port = nPort;
+			source.serverIP = dwServerIP;
+			source.serverPort = nServerPort;
+			source.ed2kID = (uPacketSXVersion < 3);
+			source.sourceFrom = nSourceFrom;
+			source.cryptOptions = byCryptOptions;
+			source.hasConnectOptions = (uPacketSXVersion >= 4);
+			source.hasUserHash = (uPacketSXVersion > 1);
+			if (source.hasUserHash) {
+				source.userHash = userHash;
 			}
 
-			if (uPacketSXVersion >= 4) {
-				newsource->SetConnectOptions(byCryptOptions, true, false);
+			QueuePendingSource(source);
+		} else {
+			break;
+		}
+	}
+}
+
+
+void CPartFile::QueuePendingSource(const CPendingSource& source)
+{
+	// LowID sources are only unique together with their server
+	uint32 serverIP = IsLowID(source.userID) ? source.serverIP : 0;
+	std::pair<uint64, uint32> key(((uint64)source.userID << 16) | source.port, serverIP);
+
+	// Answers from several servers or clients often overlap
+	if (m_pendingSourceKeys.insert(key).second) {
+		m_pendingSources.push_back(source);
+	}
+}
+
+
+uint32 CPartFile::ProcessPendingSources(uint32 limit)
+{
+	uint32 processed = 0;
+
+	while (!m_pendingSources.empty() && processed < limit) {
+		const CPendingSource source = m_pendingSources.front();
+		m_pendingSources.pop_front();
+		++processed;
+
+		// The file may have been stopped or have filled up since the source was queued
+		if (!m_stopped && thePrefs::GetMaxSourcePerFile() > GetSourceCount()) {
+			CUpDownClient* newsource = new CUpDownClient(source.port, source.userID, source.serverIP, source.serverPort, this, source.ed2kID, true);
+
+			if (source.hasUserHash) {
+				newsource->SetUserHash(source.userHash);
 			}
 
-			newsource->SetSourceFrom((ESourceFrom)nSourceFrom);
-			theApp->downloadqueue->CheckAndAddSource(this,newsource);
+			if (source.hasConnectOptions) {
+				newsource->SetConnectOptions(source.cryptOptions, true, false);
+			}
 
-	} else {
-			break;
+			newsource->SetSourceFrom((ESourceFrom)source.sourceFrom);
+			theApp->downloadqueue->CheckAndAddSource(this, newsource);
 		}
 	}
+
+	if (m_pendingSources.empty()) {
+		m_pendingSourceKeys.clear();
+	}
+
+	return processed;
 }
 
 void CPartFile::UpdateAutoDownPriority()
@@ -2945,6 +3021,11 @@ uint32 CPartFile::WriteToBuffer(uint32 transize, uint8_t* data, uint64 start, ui
 	// Increment buffer size marker
 	m_nTotalBufferData += lenData;
 
+	// Make sure the data doesn't wait longer than the time limit
+	if (!m_bufferFlushTimer) {
+		m_bufferFlushTimer = theApp->timerwheel->AddTimer(MakeTimerWheelTask(this, &CPartFile::OnBufferFlushTimer), BUFFER_TIME_LIMIT);
+	}
+
 	// Mark this small section of the file as filled
 	FillGap(item->start, item->end);
 
@@ -2966,14 +3047,28 @@ uint32 CPartFile::WriteToBuffer(uint32 transize, uint8_t* data, uint64 start, ui
 	return lenData;
 }
 
+void CPartFile::OnBufferFlushTimer()
+{
+	// The timer has run out, its ID may be given to another one
+	m_bufferFlushTimer = 0;
+	FlushBuffer();
+}
+
+
 void CPartFile::FlushBuffer(bool fromAICHRecoveryDataAvailable)
 {
-	m_nLastBufferFlushTime = GetTickCount();
+	// Part files are also loaded by the converter thread, which never
+	// buffers data, so the wheel is only touched if there is a timer
+	if (m_bufferFlushTimer) {
+		theApp->timerwheel->RemoveTimer(m_bufferFlushTimer);
+		m_bufferFlushTimer = 0;
+	}
 
 	if (m_BufferedData_list.empty()) {
 		return;
 	}
 
+	CMetricsTimer metricsTimer(CMetrics::SubsystemPartFlush);
 
 	uint32 partCount = GetPartCount();
 	// Remember which parts need to be checked at the end of the flush
@@ -3260,6 +3355,8 @@ void CPartFile::SetStatus(uint8 in)
 	wxASSERT( in != PS_PAUSED && in != PS_INSUFFICIENT );
 
 	status = in;
+	// Completed files answer with their uploading clients instead
+	InvalidateSrcInfoCache();
 
 	if (theApp->IsRunning()) {
 		UpdateDisplayedInfo( true );
@@ -3502,6 +3599,7 @@ void CPartFile::ClientStateChanged( int oldState, int newState )
 bool CPartFile::AddSource( CUpDownClient* client )
 {
 	if (m_SrcList.insert(CCLIENTREF(client, wxT("CPartFile::AddSource"))).second) {
+		InvalidateSrcInfoCache();
 		theStats::AddFoundSource();
 		theStats::AddSourceOrigin(client->GetSourceFrom());
 		return true;
@@ -3514,6 +3612,7 @@ bool CPartFile::AddSource( CUpDownClient* client )
 bool CPartFile::DelSource( CUpDownClient* client )
 {
 	if (m_SrcList.erase(CCLIENTREF(client, wxEmptyString))) {
+		InvalidateSrcInfoCache();
 		theStats::RemoveSourceOrigin(client->GetSourceFrom());
 		theStats::RemoveFoundSource();
 		return true;
@@ -3628,6 +3727,12 @@ bool CPartFile::DelSource(CUpDownClient* client)
 
 void CPartFile::UpdateDisplayedInfo(bool force)
 {
+#ifndef CLIENT_GUI
+	if (m_loading) {
+		return;
+	}
+#endif
+
 	uint32 curTick = ::GetTickCount();
 
 	// Wait 1.5s between each redraw
@@ -3673,7 +3778,7 @@ void CPartFile::Init()
 	m_LastNoNeededCheck = 0;
 	m_iRating = 0;
 	m_nTotalBufferData = 0;
-	m_nLastBufferFlushTime = 0;
+	m_bufferFlushTimer = 0;
 	m_bPercentUpdated = false;
 	m_iGainDueToCompression = 0;
 	m_iLostDueToCorruption = 0;
@@ -3684,6 +3789,9 @@ void CPartFile::Init()
 	m_tActivated = 0;
 	m_is_A4AF_auto = false;
 	m_localSrcReqQueued = false;
+	m_loading = false;
+	m_completeOnLoad = false;
+	m_rehashOnLoad = false;
 	m_nCompleteSourcesTime = time(NULL);
 	m_nCompleteSourcesCount = 0;
 	m_nCompleteSourcesCountLo = 0;
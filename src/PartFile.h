@@ -33,6 +33,10 @@
 #include "OtherStructs.h"	// Needed for Requested_Block_Struct
 #include "DeadSourceList.h"	// Needed for CDeadSourceList
 #include "GapList.h"
+#include "TimerWheel.h"		// Needed for CTimerWheel::TimerID
+
+#include <deque>
+#include <set>
 
 class CSearchFile;
 class CMemFile;
@@ -110,6 +114,13 @@ public:
 
 	uint32	Process(uint32 reducedownload, uint8 m_icounter);
 	uint8	LoadPartFile(const CPath& in_directory, const CPath& filename, bool from_backup = false, bool getsizeonly = false);
+	/**
+	 * Completes or rehashes the file, if LoadPartFile found that necessary.
+	 *
+	 * Part files may be loaded on worker threads, so this is left until
+	 * the file has been added to the download queue.
+	 */
+	void	FinishLoading();
 	bool	SavePartFile(bool Initial = false);
 	void	PartFileHashFinished(CKnownFile* result);
 	bool	HashSinglePart(uint16 partnumber); // true = ok , false = corrupted
@@ -178,6 +189,18 @@ public:
 	virtual	CPacket* CreateSrcInfoPacket(const CUpDownClient* forClient, uint8 byRequestedVersion, uint16 nRequestedOptions);
 	void    AddClientSources(CMemFile* sources, unsigned nSourceFrom, uint8 uClientSXVersion, bool bSourceExchange2, const CUpDownClient* pClient = NULL);
 
+	/**
+	 * Creates the clients for sources queued by AddSources and AddClientSources.
+	 *
+	 * @param limit The maximum number of sources to process.
+	 * @return The number of sources processed.
+	 *
+	 * Source answers may hold hundreds of sources, so only the parsing and
+	 * the cheap checks are done when they arrive, while the clients are
+	 * created a few at a time by the download queue.
+	 */
+	uint32	ProcessPendingSources(uint32 limit);
+
 	bool	PreviewAvailable();
 	uint16	GetAvailablePartCount() const	{ return m_availablePartsCount; }
 	uint32	GetLastAnsweredTime() const	{ return m_ClientSrcAnswered; }
@@ -293,7 +316,44 @@ private:
 	//! A local list of sources that are invalid for this file.
 	CDeadSourceList	m_deadSources;
 
+	/**
+	 * Creates the source exchange snapshot from the sources of the download.
+	 */
+	virtual void	BuildSrcInfoCache(SrcInfoCache& cache) const;
+
+	/**
+	 * A source that passed the checks in AddSources or AddClientSources,
+	 * but for which no client has been created yet.
+	 */
+	struct CPendingSource {
+		uint32		userID;
+		uint16		port;
+		uint32		serverIP;
+		uint16		serverPort;
+		bool		ed2kID;
+		uint8		sourceFrom;
+		//! Only applied if hasConnectOptions is set.
+		uint8		cryptOptions;
+		bool		hasConnectOptions;
+		//! Only applied if hasUserHash is set.
+		CMD4Hash	userHash;
+		bool		hasUserHash;
+	};
+
+	/**
+	 * Queues a source for ProcessPendingSources, unless it is already queued.
+	 */
+	void	QueuePendingSource(const CPendingSource& source);
+
+	//! Sources waiting for their client to be created, oldest first.
+	std::deque<CPendingSource>	m_pendingSources;
+	//! The ID, port and server IP of each queued source, to drop duplicates.
+	std::set<std::pair<uint64, uint32> >	m_pendingSourceKeys;
+
 	class CCorruptionBlackBox* m_CorruptionBlackBox;
+
+	//! Flushes the buffered data which has been waiting for BUFFER_TIME_LIMIT.
+	void	OnBufferFlushTimer();
 #endif
 
 	uint16	m_notCurrentSources;
@@ -351,7 +411,8 @@ private:
 	std::list<class PartFileBufferedData*> m_BufferedData_list;
 
 	uint32 m_nTotalBufferData;
-	uint32 m_nLastBufferFlushTime;
+	//! Runs OnBufferFlushTimer while data is buffered, 0 otherwise.
+	CTimerWheel::TimerID m_bufferFlushTimer;
 
 	uint8	m_category;
 	uint32	m_nDlActiveTime;
@@ -363,6 +424,11 @@ private:
 	bool		m_hashsetneeded;
 	uint32		m_lastsearchtime;
 	bool		m_localSrcReqQueued;
+	//! Set from LoadPartFile until FinishLoading, the file is not shown meanwhile.
+	bool		m_loading;
+	//! What FinishLoading has to do.
+	bool		m_completeOnLoad;
+	bool		m_rehashOnLoad;
 
 #ifdef CLIENT_GUI
 	FileRatingList m_FileRatingList;
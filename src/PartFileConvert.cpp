@@ -431,6 +431,7 @@ ConvStatus CPartFileConvert::performConvertToeMule(const CPath& fileName)
 	Notify_ConvertUpdateProgress(100, _("Adding download and saving new partfile"));
 
 	theApp->downloadqueue->AddDownload(file, thePrefs::AddNewFilesPaused(), 0);
+	file->FinishLoading();
 	file->SavePartFile();
 
 	if (file->GetStatus(true) == PS_READY) {
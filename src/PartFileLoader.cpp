@@ -0,0 +1,169 @@
+//
+// This file is part of the aMule Project.
+//
+// Copyright (c) 2003-2011 aMule Team ( admin@amule.org / http://www.amule.org )
+//
+// Any parts of this program derived from the xMule, lMule or eMule project,
+// or contributed by third-party developers are copyrighted by their
+// respective authors.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA
+//
+
+#include "PartFileLoader.h"	// Interface declarations
+
+#include "MuleThread.h"		// Needed for CMuleThread
+#include "PartFile.h"		// Needed for CPartFile
+
+#include <algorithm>		// Needed for std::min
+
+
+/**
+ * Worker thread, loads files until none are left.
+ */
+class CPartFileLoader::CWorker : public CMuleThread
+{
+public:
+	CWorker(CPartFileLoader* owner)
+		: CMuleThread(wxTHREAD_JOINABLE),
+		  m_owner(owner)
+	{
+	}
+
+protected:
+	virtual void* Entry()
+	{
+		m_owner->WorkerLoop();
+		return NULL;
+	}
+
+private:
+	CPartFileLoader*	m_owner;
+};
+
+
+CPartFileLoader::CPartFileLoader(const CPath& directory, const std::vector<CPath>& files, uint32 threads)
+	: m_directory(directory),
+	  m_maxThreads(threads),
+	  m_done(m_lock),
+	  m_files(files),
+	  m_results(files.size()),
+	  m_loaded(files.size(), false),
+	  m_nextFile(0),
+	  m_nextResult(0),
+	  m_abort(false)
+{
+}
+
+
+CPartFileLoader::~CPartFileLoader()
+{
+	{
+		wxMutexLocker lock(m_lock);
+		m_abort = true;
+	}
+
+	for (size_t i = 0; i < m_workers.size(); ++i) {
+		m_workers[i]->Stop();
+		delete m_workers[i];
+	}
+
+	for (size_t i = m_nextResult; i < m_results.size(); ++i) {
+		delete m_results[i];
+	}
+}
+
+
+void CPartFileLoader::Start()
+{
+	const size_t count = std::min<size_t>(m_maxThreads, m_files.size());
+
+	for (size_t i = 0; i < count; ++i) {
+		CWorker* worker = new CWorker(this);
+		if (worker->Create() != wxTHREAD_NO_ERROR || worker->Run() != wxTHREAD_NO_ERROR) {
+			// Whatever is left is loaded by the workers already running,
+			// or by GetNextFile if there are none
+			delete worker;
+			break;
+		}
+
+		m_workers.push_back(worker);
+	}
+}
+
+
+bool CPartFileLoader::GetNextFile(CPartFile*& file, CPath& name)
+{
+	if (m_nextResult >= m_files.size()) {
+		return false;
+	}
+
+	if (m_workers.empty()) {
+		file = LoadFile(m_files[m_nextResult]);
+	} else {
+		wxMutexLocker lock(m_lock);
+		while (!m_loaded[m_nextResult]) {
+			m_done.Wait();
+		}
+
+		file = m_results[m_nextResult];
+		m_results[m_nextResult] = NULL;
+	}
+
+	name = m_files[m_nextResult];
+	++m_nextResult;
+
+	return true;
+}
+
+
+void CPartFileLoader::WorkerLoop()
+{
+	while (true) {
+		size_t index;
+		{
+			wxMutexLocker lock(m_lock);
+			if (m_abort || m_nextFile >= m_files.size()) {
+				return;
+			}
+
+			index = m_nextFile++;
+		}
+
+		CPartFile* file = LoadFile(m_files[index]);
+
+		wxMutexLocker lock(m_lock);
+		m_results[index] = file;
+		m_loaded[index] = true;
+		m_done.Broadcast();
+	}
+}
+
+
+CPartFile* CPartFileLoader::LoadFile(const CPath& name) const
+{
+	CPartFile* file = new CPartFile();
+
+	if (!file->LoadPartFile(m_directory, name)) {
+		// Try from backup
+		if (!file->LoadPartFile(m_directory, name, true)) {
+			delete file;
+			return NULL;
+		}
+	}
+
+	return file;
+}
+// File_checked_for_headers
@@ -0,0 +1,122 @@
+//
+// This file is part of the aMule Project.
+//
+// Copyright (c) 2003-2011 aMule Team ( admin@amule.org / http://www.amule.org )
+//
+// Any parts of this program derived from the xMule, lMule or eMule project,
+// or contributed by third-party developers are copyrighted by their
+// respective authors.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA
+//
+
+#ifndef PARTFILELOADER_H
+#define PARTFILELOADER_H
+
+#include <wx/thread.h>		// Needed for wxMutex and wxCondition
+
+#include "Types.h"		// Needed for uint32
+#include <common/Path.h>	// Needed for CPath
+
+#include <vector>
+
+
+class CPartFile;
+
+
+/**
+ * Loads the part.met files of the temp directory on a pool of worker threads.
+ *
+ * Every file is loaded into a detached CPartFile, which is neither in the
+ * download queue nor shown yet, trying the backup of the met-file if the
+ * file itself cannot be loaded. What loading finds to be necessary beyond
+ * that, like rehashing a file which changed while aMule was not running,
+ * is left to CPartFile::FinishLoading.
+ *
+ * The files are handed back in the order they were given, as soon as each
+ * one is loaded.
+ */
+class CPartFileLoader
+{
+public:
+	/**
+	 * Constructor.
+	 *
+	 * @param directory The directory containing the met-files.
+	 * @param files The names of the met-files, in the order they are to be returned.
+	 * @param threads The maximum number of worker threads.
+	 */
+	CPartFileLoader(const CPath& directory, const std::vector<CPath>& files, uint32 threads = LOADER_THREADS);
+
+	/**
+	 * Destructor, stops and waits for the workers.
+	 *
+	 * Files which were loaded but not returned are deleted.
+	 */
+	~CPartFileLoader();
+
+	/**
+	 * Starts the workers.
+	 *
+	 * If no thread can be created, the files are loaded by GetNextFile
+	 * instead.
+	 */
+	void	Start();
+
+	/**
+	 * Waits for the next file to be loaded.
+	 *
+	 * @param file Receives the file, or NULL if neither the met-file nor its backup could be loaded.
+	 * @param name Receives the name of the met-file.
+	 * @return False once all files have been returned.
+	 */
+	bool	GetNextFile(CPartFile*& file, CPath& name);
+
+	enum { LOADER_THREADS = 4 };
+
+private:
+	class CWorker;
+	friend class CWorker;
+
+	//! Loads files until none are left, called by the workers.
+	void	WorkerLoop();
+	//! Loads a single file on the calling thread.
+	CPartFile* LoadFile(const CPath& name) const;
+
+	const CPath	m_directory;
+	const uint32	m_maxThreads;
+
+	//! Guards everything below.
+	wxMutex		m_lock;
+	//! Signalled whenever a file has been loaded.
+	wxCondition	m_done;
+
+	std::vector<CPath>	m_files;
+	//! The results, indexed like m_files.
+	std::vector<CPartFile*>	m_results;
+	//! Set once the file of the same index has been loaded.
+	std::vector<bool>	m_loaded;
+	//! Index of the next file to be loaded.
+	size_t		m_nextFile;
+	//! Index of the next file to be returned.
+	size_t		m_nextResult;
+	//! Set when the workers should stop.
+	bool		m_abort;
+
+	std::vector<CWorker*>	m_workers;
+};
+
+#endif // PARTFILELOADER_H
+// File_checked_for_headers
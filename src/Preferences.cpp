@@ -193,6 +193,8 @@ wxString	CPreferences::s_ECAddr;
 uint32		CPreferences::s_ECPort;
 wxString	CPreferences::s_ECPassword;
 bool		CPreferences::s_TransmitOnlyUploadingClients;
+wxString	CPreferences::s_MetricsAddr;
+uint32		CPreferences::s_MetricsPort;
 bool		CPreferences::s_IPFilterClients;
 bool		CPreferences::s_IPFilterServers;
 bool		CPreferences::s_UseSrcSeeds;
@@ -222,6 +224,7 @@ bool		CPreferences::s_ShowMessagesInLog;
 bool		CPreferences::s_IsAdvancedSpamfilterEnabled;
 bool		CPreferences::s_IsChatCaptchaEnabled;
 bool		CPreferences::s_ShareHiddenFiles;
+bool		CPreferences::s_WatchSharedDirs;
 bool		CPreferences::s_AutoSortDownload;
 bool		CPreferences::s_NewVersionCheck;
 bool		CPreferences::s_ConnectToKad;
@@ -1267,6 +1270,8 @@ void CPreferences::BuildItemList( const wxString& appdir )
 
 	s_MiscList.push_back( new Cfg_Bool( wxT("/eMule/DropSlowSources"),		s_DropSlowSources, false ) );
 
+	s_MiscList.push_back( new Cfg_Bool( wxT("/eMule/WatchSharedDirs"),		s_WatchSharedDirs, true ) );
+
 	s_MiscList.push_back( new Cfg_Str(  wxT("/eMule/KadNodesUrl"),			s_KadURL, wxT("http://upd.emule-security.org/nodes.dat") ) );
 	s_MiscList.push_back( new Cfg_Str(	wxT("/eMule/Ed2kServersUrl"),		s_Ed2kURL, wxT("http://upd.emule-security.org/server.met") ) );
 	s_MiscList.push_back( MkCfg_Int( wxT("/eMule/ShowRatesOnTitle"),		s_showRatesOnTitle, 0 ));
@@ -1280,6 +1285,8 @@ void CPreferences::BuildItemList( const wxString& appdir )
 	s_MiscList.push_back( new Cfg_Str( wxT("/eMule/StatsServerURL"),		s_StatsServerURL,	wxT("http://ed2k.shortypower.dyndns.org/?hash=") ) );
 
 	s_MiscList.push_back( new Cfg_Bool( wxT("/ExternalConnect/TransmitOnlyUploadingClients"),	s_TransmitOnlyUploadingClients, false ) );
+	s_MiscList.push_back( new Cfg_Str( wxT("/ExternalConnect/MetricsAddress"),	s_MetricsAddr, wxT("127.0.0.1") ) );
+	s_MiscList.push_back( MkCfg_Int( wxT("/ExternalConnect/MetricsPort"),		s_MetricsPort, 0 ) );
 	s_MiscList.push_back( new Cfg_Bool( wxT("/eMule/CreateSparseFiles"),		s_createFilesSparse, true ) );
 
 #ifndef AMULE_DAEMON
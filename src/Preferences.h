@@ -473,6 +473,9 @@ public:
 	static const wxString&	ECPassword()			{ return s_ECPassword; }
 	static void		SetECPass(const wxString& pass)	{ s_ECPassword = pass; }
 	static bool		IsTransmitOnlyUploadingClients() { return s_TransmitOnlyUploadingClients; }
+	// Metrics for Prometheus, a port of 0 disables them
+	static const wxString&	GetMetricsAddress()		{ return s_MetricsAddr; }
+	static uint32		GetMetricsPort()		{ return s_MetricsPort; }
 
 	// Fast ED2K Links Handler Toggling
 	static bool		GetFED2KLH()			{ return s_FastED2KLinksHandler; }
@@ -572,6 +575,8 @@ public:
 
 	static bool ShareHiddenFiles() { return s_ShareHiddenFiles; }
 	static void SetShareHiddenFiles(bool val) { s_ShareHiddenFiles = val; }
+	static bool WatchSharedDirs() { return s_WatchSharedDirs; }
+	static void SetWatchSharedDirs(bool val) { s_WatchSharedDirs = val; }
 
 	static bool AutoSortDownload()		{ return s_AutoSortDownload; }
 	static bool AutoSortDownload(bool val)	{ bool tmp = s_AutoSortDownload; s_AutoSortDownload = val; return tmp; }
@@ -792,6 +797,8 @@ protected:
 	static uint32	s_ECPort;
 	static wxString	s_ECPassword;
 	static bool		s_TransmitOnlyUploadingClients;
+	static wxString	s_MetricsAddr;
+	static uint32	s_MetricsPort;
 
 	// Kry - IPFilter
 	static bool	s_IPFilterClients;
@@ -839,6 +846,8 @@ protected:
 
 	// Hidden files sharing
 	static bool	s_ShareHiddenFiles;
+	// Pick up changes to shared directories without reloading
+	static bool	s_WatchSharedDirs;
 
 	static bool s_AutoSortDownload;
 
@@ -24,9 +24,10 @@
 
 #include "RLE.h"
 #include "ArchSpecific.h"
-#include "ScopedPtr.h"
 #include <ec/cpp/ECTag.h>		// Needed for CECTag
 
+#include <vector>
+
 /*
  * RLE encoder implementation. This is RLE implementation for very specific
  * purpose: encode DIFFERENCE between subsequent states of status bar.
@@ -36,6 +37,70 @@
  * We can't use implementation with "control char" since this encoder
  * will process binary data - not ascii (or unicode) strings
  */
+
+//
+// RLE encode a block
+//
+// out:		must have room for len * 3/2 + 1 bytes, as in worst case
+//          2-byte sequence is encoded as 3
+//
+// return:	number of encoded bytes
+//
+static int Pack(const uint8 *data, int len, uint8 *out)
+{
+	int i = 0, j = 0;
+	while ( i != len ) {
+		uint8 curr_val = data[i];
+		int seq_start = i;
+		while ( (i != len) && (curr_val == data[i]) && ((i - seq_start) < 0xff)) {
+			i++;
+		}
+		if (i - seq_start > 1) {
+			// if there's 2 or more equal vals - put it twice in stream
+			out[j++] = curr_val;
+			out[j++] = curr_val;
+			out[j++] = i - seq_start;
+		} else {
+			// single value - put it as is
+			out[j++] = curr_val;
+		}
+	}
+	return j;
+}
+
+//
+// Copy the UInts16 to a uint8 array and limit them to 0xff.
+//
+static void Flatten(const ArrayOfUInts16 &data, std::vector<uint8> &buf)
+{
+	const size_t size = data.size();
+	buf.resize(size);
+	for (size_t i = 0; i < size; i++) {
+		uint16 ui = data[i];
+		buf[i] = (ui > 0xff) ? 0xff : (uint8) ui;
+	}
+}
+
+//
+// uint64 is copied to a uint8 buffer
+// first all low bytes, then all second low bytes and so on
+// so inital RLE will benefit from high bytes being equal (zero)
+// 0x000003045A6A7A8A, 0x000003045B6B7B8B
+// 8A8B7A7B6A6B5A5B0404030300000000
+//
+static void Flatten(const ArrayOfUInts64 &data, std::vector<uint8> &buf)
+{
+	const size_t size = data.size();
+	buf.resize(size * 8);
+	for (size_t i = 0; i < size; i++) {
+		uint64 u = data[i];
+		for (int j = 0; j < 8; j++) {
+			buf[i + j * size] = u & 0xff;
+			u >>= 8;
+		}
+	}
+}
+
 void RLE_Data::setup(int len, bool use_diff, uint8 * content)
 {
 	m_len = len;
@@ -182,25 +247,7 @@ const uint8 * RLE_Data::Encode(const uint8 *data, int inlen, int &outlen, bool &
 	//
 	// In worst case 2-byte sequence is encoded as 3. So, data can grow by 50%.
 	uint8 * enc_buff = new uint8[m_len * 3/2 + 1];
-	int i = 0, j = 0;
-	while ( i != m_len ) {
-		uint8 curr_val = m_buff[i];
-		int seq_start = i;
-		while ( (i != m_len) && (curr_val == m_buff[i]) && ((i - seq_start) < 0xff)) {
-			i++;
-		}
-		if (i - seq_start > 1) {
-			// if there's 2 or more equal vals - put it twice in stream
-			enc_buff[j++] = curr_val;
-			enc_buff[j++] = curr_val;
-			enc_buff[j++] = i - seq_start;
-		} else {
-			// single value - put it as is
-			enc_buff[j++] = curr_val;
-		}
-	}
-
-	outlen = j;
+	outlen = Pack(m_buff, m_len, enc_buff);
 
 	//
 	// If using differential encoder, remember current data for
@@ -214,44 +261,17 @@ const uint8 * RLE_Data::Encode(const uint8 *data, int inlen, int &outlen, bool &
 
 const uint8 * RLE_Data::Encode(const ArrayOfUInts16 &data, int &outlen, bool &changed)
 {
-	// To encode, first copy the UInts16 to a uint8 array
-	// and limit them to 0xff.
 	// The encoded size is the size of data.
-	int size = (int) data.size();
-	if (size == 0) {
-		return Encode(0, 0, outlen, changed);
-	}
-	CScopedArray<uint8> buf(size);
-	uint8 * bufPtr = buf.get();
-
-	for (int i = 0; i < size; i++) {
-		uint16 ui = data[i];
-		bufPtr[i] = (ui > 0xff) ? 0xff : (uint8) ui;
-	}
-	return Encode(bufPtr, size, outlen, changed);
+	std::vector<uint8> buf;
+	Flatten(data, buf);
+	return Encode(buf.empty() ? 0 : &buf[0], (int) buf.size(), outlen, changed);
 }
 
 const uint8 * RLE_Data::Encode(const ArrayOfUInts64 &data, int &outlen, bool &changed)
 {
-	// uint64 is copied to a uint8 buffer
-	// first all low bytes, then all second low bytes and so on
-	// so inital RLE will benefit from high bytes being equal (zero)
-	// 0x000003045A6A7A8A, 0x000003045B6B7B8B
-	// 8A8B7A7B6A6B5A5B0404030300000000
-	int size = (int) data.size();
-	if (size == 0) {
-		return Encode(0, 0, outlen, changed);
-	}
-	CScopedArray<uint8> buf(size * 8);
-	uint8 * bufPtr = buf.get();
-	for (int i = 0; i < size; i++) {
-		uint64 u = data[i];
-		for (int j = 0; j < 8; j++) {
-			bufPtr[i + j * size] = u & 0xff;
-			u >>= 8;
-		}
-	}
-	return Encode(bufPtr, size * 8, outlen, changed);
+	std::vector<uint8> buf;
+	Flatten(data, buf);
+	return Encode(buf.empty() ? 0 : &buf[0], (int) buf.size(), outlen, changed);
 }
 
 void RLE_Data::Decode(const uint8 *data, int len, ArrayOfUInts64 &outdata)
@@ -270,6 +290,139 @@ void RLE_Data::Decode(const uint8 *data, int len, ArrayOfUInts64 &outdata)
 	}
 }
 
+/*
+ * Shared encoder. Snapshots are numbered, so that encoded differences can
+ * be looked up by the snapshot they start from.
+ */
+class RLE_SharedData::Snapshot
+{
+public:
+	Snapshot(std::vector<uint8> &data)
+		: m_version(++s_lastVersion), m_refs(1)
+	{
+		m_data.swap(data);
+	}
+
+	void AddRef()	{ ++m_refs; }
+	void Release()	{ if (!--m_refs) delete this; }
+
+	std::vector<uint8> m_data;
+	const uint32 m_version;
+
+private:
+	~Snapshot() {}
+
+	static uint32 s_lastVersion;
+	uint32 m_refs;
+};
+
+uint32 RLE_SharedData::Snapshot::s_lastVersion = 0;
+
+void RLE_SharedData::Cursor::Reset()
+{
+	if (m_sent) {
+		m_sent->Release();
+		m_sent = 0;
+	}
+}
+
+RLE_SharedData::RLE_SharedData()
+	: m_current(0)
+{
+}
+
+RLE_SharedData::~RLE_SharedData()
+{
+	if (m_current) {
+		m_current->Release();
+	}
+}
+
+bool RLE_SharedData::Update(const ArrayOfUInts16 &data)
+{
+	std::vector<uint8> buf;
+	Flatten(data, buf);
+	return Update(buf);
+}
+
+bool RLE_SharedData::Update(const ArrayOfUInts64 &data)
+{
+	std::vector<uint8> buf;
+	Flatten(data, buf);
+	return Update(buf);
+}
+
+bool RLE_SharedData::Update(std::vector<uint8> &data)
+{
+	if (m_current ? (m_current->m_data == data) : data.empty()) {
+		return false;
+	}
+
+	if (m_current) {
+		m_current->Release();
+	}
+	m_current = new Snapshot(data);
+	m_deltas.clear();
+
+	return true;
+}
+
+int RLE_SharedData::Size() const
+{
+	return m_current ? (int) m_current->m_data.size() : 0;
+}
+
+bool RLE_SharedData::GetDelta(Cursor &cursor, const uint8 *&data, int &outlen)
+{
+	data = 0;
+	outlen = 0;
+
+	if (cursor.m_sent == m_current) {
+		return false;
+	}
+
+	const uint32 base = cursor.m_sent ? cursor.m_sent->m_version : 0;
+	std::map<uint32, Delta>::iterator it = m_deltas.find(base);
+	if (it == m_deltas.end()) {
+		it = m_deltas.insert(std::make_pair(base, Delta())).first;
+		Delta &delta = it->second;
+
+		const int len = Size();
+		const int baselen = cursor.m_sent ? (int) cursor.m_sent->m_data.size() : 0;
+		delta.changed = (len != baselen);
+
+		if (len) {
+			// calculate difference from what was sent, like RLE_Data does
+			std::vector<uint8> diff(m_current->m_data);
+			const int common = (len < baselen) ? len : baselen;
+			for (int i = 0; i < common; i++) {
+				diff[i] ^= cursor.m_sent->m_data[i];
+			}
+			for (int i = 0; !delta.changed && i < len; i++) {
+				delta.changed = (diff[i] != 0);
+			}
+
+			if (delta.changed) {
+				delta.data.resize(len * 3/2 + 1);
+				delta.data.resize(Pack(&diff[0], len, &delta.data[0]));
+			}
+		}
+	}
+
+	cursor.Reset();
+	if (m_current) {
+		m_current->AddRef();
+		cursor.m_sent = m_current;
+	}
+
+	if (it->second.changed) {
+		data = it->second.data.empty() ? 0 : &it->second.data[0];
+		outlen = (int) it->second.data.size();
+	}
+
+	return it->second.changed;
+}
+
 void PartFileEncoderData::DecodeParts(const CECTag * tag, ArrayOfUInts16 &outdata)
 {
 	const uint8 * buf = m_part_status.Decode((uint8 *)tag->GetTagData(), tag->GetTagDataLen());
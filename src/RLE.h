@@ -28,6 +28,8 @@
 
 #include "Types.h"
 
+#include <map>
+
 /*!
  * General purpose RLE implementation. Just encode or create
  * differential data with previous
@@ -85,6 +87,91 @@ private:
 };
 
 
+/*!
+ * Differential RLE encoder whose state is shared by all EC clients.
+ *
+ * RLE_Data keeps a full copy of the data last sent to each client, and
+ * encodes the difference separately for each of them. Here the data is
+ * sampled once into an immutable, reference counted snapshot, and each
+ * client only keeps a reference to the snapshot it was sent last. The
+ * difference between a snapshot and the current one is encoded once and
+ * handed to every client that was sent that snapshot.
+ *
+ * The encoded data is the same RLE_Data produces, so clients decode it
+ * with RLE_Data as before.
+ *
+ * Not thread-safe, meant to be used from the core thread only.
+ */
+class RLE_SharedData
+{
+	class Snapshot;
+public:
+	/*!
+	 * The snapshot a client was sent last.
+	 */
+	class Cursor
+	{
+	public:
+		Cursor() : m_sent(0) {}
+		~Cursor()	{ Reset(); }
+
+		// forget what was sent, next difference is the full data
+		void Reset();
+
+	private:
+		friend class RLE_SharedData;
+
+		// not copyable, the snapshot is reference counted
+		Cursor(const Cursor &);
+		Cursor &operator=(const Cursor &);
+
+		Snapshot *m_sent;
+	};
+
+	RLE_SharedData();
+	~RLE_SharedData();
+
+	// Sample the data to encode, return true if it differs from the last sample
+	bool Update(const ArrayOfUInts16 &data);
+	bool Update(const ArrayOfUInts64 &data);
+
+	//
+	// Get the difference between what the client was sent and the last
+	// sample, and move the cursor to the last sample
+	//
+	// cursor:	the client
+	// data:	receives the encoded data, owned by this object and valid
+	//          until the next call of Update. May be 0 if the data is empty.
+	// outlen:	receives the number of encoded bytes
+	//
+	// return:	false if there is nothing to send, in the same cases
+	//          RLE_Data::Encode reports no change
+	//
+	bool GetDelta(Cursor &cursor, const uint8 *&data, int &outlen);
+
+	// Size of the last sample in bytes
+	int Size() const;
+
+private:
+	// not copyable, cursors point into it
+	RLE_SharedData(const RLE_SharedData &);
+	RLE_SharedData &operator=(const RLE_SharedData &);
+
+	bool Update(std::vector<uint8> &data);
+
+	struct Delta {
+		bool changed;
+		std::vector<uint8> data;
+	};
+
+	// last sample, 0 while nothing was sampled
+	Snapshot *m_current;
+	// encoded differences to m_current, by version of the snapshot they
+	// start from (0 for none)
+	std::map<uint32, Delta> m_deltas;
+};
+
+
 /*!
  * Data difference is different for each EC client
  */
@@ -0,0 +1,332 @@
+//
+// This file is part of the aMule Project.
+//
+// Copyright (c) 2003-2011 aMule Team ( admin@amule.org / http://www.amule.org )
+//
+// Any parts of this program derived from the xMule, lMule or eMule project,
+// or contributed by third-party developers are copyrighted by their
+// respective authors.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA
+//
+
+#ifndef ROBINHOODMAP_H
+#define ROBINHOODMAP_H
+
+#include "Types.h"		// Needed for uint32
+
+#include <algorithm>		// Needed for std::swap
+#include <cstring>		// Needed for memcpy
+#include <vector>
+
+
+/**
+ * Hash functor for 32 bit keys such as IPs and IDs.
+ *
+ * IPs are stored in network order, so the low bits of the raw value are
+ * the least random ones. The bits are mixed using the MurmurHash3
+ * finalizer, so that any subset of the result is usable as an index.
+ */
+struct CRobinHoodUInt32Hash
+{
+	uint32 operator()(uint32 key) const {
+		key ^= key >> 16;
+		key *= 0x85ebca6bu;
+		key ^= key >> 13;
+		key *= 0xc2b2ae35u;
+		key ^= key >> 16;
+		return key;
+	}
+};
+
+
+/**
+ * Hash functor for 16 byte hashes chosen by remote peers, such as user and
+ * file hashes.
+ *
+ * All of the hash is used rather than trusting any part of it to be
+ * random. Starting from a seed picked once at startup, each word is mixed
+ * into the state through the finalizer, so unlike with a plain fold, how
+ * the words combine depends on the seed and hashes which collide in the
+ * table cannot be prepared in advance.
+ */
+struct CRobinHoodMD4Hash
+{
+	template <typename HASH>
+	uint32 operator()(const HASH& hash) const {
+		uint32 words[4];
+		memcpy(words, hash.GetHash(), sizeof(words));
+
+		const CRobinHoodUInt32Hash mix;
+		uint32 state = mix(Seed());
+		for (unsigned i = 0; i < 4; ++i) {
+			state = mix(state ^ words[i]) + words[i];
+		}
+
+		return mix(state);
+	}
+
+	/**
+	 * Sets the seed, must be called before any table using it is filled.
+	 */
+	static void SetSeed(uint32 seed)	{ Seed() = seed; }
+
+private:
+	static uint32& Seed() {
+		static uint32 seed = 0;
+		return seed;
+	}
+};
+
+
+/**
+ * Open-addressing hash multimap using Robin Hood hashing.
+ *
+ * All entries are kept in a single array, so lookups touch a few adjacent
+ * cache lines instead of walking a tree of separately allocated nodes, and
+ * insertions do not allocate except when the table grows. Several values
+ * may be stored under the same key, like with std::multimap.
+ *
+ * Entries are moved inside the table using std::swap, so values with
+ * costly copies (reference counted handles like CClientRef) should
+ * provide an efficient swap.
+ *
+ * Note that unlike std::multimap, any insertion or removal invalidates
+ * all iterators. To remove entries while iterating, collect them first.
+ */
+template <typename KEY, typename VALUE, typename HASHER>
+class CRobinHoodMultiMap
+{
+public:
+	/**
+	 * A single entry, with the same member names as std::pair.
+	 */
+	struct value_type
+	{
+		KEY	first;
+		VALUE	second;
+		//! Distance from the home bucket plus one, zero if unused.
+		uint32	m_dist;
+
+		value_type() : first(), second(), m_dist(0) {}
+	};
+
+	/**
+	 * Iterates over all entries, in no particular order.
+	 */
+	class const_iterator
+	{
+	public:
+		const_iterator() : m_map(NULL), m_pos(0) {}
+
+		const value_type& operator*() const	{ return m_map->m_table[m_pos]; }
+		const value_type* operator->() const	{ return &m_map->m_table[m_pos]; }
+
+		const_iterator& operator++() {
+			m_pos = m_map->NextUsed(m_pos + 1);
+			return *this;
+		}
+
+		bool operator==(const const_iterator& other) const	{ return m_pos == other.m_pos; }
+		bool operator!=(const const_iterator& other) const	{ return m_pos != other.m_pos; }
+
+	private:
+		friend class CRobinHoodMultiMap;
+
+		const_iterator(const CRobinHoodMultiMap* map, size_t pos)
+			: m_map(map), m_pos(pos) {}
+
+		const CRobinHoodMultiMap*	m_map;
+		size_t				m_pos;
+	};
+
+	CRobinHoodMultiMap()
+		: m_size(0)
+	{
+		m_table.resize(ROBINHOOD_MIN_CAPACITY);
+	}
+
+	const_iterator	begin() const	{ return const_iterator(this, NextUsed(0)); }
+	const_iterator	end() const	{ return const_iterator(this, m_table.size()); }
+
+	size_t	size() const	{ return m_size; }
+	bool	empty() const	{ return m_size == 0; }
+
+	/**
+	 * Removes all entries and releases the table.
+	 */
+	void clear() {
+		std::vector<value_type> table(ROBINHOOD_MIN_CAPACITY);
+		m_table.swap(table);
+		m_size = 0;
+	}
+
+	/**
+	 * Adds a value under the given key, duplicates are allowed.
+	 */
+	void insert(const KEY& key, const VALUE& value) {
+		// Grow at a load factor of 7/8
+		if ((m_size + 1) * 8 > m_table.size() * 7) {
+			Grow();
+		}
+
+		value_type entry;
+		entry.first = key;
+		entry.second = value;
+		Place(entry);
+		++m_size;
+	}
+
+	/**
+	 * Returns the first entry with the given key, or end().
+	 */
+	const_iterator find(const KEY& key) const {
+		return const_iterator(this, Probe(key, Home(key), 1));
+	}
+
+	/**
+	 * Returns the entry following 'it' with the same key, or end().
+	 *
+	 * Use together with find() to visit all values of a key.
+	 */
+	const_iterator find_next(const const_iterator& it) const {
+		const size_t mask = m_table.size() - 1;
+		const KEY& key = it->first;
+		const size_t pos = (it.m_pos + 1) & mask;
+
+		return const_iterator(this, Probe(key, pos, it->m_dist + 1));
+	}
+
+	/**
+	 * Returns the number of values stored under the given key.
+	 */
+	size_t count(const KEY& key) const {
+		size_t result = 0;
+		for (const_iterator it = find(key); it != end(); it = find_next(it)) {
+			++result;
+		}
+
+		return result;
+	}
+
+	/**
+	 * Removes the entry at the given position.
+	 *
+	 * This invalidates all iterators, including 'it'.
+	 */
+	void erase(const const_iterator& it) {
+		Remove(it.m_pos);
+	}
+
+private:
+	enum { ROBINHOOD_MIN_CAPACITY = 16 };
+
+	size_t Home(const KEY& key) const {
+		return m_hasher(key) & (m_table.size() - 1);
+	}
+
+	/**
+	 * Returns the position of the first used bucket at or after pos, or the table size.
+	 */
+	size_t NextUsed(size_t pos) const {
+		while (pos < m_table.size() && !m_table[pos].m_dist) {
+			++pos;
+		}
+
+		return pos;
+	}
+
+	/**
+	 * Searches for the key, starting at pos which is dist-1 buckets from its home.
+	 *
+	 * The search stops as soon as an entry closer to its own home bucket is
+	 * found, since the key would have displaced that entry on insertion.
+	 */
+	size_t Probe(const KEY& key, size_t pos, uint32 dist) const {
+		const size_t mask = m_table.size() - 1;
+
+		while (m_table[pos].m_dist >= dist) {
+			if (m_table[pos].first == key) {
+				return pos;
+			}
+
+			pos = (pos + 1) & mask;
+			++dist;
+		}
+
+		return m_table.size();
+	}
+
+	/**
+	 * Moves an entry into the table, displacing entries that are closer to their home.
+	 */
+	void Place(value_type& entry) {
+		const size_t mask = m_table.size() - 1;
+		size_t pos = Home(entry.first);
+
+		for (entry.m_dist = 1; ; ++entry.m_dist, pos = (pos + 1) & mask) {
+			value_type& bucket = m_table[pos];
+
+			if (!bucket.m_dist) {
+				Swap(bucket, entry);
+				return;
+			} else if (bucket.m_dist < entry.m_dist) {
+				Swap(bucket, entry);
+			}
+		}
+	}
+
+	/**
+	 * Empties a bucket and shifts the following entries back into the gap.
+	 */
+	void Remove(size_t pos) {
+		const size_t mask = m_table.size() - 1;
+
+		for (size_t next = (pos + 1) & mask; m_table[next].m_dist > 1; next = (next + 1) & mask) {
+			Swap(m_table[pos], m_table[next]);
+			--m_table[pos].m_dist;
+			pos = next;
+		}
+
+		// Release the value, so that references are dropped right away
+		m_table[pos].second = VALUE();
+		m_table[pos].m_dist = 0;
+		--m_size;
+	}
+
+	void Grow() {
+		std::vector<value_type> old(m_table.size() * 2);
+		m_table.swap(old);
+
+		for (size_t i = 0; i < old.size(); ++i) {
+			if (old[i].m_dist) {
+				Place(old[i]);
+			}
+		}
+	}
+
+	static void Swap(value_type& a, value_type& b) {
+		std::swap(a.first, b.first);
+		std::swap(a.second, b.second);
+		std::swap(a.m_dist, b.m_dist);
+	}
+
+	std::vector<value_type>	m_table;
+	size_t			m_size;
+	HASHER			m_hasher;
+};
+
+#endif // ROBINHOODMAP_H
+// File_checked_for_headers
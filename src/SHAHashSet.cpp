@@ -25,8 +25,10 @@
 //
 
 #include <wx/file.h>
+#include <wx/thread.h>
 
 #include "SHAHashSet.h"
+#include "AICHHashIndex.h"
 #include "amule.h"
 #include "MemFile.h"
 #include "Preferences.h"
@@ -47,6 +49,25 @@
 
 CAICHRequestedDataList CAICHHashSet::m_liRequestedData;
 
+// Index of known2_64.met, shared by the hashing threads and the core.
+// The lock is also held while appending to known2_64.met.
+static wxMutex s_known2Lock;
+static CAICHHashIndex s_known2Index;
+
+
+/**
+ * Loads the index of known2_64.met on first use. The caller must hold s_known2Lock.
+ */
+static bool LoadKnown2Index()
+{
+	if (!s_known2Index.IsLoaded()) {
+		return s_known2Index.Load(CPath(thePrefs::GetConfigDir() + KNOWN2_MET_FILENAME),
+			CPath(thePrefs::GetConfigDir() + KNOWN2_INDEX_FILENAME));
+	}
+
+	return true;
+}
+
 /////////////////////////////////////////////////////////////////////////////////////////
 ///CAICHHash
 wxString CAICHHash::GetString() const
@@ -634,6 +655,19 @@ bool CAICHHashSet::SaveHashSet()
 	}
 
 
+	wxMutexLocker lock(s_known2Lock);
+	if (!LoadKnown2Index()) {
+		AddDebugLogLineC(logSHAHashSet, wxT("Failed to save HashSet: opening met file failed!"));
+		return false;
+	}
+
+	// first we check if the hashset we want to write is already stored
+	uint64 nOffset;
+	if (s_known2Index.Find(m_pHashTree.m_Hash, nOffset)) {
+		// this hashset if already available, no need to save it again
+		return true;
+	}
+
 	try {
 		const wxString fullpath = thePrefs::GetConfigDir() + KNOWN2_MET_FILENAME;
 		const bool exists = wxFile::Exists(fullpath);
@@ -653,29 +687,13 @@ bool CAICHHashSet::SaveHashSet()
 			}
 
 			AddDebugLogLineN(logSHAHashSet, CFormat(wxT("Met file is version 0x%2.2x.")) % header);
+			file.Seek(0, wxFromEnd);
 		} else {
 			file.WriteUInt8(KNOWN2_MET_VERSION);
 			// Update the recorded size, in order for the sanity check below to work.
 			nExistingSize += 1;
 		}
 
-		// first we check if the hashset we want to write is already stored
-		CAICHHash CurrentHash;
-		while (file.GetPosition() < nExistingSize) {
-			CurrentHash.Read(&file);
-			if (m_pHashTree.m_Hash == CurrentHash) {
-				// this hashset if already available, no need to save it again
-				return true;
-			}
-			uint32 nHashCount = file.ReadUInt32();
-			if (file.GetPosition() + nHashCount*HASHSIZE > nExistingSize) {
-				AddDebugLogLineC(logSHAHashSet, wxT("Saving failed: File contains fewer entries than specified!"));
-				return false;
-			}
-			// skip the rest of this hashset
-			file.Seek(nHashCount*HASHSIZE, wxFromCurrent);
-		}
-
 		// write hashset
 		m_pHashTree.m_Hash.Write(&file);
 		uint32 nHashCount = (PARTSIZE/EMBLOCKSIZE + ((PARTSIZE % EMBLOCKSIZE != 0)? 1 : 0)) * (m_pHashTree.m_nDataSize/PARTSIZE);
@@ -695,6 +713,7 @@ bool CAICHHashSet::SaveHashSet()
 			AddDebugLogLineC(logSHAHashSet, wxT("Failed to save HashSet: Calculated and real size of hashset differ!"));
 			return false;
 		}
+		s_known2Index.Add(m_pHashTree.m_Hash, nExistingSize, file.GetLength());
 		AddDebugLogLineN(logSHAHashSet, CFormat(wxT("Successfully saved eMuleAC Hashset, %u Hashs + 1 Masterhash written")) % nHashCount);
 	} catch (const CSafeIOException& e) {
 		AddDebugLogLineC(logSHAHashSet, wxT("IO error while saving AICH HashSet: ") + e.what());
@@ -715,6 +734,19 @@ bool CAICHHashSet::LoadHashSet()
 		wxFAIL;
 		return false;
 	}
+
+	uint64 nOffset;
+	{
+		wxMutexLocker lock(s_known2Lock);
+		if (!LoadKnown2Index()) {
+			return false;
+		}
+		if (!s_known2Index.Find(m_pHashTree.m_Hash, nOffset)) {
+			AddDebugLogLineC(logSHAHashSet, wxT("Failed to load HashSet: HashSet not found!"));
+			return false;
+		}
+	}
+
 	wxString fullpath = thePrefs::GetConfigDir() + KNOWN2_MET_FILENAME;
 	CFile file(fullpath, CFile::read);
 	if (!file.IsOpened()) {
@@ -732,45 +764,36 @@ bool CAICHHashSet::LoadHashSet()
 			return false;
 		}
 
-		CAICHHash CurrentHash;
-		uint64 nExistingSize = file.GetLength();
-		uint32 nHashCount;
-		while (file.GetPosition() < nExistingSize) {
-			CurrentHash.Read(&file);
-			if (m_pHashTree.m_Hash == CurrentHash) {
-				// found Hashset
-				uint32 nExpectedCount =	(PARTSIZE/EMBLOCKSIZE + ((PARTSIZE % EMBLOCKSIZE != 0)? 1 : 0)) * (m_pHashTree.m_nDataSize/PARTSIZE);
-				if (m_pHashTree.m_nDataSize % PARTSIZE != 0) {
-					nExpectedCount += (m_pHashTree.m_nDataSize % PARTSIZE)/EMBLOCKSIZE + (((m_pHashTree.m_nDataSize % PARTSIZE) % EMBLOCKSIZE != 0)? 1 : 0);
-				}
-				nHashCount = file.ReadUInt32();
-				if (nHashCount != nExpectedCount) {
-					AddDebugLogLineC(logSHAHashSet, wxT("Failed to load HashSet: Available Hashs and expected hashcount differ!"));
-					return false;
-				}
-				if (!m_pHashTree.LoadLowestLevelHashs(&file)) {
-					AddDebugLogLineC(logSHAHashSet, wxT("Failed to load HashSet: LoadLowestLevelHashs failed!"));
-					return false;
-				}
-				if (!ReCalculateHash(false)) {
-					AddDebugLogLineC(logSHAHashSet, wxT("Failed to load HashSet: Calculating loaded hashs failed!"));
-					return false;
-				}
-				if (CurrentHash != m_pHashTree.m_Hash) {
-					AddDebugLogLineC(logSHAHashSet, wxT("Failed to load HashSet: Calculated Masterhash differs from given Masterhash - hashset corrupt!"));
-					return false;
-				}
-				return true;
-			}
-			nHashCount = file.ReadUInt32();
-			if (file.GetPosition() + nHashCount*HASHSIZE > nExistingSize) {
-				AddDebugLogLineC(logSHAHashSet, wxT("Saving failed: File contains fewer entries than specified!"));
-				return false;
-			}
-			// skip the rest of this hashset
-			file.Seek(nHashCount*HASHSIZE, wxFromCurrent);
+		file.Seek(nOffset);
+		CAICHHash CurrentHash(&file);
+		if (m_pHashTree.m_Hash != CurrentHash) {
+			AddDebugLogLineC(logSHAHashSet, wxT("Failed to load HashSet: Index does not match met file!"));
+			return false;
+		}
+
+		// found Hashset
+		uint32 nExpectedCount =	(PARTSIZE/EMBLOCKSIZE + ((PARTSIZE % EMBLOCKSIZE != 0)? 1 : 0)) * (m_pHashTree.m_nDataSize/PARTSIZE);
+		if (m_pHashTree.m_nDataSize % PARTSIZE != 0) {
+			nExpectedCount += (m_pHashTree.m_nDataSize % PARTSIZE)/EMBLOCKSIZE + (((m_pHashTree.m_nDataSize % PARTSIZE) % EMBLOCKSIZE != 0)? 1 : 0);
+		}
+		uint32 nHashCount = file.ReadUInt32();
+		if (nHashCount != nExpectedCount) {
+			AddDebugLogLineC(logSHAHashSet, wxT("Failed to load HashSet: Available Hashs and expected hashcount differ!"));
+			return false;
+		}
+		if (!m_pHashTree.LoadLowestLevelHashs(&file)) {
+			AddDebugLogLineC(logSHAHashSet, wxT("Failed to load HashSet: LoadLowestLevelHashs failed!"));
+			return false;
+		}
+		if (!ReCalculateHash(false)) {
+			AddDebugLogLineC(logSHAHashSet, wxT("Failed to load HashSet: Calculating loaded hashs failed!"));
+			return false;
 		}
-		AddDebugLogLineC(logSHAHashSet, wxT("Failed to load HashSet: HashSet not found!"));
+		if (CurrentHash != m_pHashTree.m_Hash) {
+			AddDebugLogLineC(logSHAHashSet, wxT("Failed to load HashSet: Calculated Masterhash differs from given Masterhash - hashset corrupt!"));
+			return false;
+		}
+		return true;
 	} catch (const CSafeIOException& e) {
 		AddDebugLogLineC(logSHAHashSet, wxT("IO error while loading AICH HashSet: ") + e.what());
 	}
@@ -778,6 +801,18 @@ bool CAICHHashSet::LoadHashSet()
 	return false;
 }
 
+
+bool CAICHHashSet::GetStoredMasterHashes(std::list<CAICHHash>& hashes)
+{
+	wxMutexLocker lock(s_known2Lock);
+	if (!LoadKnown2Index()) {
+		return false;
+	}
+
+	s_known2Index.GetMasterHashes(hashes);
+	return true;
+}
+
 // delete the hashset except the masterhash (we dont keep aich hashsets in memory to save ressources)
 void CAICHHashSet::FreeHashSet()
 {
@@ -73,6 +73,7 @@ Version 2 of AICH also supports 32bit identifiers to support large files, check
 #define __SHAHAHSET_H__
 
 #include <deque>
+#include <list>
 #include <set>
 
 #include "Types.h"
@@ -80,6 +81,7 @@ Version 2 of AICH also supports 32bit identifiers to support large files, check
 
 #define HASHSIZE			20
 #define KNOWN2_MET_FILENAME		wxT("known2_64.met")
+#define KNOWN2_INDEX_FILENAME		wxT("known2_64.idx")
 #define OLD_KNOWN2_MET_FILENAME		wxT("known2.met")
 #define KNOWN2_MET_VERSION		0x02
 
@@ -122,6 +124,10 @@ public:
 		return memcmp(k1.m_abyBuffer, k2.m_abyBuffer, HASHSIZE) == 0;
 	}
 	friend bool operator!=(const CAICHHash& k1,const CAICHHash& k2)	{ return !(k1 == k2); }
+	friend bool operator<(const CAICHHash& k1,const CAICHHash& k2)
+	{
+		return memcmp(k1.m_abyBuffer, k2.m_abyBuffer, HASHSIZE) < 0;
+	}
 	void Read(CFileDataIO* file);
 	void Write(CFileDataIO* file) const;
 	void Read(uint8_t* data)		{ memcpy(m_abyBuffer, data, HASHSIZE); }
@@ -263,6 +269,13 @@ public:
 	bool SaveHashSet();
 	bool LoadHashSet(); // only call directly when debugging
 
+	/**
+	 * Returns the master hashes of all hashsets in known2_64.met.
+	 *
+	 * @return False if known2_64.met could not be opened or created.
+	 */
+	static bool GetStoredMasterHashes(std::list<CAICHHash>& hashes);
+
 	static CAICHHashAlgo* GetNewHashAlgo();
 	static void ClientAICHRequestFailed(CUpDownClient* pClient);
 	static void RemoveClientAICHRequest(const CUpDownClient* pClient);
@@ -41,6 +41,8 @@
 #include <common/Format.h>
 #include "Logger.h"
 
+#include <set>
+
 #define ID_SEARCHLISTCTRL wxID_HIGHEST+667
 
 // just to keep compiler happy
@@ -194,6 +196,53 @@ void CSearchDlg::UpdateResult(CSearchFile* toupdate)
 }
 
 
+void CSearchDlg::AddResults(const std::vector<CSearchFile*>& results)
+{
+	ShowResults(results, true);
+}
+
+
+void CSearchDlg::UpdateResults(const std::vector<CSearchFile*>& results)
+{
+	ShowResults(results, false);
+}
+
+
+void CSearchDlg::ShowResults(const std::vector<CSearchFile*>& results, bool added)
+{
+	// Results usually come in runs of the same search
+	std::set<CSearchListCtrl*> pages;
+	CSearchListCtrl* page = NULL;
+	wxUIntPtr pageID = 0;
+
+	for (size_t i = 0; i < results.size(); ++i) {
+		CSearchFile* result = results[i];
+		if (!page || pageID != result->GetSearchID()) {
+			pageID = result->GetSearchID();
+			page = GetSearchList(pageID);
+			if (!page) {
+				continue;
+			}
+
+			if (pages.insert(page).second) {
+				page->Freeze();
+			}
+		}
+
+		if (added) {
+			page->AddResult(result);
+		} else {
+			page->UpdateResult(result);
+		}
+	}
+
+	for (std::set<CSearchListCtrl*>::iterator it = pages.begin(); it != pages.end(); ++it) {
+		(*it)->Thaw();
+		UpdateHitCount(*it);
+	}
+}
+
+
 void CSearchDlg::OnListItemSelected(wxListEvent& event)
 {
 	FindWindow(IDC_SDOWNLOAD)->Enable(true);
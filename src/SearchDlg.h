@@ -31,6 +31,8 @@
 
 #include "Types.h"		// Needed for uint16 and uint32
 
+#include <vector>
+
 
 class CMuleNotebook;
 class CSearchListCtrl;
@@ -81,6 +83,18 @@ public:
 	 */
 	void UpdateResult(CSearchFile* toupdate);
 
+	/**
+	 * Adds a number of new results, like AddResult.
+	 *
+	 * The hit-count of each page is updated once for all its results.
+	 */
+	void AddResults(const std::vector<CSearchFile*>& results);
+
+	/**
+	 * Updates a number of changed results, like UpdateResult.
+	 */
+	void UpdateResults(const std::vector<CSearchFile*>& results);
+
 	/**
 	 * Checks if a result-page with the specified heading exists.
 	 *
@@ -160,6 +174,11 @@ private:
 	 */
 	void		OnSearchPageChanged(wxBookCtrlEvent& evt);
 
+	/**
+	 * Adds or updates results on their pages, with the pages frozen.
+	 */
+	void		ShowResults(const std::vector<CSearchFile*>& results, bool added);
+
 	uint32		m_last_search_time;
 
 	wxGauge*	m_progressbar;
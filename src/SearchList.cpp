@@ -42,6 +42,7 @@
 #include "Logger.h"			// Needed for AddLogLineM/...
 #include "Packet.h"			// Needed for CPacket
 #include "GuiEvents.h"		// Needed for Notify_*
+#include "ExternalConn.h"	// Needed for ECNotifier
 
 
 #ifndef AMULE_DAEMON
@@ -262,6 +263,10 @@ protected:
 ///////////////////////////////////////////////////////////
 // CSearchList
 
+//! How long new results are collected before they are announced.
+#define SEARCH_NOTIFY_DELAY	250
+
+
 BEGIN_EVENT_TABLE(CSearchList, wxEvtHandler)
 	EVT_MULE_TIMER(wxID_ANY, CSearchList::OnGlobalSearchTimer)
 END_EVENT_TABLE()
@@ -274,7 +279,8 @@ CSearchList::CSearchList()
 	  m_currentSearch(-1),
 	  m_searchPacket(NULL),
 	  m_64bitSearchPacket(false),
-	  m_KadSearchFinished(true)
+	  m_KadSearchFinished(true),
+	  m_notifyTimer(0)
 {}
 
 
@@ -282,6 +288,10 @@ CSearchList::~CSearchList()
 {
 	StopSearch();
 
+	if (m_notifyTimer) {
+		theApp->timerwheel->RemoveTimer(m_notifyTimer);
+	}
+
 	while (!m_results.empty()) {
 		RemoveResults(m_results.begin()->first);
 	}
@@ -297,12 +307,31 @@ void CSearchList::RemoveResults(long searchID)
 	if ( it != m_results.end() ) {
 		CSearchResultList& list = it->second;
 
+		// Drop whatever is still to be announced about these results
+		std::map<CSearchFile*, bool>::iterator pending = m_pendingNotifications.begin();
+		while (pending != m_pendingNotifications.end()) {
+			if (static_cast<long>(pending->first->GetSearchID()) == searchID) {
+				m_pendingNotifications.erase(pending++);
+			} else {
+				++pending;
+			}
+		}
+
+		// EC clients and the GUI are told right away, the results are
+		// gone after this
+		if (theApp->ECServerHandler) {
+			theApp->ECServerHandler->m_ec_notifier->Search_RemoveResults(searchID);
+		}
+		Notify_Search_Remove_Results(searchID);
+
 		for (size_t i = 0; i < list.size(); ++i) {
 			delete list.at(i);
 		}
 
 		m_results.erase( it );
 	}
+
+	m_resultIndex.erase(searchID);
 }
 
 
@@ -404,6 +433,7 @@ void CSearchList::LocalSearchEnd()
 		m_searchTimer.Start(750);
 	} else {
 		m_searchInProgress = false;
+		FlushNotifications();
 		Notify_SearchLocalEnd();
 	}
 }
@@ -586,15 +616,16 @@ bool CSearchList::AddToList(CSearchFile* toadd, bool clientResponse)
 
 	// Get, or implictly create, the map of results for this search
 	CSearchResultList& results = m_results[toadd->GetSearchID()];
+	ResultIndex& index = m_resultIndex[toadd->GetSearchID()];
 
-	for (size_t i = 0; i < results.size(); ++i) {
-		CSearchFile* item = results.at(i);
+	for (ResultIndex::const_iterator it = index.find(toadd->GetFileHash()); it != index.end(); it = index.find_next(it)) {
+		CSearchFile* item = it->second;
 
-		if ((toadd->GetFileHash() == item->GetFileHash()) && (toadd->GetFileSize() == item->GetFileSize())) {
+		if (toadd->GetFileSize() == item->GetFileSize()) {
 			AddDebugLogLineN(logSearch, CFormat(wxT("Received duplicate results for '%s' : %s")) % item->GetFileName() % item->GetFileHash().Encode());
 			// Add the child, possibly updating the parents filename.
 			item->AddChild(toadd);
-			Notify_Search_Update_Sources(item);
+			QueueNotification(item, false);
 			return true;
 		}
 	}
@@ -605,12 +636,50 @@ bool CSearchList::AddToList(CSearchFile* toadd, bool clientResponse)
 
 	// New unique result, simply add and display.
 	results.push_back(toadd);
-	Notify_Search_Add_Result(toadd);
+	index.insert(toadd->GetFileHash(), toadd);
+	QueueNotification(toadd, true);
 
 	return true;
 }
 
 
+void CSearchList::QueueNotification(CSearchFile* file, bool added)
+{
+	// A result announced as new is shown as it is by then
+	bool& pending = m_pendingNotifications[file];
+	pending = pending || added;
+
+	if (!m_notifyTimer) {
+		m_notifyTimer = theApp->timerwheel->AddTimer(MakeTimerWheelTask(this, &CSearchList::FlushNotifications), SEARCH_NOTIFY_DELAY);
+	}
+}
+
+
+void CSearchList::FlushNotifications()
+{
+	if (m_notifyTimer) {
+		theApp->timerwheel->RemoveTimer(m_notifyTimer);
+		m_notifyTimer = 0;
+	}
+
+	if (m_pendingNotifications.empty()) {
+		return;
+	}
+
+	std::map<CSearchFile*, bool> pending;
+	pending.swap(m_pendingNotifications);
+
+	// Shown in ranges on the next core tick, see FlushListNotifications
+	for (std::map<CSearchFile*, bool>::const_iterator it = pending.begin(); it != pending.end(); ++it) {
+		if (it->second) {
+			Notify_Search_Add_Result(it->first);
+		} else {
+			Notify_Search_Update_Sources(it->first);
+		}
+	}
+}
+
+
 const CSearchResultList& CSearchList::GetSearchResults(long searchID) const
 {
 	ResultMap::const_iterator it = m_results.find(searchID);
@@ -626,16 +695,15 @@ const CSearchResultList& CSearchList::GetSearchResults(long searchID) const
 
 void CSearchList::AddFileToDownloadByHash(const CMD4Hash& hash, uint8 cat)
 {
-	ResultMap::iterator it = m_results.begin();
-	for ( ; it != m_results.end(); ++it ) {
-		CSearchResultList& list = it->second;
+	std::map<long, ResultIndex>::const_iterator it = m_resultIndex.begin();
+	for ( ; it != m_resultIndex.end(); ++it ) {
+		const ResultIndex& index = it->second;
 
-		for ( unsigned int i = 0; i < list.size(); ++i ) {
-			if ( list[i]->GetFileHash() == hash ) {
-				CoreNotify_Search_Add_Download( list[i], cat );
+		ResultIndex::const_iterator result = index.find(hash);
+		if ( result != index.end() ) {
+			CoreNotify_Search_Add_Download( result->second, cat );
 
-				return;
-			}
+			return;
 		}
 	}
 }
@@ -1037,16 +1105,13 @@ void CSearchList::KademliaSearchKeyword(uint32_t searchID, const Kademlia::CUInt
 
 void CSearchList::UpdateSearchFileByHash(const CMD4Hash& hash)
 {
-	for (ResultMap::iterator it = m_results.begin(); it != m_results.end(); ++it) {
-		CSearchResultList& results = it->second;
-		for (size_t i = 0; i < results.size(); ++i) {
-			CSearchFile* item = results.at(i);
-
-			if (hash == item->GetFileHash()) {
-				// This covers only parent items,
-				// child items have to be updated separately.
-				Notify_Search_Update_Sources(item);
-			}
+	for (std::map<long, ResultIndex>::const_iterator it = m_resultIndex.begin(); it != m_resultIndex.end(); ++it) {
+		const ResultIndex& index = it->second;
+
+		for (ResultIndex::const_iterator result = index.find(hash); result != index.end(); result = index.find_next(result)) {
+			// This covers only parent items,
+			// child items have to be updated separately.
+			Notify_Search_Update_Sources(result->second);
 		}
 	}
 }
@@ -29,8 +29,12 @@
 #include "Timer.h"		// Needed for CTimer
 #include "ObservableQueue.h"	// Needed for CQueueObserver
 #include "SearchFile.h"		// Needed for CSearchFile
+#include "RobinHoodMap.h"	// Needed for CRobinHoodMultiMap
+#include "TimerWheel.h"		// Needed for CTimerWheel::TimerID
 #include <common/SmartPtr.h>	// Needed for CSmartPtr
 
+#include <map>
+
 
 class CMemFile;
 class CMD4Hash;
@@ -171,10 +175,22 @@ public:
 	/** Mark current KAD search as finished */
 	void SetKadSearchFinished() { m_KadSearchFinished = true; }
 
+	/**
+	 * Sends the notifications for the results added or updated since the last call.
+	 *
+	 * Results are not announced one by one as they arrive, but collected
+	 * and handed to the GUI and the EC clients in one go, either after
+	 * SEARCH_NOTIFY_DELAY or once the search has ended.
+	 */
+	void FlushNotifications();
+
 private:
 	/** Event-handler for global searches. */
 	void OnGlobalSearchTimer(CTimerEvent& evt);
 
+	/** Queues the notification for a new or updated result. */
+	void QueueNotification(CSearchFile* file, bool added);
+
 	/**
 	 * Adds the specified file to the current search's results.
 	 *
@@ -225,6 +241,18 @@ private:
 	//! Map of all search-results added.
 	ResultMap	m_results;
 
+	//! File-hash -> result, for finding duplicates without scanning the results.
+	typedef CRobinHoodMultiMap<CMD4Hash, CSearchFile*, CRobinHoodMD4Hash> ResultIndex;
+
+	//! Index of the results of each search (key is a SearchID).
+	std::map<long, ResultIndex> m_resultIndex;
+
+	//! Results waiting to be announced, with true for new ones.
+	std::map<CSearchFile*, bool> m_pendingNotifications;
+
+	//! The timer sending the pending notifications, 0 if none is scheduled.
+	CTimerWheel::TimerID	m_notifyTimer;
+
 	//! Contains the results type desired in the current search.
 	//! If not empty, results of different types are filtered.
 	wxString	m_resultType;
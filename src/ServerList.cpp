@@ -245,7 +245,7 @@ bool CServerList::AddServer(CServer* in_server, bool fromUser)
 	theStats::AddServer();
 
 	m_servers.push_back(in_server);
-	NotifyObservers( EventType( EventType::INSERTED, in_server ) );
+	NotifyInserted( in_server );
 
 	if ( fromUser ) {
 		AddLogLineC(CFormat( _("Server added: Server at [%s:%d] using the name '%s'.") )
@@ -351,7 +351,7 @@ void CServerList::RemoveServer(CServer* in_server)
 				theApp->downloadqueue->SetUDPServer( 0 );
 			}
 
-			NotifyObservers( EventType( EventType::REMOVED, in_server ) );
+			NotifyRemoved( in_server );
 
 			if (m_serverpos == it) {
 				++m_serverpos;
@@ -371,7 +371,7 @@ void CServerList::RemoveServer(CServer* in_server)
 
 void CServerList::RemoveAllServers()
 {
-	NotifyObservers( EventType( EventType::CLEARED ) );
+	NotifyCleared();
 
 	theStats::DeleteAllServers();
 	// no connection, safely remove all servers
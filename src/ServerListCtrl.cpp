@@ -126,6 +126,18 @@ void CServerListCtrl::AddServer( CServer* toadd )
 }
 
 
+void CServerListCtrl::AddServers( const std::vector<CServer*>& servers )
+{
+	Freeze();
+	for (size_t i = 0; i < servers.size(); ++i) {
+		RefreshServer( servers[i] );
+	}
+	Thaw();
+
+	ShowServerCount();
+}
+
+
 void CServerListCtrl::RemoveServer(CServer* server)
 {
 	long result = FindItem(-1, reinterpret_cast<wxUIntPtr>(server));
@@ -28,6 +28,8 @@
 
 #include "MuleListCtrl.h"	// Needed for CMuleListCtrl
 
+#include <vector>
+
 #define	COLUMN_SERVER_NAME	0
 #define	COLUMN_SERVER_ADDR	1
 #define	COLUMN_SERVER_PORT	2
@@ -87,6 +89,16 @@ public:
 	 */
 	void	AddServer( CServer* toadd );
 
+	/**
+	 * Adds a number of servers to the list.
+	 *
+	 * @param servers The new servers.
+	 *
+	 * Like AddServer, but with the list frozen and the server-count updated
+	 * only once, which makes up for most of the time spent on large lists.
+	 */
+	void	AddServers( const std::vector<CServer*>& servers );
+
 	/**
 	 * Removes a server from the displayed list.
 	 */
@@ -48,6 +48,7 @@
 #include <common/Format.h>
 #include "IPFilter.h"
 #include "GuiEvents.h"		// Needed for Notify_*
+#include "Metrics.h"		// Needed for CMetricsTimer
 #ifdef ASIO_SOCKETS
 #	include <boost/system/error_code.hpp>
 #endif
@@ -672,6 +673,8 @@ void CServerSocket::OnError(int DEBUG_ONLY(nErrorCode))
 
 bool CServerSocket::PacketReceived(CPacket* packet)
 {
+	CMetricsTimer metricsTimer(CMetrics::SubsystemServerTCP);
+
 	AddDebugLogLineN(logServer, CFormat(wxT("Server: Packet Received: Prot %x, Opcode %x, Length %u")) % packet->GetProtocol() % packet->GetOpCode() % packet->GetPacketSize());
 
 	if (packet->GetProtocol() == OP_PACKEDPROT) {
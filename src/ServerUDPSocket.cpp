@@ -41,6 +41,7 @@
 #include "AsyncDNS.h" // Needed for CAsyncDNS
 #include "Statistics.h"		// Needed for theStats
 #include "Logger.h"
+#include "Metrics.h"		// Needed for CMetrics
 #include <common/Format.h>
 #include "updownclient.h"	// Needed for SF_REMOTE_SERVER
 #include "GuiEvents.h"		// Needed for Notify_*
@@ -92,6 +93,9 @@ void CServerUDPSocket::OnPacketReceived(uint32 serverip, uint16 serverport, uint
 	uint8 protocol = pBuffer[0];
 	uint8 opcode  = pBuffer[1];
 
+	CMetrics::CountPacket(CMetrics::Received, CMetrics::TransportUDP, protocol, opcode);
+	CMetricsTimer metricsTimer(CMetrics::SubsystemServerUDP);
+
 	if (protocol == OP_EDONKEYPROT) {
 		CMemFile data(pBuffer + 2, nPayLoadLen - 2);
 		ProcessPacket(data, opcode, serverip, serverport);
@@ -0,0 +1,111 @@
+//
+// This file is part of the aMule Project.
+//
+// Copyright (c) 2003-2011 aMule Team ( admin@amule.org / http://www.amule.org )
+//
+// Any parts of this program derived from the xMule, lMule or eMule project,
+// or contributed by third-party developers are copyrighted by their
+// respective authors.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA
+//
+
+#ifndef SHARDEDCOUNTER_H
+#define SHARDEDCOUNTER_H
+
+#include "Types.h"		// Needed for uint32
+#include "MuleAtomic.h"		// Needed for CAtomic
+
+#include <wx/thread.h>		// Needed for wxThread::GetCurrentId
+
+
+/**
+ * A sum which many threads add to without locking and without all of
+ * them writing the same cache line.
+ *
+ * Each thread adds to one of a few shards, chosen by its thread id. The
+ * shards only ever grow (wrapping around), and the single reader keeps
+ * the values it saw last, so Collect needs no read-modify-write on the
+ * shards and cannot lose additions made while it runs.
+ *
+ * Collect must only be called by one thread at a time, and more than
+ * 4GB must not be added between two calls.
+ */
+class CShardedCounter
+{
+public:
+	CShardedCounter()
+	{
+		for (uint32 i = 0; i < SHARD_COUNT; ++i) {
+			m_collected[i] = 0;
+		}
+	}
+
+	//! Adds to the sum, can be called by any thread.
+	void Add(uint32 value)
+	{
+		m_shards[GetShard()].sum.FetchAdd(value);
+	}
+
+	//! Returns what was added since the last call.
+	uint32 Collect()
+	{
+		uint32 result = 0;
+		for (uint32 i = 0; i < SHARD_COUNT; ++i) {
+			const uint32 sum = m_shards[i].sum.Load();
+			result += sum - m_collected[i];
+			m_collected[i] = sum;
+		}
+
+		return result;
+	}
+
+	//! Forgets what was added since the last call of Collect.
+	void Discard()	{ Collect(); }
+
+private:
+	enum {
+		SHARD_BITS = 3,
+		SHARD_COUNT = 1 << SHARD_BITS,
+		CACHE_LINE = 64
+	};
+
+	static uint32 GetShard()
+	{
+		// Thread ids are usually aligned addresses, mix the high bits in
+		unsigned long id = wxThread::GetCurrentId();
+		id ^= id >> 21;
+		id ^= id >> 12;
+		return (static_cast<uint32>(id) * 2654435761u) >> (32 - SHARD_BITS);
+	}
+
+	struct Shard
+	{
+		CAtomic<uint32>	sum;
+		// Without lock-free atomics CAtomic holds a mutex and may not fit
+		char		padding[sizeof(CAtomic<uint32>) < CACHE_LINE ? CACHE_LINE - sizeof(CAtomic<uint32>) : 1];
+	};
+
+	Shard	m_shards[SHARD_COUNT];
+	//! Only used by the reader.
+	uint32	m_collected[SHARD_COUNT];
+
+	//! A CShardedCounter is neither copyable nor assignable.
+	CShardedCounter(const CShardedCounter&);
+	CShardedCounter& operator=(const CShardedCounter&);
+};
+
+#endif // SHARDEDCOUNTER_H
+// File_checked_for_headers
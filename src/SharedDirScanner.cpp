@@ -0,0 +1,259 @@
+//
+// This file is part of the aMule Project.
+//
+// Copyright (c) 2003-2011 aMule Team ( admin@amule.org / http://www.amule.org )
+//
+// Any parts of this program derived from the xMule, lMule or eMule project,
+// or contributed by third-party developers are copyrighted by their
+// respective authors.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA
+//
+
+#include "SharedDirScanner.h"	// Interface declarations
+
+#include "MuleThread.h"		// Needed for CMuleThread
+
+#include <algorithm>		// Needed for std::min
+
+#ifdef __WINDOWS__
+	#include <common/FileFunctions.h>	// Needed for CDirIterator
+#else
+	#include <sys/types.h>
+	#include <sys/stat.h>
+	#include <dirent.h>
+	#include <fcntl.h>
+#endif
+
+
+/**
+ * Worker thread, lists directories until none are left.
+ */
+class CSharedDirScanner::CWorker : public CMuleThread
+{
+public:
+	CWorker(CSharedDirScanner* owner)
+		: CMuleThread(wxTHREAD_JOINABLE),
+		  m_owner(owner)
+	{
+	}
+
+protected:
+	virtual void* Entry()
+	{
+		m_owner->WorkerLoop();
+		return NULL;
+	}
+
+private:
+	CSharedDirScanner*	m_owner;
+};
+
+
+CSharedDirScanner::CSharedDirScanner(const std::list<CPath>& directories, bool includeHidden, uint32 threads)
+	: m_includeHidden(includeHidden),
+	  m_maxThreads(threads),
+	  m_done(m_lock),
+	  m_directories(directories.begin(), directories.end()),
+	  m_results(directories.size()),
+	  m_nextDir(0),
+	  m_nextResult(0),
+	  m_abort(false)
+{
+}
+
+
+CSharedDirScanner::~CSharedDirScanner()
+{
+	{
+		wxMutexLocker lock(m_lock);
+		m_abort = true;
+	}
+
+	for (size_t i = 0; i < m_workers.size(); ++i) {
+		m_workers[i]->Stop();
+		delete m_workers[i];
+	}
+
+	for (size_t i = 0; i < m_results.size(); ++i) {
+		delete m_results[i];
+	}
+}
+
+
+void CSharedDirScanner::Start()
+{
+	const size_t count = std::min<size_t>(m_maxThreads, m_directories.size());
+
+	for (size_t i = 0; i < count; ++i) {
+		CWorker* worker = new CWorker(this);
+		if (worker->Create() != wxTHREAD_NO_ERROR || worker->Run() != wxTHREAD_NO_ERROR) {
+			// Whatever is left is listed by the workers already running,
+			// or by GetNextDirectory if there are none
+			delete worker;
+			break;
+		}
+
+		m_workers.push_back(worker);
+	}
+}
+
+
+bool CSharedDirScanner::GetNextDirectory(CScannedDir& result, bool wait)
+{
+	if (IsFinished()) {
+		return false;
+	}
+
+	CScannedDir* scanned = NULL;
+	if (m_workers.empty()) {
+		scanned = new CScannedDir();
+		ScanDirectory(m_directories[m_nextResult], m_includeHidden, *scanned);
+	} else {
+		wxMutexLocker lock(m_lock);
+		while (!m_results[m_nextResult]) {
+			if (!wait) {
+				return false;
+			}
+			m_done.Wait();
+		}
+
+		scanned = m_results[m_nextResult];
+		m_results[m_nextResult] = NULL;
+	}
+
+	++m_nextResult;
+
+	result.directory = scanned->directory;
+	result.opened = scanned->opened;
+	result.files.swap(scanned->files);
+	result.failed.swap(scanned->failed);
+	delete scanned;
+
+	return true;
+}
+
+
+void CSharedDirScanner::WorkerLoop()
+{
+	while (true) {
+		size_t index;
+		{
+			wxMutexLocker lock(m_lock);
+			if (m_abort || m_nextDir >= m_directories.size()) {
+				return;
+			}
+
+			index = m_nextDir++;
+		}
+
+		CScannedDir* scanned = new CScannedDir();
+		ScanDirectory(m_directories[index], m_includeHidden, *scanned);
+
+		wxMutexLocker lock(m_lock);
+		m_results[index] = scanned;
+		m_done.Broadcast();
+	}
+}
+
+
+#ifdef __WINDOWS__
+
+void CSharedDirScanner::ScanDirectory(const CPath& directory, bool includeHidden, CScannedDir& result)
+{
+	result.directory = directory;
+	result.opened = directory.DirExists();
+
+	CDirIterator dir(directory);
+	const CDirIterator::FileType searchFor = includeHidden ? CDirIterator::File : CDirIterator::FileNoHidden;
+
+	for (CPath fname = dir.GetFirstFile(searchFor); fname.IsOk(); fname = dir.GetNextFile()) {
+		const CPath fullPath = directory.JoinPaths(fname);
+
+		CScannedFile file;
+		file.name = fname;
+		file.mtime = CPath::GetModificationTime(fullPath);
+		const sint64 size = fullPath.GetFileSize();
+
+		if ((file.mtime == (time_t)-1) || (size == wxInvalidOffset)) {
+			result.failed.push_back(fname);
+		} else {
+			file.size = size;
+			result.files.push_back(file);
+		}
+	}
+}
+
+#else
+
+void CSharedDirScanner::ScanDirectory(const CPath& directory, bool includeHidden, CScannedDir& result)
+{
+	result.directory = directory;
+
+	DIR* dir = opendir(directory.GetRaw().fn_str());
+	if (!dir) {
+		return;
+	}
+
+	result.opened = true;
+	const int dirFD = dirfd(dir);
+
+	while (struct dirent* entry = readdir(dir)) {
+		const char* name = entry->d_name;
+
+		// Also skips '.' and '..'
+		if (name[0] == '.' && (!includeHidden || !name[1] || (name[1] == '.' && !name[2]))) {
+			continue;
+		}
+
+#ifdef DT_UNKNOWN
+		// Only regular files and links to them can be shared
+		if (entry->d_type != DT_REG && entry->d_type != DT_LNK && entry->d_type != DT_UNKNOWN) {
+			continue;
+		}
+#endif
+
+		wxString fname(name, *wxConvFileName);
+		if (fname.IsEmpty()) {
+			// Not valid in the current locale
+			fname = wxString::FromUTF8(name);
+			if (fname.IsEmpty()) {
+				continue;
+			}
+		}
+
+		// One stat per entry, following links like CPath::FileExists did
+		struct stat st;
+		if (fstatat(dirFD, name, &st, 0) != 0) {
+			result.failed.push_back(CPath(fname));
+			continue;
+		}
+
+		if (!S_ISREG(st.st_mode)) {
+			continue;
+		}
+
+		CScannedFile file;
+		file.name = CPath(fname);
+		file.mtime = st.st_mtime;
+		file.size = st.st_size;
+		result.files.push_back(file);
+	}
+
+	closedir(dir);
+}
+
+#endif
+// File_checked_for_headers
@@ -0,0 +1,149 @@
+//
+// This file is part of the aMule Project.
+//
+// Copyright (c) 2003-2011 aMule Team ( admin@amule.org / http://www.amule.org )
+//
+// Any parts of this program derived from the xMule, lMule or eMule project,
+// or contributed by third-party developers are copyrighted by their
+// respective authors.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA
+//
+
+#ifndef SHAREDDIRSCANNER_H
+#define SHAREDDIRSCANNER_H
+
+#include <wx/thread.h>		// Needed for wxMutex and wxCondition
+
+#include "Types.h"		// Needed for uint32 and uint64
+#include <common/Path.h>	// Needed for CPath
+
+#include <list>
+#include <vector>
+
+
+/**
+ * Lists the files of the shared directories on a pool of worker threads.
+ *
+ * Each directory is read with a single pass of readdir, and each entry is
+ * examined with one fstatat call relative to the open directory, which
+ * yields existence, type, size and modification time at once. Entries
+ * which the directory already reports as something other than a file or
+ * a link are skipped without being stat'ed at all.
+ *
+ * Directories are listed concurrently, which hides most of the latency of
+ * network mounts, but are handed back in the order they were given, as
+ * soon as each one is done, so that the caller can work on the first
+ * directories while the rest are still being listed.
+ */
+class CSharedDirScanner
+{
+public:
+	//! A regular file found in a directory.
+	struct CScannedFile
+	{
+		CPath	name;
+		time_t	mtime;
+		uint64	size;
+	};
+
+	//! The result of listing one directory.
+	struct CScannedDir
+	{
+		CScannedDir() : opened(false) {}
+
+		CPath	directory;
+		//! False if the directory could not be read.
+		bool	opened;
+		std::vector<CScannedFile> files;
+		//! Entries that could not be examined, like broken links.
+		std::vector<CPath> failed;
+	};
+
+	/**
+	 * Constructor.
+	 *
+	 * @param directories The directories to list, in the order they are to be returned.
+	 * @param includeHidden Specifies if hidden files are to be listed.
+	 * @param threads The maximum number of worker threads.
+	 */
+	CSharedDirScanner(const std::list<CPath>& directories, bool includeHidden, uint32 threads = SCANNER_THREADS);
+
+	/**
+	 * Destructor, stops and waits for the workers.
+	 */
+	~CSharedDirScanner();
+
+	/**
+	 * Starts the workers.
+	 *
+	 * If no thread can be created, the directories are listed by
+	 * GetNextDirectory instead.
+	 */
+	void	Start();
+
+	/**
+	 * Returns the next directory, in the order they were given.
+	 *
+	 * @param result Receives the listing.
+	 * @param wait If false, returns at once when the next directory is
+	 *             still being listed, rather than waiting for it.
+	 * @return False once all directories have been returned, or if the
+	 *         next one is not listed yet and 'wait' is false.
+	 */
+	bool	GetNextDirectory(CScannedDir& result, bool wait = true);
+
+	/**
+	 * Returns true once all directories have been returned.
+	 */
+	bool	IsFinished() const	{ return m_nextResult >= m_directories.size(); }
+
+	/**
+	 * Lists a single directory on the calling thread.
+	 */
+	static void ScanDirectory(const CPath& directory, bool includeHidden, CScannedDir& result);
+
+	enum { SCANNER_THREADS = 4 };
+
+private:
+	class CWorker;
+	friend class CWorker;
+
+	//! Lists directories until none are left, called by the workers.
+	void	WorkerLoop();
+
+	const bool	m_includeHidden;
+	const uint32	m_maxThreads;
+
+	//! Guards everything below.
+	wxMutex		m_lock;
+	//! Signalled whenever a directory has been listed.
+	wxCondition	m_done;
+
+	std::vector<CPath>		m_directories;
+	//! The results, indexed like m_directories, NULL until listed.
+	std::vector<CScannedDir*>	m_results;
+	//! Index of the next directory to be listed.
+	size_t		m_nextDir;
+	//! Index of the next directory to be returned.
+	size_t		m_nextResult;
+	//! Set when the workers should stop.
+	bool		m_abort;
+
+	std::vector<CWorker*>	m_workers;
+};
+
+#endif // SHAREDDIRSCANNER_H
+// File_checked_for_headers
@@ -0,0 +1,300 @@
+//
+// This file is part of the aMule Project.
+//
+// Copyright (c) 2003-2011 aMule Team ( admin@amule.org / http://www.amule.org )
+//
+// Any parts of this program derived from the xMule, lMule or eMule project,
+// or contributed by third-party developers are copyrighted by their
+// respective authors.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA
+//
+
+#include "config.h"		// Needed for HAVE_SYS_INOTIFY_H
+
+#include "SharedDirWatcher.h"	// Interface declarations
+
+#include "SharedDirScanner.h"	// Needed for CSharedDirScanner
+#include "GetTickCount.h"	// Needed for GetTickCount
+#include "Logger.h"		// Needed for AddDebugLogLineN
+#include <common/Format.h>	// Needed for CFormat
+#include <common/Macros.h>	// Needed for SEC2MS
+
+#ifdef HAVE_SYS_INOTIFY_H
+	#include <sys/inotify.h>
+	#include <unistd.h>
+	#include <fcntl.h>
+	#include <errno.h>
+#endif
+
+
+//! A file is reported once nothing happened to it for this long.
+#define SHAREWATCH_SETTLE_TIME	SEC2MS(3)
+//! How often directories without inotify watch are listed.
+#define SHAREWATCH_POLL_TIME	SEC2MS(60)
+
+
+CSharedDirWatcher::CSharedDirWatcher()
+	: m_includeHidden(false),
+	  m_lost(false),
+	  m_lastPoll(0),
+	  m_inotify(-1)
+{
+}
+
+
+CSharedDirWatcher::~CSharedDirWatcher()
+{
+	Stop();
+}
+
+
+void CSharedDirWatcher::Watch(const std::list<CPath>& directories, bool includeHidden)
+{
+	Stop();
+
+	m_directories.assign(directories.begin(), directories.end());
+	m_snapshots.resize(m_directories.size());
+	m_polled.assign(m_directories.size(), true);
+	m_includeHidden = includeHidden;
+	m_lastPoll = GetTickCount();
+
+#ifdef HAVE_SYS_INOTIFY_H
+	if (!m_directories.empty()) {
+		m_inotify = inotify_init();
+		if (m_inotify != -1) {
+			fcntl(m_inotify, F_SETFL, fcntl(m_inotify, F_GETFL) | O_NONBLOCK);
+			fcntl(m_inotify, F_SETFD, FD_CLOEXEC);
+		} else {
+			AddDebugLogLineN(logKnownFiles, wxT("inotify is not available, polling shared directories instead."));
+		}
+	}
+
+	const uint32 mask = IN_CREATE | IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB
+		| IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE | IN_DELETE_SELF | IN_MOVE_SELF;
+
+	for (size_t i = 0; m_inotify != -1 && i < m_directories.size(); ++i) {
+		int wd = inotify_add_watch(m_inotify, m_directories[i].GetRaw().fn_str(), mask);
+		if (wd != -1) {
+			m_watches[wd] = i;
+			m_polled[i] = false;
+		} else {
+			AddDebugLogLineN(logKnownFiles,
+				CFormat(wxT("Cannot watch shared directory, polling it instead: %s"))
+					% m_directories[i]);
+		}
+	}
+#endif
+
+	// Take the initial listing of polled directories
+	for (size_t i = 0; i < m_directories.size(); ++i) {
+		if (m_polled[i]) {
+			CSharedDirScanner::CScannedDir scanned;
+			CSharedDirScanner::ScanDirectory(m_directories[i], m_includeHidden, scanned);
+
+			for (size_t j = 0; j < scanned.files.size(); ++j) {
+				const CSharedDirScanner::CScannedFile& file = scanned.files[j];
+				m_snapshots[i][file.name] = std::make_pair(file.mtime, file.size);
+			}
+		}
+	}
+}
+
+
+void CSharedDirWatcher::Stop()
+{
+#ifdef HAVE_SYS_INOTIFY_H
+	if (m_inotify != -1) {
+		// Closing the descriptor removes all watches
+		close(m_inotify);
+		m_inotify = -1;
+	}
+#endif
+
+	m_watches.clear();
+	m_directories.clear();
+	m_snapshots.clear();
+	m_polled.clear();
+	m_pending.clear();
+	m_lost = false;
+}
+
+
+bool CSharedDirWatcher::GetChanges(std::vector<CChange>& changes)
+{
+	if (m_directories.empty()) {
+		return true;
+	}
+
+	const uint32 now = GetTickCount();
+
+	ReadEvents(now);
+
+	if (now - m_lastPoll >= SHAREWATCH_POLL_TIME) {
+		m_lastPoll = now;
+		PollDirectories(now);
+	}
+
+	if (m_lost) {
+		m_pending.clear();
+		m_lost = false;
+		return false;
+	}
+
+	for (PendingMap::iterator it = m_pending.begin(); it != m_pending.end(); ) {
+		if (now - it->second >= SHAREWATCH_SETTLE_TIME) {
+			CChange change;
+			change.directory = m_directories[it->first.first];
+			change.name = it->first.second;
+			changes.push_back(change);
+
+			m_pending.erase(it++);
+		} else {
+			++it;
+		}
+	}
+
+	return true;
+}
+
+
+void CSharedDirWatcher::AddPending(size_t dir, const CPath& name, uint32 now)
+{
+	m_pending[std::make_pair(dir, name)] = now;
+}
+
+
+void CSharedDirWatcher::ReadEvents(uint32 now)
+{
+#ifdef HAVE_SYS_INOTIFY_H
+	if (m_inotify == -1) {
+		return;
+	}
+
+	// Aligned for struct inotify_event
+	uint32 buffer[4096];
+
+	while (true) {
+		ssize_t len = read(m_inotify, buffer, sizeof(buffer));
+		if (len <= 0) {
+			if (len == -1 && errno == EINTR) {
+				continue;
+			}
+
+			// EAGAIN, nothing more queued
+			return;
+		}
+
+		const char* pos = reinterpret_cast<const char*>(buffer);
+		const char* end = pos + len;
+		while (pos < end) {
+			const struct inotify_event* event = reinterpret_cast<const struct inotify_event*>(pos);
+			pos += sizeof(struct inotify_event) + event->len;
+
+			if (event->mask & IN_Q_OVERFLOW) {
+				AddDebugLogLineN(logKnownFiles, wxT("Shared directory events were lost, reloading shared files."));
+				m_lost = true;
+				continue;
+			}
+
+			std::map<int, size_t>::const_iterator it = m_watches.find(event->wd);
+			if (it == m_watches.end()) {
+				continue;
+			}
+
+			if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) {
+				AddDebugLogLineN(logKnownFiles,
+					CFormat(wxT("Shared directory went away, reloading shared files: %s"))
+						% m_directories[it->second]);
+				m_lost = true;
+				continue;
+			}
+
+			// Subdirectories are not shared
+			if (!event->len || (event->mask & IN_ISDIR)) {
+				continue;
+			}
+
+			const char* name = event->name;
+			if (name[0] == '.' && !m_includeHidden) {
+				continue;
+			}
+
+			wxString fname(name, *wxConvFileName);
+			if (fname.IsEmpty()) {
+				fname = wxString::FromUTF8(name);
+				if (fname.IsEmpty()) {
+					continue;
+				}
+			}
+
+			AddPending(it->second, CPath(fname), now);
+		}
+	}
+#else
+	(void)now;
+#endif
+}
+
+
+void CSharedDirWatcher::PollDirectories(uint32 now)
+{
+	for (size_t i = 0; i < m_directories.size(); ++i) {
+		if (!m_polled[i]) {
+			continue;
+		}
+
+		CSharedDirScanner::CScannedDir scanned;
+		CSharedDirScanner::ScanDirectory(m_directories[i], m_includeHidden, scanned);
+		if (!scanned.opened) {
+			AddDebugLogLineN(logKnownFiles,
+				CFormat(wxT("Shared directory went away, reloading shared files: %s"))
+					% m_directories[i]);
+			m_lost = true;
+			return;
+		}
+
+		Snapshot current;
+		for (size_t j = 0; j < scanned.files.size(); ++j) {
+			const CSharedDirScanner::CScannedFile& file = scanned.files[j];
+			current[file.name] = std::make_pair(file.mtime, file.size);
+		}
+
+		// Both listings are sorted by name, so they can be merged
+		Snapshot& previous = m_snapshots[i];
+		Snapshot::const_iterator oldIt = previous.begin();
+		Snapshot::const_iterator newIt = current.begin();
+		while (oldIt != previous.end() || newIt != current.end()) {
+			if (newIt == current.end() || (oldIt != previous.end() && oldIt->first < newIt->first)) {
+				// Removed
+				AddPending(i, oldIt->first, now);
+				++oldIt;
+			} else if (oldIt == previous.end() || newIt->first < oldIt->first) {
+				// Added
+				AddPending(i, newIt->first, now);
+				++newIt;
+			} else {
+				if (oldIt->second != newIt->second) {
+					AddPending(i, newIt->first, now);
+				}
+				++oldIt;
+				++newIt;
+			}
+		}
+
+		previous.swap(current);
+	}
+}
+// File_checked_for_headers
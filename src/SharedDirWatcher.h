@@ -0,0 +1,119 @@
+//
+// This file is part of the aMule Project.
+//
+// Copyright (c) 2003-2011 aMule Team ( admin@amule.org / http://www.amule.org )
+//
+// Any parts of this program derived from the xMule, lMule or eMule project,
+// or contributed by third-party developers are copyrighted by their
+// respective authors.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA
+//
+
+#ifndef SHAREDDIRWATCHER_H
+#define SHAREDDIRWATCHER_H
+
+#include "Types.h"		// Needed for uint32 and uint64
+#include <common/Path.h>	// Needed for CPath
+
+#include <list>
+#include <map>
+#include <vector>
+
+
+/**
+ * Watches the shared directories for files being added, removed or changed.
+ *
+ * On Linux, inotify is used. Directories which cannot be watched that way
+ * (no inotify, or the watch limit was reached) are polled instead, by
+ * listing them periodically and comparing the result with the previous
+ * listing.
+ *
+ * Changes are coalesced: a file is only reported once nothing happened
+ * to it for a while, so that a file being copied into a shared directory
+ * is reported once, after the copy is done. What actually changed is left
+ * to the caller, which has to look at the file anyway.
+ *
+ * The class is not thread-safe and is meant to be polled from the core
+ * thread.
+ */
+class CSharedDirWatcher
+{
+public:
+	//! A file which was added, removed or changed.
+	struct CChange
+	{
+		CPath	directory;
+		CPath	name;
+	};
+
+	CSharedDirWatcher();
+	~CSharedDirWatcher();
+
+	/**
+	 * Starts watching the given directories, replacing the previous ones.
+	 */
+	void	Watch(const std::list<CPath>& directories, bool includeHidden);
+
+	/**
+	 * Stops watching and drops all pending changes.
+	 */
+	void	Stop();
+
+	//! Returns true if any directory is watched.
+	bool	IsWatching() const	{ return !m_directories.empty(); }
+
+	/**
+	 * Collects the changes which have settled.
+	 *
+	 * @param changes Receives the changed files.
+	 * @return False if changes were lost, or a shared directory itself
+	 *         went away, in which case the shares have to be reloaded.
+	 */
+	bool	GetChanges(std::vector<CChange>& changes);
+
+private:
+	//! Records an event for a file.
+	void	AddPending(size_t dir, const CPath& name, uint32 now);
+	//! Reads all queued inotify events.
+	void	ReadEvents(uint32 now);
+	//! Lists the polled directories and records differences.
+	void	PollDirectories(uint32 now);
+
+	typedef std::map<CPath, std::pair<time_t, uint64> > Snapshot;
+
+	//! The watched directories.
+	std::vector<CPath>	m_directories;
+	//! Listing of each directory which is polled, empty for watched ones.
+	std::vector<Snapshot>	m_snapshots;
+	std::vector<bool>	m_polled;
+	bool			m_includeHidden;
+
+	//! (directory, name) -> time of the last event.
+	typedef std::map<std::pair<size_t, CPath>, uint32> PendingMap;
+	PendingMap		m_pending;
+
+	//! Set when a full reload is needed.
+	bool			m_lost;
+	uint32			m_lastPoll;
+
+	//! The inotify descriptor, or -1.
+	int			m_inotify;
+	//! Watch descriptor -> index in m_directories.
+	std::map<int, size_t>	m_watches;
+};
+
+#endif // SHAREDDIRWATCHER_H
+// File_checked_for_headers
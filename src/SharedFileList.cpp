@@ -285,11 +285,18 @@ void CPublishKeywordList::PurgeUnreferencedKeywords()
 }
 
 
+//! Time in ms ContinueReload may spend adding files per call.
+#define RELOAD_TIME_BUDGET	50
+
+
 CSharedFileList::CSharedFileList(CKnownFileList* in_filelist){
 	filelist = in_filelist;
 	reloading = false;
+	m_scanner = NULL;
 	m_lastPublishED2K = 0;
 	m_lastPublishED2KFlag = true;
+	m_publishTimer = 0;
+	SchedulePublish();
 	/* Kad Stuff */
 	m_keywords = new CPublishKeywordList;
 	m_currFileSrc = 0;
@@ -302,10 +309,53 @@ CSharedFileList::CSharedFileList(CKnownFileList* in_filelist){
 
 CSharedFileList::~CSharedFileList()
 {
+	theApp->timerwheel->RemoveTimer(m_publishTimer);
+	// The known file list may be gone already, so no AbortSharedFiles
+	delete m_scanner;
+	DeleteContents(m_hashTasks);
 	delete m_keywords;
 }
 
 
+// Checks if the dir a is the same as b. If they are, then logs the message and returns true.
+static bool CheckDirectory(const wxString& a, const CPath& b)
+{
+	if (CPath(a).IsSameDir(b)) {
+		AddLogLineC(CFormat( _("ERROR: Attempted to share %s") ) % a);
+
+		return true;
+	}
+
+	return false;
+}
+
+
+// Checks if a directory may be shared at all, logging the reason if not.
+static bool IsShareableDirectory(const CPath& directory)
+{
+	// Do not allow these folders to be shared:
+	//  - The .aMule folder
+	//  - The Temp folder
+	//  - The users home-dir
+	if (CheckDirectory(wxGetHomeDir(), directory)) {
+		return false;
+	} else if (CheckDirectory(thePrefs::GetConfigDir(), directory)) {
+		return false;
+	} else if (CheckDirectory(thePrefs::GetTempDir().GetRaw(), directory)) {
+		return false;
+	}
+
+	if (!directory.DirExists()) {
+		AddLogLineNS(CFormat(_("Shared directory not found, skipping: %s"))
+			% directory.GetPrintable());
+
+		return false;
+	}
+
+	return true;
+}
+
+
 void CSharedFileList::FindSharedFiles()
 {
 	/* Abort loading if we are shutting down. */
@@ -322,6 +372,8 @@ void CSharedFileList::FindSharedFiles()
 	{
 		wxMutexLocker lock(list_mut);
 		m_Files_map.clear();
+		m_pathIndex.clear();
+		m_indexedPaths.clear();
 	}
 
 	// All part files are automatically shared.
@@ -350,22 +402,65 @@ void CSharedFileList::FindSharedFiles()
 	sharedPaths.sort();
 	sharedPaths.unique();
 
+	// Weed out directories which must not be shared, before listing any of them.
+	for (std::list<CPath>::iterator it = sharedPaths.begin(); it != sharedPaths.end(); ) {
+		if (IsShareableDirectory(*it)) {
+			++it;
+		} else {
+			it = sharedPaths.erase(it);
+		}
+	}
+
 	filelist->PrepareIndex();
+	// The directories are listed on worker threads, and the files of each one are added
+	// by ContinueReload as soon as it is listed, without blocking the core meanwhile.
 	// Gathering is done in the foreground and can be slowed down severely by parallel background hashing.
-	// So just store the hashing tasks for now.
-	TaskList hashTasks;
-	for (std::list<CPath>::iterator it = sharedPaths.begin(); it != sharedPaths.end(); ++it) {
-		AddFilesFromDirectory(*it, hashTasks);
+	// So just store the hashing tasks until all directories are listed.
+	m_scanPaths = sharedPaths;
+	m_scanner = new CSharedDirScanner(sharedPaths, thePrefs::ShareHiddenFiles());
+	m_scanner->Start();
+}
+
+
+void CSharedFileList::ContinueReload()
+{
+	if (!m_scanner) {
+		return;
+	}
+
+	const uint32 start = GetTickCount();
+	CSharedDirScanner::CScannedDir scanned;
+	while (GetTickCount() - start < RELOAD_TIME_BUDGET && m_scanner->GetNextDirectory(scanned, false)) {
+		AddScannedFiles(scanned, m_hashTasks);
 	}
+
+	if (m_scanner->IsFinished()) {
+		FinishSharedFiles();
+	}
+}
+
+
+void CSharedFileList::FinishSharedFiles()
+{
+	delete m_scanner;
+	m_scanner = NULL;
 	filelist->ReleaseIndex();
 
+	if (thePrefs::WatchSharedDirs()) {
+		m_watcher.Watch(m_scanPaths, thePrefs::ShareHiddenFiles());
+	} else {
+		m_watcher.Stop();
+	}
+	m_scanPaths.clear();
+
 	// Now that the shared files are gathered feed the hashing tasks to the scheduler to start hashing.
 	unsigned addedFiles = 0;
-	for (TaskList::iterator it = hashTasks.begin(); it != hashTasks.end(); ++it) {
+	for (TaskList::iterator it = m_hashTasks.begin(); it != m_hashTasks.end(); ++it) {
 		if (CThreadScheduler::AddTask(*it)) {
 			addedFiles++;
 		}
 	}
+	m_hashTasks.clear();
 
 	if (addedFiles == 0) {
 		AddLogLineN(CFormat(wxPLURAL("Found %i known shared file", "Found %i known shared files", GetCount())) % GetCount());
@@ -376,83 +471,66 @@ void CSharedFileList::FindSharedFiles()
 		// New files, AICH thread will be run at the end of the hashing thread.
 		AddLogLineN(CFormat(wxPLURAL("Found %i known shared file, %i unknown", "Found %i known shared files, %i unknown", GetCount())) % GetCount() % addedFiles);
 	}
-}
 
+	/* And now the unreferenced keywords must be removed also */
+	m_keywords->PurgeUnreferencedKeywords();
 
-// Checks if the dir a is the same as b. If they are, then logs the message and returns true.
-static bool CheckDirectory(const wxString& a, const CPath& b)
-{
-	if (CPath(a).IsSameDir(b)) {
-		AddLogLineC(CFormat( _("ERROR: Attempted to share %s") ) % a);
+	Notify_SharedFilesShowFileList();
 
-		return true;
-	}
+	// Servers connected meanwhile got a partial list
+	m_lastPublishED2KFlag = true;
 
-	return false;
+	reloading = false;
 }
 
 
-unsigned CSharedFileList::AddFilesFromDirectory(const CPath& directory, TaskList & hashTasks)
+void CSharedFileList::AbortSharedFiles()
 {
-	// Do not allow these folders to be shared:
-	//  - The .aMule folder
-	//  - The Temp folder
-	//  - The users home-dir
-	if (CheckDirectory(wxGetHomeDir(), directory)) {
-		return 0;
-	} else if (CheckDirectory(thePrefs::GetConfigDir(), directory)) {
-		return 0;
-	} else if (CheckDirectory(thePrefs::GetTempDir().GetRaw(), directory)) {
-		return 0;
-	}
+	delete m_scanner;
+	m_scanner = NULL;
+	filelist->ReleaseIndex();
+	m_scanPaths.clear();
+	DeleteContents(m_hashTasks);
+}
 
-	if (!directory.DirExists()) {
+
+unsigned CSharedFileList::AddScannedFiles(const CSharedDirScanner::CScannedDir& scanned, TaskList & hashTasks)
+{
+	const CPath& directory = scanned.directory;
+
+	if (!scanned.opened) {
 		AddLogLineNS(CFormat(_("Shared directory not found, skipping: %s"))
 			% directory.GetPrintable());
 
 		return 0;
 	}
 
-	CDirIterator::FileType searchFor = CDirIterator::FileNoHidden;
-	if (thePrefs::ShareHiddenFiles()) {
-		 searchFor = CDirIterator::File;
+	for (size_t i = 0; i < scanned.failed.size(); ++i) {
+		// This will also catch files with too strict permissions.
+		AddDebugLogLineN(logKnownFiles,
+			CFormat(wxT("Shared file does not exist (possibly a broken link) or cannot be accessed: %s"))
+				% directory.JoinPaths(scanned.failed[i]));
 	}
 
 	unsigned knownFiles = 0;
 	unsigned addedFiles = 0;
 
-	CDirIterator SharedDir(directory);
+	std::vector<CKnownFile*> found;
+	filelist->FindKnownFiles(scanned.files, found);
 
-	for (CPath fname = SharedDir.GetFirstFile(searchFor); fname.IsOk(); fname = SharedDir.GetNextFile()) {
-		CPath fullPath = directory.JoinPaths(fname);
-
-		if (!fullPath.FileExists()) {
-			AddDebugLogLineN(logKnownFiles,
-				CFormat(wxT("Shared file does not exist (possibly a broken link): %s")) % fullPath);
-			continue;
-		}
+	for (size_t i = 0; i < scanned.files.size(); ++i) {
+		const CPath& fname = scanned.files[i].name;
 
 		AddDebugLogLineN(logKnownFiles,
-			CFormat(wxT("Found shared file: %s")) % fullPath);
-
-		time_t fdate = CPath::GetModificationTime(fullPath);
-		sint64 fsize = fullPath.GetFileSize();
+			CFormat(wxT("Found shared file: %s")) % directory.JoinPaths(fname));
 
-		// This will also catch files with too strict permissions.
-		if ((fdate == (time_t)-1) || (fsize == wxInvalidOffset)) {
+		if (scanned.files[i].size == 0) {
 			AddDebugLogLineN(logKnownFiles,
-				CFormat(wxT("Failed to retrieve modification time or size for '%s', skipping.")) % fullPath);
+				CFormat(wxT("Skip zero size file '%s'")) % directory.JoinPaths(fname));
 			continue;
 		}
 
-		if (fsize == 0) {
-			AddDebugLogLineN(logKnownFiles,
-				CFormat(wxT("Skip zero size file '%s'")) % fullPath);
-			continue;
-		}
-
-
-		CKnownFile* toadd = filelist->FindKnownFile(fname, fdate, fsize);
+		CKnownFile* toadd = found[i];
 		if (toadd) {
 			knownFiles++;
 			if (AddFile(toadd)) {
@@ -460,7 +538,7 @@ unsigned CSharedFileList::AddFilesFromDirectory(const CPath& directory, TaskList
 					CFormat(wxT("Added known file '%s' to shares"))
 						% fname);
 
-				toadd->SetFilePath(directory);
+				SetFilePath(toadd, directory);
 			} else {
 				AddDebugLogLineN(logKnownFiles,
 					CFormat(wxT("File already shared, skipping: %s"))
@@ -492,16 +570,57 @@ bool CSharedFileList::AddFile(CKnownFile* pFile)
 	wxMutexLocker lock(list_mut);
 
 	CKnownFileMap::value_type entry(pFile->GetFileHash(), pFile);
-	if (m_Files_map.insert(entry).second) {
+	std::pair<CKnownFileMap::iterator, bool> inserted = m_Files_map.insert(entry);
+	if (inserted.second) {
+		IndexPath(pFile);
 		/* Keywords to publish on Kad */
 		m_keywords->AddKeywords(pFile);
 		theStats::AddSharedFile(pFile->GetFileSize());
 		return true;
+	} else if (inserted.first->second == pFile) {
+		// Already shared, but it moved if it is a download which just completed
+		IndexPath(pFile);
 	}
 	return false;
 }
 
 
+void CSharedFileList::SetFilePath(CKnownFile* file, const CPath& directory)
+{
+	wxMutexLocker lock(list_mut);
+
+	file->SetFilePath(directory);
+	IndexPath(file);
+}
+
+
+void CSharedFileList::IndexPath(CKnownFile* file)
+{
+	UnindexPath(file);
+
+	// Part files are not in the shared directories
+	if (!file->IsPartFile()) {
+		const CPath fullPath = file->GetFilePath().JoinPaths(file->GetFileName());
+		m_pathIndex[fullPath] = file;
+		m_indexedPaths[file] = fullPath;
+	}
+}
+
+
+void CSharedFileList::UnindexPath(CKnownFile* file)
+{
+	std::map<CKnownFile*, CPath>::iterator it = m_indexedPaths.find(file);
+	if (it != m_indexedPaths.end()) {
+		// Another file may have taken the path since
+		CKnownFilePathMap::iterator entry = m_pathIndex.find(it->second);
+		if (entry != m_pathIndex.end() && entry->second == file) {
+			m_pathIndex.erase(entry);
+		}
+		m_indexedPaths.erase(it);
+	}
+}
+
+
 void CSharedFileList::SafeAddKFile(CKnownFile* toadd, bool bOnlyAdd)
 {
 	// TODO: Check if the file is already known - only with another date
@@ -525,6 +644,7 @@ void CSharedFileList::RemoveFile(CKnownFile* toremove){
 	if (m_Files_map.erase(toremove->GetFileHash()) > 0) {
 		theStats::RemoveSharedFile(toremove->GetFileSize());
 	}
+	UnindexPath(toremove);
 	/* This file keywords must not be published to kad anymore */
 	m_keywords->RemoveKeywords(toremove);
 }
@@ -532,28 +652,28 @@ void CSharedFileList::RemoveFile(CKnownFile* toremove){
 
 void CSharedFileList::Reload()
 {
-	// Madcat - Disable reloading if reloading already in progress.
-	// Kry - Fixed to let non-english language users use the 'Reload' button :P
-	// deltaHF - removed the old ugly button and changed the code to use the new small one
-	// Kry - bah, let's use a var.
-	if (!reloading) {
-		AddDebugLogLineN(logKnownFiles, wxT("Reload shared files"));
-		reloading = true;
-		Notify_SharedFilesRemoveAllItems();
+	if (reloading) {
+		// The shared directories may have changed since it started
+		AddDebugLogLineN(logKnownFiles, wxT("Restarting the reload of shared files"));
+		AbortSharedFiles();
+	}
 
-		/* All Kad keywords must be removed */
-		m_keywords->RemoveAllKeywordReferences();
+	AddDebugLogLineN(logKnownFiles, wxT("Reload shared files"));
+	reloading = true;
+	Notify_SharedFilesRemoveAllItems();
 
-		/* Public identifiers must be erased as they might be invalid now */
-		m_PublicSharedDirNames.clear();
+	/* All Kad keywords must be removed */
+	m_keywords->RemoveAllKeywordReferences();
 
-		FindSharedFiles();
+	/* Public identifiers must be erased as they might be invalid now */
+	m_PublicSharedDirNames.clear();
 
-		/* And now the unreferenced keywords must be removed also */
-		m_keywords->PurgeUnreferencedKeywords();
+	FindSharedFiles();
 
+	if (!m_scanner) {
+		// Nothing to list, e.g. on shutdown
+		m_keywords->PurgeUnreferencedKeywords();
 		Notify_SharedFilesShowFileList();
-
 		reloading = false;
 	}
 }
@@ -636,6 +756,8 @@ void CSharedFileList::GetSharedFilesByDirectory(const wxString& directory,
 void CSharedFileList::ClearED2KPublishInfo(){
 	CKnownFile* cur_file;
 	m_lastPublishED2KFlag = true;
+	// Called on (dis)connecting, don't wait for the next minute
+	SchedulePublish();
 	wxMutexLocker lock(list_mut);
 	for (CKnownFileMap::iterator pos = m_Files_map.begin(); pos != m_Files_map.end(); ++pos ) {
 		cur_file = pos->second;
@@ -754,10 +876,103 @@ void CSharedFileList::SendListToServer(){
 }
 
 
+void CSharedFileList::ProcessSharedDirChanges()
+{
+	std::vector<CSharedDirWatcher::CChange> changes;
+	if (!m_watcher.GetChanges(changes)) {
+		Reload();
+		return;
+	} else if (changes.empty()) {
+		return;
+	}
+
+	TaskList hashTasks;
+	for (size_t i = 0; i < changes.size(); ++i) {
+		const CPath& directory = changes[i].directory;
+		const CPath& fname = changes[i].name;
+		const CPath fullPath = directory.JoinPaths(fname);
+
+		CKnownFile* current = NULL;
+		{
+			wxMutexLocker lock(list_mut);
+			CKnownFilePathMap::const_iterator shared = m_pathIndex.find(fullPath);
+			if (shared != m_pathIndex.end()) {
+				current = shared->second;
+			}
+		}
+
+		time_t fdate = (time_t)-1;
+		sint64 fsize = wxInvalidOffset;
+		if (fullPath.FileExists()) {
+			fdate = CPath::GetModificationTime(fullPath);
+			fsize = fullPath.GetFileSize();
+		}
+
+		if ((fdate == (time_t)-1) || (fsize == wxInvalidOffset) || (fsize == 0)) {
+			if (current) {
+				AddDebugLogLineN(logKnownFiles,
+					CFormat(wxT("Shared file is gone, removing it from shares: %s")) % fullPath);
+				RemoveFile(current);
+			}
+			continue;
+		}
+
+		if (current) {
+			if (current->GetLastChangeDatetime() == fdate && current->GetFileSize() == (uint64)fsize) {
+				continue;
+			}
+
+			AddDebugLogLineN(logKnownFiles,
+				CFormat(wxT("Shared file was modified, removing it from shares: %s")) % fullPath);
+			RemoveFile(current);
+		}
+
+		CKnownFile* toadd = filelist->FindKnownFile(fname, fdate, fsize);
+		if (toadd) {
+			if (AddFile(toadd)) {
+				AddDebugLogLineN(logKnownFiles,
+					CFormat(wxT("Added known file '%s' to shares")) % fname);
+
+				SetFilePath(toadd, directory);
+				Notify_SharedFilesShowFile(toadd);
+				m_lastPublishED2KFlag = true;
+			}
+		} else {
+			AddDebugLogLineN(logKnownFiles,
+				CFormat(wxT("Hashing new unknown shared file '%s'")) % fname);
+			hashTasks.push_back(new CHashingTask(directory, fname));
+		}
+	}
+
+	for (TaskList::iterator it = hashTasks.begin(); it != hashTasks.end(); ++it) {
+		CThreadScheduler::AddTask(*it);
+	}
+}
+
+
 void CSharedFileList::Process()
 {
+	if (!reloading) {
+		ProcessSharedDirChanges();
+	}
+
 	Publish();
-	if( !m_lastPublishED2KFlag || ( ::GetTickCount() - m_lastPublishED2K < ED2KREPUBLISHTIME ) ) {
+}
+
+void CSharedFileList::SchedulePublish()
+{
+	theApp->timerwheel->RemoveTimer(m_publishTimer);
+
+	const uint32 elapsed = ::GetTickCount() - m_lastPublishED2K;
+	const uint32 delay = (elapsed < ED2KREPUBLISHTIME) ? ED2KREPUBLISHTIME - elapsed : 0;
+	m_publishTimer = theApp->timerwheel->AddTimer(MakeTimerWheelTask(this, &CSharedFileList::OnPublishTimer), delay, ED2KREPUBLISHTIME);
+}
+
+void CSharedFileList::OnPublishTimer()
+{
+	// The flag is also set from other threads, e.g. by the part file
+	// converter, so the timer keeps running instead of being armed by it.
+	if (!m_lastPublishED2KFlag) {
 		return;
 	}
 	SendListToServer();
@@ -917,6 +1132,10 @@ bool CSharedFileList::RenameFile(CKnownFile* file, const CPath& newName)
 			// 2) we will want to edit it
 			Kademlia::WordList oldwords = file->GetKadKeywords();
 			file->SetFileName(newName);
+			{
+				wxMutexLocker lock(list_mut);
+				IndexPath(file);
+			}
 			theApp->knownfiles->Save();
 			UpdateItem(file);
 			RepublishFile(file);
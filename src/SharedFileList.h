@@ -31,6 +31,9 @@
 #include <wx/thread.h>		// Needed for wxMutex
 
 #include "Types.h"		// Needed for uint16 and uint64
+#include "SharedDirScanner.h"	// Needed for CSharedDirScanner
+#include "SharedDirWatcher.h"	// Needed for CSharedDirWatcher
+#include "TimerWheel.h"		// Needed for CTimerWheel::TimerID
 
 struct UnknownFile_Struct;
 
@@ -46,6 +49,7 @@ class CThreadTask;
 
 
 typedef std::map<CMD4Hash,CKnownFile*> CKnownFileMap;
+typedef std::map<CPath,CKnownFile*> CKnownFilePathMap;
 typedef std::map<wxString, CPath> StringPathMap;
 typedef std::list<CPath> PathList;
 
@@ -53,7 +57,26 @@ class CSharedFileList {
 public:
 	CSharedFileList(CKnownFileList* in_filelist);
 	~CSharedFileList();
+
+	/**
+	 * Starts listing the shared directories over again.
+	 *
+	 * The directories are listed on worker threads, and their files are
+	 * added by ContinueReload as the listings come in. A reload already
+	 * in progress is started over.
+	 */
 	void	Reload();
+
+	/**
+	 * Adds the files of the directories listed since the last call.
+	 *
+	 * Called by the core timer, never waits for a directory still being
+	 * listed, and returns after a few ms even if more are ready.
+	 */
+	void	ContinueReload();
+	//! Returns true while the shared directories are being listed.
+	bool	IsReloading() const	{ return reloading; }
+
 	void	SafeAddKFile(CKnownFile* toadd, bool bOnlyAdd = false);
 	void	RemoveFile(CKnownFile* toremove);
 	CKnownFile*	GetFileByID(const CMD4Hash& filehash);
@@ -105,17 +128,56 @@ private:
 	typedef std::list<CThreadTask *> TaskList;
 
 	bool	AddFile(CKnownFile* pFile);
-	unsigned	AddFilesFromDirectory(const CPath& directory, TaskList & hashTasks);
+	//! Moves a shared file to another directory, keeping the path index in sync.
+	void	SetFilePath(CKnownFile* file, const CPath& directory);
+	//! Updates the path index entry of a file, list_mut must be held.
+	void	IndexPath(CKnownFile* file);
+	//! Drops the path index entry of a file, list_mut must be held.
+	void	UnindexPath(CKnownFile* file);
+	unsigned	AddScannedFiles(const CSharedDirScanner::CScannedDir& scanned, TaskList & hashTasks);
+	//! Starts the scanner on the shared directories.
 	void	FindSharedFiles();
+	//! Watches the directories and starts hashing once all are listed.
+	void	FinishSharedFiles();
+	//! Drops the scan in progress and the files it found to hash.
+	void	AbortSharedFiles();
 	bool	reloading;
 
+	//! Lists the shared directories while reloading, NULL otherwise.
+	CSharedDirScanner*	m_scanner;
+	//! The directories being listed.
+	std::list<CPath>	m_scanPaths;
+	//! The unknown files found so far, hashed once all are listed.
+	TaskList	m_hashTasks;
+
+	/**
+	 * Adds, removes or rehashes the files which changed in the shared
+	 * directories, instead of reloading all of them.
+	 */
+	void	ProcessSharedDirChanges();
+	CSharedDirWatcher	m_watcher;
+
 	void	SendListToServer();
 	uint32 m_lastPublishED2K;
 	bool	 m_lastPublishED2KFlag;
 
+	/**
+	 * Moves the next run of the publish timer to ED2KREPUBLISHTIME after
+	 * the last publish, which may be right away.
+	 */
+	void	SchedulePublish();
+	//! Sends the files to the server if m_lastPublishED2KFlag is set.
+	void	OnPublishTimer();
+	//! Runs OnPublishTimer every ED2KREPUBLISHTIME.
+	CTimerWheel::TimerID	m_publishTimer;
+
 	CKnownFileList*	filelist;
 
 	CKnownFileMap		m_Files_map;
+	//! Shared complete files by full path, for matching directory changes.
+	CKnownFilePathMap	m_pathIndex;
+	//! The key of each file in m_pathIndex, as its path may change later.
+	std::map<CKnownFile*, CPath>	m_indexedPaths;
 	mutable wxMutex		list_mut;
 
 	StringPathMap m_PublicSharedDirNames;  //! used for mapping strings to shared directories
@@ -27,6 +27,8 @@
 
 #include <common/MenuIDs.h>
 
+#include <set>
+
 #include "muuli_wdr.h"			// Needed for ID_SHFILELIST
 #include "SharedFilesWnd.h"		// Needed for CSharedFilesWnd
 #include "amuleDlg.h"			// Needed for CamuleDlg
@@ -250,6 +252,29 @@ void CSharedFilesCtrl::ShowFile(CKnownFile* file)
 }
 
 
+void CSharedFilesCtrl::ShowFiles(const std::vector<CKnownFile*>& files)
+{
+	// One pass over the list, rather than a FindItem for every file
+	std::set<wxUIntPtr> shown;
+	for (long i = 0; i < GetItemCount(); ++i) {
+		shown.insert(GetItemData(i));
+	}
+
+	Freeze();
+
+	for (size_t i = 0; i < files.size(); ++i) {
+		if (shown.insert(reinterpret_cast<wxUIntPtr>(files[i])).second) {
+			DoShowFile(files[i], true);
+		}
+	}
+
+	SortList();
+	ShowFilesCount();
+
+	Thaw();
+}
+
+
 void CSharedFilesCtrl::DoShowFile(CKnownFile* file, bool batch)
 {
 	wxUIntPtr ptr = reinterpret_cast<wxUIntPtr>(file);
@@ -458,6 +483,27 @@ void CSharedFilesCtrl::UpdateItem(CKnownFile* toupdate)
 }
 
 
+void CSharedFilesCtrl::UpdateItems(const std::vector<CKnownFile*>& files)
+{
+	std::set<wxUIntPtr> updated;
+	for (size_t i = 0; i < files.size(); ++i) {
+		updated.insert(reinterpret_cast<wxUIntPtr>(files[i]));
+	}
+
+	bool selected = false;
+	for (long i = 0; i < GetItemCount(); ++i) {
+		if (updated.count(GetItemData(i))) {
+			RefreshItem(i);
+			selected = selected || GetItemState(i, wxLIST_STATE_SELECTED);
+		}
+	}
+
+	if (selected) {
+		theApp->amuledlg->m_sharedfileswnd->SelectionUpdated();
+	}
+}
+
+
 void CSharedFilesCtrl::ShowFilesCount()
 {
 	wxStaticText* label = CastByName( wxT("sharedFilesLabel"), GetParent(), wxStaticText );
@@ -28,6 +28,8 @@
 
 #include "MuleListCtrl.h"	// Needed for CMuleListCtrl
 
+#include <vector>
+
 
 class CSharedFileList;
 class CKnownFile;
@@ -65,6 +67,15 @@ public:
 	 */
 	void	ShowFile(CKnownFile* file);
 
+	/**
+	 * Adds a number of files to the list, skipping those already shown.
+	 *
+	 * @param files The new files to be shown.
+	 *
+	 * The list is sorted and the filecount updated once for all files.
+	 */
+	void	ShowFiles(const std::vector<CKnownFile*>& files);
+
 	/**
 	 * Removes a file from the list.
 	 *
@@ -79,6 +90,13 @@ public:
 	 */
 	void	UpdateItem(CKnownFile* toupdate);
 
+	/**
+	 * Updates a number of files on the list.
+	 *
+	 * @param files The files to be updated.
+	 */
+	void	UpdateItems(const std::vector<CKnownFile*>& files);
+
 	/**
 	 * Updates the number of shared files displayed above the list.
 	 */
@@ -0,0 +1,237 @@
+//
+// This file is part of the aMule Project.
+//
+// Copyright (c) 2003-2011 aMule Team ( admin@amule.org / http://www.amule.org )
+//
+// Any parts of this program derived from the xMule, lMule or eMule project,
+// or contributed by third-party developers are copyrighted by their
+// respective authors.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA
+//
+
+#include "StartupLoader.h"	// Interface declarations
+
+#include "MuleThread.h"		// Needed for CMuleThread
+#include "GetTickCount.h"	// Needed for GetTickCountFullRes
+#include "Logger.h"		// Needed for AddLogLineNS
+#include <common/Format.h>	// Needed for CFormat
+
+#include <algorithm>		// Needed for std::min and std::max
+
+
+/**
+ * Worker thread, runs phases until none are left for it.
+ */
+class CStartupLoader::CWorker : public CMuleThread
+{
+public:
+	CWorker(CStartupLoader* owner, uint32 thread)
+		: CMuleThread(wxTHREAD_JOINABLE),
+		  m_owner(owner),
+		  m_thread(thread)
+	{
+	}
+
+protected:
+	virtual void* Entry()
+	{
+		m_owner->WorkerLoop(m_thread);
+		return NULL;
+	}
+
+private:
+	CStartupLoader*	m_owner;
+	uint32		m_thread;
+};
+
+
+CStartupLoader::CStartupLoader(uint32 threads)
+	: m_maxThreads(threads),
+	  m_changed(m_lock),
+	  m_done(0),
+	  m_startTime(0)
+{
+}
+
+
+CStartupLoader::~CStartupLoader()
+{
+	for (size_t i = 0; i < m_workers.size(); ++i) {
+		m_workers[i]->Stop();
+		delete m_workers[i];
+	}
+
+	for (size_t i = 0; i < m_phases.size(); ++i) {
+		delete m_phases[i].task;
+	}
+}
+
+
+size_t CStartupLoader::AddPhase(const wxString& name, CStartupTask* task, bool onWorker)
+{
+	CPhase phase;
+	phase.name = name;
+	phase.task = task;
+	phase.onWorker = onWorker;
+	phase.started = false;
+	phase.done = false;
+	phase.startTime = 0;
+	phase.endTime = 0;
+	phase.thread = 0;
+	m_phases.push_back(phase);
+
+	return m_phases.size() - 1;
+}
+
+
+void CStartupLoader::AddDependency(size_t phase, size_t dependsOn)
+{
+	// Only depending on earlier phases rules out cycles
+	wxCHECK_RET(dependsOn < phase && phase < m_phases.size(), wxT("Invalid startup phase dependency"));
+
+	m_phases[phase].dependencies.push_back(dependsOn);
+}
+
+
+void CStartupLoader::Run()
+{
+	m_startTime = GetTickCountFullRes();
+
+	size_t workerPhases = 0;
+	for (size_t i = 0; i < m_phases.size(); ++i) {
+		if (m_phases[i].onWorker) {
+			++workerPhases;
+		}
+	}
+
+	const size_t count = std::min<size_t>(m_maxThreads, workerPhases);
+	for (size_t i = 0; i < count; ++i) {
+		CWorker* worker = new CWorker(this, i + 1);
+		if (worker->Create() != wxTHREAD_NO_ERROR || worker->Run() != wxTHREAD_NO_ERROR) {
+			// The workers already running, or this thread, take over
+			delete worker;
+			break;
+		}
+
+		wxMutexLocker lock(m_lock);
+		m_workers.push_back(worker);
+	}
+
+	{
+		wxMutexLocker lock(m_lock);
+		while (m_done < m_phases.size()) {
+			CPhase* phase = GetReadyPhase(false);
+			if (phase) {
+				RunPhase(phase, 0);
+			} else {
+				m_changed.Wait();
+			}
+		}
+	}
+
+	LogTimeline();
+}
+
+
+void CStartupLoader::WorkerLoop(uint32 thread)
+{
+	wxMutexLocker lock(m_lock);
+	while (HasWaitingWorkerPhases()) {
+		CPhase* phase = GetReadyPhase(true);
+		if (phase) {
+			RunPhase(phase, thread);
+		} else {
+			m_changed.Wait();
+		}
+	}
+}
+
+
+CStartupLoader::CPhase* CStartupLoader::GetReadyPhase(bool workerOnly)
+{
+	// Without workers, the calling thread runs the worker phases as well
+	const bool anyPhase = !workerOnly && m_workers.empty();
+
+	for (size_t i = 0; i < m_phases.size(); ++i) {
+		CPhase& phase = m_phases[i];
+		if (phase.started || (phase.onWorker != workerOnly && !anyPhase)) {
+			continue;
+		}
+
+		bool ready = true;
+		for (size_t j = 0; ready && j < phase.dependencies.size(); ++j) {
+			ready = m_phases[phase.dependencies[j]].done;
+		}
+
+		if (ready) {
+			return &phase;
+		}
+	}
+
+	return NULL;
+}
+
+
+bool CStartupLoader::HasWaitingWorkerPhases() const
+{
+	for (size_t i = 0; i < m_phases.size(); ++i) {
+		if (m_phases[i].onWorker && !m_phases[i].started) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+
+void CStartupLoader::RunPhase(CPhase* phase, uint32 thread)
+{
+	phase->started = true;
+	phase->thread = thread;
+	phase->startTime = GetTickCountFullRes() - m_startTime;
+
+	m_lock.Unlock();
+	phase->task->Run();
+	m_lock.Lock();
+
+	phase->endTime = GetTickCountFullRes() - m_startTime;
+	phase->done = true;
+	++m_done;
+
+	m_changed.Broadcast();
+}
+
+
+void CStartupLoader::LogTimeline() const
+{
+	uint32 total = 0;
+	uint32 serial = 0;
+
+	for (size_t i = 0; i < m_phases.size(); ++i) {
+		const CPhase& phase = m_phases[i];
+		const wxString thread = phase.thread ? wxString(CFormat(wxT("worker %u")) % phase.thread) : wxString(wxT("main thread"));
+
+		AddLogLineNS(CFormat(wxT("Startup: %s took %u ms, from %u ms to %u ms (%s)"))
+			% phase.name % (phase.endTime - phase.startTime) % phase.startTime % phase.endTime % thread);
+
+		total = std::max(total, phase.endTime);
+		serial += phase.endTime - phase.startTime;
+	}
+
+	AddLogLineNS(CFormat(wxT("Startup: loading took %u ms, %u ms when run one after another"))
+		% total % serial);
+}
+// File_checked_for_headers
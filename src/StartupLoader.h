@@ -0,0 +1,208 @@
+//
+// This file is part of the aMule Project.
+//
+// Copyright (c) 2003-2011 aMule Team ( admin@amule.org / http://www.amule.org )
+//
+// Any parts of this program derived from the xMule, lMule or eMule project,
+// or contributed by third-party developers are copyrighted by their
+// respective authors.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA
+//
+
+#ifndef STARTUPLOADER_H
+#define STARTUPLOADER_H
+
+#include <wx/thread.h>		// Needed for wxMutex and wxCondition
+
+#include "Types.h"		// Needed for uint32
+
+#include <vector>
+
+
+/**
+ * Base class for the work done by a startup phase.
+ */
+class CStartupTask
+{
+public:
+	virtual ~CStartupTask() {}
+
+	/**
+	 * Does the work, on the thread the phase was given to.
+	 */
+	virtual void Run() = 0;
+};
+
+
+/**
+ * Startup task that calls a member function of an object.
+ *
+ * Whatever the function returns is ignored, loaders report their
+ * problems themselves.
+ */
+template <typename T, typename R>
+class CStartupMemberTask : public CStartupTask
+{
+public:
+	typedef R (T::*TaskMethod)();
+
+	CStartupMemberTask(T* object, TaskMethod method)
+		: m_object(object),
+		  m_method(method)
+	{}
+
+	virtual void Run()	{ (m_object->*m_method)(); }
+
+private:
+	T*		m_object;
+	TaskMethod	m_method;
+};
+
+
+/**
+ * Startup task that calls a free or static member function.
+ */
+class CStartupFunctionTask : public CStartupTask
+{
+public:
+	typedef void (*TaskFunction)();
+
+	CStartupFunctionTask(TaskFunction function)
+		: m_function(function)
+	{}
+
+	virtual void Run()	{ m_function(); }
+
+private:
+	TaskFunction	m_function;
+};
+
+
+/**
+ * Helpers for creating tasks without spelling out the type.
+ */
+template <typename T, typename R>
+CStartupTask* MakeStartupTask(T* object, R (T::*method)())
+{
+	return new CStartupMemberTask<T, R>(object, method);
+}
+
+inline CStartupTask* MakeStartupTask(void (*function)())
+{
+	return new CStartupFunctionTask(function);
+}
+
+
+/**
+ * Runs the loaders of the startup sequence, as many at once as possible.
+ *
+ * Every phase declares which earlier phases it needs, and whether it may
+ * run on a worker thread. Phases which only fill their own structures can
+ * do so, those which notify the GUI or other subsystems are run by the
+ * thread calling Run. Each phase is started as soon as everything it
+ * depends on is done, so independent loaders overlap instead of running
+ * one after another.
+ *
+ * Once all phases are done, the time each took and when it started is
+ * logged, to show what the startup is waiting for.
+ */
+class CStartupLoader
+{
+public:
+	/**
+	 * Constructor.
+	 *
+	 * @param threads The maximum number of worker threads.
+	 */
+	CStartupLoader(uint32 threads = LOADER_THREADS);
+
+	/**
+	 * Destructor, deletes the tasks.
+	 */
+	~CStartupLoader();
+
+	/**
+	 * Adds a phase.
+	 *
+	 * @param name Shown in the timeline.
+	 * @param task The work to do, deleted by the loader.
+	 * @param onWorker Specifies if the task may run on a worker thread,
+	 *                 alongside the other phases it does not depend on.
+	 * @return The id of the phase, for AddDependency.
+	 */
+	size_t	AddPhase(const wxString& name, CStartupTask* task, bool onWorker);
+
+	/**
+	 * Makes a phase wait until an earlier phase is done.
+	 */
+	void	AddDependency(size_t phase, size_t dependsOn);
+
+	/**
+	 * Runs all phases, and returns once they are done.
+	 *
+	 * If no worker thread can be created, all phases are run by the
+	 * calling thread in the order they were added.
+	 */
+	void	Run();
+
+	enum { LOADER_THREADS = 4 };
+
+private:
+	class CWorker;
+	friend class CWorker;
+
+	struct CPhase
+	{
+		wxString	name;
+		CStartupTask*	task;
+		bool		onWorker;
+		std::vector<size_t> dependencies;
+		bool		started;
+		bool		done;
+		//! Milliseconds since Run was called.
+		uint32		startTime;
+		uint32		endTime;
+		//! 0 for the thread calling Run, workers count from 1.
+		uint32		thread;
+	};
+
+	//! Runs worker phases until none are left, called by the workers.
+	void	WorkerLoop(uint32 thread);
+	//! Returns a phase which can be started, or NULL. Requires m_lock.
+	CPhase*	GetReadyPhase(bool workerOnly);
+	//! Returns true if some worker phase has not been started. Requires m_lock.
+	bool	HasWaitingWorkerPhases() const;
+	//! Runs a phase with m_lock released. Requires m_lock.
+	void	RunPhase(CPhase* phase, uint32 thread);
+	//! Logs when each phase ran.
+	void	LogTimeline() const;
+
+	const uint32	m_maxThreads;
+
+	//! Guards the phases while running.
+	wxMutex		m_lock;
+	//! Signalled whenever a phase is done.
+	wxCondition	m_changed;
+
+	std::vector<CPhase>	m_phases;
+	size_t		m_done;
+	uint32		m_startTime;
+
+	std::vector<CWorker*>	m_workers;
+};
+
+#endif // STARTUPLOADER_H
+// File_checked_for_headers
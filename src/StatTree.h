@@ -732,6 +732,12 @@ public:
 		m_bytes += size;
 	}
 
+	//! Returns the number of packets.
+	uint32_t GetPackets() const	{ return m_packets; }
+
+	//! Returns the bytes in the packets.
+	uint64_t GetBytes() const	{ return m_bytes; }
+
 #ifndef AMULE_DAEMON
 	/**
 	 * @see CStatTreeItemBase::GetDisplayString()
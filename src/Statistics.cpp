@@ -41,6 +41,8 @@
 	#include "ListenSocket.h"	// (tree, GetAverageConnections)
 	#include "ServerList.h"		// Needed for CServerList (tree)
 	#include <cmath>		// Needed for std::floor
+	#include <ctime>		// Needed for time
+	#include "Metrics.h"		// Needed for CMetricsWriter
 	#include "updownclient.h"	// Needed for CUpDownClient
 #else
 	#include "GetTickCount.h"	// Needed for GetTickCount64()
@@ -66,28 +68,24 @@
 
 void CPreciseRateCounter::CalculateRate(uint64_t now)
 {
-	wxMutexLocker lock(m_mutex);
+	const uint32 bytes = m_tmp_sum.Collect();
+	m_total += bytes;
+	PushBack(now, bytes);
 
-	m_total += m_tmp_sum;
-	m_byte_history.push_back(m_tmp_sum);
-	m_tick_history.push_back(now);
-	m_tmp_sum = 0;
-
-	uint64_t timespan = now - m_tick_history.front();
+	const uint32 max_timespan = m_timespan.Load();
+	uint64_t timespan = now - (m_count_average ? m_history[m_history_first].tick : m_start_tick);
 
 	// Checking maximal timespan, but make sure not to remove
-	// the extra node in m_tick_history.
-	while (timespan > m_timespan && !m_byte_history.empty()) {
-		m_total -= m_byte_history.front();
-		m_byte_history.pop_front();
-		m_tick_history.pop_front();
-		timespan = now - m_tick_history.front();
+	// the last entry when counting average.
+	while (timespan > max_timespan && m_history_count > (m_count_average ? 1u : 0u)) {
+		PopFront();
+		timespan = now - (m_count_average ? m_history[m_history_first].tick : m_start_tick);
 	}
 
 	// Count rate/average
 	if (m_count_average) {
-		if (!m_byte_history.empty()) {
-			m_rate = m_total / (double)m_byte_history.size();
+		if (m_history_count) {
+			m_rate = m_total / (double)m_history_count;
 		}
 	} else {
 		if (timespan > 0) {
@@ -97,7 +95,71 @@ void CPreciseRateCounter::CalculateRate(uint64_t now)
 
 	if (m_rate > m_max_rate) {
 		m_max_rate = m_rate;
+		m_published_max_rate.Store(ToBits(m_max_rate));
+	}
+	m_published_rate.Store(ToBits(m_rate));
+}
+
+
+void CPreciseRateCounter::ClearHistory()
+{
+	m_history_first = 0;
+	m_history_count = 0;
+	m_total = 0;
+	m_tmp_sum.Discard();
+}
+
+
+void CPreciseRateCounter::PushFront(uint64 tick, uint32 bytes)
+{
+	if (m_history_count == m_history_size) {
+		Grow();
+	}
+
+	m_history_first = (m_history_first + m_history_size - 1) % m_history_size;
+	m_history[m_history_first].tick = tick;
+	m_history[m_history_first].bytes = bytes;
+	++m_history_count;
+}
+
+
+void CPreciseRateCounter::PushBack(uint64 tick, uint32 bytes)
+{
+	if (m_history_count == m_history_size) {
+		Grow();
+	}
+
+	Sample& sample = m_history[(m_history_first + m_history_count) % m_history_size];
+	sample.tick = tick;
+	sample.bytes = bytes;
+	++m_history_count;
+}
+
+
+void CPreciseRateCounter::PopFront()
+{
+	const Sample& sample = m_history[m_history_first];
+	m_total -= sample.bytes;
+	// The next entry starts where this one ended
+	m_start_tick = sample.tick;
+	m_history_first = (m_history_first + 1) % m_history_size;
+	--m_history_count;
+}
+
+
+void CPreciseRateCounter::Grow()
+{
+	// Only happens until the buffer holds a whole timespan
+	const uint32 size = m_history_size ? m_history_size * 2 : 64;
+	Sample* history = new Sample[size];
+	for (uint32 i = 0; i < m_history_count; ++i) {
+		history[i] = m_history[(m_history_first + i) % m_history_size];
 	}
+
+	delete [] m_history;
+	m_history = history;
+	m_history_size = size;
+	m_history_first = 0;
 }
 
 
@@ -106,13 +168,13 @@ void CPreciseRateCounter::CalculateRate(uint64_t now)
 #ifndef AMULE_DAEMON
 wxString CStatTreeItemRateCounter::GetDisplayString() const
 {
-	return CFormat(wxGetTranslation(m_label)) % CastItoSpeed(m_show_maxrate ? (uint32)m_max_rate : (uint32)m_rate);
+	return CFormat(wxGetTranslation(m_label)) % CastItoSpeed(m_show_maxrate ? (uint32)GetMaxRate() : (uint32)GetRate());
 }
 #endif
 
 void CStatTreeItemRateCounter::AddECValues(CECTag* tag) const
 {
-	CECTag value(EC_TAG_STAT_NODE_VALUE, m_show_maxrate ? (uint32)m_max_rate : (uint32)m_rate);
+	CECTag value(EC_TAG_STAT_NODE_VALUE, m_show_maxrate ? (uint32)GetMaxRate() : (uint32)GetRate());
 	value.AddTag(CECTag(EC_TAG_STAT_VALUE_TYPE, (uint8)EC_VALUE_SPEED));
 	tag->AddTag(value);
 }
@@ -231,7 +293,8 @@ bool				CStatistics::s_statsNeedSave;
 CStatistics::CStatistics()
 	: m_graphRunningAvgDown(thePrefs::GetStatsAverageMinutes() * 60 * 1000, true),
 	  m_graphRunningAvgUp(thePrefs::GetStatsAverageMinutes() * 60 * 1000, true),
-	  m_graphRunningAvgKad(thePrefs::GetStatsAverageMinutes() * 60 * 1000, true)
+	  m_graphRunningAvgKad(thePrefs::GetStatsAverageMinutes() * 60 * 1000, true),
+	  m_lastHistoryFlush(0)
 {
 	uint64 start_time = GetTickCount64();
 
@@ -266,6 +329,13 @@ CStatistics::CStatistics()
 	// Load saved statistics
 	Load();
 	s_statsNeedSave = false;
+
+	// Long term history
+	CPath historyPath(JoinPaths(thePrefs::GetConfigDir(), wxT("statistics-history.dat")));
+	if (!m_statsHistory.Open(historyPath)) {
+		AddLogLineN(CFormat(_("Failed to open statistics history file '%s', history is not saved.")) % historyPath);
+	}
+	m_lastHistoryFlush = time(NULL);
 }
 
 
@@ -368,6 +438,92 @@ void CStatistics::CalculateRates()
 	s_uploadrate->CalculateRate(now);
 }
 
+void CStatistics::WriteMetrics(CMetricsWriter& writer)
+{
+	// Read straight from the tree items, without updating the tree
+	writer.Family("amule_uptime_seconds", "gauge", "Time since aMule was started.");
+	writer.Sample("amule_uptime_seconds", NULL, GetUptimeSeconds());
+
+	writer.Family("amule_session_bytes_total", "counter", "Payload transferred in this session.");
+	writer.Sample("amule_session_bytes_total", "direction=\"upload\"", GetSessionSentBytes());
+	writer.Sample("amule_session_bytes_total", "direction=\"download\"", GetSessionReceivedBytes());
+
+	writer.Family("amule_cumulative_bytes_total", "counter", "Payload transferred in all sessions.");
+	writer.Sample("amule_cumulative_bytes_total", "direction=\"upload\"", s_totalSent);
+	writer.Sample("amule_cumulative_bytes_total", "direction=\"download\"", s_totalReceived);
+
+	writer.Family("amule_rate_bytes_per_second", "gauge", "Current transfer rates.");
+	writer.Sample("amule_rate_bytes_per_second", "direction=\"upload\",kind=\"payload\"", GetUploadRate());
+	writer.Sample("amule_rate_bytes_per_second", "direction=\"download\",kind=\"payload\"", GetDownloadRate());
+	writer.Sample("amule_rate_bytes_per_second", "direction=\"upload\",kind=\"overhead\"", GetUpOverheadRate());
+	writer.Sample("amule_rate_bytes_per_second", "direction=\"download\",kind=\"overhead\"", GetDownOverheadRate());
+
+	// The totals items count what is not in one of their children
+	const struct {
+		const char* labels;
+		const CStatTreeItemPackets* counter;
+	} overhead[] = {
+		{ "direction=\"upload\",kind=\"file_request\"",		s_fileReqUpOverhead },
+		{ "direction=\"upload\",kind=\"source_exchange\"",		s_sourceXchgUpOverhead },
+		{ "direction=\"upload\",kind=\"server\"",			s_serverUpOverhead },
+		{ "direction=\"upload\",kind=\"kad\"",			s_kadUpOverhead },
+		{ "direction=\"upload\",kind=\"other\"",			s_totalUpOverhead },
+		{ "direction=\"download\",kind=\"file_request\"",		s_fileReqDownOverhead },
+		{ "direction=\"download\",kind=\"source_exchange\"",	s_sourceXchgDownOverhead },
+		{ "direction=\"download\",kind=\"server\"",			s_serverDownOverhead },
+		{ "direction=\"download\",kind=\"kad\"",			s_kadDownOverhead },
+		{ "direction=\"download\",kind=\"other\"",			s_totalDownOverhead }
+	};
+	const size_t overheadCount = sizeof(overhead) / sizeof(overhead[0]);
+
+	writer.Family("amule_overhead_packets_total", "counter", "Protocol overhead packets.");
+	for (size_t i = 0; i < overheadCount; ++i) {
+		writer.Sample("amule_overhead_packets_total", overhead[i].labels, (uint64)overhead[i].counter->GetPackets());
+	}
+	writer.Family("amule_overhead_bytes_total", "counter", "Protocol overhead bytes.");
+	for (size_t i = 0; i < overheadCount; ++i) {
+		writer.Sample("amule_overhead_bytes_total", overhead[i].labels, (uint64)overhead[i].counter->GetBytes());
+	}
+
+	writer.Family("amule_connections", "gauge", "Active connections.");
+	writer.Sample("amule_connections", NULL, (uint64)GetActiveConnections());
+	writer.Family("amule_connections_peak", "gauge", "Most active connections in this session.");
+	writer.Sample("amule_connections_peak", NULL, (uint64)GetPeakConnections());
+	writer.Family("amule_reconnects_total", "counter", "Reconnects to a server.");
+	writer.Sample("amule_reconnects_total", NULL, (uint64)(s_reconnects->GetValue() ? s_reconnects->GetValue() - 1 : 0));
+
+	writer.Family("amule_uploads", "gauge", "Clients being uploaded to.");
+	writer.Sample("amule_uploads", NULL, (uint64)GetActiveUploadsCount());
+	writer.Family("amule_upload_queue_length", "gauge", "Clients waiting for an upload slot.");
+	writer.Sample("amule_upload_queue_length", NULL, (uint64)GetWaitingUserCount());
+	writer.Family("amule_upload_sessions_total", "counter", "Finished upload sessions.");
+	writer.Sample("amule_upload_sessions_total", "result=\"success\"", s_totalSuccUploads->GetValue());
+	writer.Sample("amule_upload_sessions_total", "result=\"failed\"", s_totalFailedUploads->GetValue());
+
+	writer.Family("amule_downloading_sources", "gauge", "Sources being downloaded from.");
+	writer.Sample("amule_downloading_sources", NULL, (uint64)GetDownloadingSources());
+	writer.Family("amule_found_sources", "gauge", "Known sources of the downloads.");
+	writer.Sample("amule_found_sources", NULL, (uint64)GetFoundSources());
+
+	writer.Family("amule_clients_banned", "gauge", "Banned clients.");
+	writer.Sample("amule_clients_banned", NULL, (uint64)GetBannedCount());
+	writer.Family("amule_clients_filtered_total", "counter", "Clients rejected by the IP filter.");
+	writer.Sample("amule_clients_filtered_total", NULL, (uint64)s_filtered->GetValue());
+
+	writer.Family("amule_servers", "gauge", "Servers in the server list.");
+	writer.Sample("amule_servers", NULL, (uint64)s_totalServers->GetValue());
+
+	writer.Family("amule_shared_files", "gauge", "Shared files.");
+	writer.Sample("amule_shared_files", NULL, (uint64)GetSharedFileCount());
+	writer.Family("amule_shared_bytes", "gauge", "Total size of the shared files.");
+	writer.Sample("amule_shared_bytes", NULL, s_sizeOfShare->GetValue());
+
+	writer.Family("amule_kad_nodes", "gauge", "Known Kad nodes.");
+	writer.Sample("amule_kad_nodes", NULL, (uint64)GetKadNodes());
+
+	CMetrics::Write(writer);
+}
+
 
 
 /* ------------------------------- GRAPHS ---------------------------- */
@@ -456,6 +612,22 @@ void CStatistics::RecordHistory()
 	s_kadNodesTotal += s_kadNodesCur;
 	phr->kadNodesTotal = s_kadNodesTotal;
 	phr->kadNodesCur = s_kadNodesCur;
+
+	// The long term history is kept by wall clock time, so it lines up across restarts
+	const uint32 now = time(NULL);
+	float values[CStatsHistory::ColCount];
+	values[CStatsHistory::ColDownloadRate] = GetDownloadRate();
+	values[CStatsHistory::ColUploadRate] = GetUploadRate();
+	values[CStatsHistory::ColConnections] = phr->cntConnections;
+	values[CStatsHistory::ColKadNodes] = s_kadNodesCur;
+	values[CStatsHistory::ColUploads] = phr->cntUploads;
+	values[CStatsHistory::ColDownloads] = phr->cntDownloads;
+	m_statsHistory.Record(now, values);
+
+	if (now - m_lastHistoryFlush >= 600) {
+		m_statsHistory.Flush();
+		m_lastHistoryFlush = now;
+	}
 }
 
 
@@ -617,11 +789,8 @@ void CStatistics::ComputeAverages(
 			wxCHECK_RET(false, wxT("ComputeAverages called with unsupported graph type."));
 	}
 
-	runningAvg->m_timespan = avgTime * 1000;
-	runningAvg->m_tick_history.clear();
-	runningAvg->m_byte_history.clear();
-	runningAvg->m_total = 0;
-	runningAvg->m_tmp_sum = 0;
+	runningAvg->m_timespan.Store(avgTime * 1000);
+	runningAvg->ClearHistory();
 
 	if (pos == listHR.rend()) {
 		sTarget = 0.0;
@@ -632,8 +801,6 @@ void CStatistics::ComputeAverages(
 	while (nBtPoints--) {
 		while (pos != listHR.rend() && pos->sTimestamp > sTarget) ++pos;	// find next history record
 		if (pos != listHR.rend()) {
-			runningAvg->m_tick_history.push_front((uint64)(pos->sTimestamp * 1000.0));
-
 			uint32 value = 0;
 			switch (which_graph) {
 			case GRAPH_DOWN:
@@ -649,7 +816,7 @@ void CStatistics::ComputeAverages(
 				wxCHECK_RET(false, wxT("ComputeAverages called with unsupported graph type."));
 			}
 
-			runningAvg->m_byte_history.push_front(value);
+			runningAvg->PushFront((uint64)(pos->sTimestamp * 1000.0), value);
 			runningAvg->m_total += value;
 		} else {
 			break;
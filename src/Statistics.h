@@ -30,7 +30,11 @@
 #include "Constants.h"		// Needed for StatsGraphType
 #include "StatTree.h"		// Needed for CStatTreeItem* classes
 
-#include <deque>		// Needed for std::deque
+#include "MuleAtomic.h"		// Needed for CAtomic
+#include "ShardedCounter.h"	// Needed for CShardedCounter
+#include "StatsHistory.h"	// Needed for CStatsHistory
+
+#include <cstring>		// Needed for memcpy
 
 typedef struct UpdateInfo {
 	double timestamp;
@@ -59,7 +63,9 @@ typedef struct HistoryRecord {
 /**
  * Counts precise rate/average on added bytes/values.
  *
- * @note This class is MT-safe.
+ * @note This class is MT-safe: any thread may add bytes and read the
+ * rates without taking a lock. CalculateRate must only be called by one
+ * thread at a time.
  */
 class CPreciseRateCounter {
 	friend class CStatistics;	// for playing dirty tricks to compute running average :P
@@ -72,20 +78,23 @@ class CPreciseRateCounter {
 	 * @param count_average Counts average instead of rate.
 	 */
 	CPreciseRateCounter(uint32_t timespan, bool count_average = false)
-		: m_timespan(timespan), m_total(0), m_rate(0.0), m_max_rate(0.0), m_tmp_sum(0), m_count_average(count_average)
+		: m_timespan(timespan), m_total(0), m_rate(0.0), m_max_rate(0.0),
+		  m_history(0), m_history_size(0), m_history_first(0), m_history_count(0),
+		  m_start_tick(0), m_count_average(count_average)
 		{
 			if (!count_average) {
 				uint64_t cur_time = GetTickCount64();
 				uint64_t target_time = cur_time - timespan;
 				while (cur_time > target_time) {
-					m_tick_history.push_front(cur_time);
-					m_byte_history.push_front(0);
+					PushFront(cur_time, 0);
 					cur_time -= 100;	// default update period
 				}
-				m_tick_history.push_front(cur_time);
+				m_start_tick = cur_time;
 			}
 		}
 
+	~CPreciseRateCounter()		{ delete [] m_history; }
+
 	/**
 	 * Calculate current rate.
 	 *
@@ -100,14 +109,14 @@ class CPreciseRateCounter {
 	 *
 	 * @return Current rate in bytes/second.
 	 */
-	double	GetRate()			{ wxMutexLocker lock(m_mutex); return m_rate; };
+	double	GetRate() const		{ return FromBits(m_published_rate.Load()); };
 
 	/**
 	 * Gets ever seen maximal rate.
 	 *
 	 * @return The maximal rate which occured.
 	 */
-	double	GetMaxRate()			{ wxMutexLocker lock(m_mutex); return m_max_rate; }
+	double	GetMaxRate() const		{ return FromBits(m_published_max_rate.Load()); }
 
 	/**
 	 * Sets desired timespan for rate calculations.
@@ -119,23 +128,49 @@ class CPreciseRateCounter {
 	 * If the new timespan is lower than the old, the change takes
 	 * effect immediately at the next call to CalculateRate().
 	 */
-	void	SetTimespan(uint32_t timespan)	{ wxMutexLocker lock(m_mutex); m_timespan = timespan; }
+	void	SetTimespan(uint32_t timespan)	{ m_timespan.Store(timespan); }
 
 	/**
 	 * Add bytes to be tracked for rate-counting.
 	 */
-	void	operator+=(uint32_t bytes)	{ wxMutexLocker lock(m_mutex); m_tmp_sum += bytes; }
+	void	operator+=(uint32_t bytes)	{ m_tmp_sum.Add(bytes); }
 
  protected:
 
-	std::deque<uint32>	m_byte_history;
-	std::deque<uint64>	m_tick_history;
-	uint32_t	m_timespan;
+	//! One history entry: bytes counted up to the given tick.
+	struct Sample {
+		uint64	tick;
+		uint32	bytes;
+	};
+
+	//! Drop all history.
+	void	ClearHistory();
+	//! Add an entry older than all others.
+	void	PushFront(uint64 tick, uint32 bytes);
+	void	PushBack(uint64 tick, uint32 bytes);
+	void	PopFront();
+	//! Make room for one more entry.
+	void	Grow();
+
+	// Rates are published as float, which fits into a lock-free atomic everywhere
+	static	uint32	ToBits(double value)	{ float f = value; uint32 bits; memcpy(&bits, &f, sizeof(bits)); return bits; }
+	static	double	FromBits(uint32 bits)	{ float f; memcpy(&f, &bits, sizeof(f)); return f; }
+
+	CAtomic<uint32_t>	m_timespan;
 	uint32_t	m_total;
 	double		m_rate;
 	double		m_max_rate;
-	uint32_t	m_tmp_sum;
-	wxMutex		m_mutex;
+	CAtomic<uint32>	m_published_rate;
+	CAtomic<uint32>	m_published_max_rate;
+	CShardedCounter	m_tmp_sum;
+
+	//! Ring buffer of history, oldest entry first.
+	Sample*		m_history;
+	uint32		m_history_size;
+	uint32		m_history_first;
+	uint32		m_history_count;
+	//! When counting rate: tick at which the oldest entry started.
+	uint64		m_start_tick;
 	bool		m_count_average;
 };
 
@@ -212,6 +247,7 @@ class CStatTreeItemPeakConnections : public CStatTreeItemBase {
 
 
 class CUpDownClient;
+class CMetricsWriter;
 
 class CStatistics {
 	friend class CStatisticsDlg;	// to access CStatistics::GetTreeRoot()
@@ -228,6 +264,7 @@ class CStatistics {
 	unsigned GetHistoryForWeb(unsigned cntPoints, double sStep, double *sStart, uint32 **graphData);
 	unsigned GetHistory(unsigned cntPoints, double sStep, double sFinal, const std::vector<float *> &ppf, StatsGraphType which_graph);
 	GraphUpdateInfo GetPointsForUpdate();
+	const CStatsHistory& GetStatsHistory() const	{ return m_statsHistory; }
 
 	/* Statistics tree functions */
 
@@ -355,6 +392,9 @@ class CStatistics {
 	// EC
 	static	CECTag*	GetECStatTree(uint8 tree_capping_value)	{ return s_statTree->CreateECTag(tree_capping_value); }
 
+	// Metrics, see CMetricsServer
+	static	void	WriteMetrics(CMetricsWriter& writer);
+
 	void SetAverageMinutes(uint8 minutes) { average_minutes = minutes; }
 
  private:
@@ -387,6 +427,10 @@ class CStatistics {
 
 	HR hrInit;
 
+	/* Long term history, see CStatsHistory */
+	CStatsHistory	m_statsHistory;
+	uint32		m_lastHistoryFlush;
+
 	/* Rate/Average counters */
 	static	CPreciseRateCounter*		s_upOverheadRate;
 	static	CPreciseRateCounter*		s_downOverheadRate;
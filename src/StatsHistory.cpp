@@ -0,0 +1,433 @@
+//
+// This file is part of the aMule Project.
+//
+// Copyright (c) 2003-2011 aMule Team ( admin@amule.org / http://www.amule.org )
+//
+// Any parts of this program derived from the xMule, lMule or eMule project,
+// or contributed by third-party developers are copyrighted by their
+// respective authors.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA
+//
+
+#include "config.h"		// Needed for HAVE_MMAP
+
+#include "StatsHistory.h"	// Interface declarations
+
+#include <algorithm>		// Needed for std::min
+#include <cstring>		// Needed for memcmp
+#include <limits>		// Needed for std::numeric_limits
+
+#ifndef ENABLE_MMAP
+#	define ENABLE_MMAP	0
+#endif
+
+#if ENABLE_MMAP && defined(HAVE_MMAP)
+#	define USE_MMAP
+#	include <sys/mman.h>
+#endif
+
+
+//! Identifies the file.
+static const char s_magic[8] = { 'a', 'M', 'u', 'l', 'e', 'S', 'H', 0 };
+//! Written in native byte order, files of other platforms are started over.
+static const uint32 s_byteOrder = 0x01020304;
+static const uint32 s_version = 1;
+
+//! Period of each tier in seconds.
+static const uint32 s_periods[CStatsHistory::TierCount] = { 1, 60, 3600 };
+//! A day of seconds, 30 days of minutes and two years of hours.
+static const uint32 s_capacities[CStatsHistory::TierCount] = { 86400, 43200, 17520 };
+
+
+/**
+ * Start of the file, followed by the tiers. Each tier is its column of
+ * slot times followed by one column per value.
+ */
+struct CStatsHistory::Header {
+	char	magic[8];
+	//! Running sums of the period being averaged in each tier.
+	double	accSum[TierCount][ColCount];
+	uint32	byteOrder;
+	uint32	version;
+	uint32	columns;
+	uint32	tiers;
+	uint32	periods[TierCount];
+	uint32	capacities[TierCount];
+	//! Start of the period being averaged in each tier.
+	uint32	accStart[TierCount];
+	//! Number of samples in the running sums.
+	uint32	accCount[TierCount];
+};
+
+
+CStatsHistory::CStatsHistory()
+	: m_buffer(new uint8[GetStoreSize()]),
+	  m_mapped(false)
+{
+	SetColumns();
+	Reset();
+}
+
+
+CStatsHistory::~CStatsHistory()
+{
+	Flush();
+	Release();
+}
+
+
+uint32 CStatsHistory::GetPeriod(Tier tier)
+{
+	return s_periods[tier];
+}
+
+
+uint32 CStatsHistory::GetCapacity(Tier tier)
+{
+	return s_capacities[tier];
+}
+
+
+size_t CStatsHistory::GetStoreSize()
+{
+	size_t size = sizeof(Header);
+	for (unsigned tier = 0; tier < TierCount; ++tier) {
+		size += s_capacities[tier] * (sizeof(uint32) + ColCount * sizeof(float));
+	}
+
+	return size;
+}
+
+
+void CStatsHistory::SetColumns()
+{
+	uint8* pos = m_buffer + sizeof(Header);
+	for (unsigned tier = 0; tier < TierCount; ++tier) {
+		m_times[tier] = reinterpret_cast<uint32*>(pos);
+		pos += s_capacities[tier] * sizeof(uint32);
+
+		for (unsigned col = 0; col < ColCount; ++col) {
+			m_values[tier][col] = reinterpret_cast<float*>(pos);
+			pos += s_capacities[tier] * sizeof(float);
+		}
+	}
+}
+
+
+bool CStatsHistory::IsValid() const
+{
+	const Header* header = GetHeader();
+	if (memcmp(header->magic, s_magic, sizeof(s_magic))
+		|| header->byteOrder != s_byteOrder
+		|| header->version != s_version
+		|| header->columns != ColCount
+		|| header->tiers != TierCount) {
+		return false;
+	}
+
+	for (unsigned tier = 0; tier < TierCount; ++tier) {
+		if (header->periods[tier] != s_periods[tier] || header->capacities[tier] != s_capacities[tier]) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+
+void CStatsHistory::Reset()
+{
+	memset(m_buffer, 0, GetStoreSize());
+
+	Header* header = GetHeader();
+	memcpy(header->magic, s_magic, sizeof(s_magic));
+	header->byteOrder = s_byteOrder;
+	header->version = s_version;
+	header->columns = ColCount;
+	header->tiers = TierCount;
+	for (unsigned tier = 0; tier < TierCount; ++tier) {
+		header->periods[tier] = s_periods[tier];
+		header->capacities[tier] = s_capacities[tier];
+
+		// The whole store has to be written
+		m_dirtyFirst[tier] = 0;
+		m_dirtyCount[tier] = s_capacities[tier];
+	}
+}
+
+
+void CStatsHistory::MarkDirty(unsigned tier, uint32 slot)
+{
+	const uint32 capacity = s_capacities[tier];
+	if (!m_dirtyCount[tier]) {
+		m_dirtyFirst[tier] = slot;
+		m_dirtyCount[tier] = 1;
+		return;
+	}
+
+	// Slots are mostly stored in order, so the range just grows at its end.
+	// A slot before the range, e.g. after the clock was set back, extends
+	// it around the ring, at worst to the whole tier.
+	const uint32 offset = (slot + capacity - m_dirtyFirst[tier]) % capacity;
+	if (offset >= m_dirtyCount[tier]) {
+		m_dirtyCount[tier] = offset + 1;
+	}
+}
+
+
+void CStatsHistory::WriteDirty(unsigned tier, const uint8* column, size_t width)
+{
+	const uint32 capacity = s_capacities[tier];
+	uint32 first = m_dirtyFirst[tier];
+	uint32 count = m_dirtyCount[tier];
+
+	// At most two runs, the range may wrap around the end of the column
+	while (count) {
+		const uint32 run = std::min(count, capacity - first);
+		const uint8* data = column + first * width;
+		m_file.Seek(data - m_buffer);
+		m_file.Write(data, run * width);
+
+		first = 0;
+		count -= run;
+	}
+}
+
+
+void CStatsHistory::Release()
+{
+#ifdef USE_MMAP
+	if (m_mapped) {
+		munmap(m_buffer, GetStoreSize());
+	} else
+#endif
+	{
+		delete [] m_buffer;
+	}
+
+	m_buffer = NULL;
+	m_mapped = false;
+}
+
+
+bool CStatsHistory::Open(const CPath& path)
+{
+	Close();
+
+	// Opening for writing only creates the file
+	if (!path.FileExists() && m_file.Create(path)) {
+		m_file.Close();
+	}
+
+	if (!m_file.Open(path, CFile::read_write)) {
+		return false;
+	}
+
+	const size_t size = GetStoreSize();
+	try {
+		const bool sameSize = m_file.GetLength() == size;
+		if (!sameSize && !m_file.SetLength(size)) {
+			m_file.Close();
+			return false;
+		}
+
+#ifdef USE_MMAP
+		void* mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, m_file.fd(), 0);
+		if (mapping != MAP_FAILED) {
+			Release();
+			m_buffer = static_cast<uint8*>(mapping);
+			m_mapped = true;
+			SetColumns();
+		}
+#endif
+
+		if (!m_mapped && sameSize) {
+			m_file.Seek(0);
+			m_file.Read(m_buffer, size);
+
+			// The file matches the buffer now
+			for (unsigned tier = 0; tier < TierCount; ++tier) {
+				m_dirtyCount[tier] = 0;
+			}
+		}
+
+		if (!sameSize || !IsValid()) {
+			Reset();
+			Flush();
+		}
+	} catch (const CSafeIOException&) {
+		// A partial read, keep the history in memory
+		Reset();
+		m_file.Close();
+		return false;
+	}
+
+	return true;
+}
+
+
+void CStatsHistory::Close()
+{
+	if (!m_file.IsOpened()) {
+		return;
+	}
+
+	Flush();
+
+	if (m_mapped) {
+		uint8* copy = new uint8[GetStoreSize()];
+		memcpy(copy, m_buffer, GetStoreSize());
+		Release();
+		m_buffer = copy;
+		SetColumns();
+	}
+
+	m_file.Close();
+}
+
+
+bool CStatsHistory::Flush()
+{
+	if (!m_file.IsOpened()) {
+		return false;
+	}
+
+#ifdef USE_MMAP
+	if (m_mapped) {
+		// The kernel writes the pages back, just don't wait for it
+		return msync(m_buffer, GetStoreSize(), MS_ASYNC) == 0;
+	}
+#endif
+
+	// Only the header and the slots stored since the last flush are
+	// written, and like above, the write back is left to the kernel.
+	// Should a write fail, the slots stay dirty for the next flush.
+	try {
+		m_file.Seek(0);
+		m_file.Write(m_buffer, sizeof(Header));
+
+		for (unsigned tier = 0; tier < TierCount; ++tier) {
+			if (!m_dirtyCount[tier]) {
+				continue;
+			}
+
+			WriteDirty(tier, reinterpret_cast<const uint8*>(m_times[tier]), sizeof(uint32));
+			for (unsigned col = 0; col < ColCount; ++col) {
+				WriteDirty(tier, reinterpret_cast<const uint8*>(m_values[tier][col]), sizeof(float));
+			}
+			m_dirtyCount[tier] = 0;
+		}
+
+		return true;
+	} catch (const CSafeIOException&) {
+		return false;
+	}
+}
+
+
+void CStatsHistory::Store(unsigned tier, uint32 start, const float values[ColCount])
+{
+	// 0 marks unused slots
+	if (!start) {
+		return;
+	}
+
+	const uint32 slot = (start / s_periods[tier]) % s_capacities[tier];
+	m_times[tier][slot] = start;
+	for (unsigned col = 0; col < ColCount; ++col) {
+		m_values[tier][col][slot] = values[col];
+	}
+
+	MarkDirty(tier, slot);
+}
+
+
+void CStatsHistory::Record(uint32 time, const float values[ColCount])
+{
+	Store(TierSeconds, time, values);
+
+	Header* header = GetHeader();
+	for (unsigned tier = TierSeconds + 1; tier < TierCount; ++tier) {
+		const uint32 start = time - time % s_periods[tier];
+		double* sum = header->accSum[tier];
+
+		if (header->accCount[tier] && header->accStart[tier] != start) {
+			float average[ColCount];
+			for (unsigned col = 0; col < ColCount; ++col) {
+				average[col] = sum[col] / header->accCount[tier];
+			}
+			Store(tier, header->accStart[tier], average);
+			header->accCount[tier] = 0;
+		}
+
+		if (!header->accCount[tier]) {
+			header->accStart[tier] = start;
+			for (unsigned col = 0; col < ColCount; ++col) {
+				sum[col] = 0.0;
+			}
+		}
+
+		for (unsigned col = 0; col < ColCount; ++col) {
+			sum[col] += values[col];
+		}
+		++header->accCount[tier];
+	}
+}
+
+
+uint32 CStatsHistory::GetRange(Tier tier, uint32 from, uint32 to, std::vector<float>& rows) const
+{
+	rows.clear();
+	if (tier >= TierCount || to < from) {
+		return 0;
+	}
+
+	const uint32 period = s_periods[tier];
+	const uint32 capacity = s_capacities[tier];
+	const uint32 last = to - to % period;
+	uint32 first = from - from % period;
+	if ((last - first) / period >= capacity) {
+		first = last - (capacity - 1) * period;
+	}
+
+	const Header* header = GetHeader();
+	const float missing = std::numeric_limits<float>::quiet_NaN();
+	const uint32* times = m_times[tier];
+
+	rows.reserve(((last - first) / period + 1) * ColCount);
+	for (uint32 start = first; ; start += period) {
+		const uint32 slot = (start / period) % capacity;
+		if (start && times[slot] == start) {
+			for (unsigned col = 0; col < ColCount; ++col) {
+				rows.push_back(m_values[tier][col][slot]);
+			}
+		} else if (tier != TierSeconds && header->accCount[tier] && header->accStart[tier] == start) {
+			for (unsigned col = 0; col < ColCount; ++col) {
+				rows.push_back(header->accSum[tier][col] / header->accCount[tier]);
+			}
+		} else {
+			rows.insert(rows.end(), ColCount, missing);
+		}
+
+		// 'last' is aligned, so this also stops before wrapping around
+		if (start == last) {
+			break;
+		}
+	}
+
+	return first;
+}
+// File_checked_for_headers
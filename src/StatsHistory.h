@@ -0,0 +1,187 @@
+//
+// This file is part of the aMule Project.
+//
+// Copyright (c) 2003-2011 aMule Team ( admin@amule.org / http://www.amule.org )
+//
+// Any parts of this program derived from the xMule, lMule or eMule project,
+// or contributed by third-party developers are copyrighted by their
+// respective authors.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA
+//
+
+#ifndef STATSHISTORY_H
+#define STATSHISTORY_H
+
+#include "CFile.h"		// Needed for CFile
+
+#include <vector>
+
+
+/**
+ * Long term statistics history.
+ *
+ * Samples are kept in three tiers of fixed size ring buffers: one slot per
+ * second for a day, one per minute for 30 days and one per hour for two
+ * years. Every tier stores each value in its own column, and the slot of a
+ * sample is given by its wall clock time, so a range of any tier is read
+ * without searching.
+ *
+ * The minute and hour tiers hold the average of the samples recorded in
+ * their period. The running sums are part of the file, so a period spanning
+ * a restart is averaged correctly.
+ *
+ * The whole store is a single file of fixed size, which is memory mapped
+ * when mmap is enabled, and read at Open otherwise. In the latter case
+ * Flush and Close write back the header and the range of slots of each
+ * tier stored since the last flush, not the whole file.
+ *
+ * Not thread-safe, meant to be used from the core thread only.
+ */
+class CStatsHistory
+{
+public:
+	//! The values of a sample.
+	enum Column {
+		//! Download rate in bytes/s
+		ColDownloadRate = 0,
+		//! Upload rate in bytes/s
+		ColUploadRate,
+		//! Active connections
+		ColConnections,
+		//! Kad nodes
+		ColKadNodes,
+		//! Active uploads
+		ColUploads,
+		//! Downloading sources
+		ColDownloads,
+
+		ColCount
+	};
+
+	//! The downsampling tiers.
+	enum Tier {
+		TierSeconds = 0,
+		TierMinutes,
+		TierHours,
+
+		TierCount
+	};
+
+	CStatsHistory();
+	~CStatsHistory();
+
+	/**
+	 * Opens the history file, creating it if needed.
+	 *
+	 * A file with a different layout, e.g. written on another platform,
+	 * is started over. If the file cannot be used at all, the history is
+	 * kept in memory for the session.
+	 *
+	 * @return False if the history is not saved to the file.
+	 */
+	bool Open(const CPath& path);
+
+	/**
+	 * Writes the history to the file and closes it.
+	 *
+	 * History recorded afterwards is kept in memory.
+	 */
+	void Close();
+
+	/**
+	 * Hands the history recorded so far to the operating system.
+	 *
+	 * Does not wait for the data to reach the disk.
+	 */
+	bool Flush();
+
+	/**
+	 * Records one sample.
+	 *
+	 * @param time The wall clock time of the sample in seconds.
+	 * @param values One value for each column.
+	 *
+	 * Samples are expected about once a second. A later sample of the same
+	 * second replaces the earlier one in the seconds tier, but both are
+	 * part of the averages.
+	 */
+	void Record(uint32 time, const float values[ColCount]);
+
+	/**
+	 * Reads a range of a tier.
+	 *
+	 * @param tier The tier to read.
+	 * @param from The time of the first sample wanted.
+	 * @param to The time of the last sample wanted.
+	 * @param rows Receives one row of ColCount values for each period
+	 *             from the one containing 'from' to the one containing
+	 *             'to'. Periods without a sample are NaN.
+	 * @return The start time of the first row.
+	 *
+	 * Ranges longer than the tier are cut off at the old end. The period
+	 * still being averaged is reported with the average so far.
+	 */
+	uint32 GetRange(Tier tier, uint32 from, uint32 to, std::vector<float>& rows) const;
+
+	//! Returns the length of a period of the tier in seconds.
+	static uint32 GetPeriod(Tier tier);
+	//! Returns the number of periods kept in the tier.
+	static uint32 GetCapacity(Tier tier);
+
+private:
+	struct Header;
+
+	//! Size of the store, header and all tiers.
+	static size_t GetStoreSize();
+	//! Points the tier columns into m_buffer.
+	void SetColumns();
+	//! Returns true if m_buffer holds a store of this layout.
+	bool IsValid() const;
+	//! Starts over with an empty store.
+	void Reset();
+	//! Frees m_buffer, unmapping it if needed.
+	void Release();
+	//! Stores a sample in the slot of the given period start.
+	void Store(unsigned tier, uint32 start, const float values[ColCount]);
+	//! Adds a slot to the range of the tier to write at the next flush.
+	void MarkDirty(unsigned tier, uint32 slot);
+	//! Writes the dirty range of one column of the tier to the file.
+	void WriteDirty(unsigned tier, const uint8* column, size_t width);
+
+	Header* GetHeader() const { return reinterpret_cast<Header*>(m_buffer); }
+
+	// not copyable, the columns point into the buffer
+	CStatsHistory(const CStatsHistory&);
+	CStatsHistory& operator=(const CStatsHistory&);
+
+	CFile	m_file;
+	uint8*	m_buffer;
+	//! True if m_buffer is a mapping of m_file.
+	bool	m_mapped;
+
+	//! Start time of the period of each slot, 0 for unused ones.
+	uint32*	m_times[TierCount];
+	//! Value columns of each tier.
+	float*	m_values[TierCount][ColCount];
+
+	//! First slot of each tier not yet written to the file.
+	uint32	m_dirtyFirst[TierCount];
+	//! Number of slots from m_dirtyFirst on, wrapping around, to write.
+	uint32	m_dirtyCount[TierCount];
+};
+
+#endif // STATSHISTORY_H
+// File_checked_for_headers
@@ -278,62 +278,17 @@ void CAICHSyncTask::Entry()
 
 	AddDebugLogLineN( logAICHThread, wxT("Syncronization thread started.") );
 
-	// We collect all masterhashs which we find in the known2.met and store them in a list
+	// We collect all masterhashs which we find in the known2.met and store them in a list.
+	// They are taken from the index of known2.met, which is only rebuilt if missing or outdated.
 	std::list<CAICHHash> hashlist;
-	const CPath fullpath = CPath(thePrefs::GetConfigDir() + KNOWN2_MET_FILENAME);
-
-	CFile file;
-	if (!fullpath.FileExists()) {
-		// File does not exist. Try to create it to see if it can be created at all (and don't start hashing otherwise).
-		if (!file.Open(fullpath, CFile::write)) {
-			AddDebugLogLineC( logAICHThread, wxT("Error, failed to open 'known2_64.met' file!") );
-			return;
-		}
-		try {
-			file.WriteUInt8(KNOWN2_MET_VERSION);
-		} catch (const CIOFailureException& e) {
-			AddDebugLogLineC(logAICHThread, wxT("IO failure while creating hashlist (Aborting): ") + e.what());
-			return;
-		}
-	} else {
-		if (!file.Open(fullpath, CFile::read)) {
-			AddDebugLogLineC( logAICHThread, wxT("Error, failed to open 'known2_64.met' file!") );
-			return;
-		}
-
-		uint32 nLastVerifiedPos = 0;
-		try {
-			if (file.ReadUInt8() != KNOWN2_MET_VERSION) {
-				throw CEOFException(wxT("Invalid met-file header found, removing file."));
-			}
-
-			uint64 nExistingSize = file.GetLength();
-			while (file.GetPosition() < nExistingSize) {
-				// Read the next hash
-				hashlist.push_back(CAICHHash(&file));
-
-				uint32 nHashCount = file.ReadUInt32();
-				if (file.GetPosition() + nHashCount * CAICHHash::GetHashSize() > nExistingSize){
-					throw CEOFException(wxT("Hashlist ends past end of file."));
-				}
-
-				// skip the rest of this hashset
-				nLastVerifiedPos = file.Seek(nHashCount * HASHSIZE, wxFromCurrent);
-			}
-		} catch (const CEOFException&) {
-			AddDebugLogLineC(logAICHThread, wxT("Hashlist corrupted, truncating file."));
-			file.Close();
-			file.Reopen(CFile::read_write);
-			file.SetLength(nLastVerifiedPos);
-		} catch (const CIOFailureException& e) {
-			AddDebugLogLineC(logAICHThread, wxT("IO failure while reading hashlist (Aborting): ") + e.what());
-
-			return;
-		}
-
-		AddDebugLogLineN( logAICHThread, wxT("Masterhashes of known files have been loaded.") );
+	if (!CAICHHashSet::GetStoredMasterHashes(hashlist)) {
+		// Don't start hashing if the file cannot be created at all
+		AddDebugLogLineC( logAICHThread, wxT("Error, failed to open 'known2_64.met' file!") );
+		return;
 	}
 
+	AddDebugLogLineN( logAICHThread, wxT("Masterhashes of known files have been loaded.") );
+
 	// Now we check that all files which are in the sharedfilelist have a
 	// corresponding hash in our list. Those how don't are queued for hashing.
 	theApp->sharedfiles->CheckAICHHashes(hashlist);
@@ -403,6 +358,24 @@ bool CAICHSyncTask::ConvertToKnown2ToKnown264()
 }
 
 
+////////////////////////////////////////////////////////////
+// CKnownFilesCompactTask
+
+CKnownFilesCompactTask::CKnownFilesCompactTask(const CPath& metPath, uint64 journalOffset, uint32 generation)
+	: CThreadTask(wxT("Compacting"), metPath.GetPrintable(), ETP_Normal),
+	  m_metPath(metPath),
+	  m_journalOffset(journalOffset),
+	  m_generation(generation)
+{
+}
+
+
+void CKnownFilesCompactTask::Entry()
+{
+	CKnownFileList::CompactJournal(m_metPath, m_journalOffset, m_generation);
+}
+
+
 
 ////////////////////////////////////////////////////////////
 // CCompletionTask
@@ -135,6 +135,34 @@ protected:
 };
 
 
+/**
+ * This task merges the known.met journal into known.met in the background.
+ *
+ * @see CKnownFileList::CompactJournal
+ */
+class CKnownFilesCompactTask : public CThreadTask
+{
+public:
+	/**
+	 * @param metPath The full path of known.met.
+	 * @param journalOffset The length of the journal to merge.
+	 * @param generation Identifies the known.met the journal belongs to.
+	 */
+	CKnownFilesCompactTask(const CPath& metPath, uint64 journalOffset, uint32 generation);
+
+protected:
+	/** See CThreadTask::Entry */
+	virtual void Entry();
+
+	//! The full path of known.met.
+	CPath		m_metPath;
+	//! The length of the journal to merge.
+	uint64		m_journalOffset;
+	//! Identifies the known.met the journal belongs to.
+	uint32		m_generation;
+};
+
+
 /**
  * This task performs the final tasks on a complete download.
  *
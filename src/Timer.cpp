@@ -33,45 +33,65 @@ class CTimerThread : public CMuleThread
 {
 public:
 	CTimerThread()
-		: CMuleThread(wxTHREAD_JOINABLE)
+		: CMuleThread(wxTHREAD_JOINABLE),
+		  m_stop(false),
+		  m_nextEvent(0)
 	{
 	}
 
 	void* Entry() {
 		CTimerEvent evt(m_id);
 
-		uint32 lastEvent = GetTickCountFullRes();
-		do {
-			// current time
-			uint32 now = GetTickCountFullRes();
-			// This is typically zero, because lastEvent was already incremented by one period.
-			sint32 delta = now - lastEvent;
-			if (delta > 100 * m_period) {
-				// We're way too far behind.  Probably what really happened is
-				// the system time was adjusted backwards a bit.  So,
-				// the calculation of delta has produced an absurd value.
-				delta = 100 * m_period;
-				lastEvent = now - delta;
+		for (;;) {
+			sint32 timeout;
+			{
+				wxMutexLocker lock(m_mutex);
+				if (m_stop) {
+					break;
+				}
+
+				// current time
+				uint32 now = GetTickCountFullRes();
+				// This is typically zero or negative, because the next event was set one period ahead.
+				sint32 delta = now - m_nextEvent;
+				if (delta > 99 * m_period) {
+					// We're way too far behind.  Probably what really happened is
+					// the system time was adjusted backwards a bit.  So,
+					// the calculation of delta has produced an absurd value.
+					delta = 99 * m_period;
+					m_nextEvent = now - delta;
+				}
+
+				// Wait until the next event is due
+				timeout = (delta > 0) ? 0 : -delta;
 			}
 
-			// Wait one period (adjusted by the difference just calculated)
-			sint32 timeout = ((m_period < delta) ? 0 : (m_period - delta));
-
 			// In normal operation, we will never actually acquire the
 			// semaphore; we will always timeout.  This is used to
 			// implement a Sleep operation which the owning CTimer can
-			// interrupt by posting to the semaphore.  So, it follows
-			// that if we do acquire the semaphore it means the owner
-			// wants us to exit.
-			if (m_sleepSemaphore.WaitTimeout(timeout) == wxSEMA_TIMEOUT) {
+			// interrupt by posting to the semaphore, either to exit or
+			// because the next event was moved.
+			if (m_sleepSemaphore.WaitTimeout(timeout) != wxSEMA_TIMEOUT) {
+				continue;
+			}
+
+			{
+				wxMutexLocker lock(m_mutex);
+				// Woken up early, or the event was postponed meanwhile
+				if (m_stop || (sint32)(GetTickCountFullRes() - m_nextEvent) < 0) {
+					continue;
+				}
+
 				// Increment for one event only, so no events can be lost.
-				lastEvent += m_period;
+				m_nextEvent += m_period;
+			}
 
-				wxPostEvent(m_owner, evt);
-			} else {
+			wxPostEvent(m_owner, evt);
+
+			if (m_oneShot) {
 				break;
 			}
-		} while (!m_oneShot);
+		}
 
 		return NULL;
 	}
@@ -81,6 +101,13 @@ public:
 	wxEvtHandler*	m_owner;
 	int				m_id;
 	wxSemaphore		m_sleepSemaphore;
+
+	//! Protects m_stop and m_nextEvent.
+	wxMutex			m_mutex;
+	//! Set by the owner to make the thread exit.
+	bool			m_stop;
+	//! The time of the next event, in GetTickCountFullRes.
+	uint32			m_nextEvent;
 };
 
 
@@ -120,6 +147,7 @@ bool CTimer::Start(int millisecs, bool oneShot)
 	m_thread->m_oneShot	= oneShot;
 	m_thread->m_owner	= m_owner;
 	m_thread->m_id		= m_id;
+	m_thread->m_nextEvent	= GetTickCountFullRes() + millisecs;
 
 	if (m_thread->Create() == wxTHREAD_NO_ERROR) {
 		if (m_thread->Run() == wxTHREAD_NO_ERROR) {
@@ -139,6 +167,10 @@ bool CTimer::Start(int millisecs, bool oneShot)
 void CTimer::Stop()
 {
 	if (m_thread) {
+		{
+			wxMutexLocker lock(m_thread->m_mutex);
+			m_thread->m_stop = true;
+		}
 		m_thread->m_sleepSemaphore.Post();
 		m_thread->Stop();
 		delete m_thread;
@@ -147,6 +179,19 @@ void CTimer::Stop()
 }
 
 
+void CTimer::Delay(int millisecs)
+{
+	if (m_thread) {
+		{
+			wxMutexLocker lock(m_thread->m_mutex);
+			m_thread->m_nextEvent = GetTickCountFullRes() + millisecs;
+		}
+		// Let the thread start over with the new time
+		m_thread->m_sleepSemaphore.Post();
+	}
+}
+
+
 DEFINE_LOCAL_EVENT_TYPE(MULE_EVT_TIMER)
 
 CTimerEvent::CTimerEvent(int id)
@@ -62,6 +62,16 @@ public:
 	 */
 	void Stop();
 
+	/**
+	 * Postpones the next event.
+	 *
+	 * @param millisecs The time from now at which the next event is
+	 *                  produced. Later events follow one period apart.
+	 *
+	 * Does nothing if the timer is not running.
+	 */
+	void Delay(int millisecs);
+
 private:
 	CTimerThread* m_thread;
 	wxEvtHandler* m_owner;
@@ -0,0 +1,238 @@
+//
+// This file is part of the aMule Project.
+//
+// Copyright (c) 2003-2011 aMule Team ( admin@amule.org / http://www.amule.org )
+//
+// Any parts of this program derived from the xMule, lMule or eMule project,
+// or contributed by third-party developers are copyrighted by their
+// respective authors.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA
+//
+
+#include "TimerWheel.h"		// Interface declarations
+
+#include <wx/debug.h>		// Needed for wxASSERT
+
+
+CTimerWheel::CTimerWheel(uint64 now)
+	: m_running(NULL),
+	  m_currentTick(MsToTicks(now) + 1),
+	  m_lastID(0)
+{
+}
+
+
+CTimerWheel::~CTimerWheel()
+{
+	for (uint32 level = 0; level < TIMERWHEEL_LEVELS; ++level) {
+		for (uint32 slot = 0; slot < TIMERWHEEL_SLOTS; ++slot) {
+			TimerSlot& entries = m_wheel[level][slot];
+			for (TimerSlot::iterator it = entries.begin(); it != entries.end(); ++it) {
+				delete (*it)->task;
+				delete *it;
+			}
+		}
+	}
+}
+
+
+uint64 CTimerWheel::MsToTicks(uint64 ms)
+{
+	return ms / TIMERWHEEL_RESOLUTION;
+}
+
+
+CTimerWheel::TimerID CTimerWheel::AddTimer(CTimerWheelTask* task, uint32 delay, uint32 period)
+{
+	wxASSERT(task);
+
+	// Skip IDs that are still in use after a wrap-around, and zero.
+	do {
+		++m_lastID;
+	} while (m_lastID == 0 || m_timers.find(m_lastID) != m_timers.end());
+
+	TimerEntry* entry = new TimerEntry;
+	entry->id = m_lastID;
+	// Delays are counted from the last processed tick. Round up, so a task
+	// never runs before its delay has passed.
+	entry->expires = m_currentTick + (delay + TIMERWHEEL_RESOLUTION - 1) / TIMERWHEEL_RESOLUTION;
+	entry->period = period ? (period + TIMERWHEEL_RESOLUTION - 1) / TIMERWHEEL_RESOLUTION : 0;
+	entry->task = task;
+
+	m_timers[entry->id] = entry;
+	Insert(entry);
+
+	return entry->id;
+}
+
+
+bool CTimerWheel::RemoveTimer(TimerID id)
+{
+	std::map<TimerID, TimerEntry*>::iterator it = m_timers.find(id);
+	if (it == m_timers.end()) {
+		return false;
+	}
+
+	TimerEntry* entry = it->second;
+	m_timers.erase(it);
+
+	// The entry itself is freed when its slot is next visited. A running
+	// task is deleted by RunSlot once it has returned.
+	if (entry != m_running) {
+		delete entry->task;
+	}
+	entry->task = NULL;
+
+	return true;
+}
+
+
+void CTimerWheel::Insert(TimerEntry* entry)
+{
+	// Overdue timers are run on the next processed tick.
+	uint64 expires = (entry->expires < m_currentTick) ? m_currentTick : entry->expires;
+	uint64 delta = expires - m_currentTick;
+
+	for (uint32 level = 0; level < TIMERWHEEL_LEVELS; ++level) {
+		uint32 shift = level * TIMERWHEEL_SLOT_BITS;
+		uint64 range = 1ull << (shift + TIMERWHEEL_SLOT_BITS);
+
+		if (delta < range || level == TIMERWHEEL_LEVELS - 1) {
+			if (delta >= range) {
+				// Further out than the wheel reaches. Park it in the last
+				// slot in range, it will be re-inserted once cascaded.
+				expires = m_currentTick + range - 1;
+			}
+
+			m_wheel[level][(expires >> shift) & TIMERWHEEL_SLOT_MASK].push_back(entry);
+			return;
+		}
+	}
+}
+
+
+bool CTimerWheel::Cascade(uint32 level)
+{
+	uint32 index = (m_currentTick >> (level * TIMERWHEEL_SLOT_BITS)) & TIMERWHEEL_SLOT_MASK;
+
+	TimerSlot entries;
+	entries.swap(m_wheel[level][index]);
+
+	for (TimerSlot::iterator it = entries.begin(); it != entries.end(); ++it) {
+		if ((*it)->task) {
+			Insert(*it);
+		} else {
+			delete *it;
+		}
+	}
+
+	return index == 0;
+}
+
+
+void CTimerWheel::RunSlot(TimerSlot& slot, uint64 now)
+{
+	for (TimerSlot::iterator it = slot.begin(); it != slot.end(); ++it) {
+		TimerEntry* entry = *it;
+		CTimerWheelTask* task = entry->task;
+
+		if (!task) {
+			// Removed since it was scheduled
+			delete entry;
+			continue;
+		} else if (entry->expires >= m_currentTick) {
+			// Not due yet, can only happen for entries parked at the end of the wheel
+			Insert(entry);
+			continue;
+		}
+
+		m_running = entry;
+		task->Run();
+		m_running = NULL;
+
+		if (!entry->task) {
+			// The task removed its own timer
+			delete task;
+			delete entry;
+		} else if (entry->period) {
+			// Reschedule relative to the real time rather than to the
+			// tick being processed, so late runs are not followed by
+			// a burst of catch-up runs.
+			entry->expires = now + entry->period;
+			Insert(entry);
+		} else {
+			m_timers.erase(entry->id);
+			delete task;
+			delete entry;
+		}
+	}
+}
+
+
+void CTimerWheel::Process(uint64 now)
+{
+	uint64 target = MsToTicks(now);
+
+	if (m_timers.empty() && m_currentTick <= target) {
+		// Nothing to do, but removed entries may linger in the slots,
+		// so the wheel can only be skipped ahead when it is empty.
+		bool empty = true;
+		for (uint32 level = 0; empty && level < TIMERWHEEL_LEVELS; ++level) {
+			for (uint32 slot = 0; empty && slot < TIMERWHEEL_SLOTS; ++slot) {
+				empty = m_wheel[level][slot].empty();
+			}
+		}
+
+		if (empty) {
+			m_currentTick = target + 1;
+			return;
+		}
+	}
+
+	while (m_currentTick <= target) {
+		uint32 index = m_currentTick & TIMERWHEEL_SLOT_MASK;
+
+		if (index == 0) {
+			for (uint32 level = 1; level < TIMERWHEEL_LEVELS && Cascade(level); ++level);
+		}
+
+		// The tick is advanced before running tasks, so timers added from
+		// within a task never end up in the slot currently being run.
+		TimerSlot expired;
+		expired.swap(m_wheel[0][index]);
+		++m_currentTick;
+
+		RunSlot(expired, target);
+	}
+}
+
+
+uint32 CTimerWheel::GetTimeToNextTimer(uint64 now) const
+{
+	uint64 nowTicks = MsToTicks(now);
+
+	for (uint32 i = 0; i < TIMERWHEEL_SLOTS; ++i) {
+		uint64 tick = m_currentTick + i;
+
+		// Either a pending timer or a cascade, which may bring new ones.
+		if (!m_wheel[0][tick & TIMERWHEEL_SLOT_MASK].empty() || (i && !(tick & TIMERWHEEL_SLOT_MASK))) {
+			return (tick > nowTicks) ? (tick - nowTicks) * TIMERWHEEL_RESOLUTION : 0;
+		}
+	}
+
+	return (m_currentTick + TIMERWHEEL_SLOTS - nowTicks) * TIMERWHEEL_RESOLUTION;
+}
+// File_checked_for_headers
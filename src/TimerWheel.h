@@ -0,0 +1,241 @@
+//
+// This file is part of the aMule Project.
+//
+// Copyright (c) 2003-2011 aMule Team ( admin@amule.org / http://www.amule.org )
+//
+// Any parts of this program derived from the xMule, lMule or eMule project,
+// or contributed by third-party developers are copyrighted by their
+// respective authors.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA
+//
+
+#ifndef TIMERWHEEL_H
+#define TIMERWHEEL_H
+
+#include "Types.h"		// Needed for uint32, uint64
+
+#include <list>
+#include <map>
+
+
+/**
+ * Base class for work scheduled on the timer wheel.
+ */
+class CTimerWheelTask
+{
+public:
+	virtual ~CTimerWheelTask() {}
+
+	/**
+	 * Called on the core thread once the deadline has passed.
+	 */
+	virtual void Run() = 0;
+};
+
+
+/**
+ * Timer task that calls a member function of an object.
+ *
+ * The object must outlive the registration, so objects that register
+ * tasks with the wheel must remove them in their destructor.
+ */
+template <typename T>
+class CTimerWheelMemberTask : public CTimerWheelTask
+{
+public:
+	typedef void (T::*TaskMethod)();
+
+	CTimerWheelMemberTask(T* object, TaskMethod method)
+		: m_object(object),
+		  m_method(method)
+	{}
+
+	virtual void Run()	{ (m_object->*m_method)(); }
+
+private:
+	T*		m_object;
+	TaskMethod	m_method;
+};
+
+
+/**
+ * Timer task that calls a free or static member function.
+ */
+class CTimerWheelFunctionTask : public CTimerWheelTask
+{
+public:
+	typedef void (*TaskFunction)();
+
+	CTimerWheelFunctionTask(TaskFunction function)
+		: m_function(function)
+	{}
+
+	virtual void Run()	{ m_function(); }
+
+private:
+	TaskFunction	m_function;
+};
+
+
+/**
+ * Helpers for creating tasks without spelling out the type.
+ */
+template <typename T>
+CTimerWheelTask* MakeTimerWheelTask(T* object, void (T::*method)())
+{
+	return new CTimerWheelMemberTask<T>(object, method);
+}
+
+inline CTimerWheelTask* MakeTimerWheelTask(void (*function)())
+{
+	return new CTimerWheelFunctionTask(function);
+}
+
+
+/**
+ * Hierarchical timing wheel for the periodic and one-shot work of the core.
+ *
+ * Instead of having every subsystem compare ::GetTickCount() against its own
+ * "last time" member on every core tick, subsystems register their tasks
+ * here. Timers are kept in TIMERWHEEL_LEVELS wheels of TIMERWHEEL_SLOTS
+ * slots each, where every level covers TIMERWHEEL_SLOTS times the range of
+ * the level below. Adding and removing a timer is O(1) and a tick only
+ * looks at a single slot, so the cost of a tick no longer depends on the
+ * number of registered timers.
+ *
+ * The wheel is not thread-safe and must only be used from the core thread.
+ */
+class CTimerWheel
+{
+public:
+	//! Identifies a registered timer, 0 is never used.
+	typedef uint32 TimerID;
+
+	/**
+	 * Constructor.
+	 *
+	 * @param now The current time in milliseconds (GetTickCount64).
+	 */
+	CTimerWheel(uint64 now);
+
+	/**
+	 * Destructor, deletes all tasks still registered.
+	 */
+	~CTimerWheel();
+
+	/**
+	 * Registers a task.
+	 *
+	 * @param task The task to run, the wheel takes ownership.
+	 * @param delay Milliseconds until the first run, counted from the last call to Process.
+	 * @param period If non-zero, the task is rescheduled every period ms after each run.
+	 * @return The ID that can be used to remove the timer again.
+	 */
+	TimerID	AddTimer(CTimerWheelTask* task, uint32 delay, uint32 period = 0);
+
+	/**
+	 * Registers a periodic task whose first run happens one period from now.
+	 */
+	TimerID	AddPeriodicTimer(CTimerWheelTask* task, uint32 period)	{ return AddTimer(task, period, period); }
+
+	/**
+	 * Removes a timer and deletes its task.
+	 *
+	 * @return True if the timer was still registered.
+	 *
+	 * This can safely be called from within a running task, including
+	 * the task of the timer being removed.
+	 */
+	bool	RemoveTimer(TimerID id);
+
+	/**
+	 * Runs all tasks whose deadline is at or before 'now'.
+	 *
+	 * @param now The current time in milliseconds (GetTickCount64).
+	 */
+	void	Process(uint64 now);
+
+	/**
+	 * Returns the number of milliseconds until the next timer expires.
+	 *
+	 * If no timer is found in the lowest level, the time until the next
+	 * cascade is returned, so callers may safely sleep for that long.
+	 */
+	uint32	GetTimeToNextTimer(uint64 now) const;
+
+	/**
+	 * Returns the number of registered timers.
+	 */
+	uint32	GetTimerCount() const	{ return m_timers.size(); }
+
+private:
+	//! A single registration.
+	struct TimerEntry {
+		TimerID			id;
+		uint64			expires;	// in ticks
+		uint32			period;		// in ticks, 0 for one-shot timers
+		CTimerWheelTask*	task;		// NULL once removed
+	};
+
+	typedef std::list<TimerEntry*> TimerSlot;
+
+	/**
+	 * Places an entry into the slot matching its expiry.
+	 */
+	void	Insert(TimerEntry* entry);
+
+	/**
+	 * Moves the entries of a higher level slot down to the lower levels.
+	 *
+	 * @return True if the next higher level has to be cascaded as well.
+	 */
+	bool	Cascade(uint32 level);
+
+	/**
+	 * Runs the tasks of the given lowest level slot.
+	 *
+	 * @param slot The entries of the slot, already detached from the wheel.
+	 * @param now The current time in ticks.
+	 */
+	void	RunSlot(TimerSlot& slot, uint64 now);
+
+	static uint64	MsToTicks(uint64 ms);
+
+	enum {
+		//! Milliseconds per tick of the lowest level.
+		TIMERWHEEL_RESOLUTION = 50,
+		//! Bits of the tick counter handled by each level.
+		TIMERWHEEL_SLOT_BITS = 6,
+		TIMERWHEEL_SLOTS = 1 << TIMERWHEEL_SLOT_BITS,
+		TIMERWHEEL_SLOT_MASK = TIMERWHEEL_SLOTS - 1,
+		//! With 50ms ticks, four levels cover about 9.7 days.
+		TIMERWHEEL_LEVELS = 4
+	};
+
+	//! The slots, indexed by level and slot.
+	TimerSlot	m_wheel[TIMERWHEEL_LEVELS][TIMERWHEEL_SLOTS];
+	//! All registered timers, for removal by ID.
+	std::map<TimerID, TimerEntry*> m_timers;
+	//! The entry whose task is currently running, if any.
+	TimerEntry*	m_running;
+	//! The next tick to be processed.
+	uint64		m_currentTick;
+	//! The last ID handed out.
+	TimerID		m_lastID;
+};
+
+#endif // TIMERWHEEL_H
+// File_checked_for_headers
@@ -77,6 +77,9 @@ BEGIN_EVENT_TABLE(CamuleGuiApp, wxApp)
 
 	EVT_MULE_INTERNAL(wxEVT_CORE_SERVER_DNS_DONE, -1, CamuleGuiApp::OnServerDnsDone)
 
+	// Secure ident signatures created or verified
+	EVT_MULE_INTERNAL(wxEVT_CORE_SECIDENT_DONE, -1, CamuleGuiApp::OnSecIdentDone)
+
 	// Hash ended notifier
 	EVT_MULE_HASHING(CamuleGuiApp::OnFinishedHashing)
 	EVT_MULE_AICH_HASHING(CamuleGuiApp::OnFinishedAICHHashing)
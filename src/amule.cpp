@@ -53,8 +53,12 @@
 #include "ClientList.h"			// Needed for CClientList
 #include "ClientUDPSocket.h"		// Needed for CClientUDPSocket & CMuleUDPSocket
 #include "ExternalConn.h"		// Needed for ExternalConn & MuleConnection
+#include "Metrics.h"			// Needed for CMetricsTimer
+#include "MetricsServer.h"		// Needed for CMetricsServer
+#include "GetTickCount.h"		// Needed for GetTickCount64
 #include <common/FileFunctions.h>	// Needed for CDirIterator
 #include "FriendList.h"			// Needed for CFriendList
+#include "GuiEvents.h"			// Needed for MuleNotify::FlushListNotifications
 #include "HTTPDownload.h"		// Needed for CHTTPDownloadThread
 #include "InternalEvents.h"		// Needed for CMuleInternalEvent
 #include "IPFilter.h"			// Needed for CIPFilter
@@ -66,14 +70,20 @@
 #include "PartFile.h"			// Needed for CPartFile
 #include "PlatformSpecific.h"   // Needed for PlatformSpecific::AllowSleepMode();
 #include "Preferences.h"		// Needed for CPreferences
+#include "RandomFunctions.h"		// Needed for GetRandomUint32
+#include "RobinHoodMap.h"		// Needed for CRobinHoodMD4Hash
 #include "SearchList.h"			// Needed for CSearchList
 #include "Server.h"			// Needed for GetListName
 #include "ServerList.h"			// Needed for CServerList
 #include "ServerConnect.h"              // Needed for CServerConnect
 #include "ServerUDPSocket.h"		// Needed for CServerUDPSocket
+#include "SharedFileList.h"		// Needed for CSharedFileList
+#include "StartupLoader.h"		// Needed for CStartupLoader
 #include "Statistics.h"			// Needed for CStatistics
 #include "TerminationProcessAmuleweb.h"	// Needed for CTerminationProcessAmuleweb
 #include "ThreadTasks.h"
+#include "Timer.h"			// Needed for CTimer
+#include "TimerWheel.h"			// Needed for CTimerWheel
 #include "UploadQueue.h"		// Needed for CUploadQueue
 #include "UploadBandwidthThrottler.h"
 #include "UserEvents.h"
@@ -148,6 +158,12 @@ static void SetResourceLimits()
 #endif
 }
 
+
+static void LoadPartFiles()
+{
+	theApp->downloadqueue->LoadMetFiles(thePrefs::GetTempDir());
+}
+
 // We store the received signal in order to avoid race-conditions
 // in the signal handler.
 bool g_shutdownSignal = false;
@@ -190,7 +206,9 @@ CamuleApp::CamuleApp()
 	downloadqueue	= NULL;
 	uploadqueue	= NULL;
 	ipfilter	= NULL;
+	timerwheel	= NULL;
 	ECServerHandler = NULL;
+	m_metricsServer	= NULL;
 	glob_prefs	= NULL;
 	m_statistics	= NULL;
 	uploadBandwidthThrottler = NULL;
@@ -218,6 +236,7 @@ CamuleApp::~CamuleApp()
 {
 	// Closing the log-file as the very last thing, since
 	// wxWidgets log-events are saved in it as well.
+	theLogger.StopWriter();
 	theLogger.CloseLogfile();
 }
 
@@ -309,6 +328,9 @@ int CamuleApp::OnExit()
 	delete ECServerHandler;
 	ECServerHandler = NULL;
 
+	delete m_metricsServer;
+	m_metricsServer = NULL;
+
 	delete m_statistics;
 	m_statistics = NULL;
 
@@ -319,6 +341,10 @@ int CamuleApp::OnExit()
 	delete uploadBandwidthThrottler;
 	uploadBandwidthThrottler = NULL;
 
+	// Subsystems remove their timers on destruction, so this goes last
+	delete timerwheel;
+	timerwheel = NULL;
+
 #ifdef ASIO_SOCKETS
 	delete m_AsioService;
 	m_AsioService = NULL;
@@ -502,6 +528,12 @@ bool CamuleApp::OnInit()
 
 	m_statistics = new CStatistics();
 
+	// Must exist before any subsystem registers its timers
+	timerwheel	= new CTimerWheel(GetTickCount64());
+
+	// Must be seeded before any peer supplied hash gets indexed
+	CRobinHoodMD4Hash::SetSeed(GetRandomUint32());
+
 	clientlist	= new CClientList();
 	friendlist	= new CFriendList();
 	searchlist	= new CSearchList();
@@ -517,6 +549,12 @@ bool CamuleApp::OnInit()
 	uploadqueue	= new CUploadQueue();
 	ipfilter	= new CIPFilter();
 
+	// Periodic work of the core timer
+	timerwheel->AddPeriodicTimer(MakeTimerWheelTask(this, &CamuleApp::OnSecondTimer), 1000);
+	timerwheel->AddPeriodicTimer(MakeTimerWheelTask(this, &CamuleApp::OnListenSocketTimer), 5000);
+	timerwheel->AddPeriodicTimer(MakeTimerWheelTask(&theStats::Save), 60000);
+	timerwheel->AddPeriodicTimer(MakeTimerWheelTask(this, &CamuleApp::OnKnownFilesSaveTimer), 30*60*1000/*There must be a prefs option for this*/);
+
 	// Creates all needed listening sockets
 	wxString msg;
 	if (!ReinitializeNetwork(&msg)) {
@@ -550,6 +588,9 @@ bool CamuleApp::OnInit()
 	// and the UBT constructor creates a thread.
 	uploadBandwidthThrottler = new UploadBandwidthThrottler();
 
+	// Same for the log writer, lines are written synchronously until now
+	theLogger.StartWriter();
+
 #ifdef ASIO_SOCKETS
 	m_AsioService = new CAsioService;
 #endif
@@ -561,19 +602,39 @@ bool CamuleApp::OnInit()
 	// of the partfiles has finished.
 	CThreadScheduler::Start();
 
-	// These must be initialized after the gui is loaded.
-	if (thePrefs::GetNetworkED2K()) {
-		serverlist->Init();
+	// These must be initialized after the gui is loaded, and after
+	// the fork, as the loaders run on threads of their own.
+	//
+	// Loaders which only fill their own list run on workers, the ones
+	// updating the GUI on this thread, all of them as early as possible.
+	{
+		CStartupLoader loader;
+
+		const size_t knownPhase = loader.AddPhase(wxT("known.met"), MakeStartupTask(knownfiles, &CKnownFileList::Init), true);
+		loader.AddPhase(wxT("canceled.met"), MakeStartupTask(canceledfiles, &CCanceledFileList::Init), true);
+		loader.AddPhase(wxT("clients.met"), MakeStartupTask(clientcredits, &CClientCreditsList::LoadList), true);
+		loader.AddPhase(wxT("cryptkey.dat"), MakeStartupTask(clientcredits, &CClientCreditsList::InitalizeCrypting), true);
+
+		if (thePrefs::GetNetworkED2K()) {
+			loader.AddPhase(wxT("server.met"), MakeStartupTask(serverlist, &CServerList::Init), false);
+		}
+
+		const size_t partPhase = loader.AddPhase(wxT("part files"), MakeStartupTask(&LoadPartFiles), false);
+
+		// Needs the known files and the part files to tell which files are new
+		const size_t sharedPhase = loader.AddPhase(wxT("shared files"), MakeStartupTask(sharedfiles, &CSharedFileList::Reload), false);
+		loader.AddDependency(sharedPhase, knownPhase);
+		loader.AddDependency(sharedPhase, partPhase);
+
+		// Load saved friendlist (now, so it can update in GUI right away)
+		loader.AddPhase(wxT("friends"), MakeStartupTask(friendlist, &CFriendList::LoadList), false);
+
+		loader.Run();
 	}
-	downloadqueue->LoadMetFiles(thePrefs::GetTempDir());
-	sharedfiles->Reload();
 
 	// Ensure that the up/down ratio is used
 	CPreferences::CheckUlDlRatio();
 
-	// Load saved friendlist (now, so it can update in GUI right away)
-	friendlist->LoadList();
-
 	// The user can start pressing buttons like mad if he feels like it.
 	m_app_state = APP_STATE_RUNNING;
 
@@ -734,6 +795,16 @@ bool CamuleApp::ReinitializeNetwork(wxString* msg)
 	myaddr[0].Service(thePrefs::ECPort());
 	ECServerHandler = new ExternalConn(myaddr[0], msg);
 
+	// Metrics for Prometheus, only if a port is set
+	if (thePrefs::GetMetricsPort()) {
+		amuleIPV4Address metricsAddr;
+		if (thePrefs::GetMetricsAddress().IsEmpty() || !metricsAddr.Hostname(thePrefs::GetMetricsAddress())) {
+			metricsAddr.Hostname(wxT("127.0.0.1"));
+		}
+		metricsAddr.Service(thePrefs::GetMetricsPort());
+		m_metricsServer = new CMetricsServer(metricsAddr);
+	}
+
 	// Create the UDP socket TCP+3.
 	// Used for source asking on servers.
 	if (thePrefs::GetAddress().IsEmpty()) {
@@ -1128,6 +1199,15 @@ void CamuleApp::OnServerDnsDone(CMuleInternalEvent& evt)
 }
 
 
+void CamuleApp::OnSecIdentDone(CMuleInternalEvent& WXUNUSED(evt))
+{
+	// The list is gone once shutting down
+	if (clientcredits) {
+		clientcredits->ProcessCryptoResults();
+	}
+}
+
+
 void CamuleApp::OnTCPTimer(CTimerEvent& WXUNUSED(evt))
 {
 	if(!IsRunning()) {
@@ -1144,7 +1224,7 @@ void CamuleApp::OnTCPTimer(CTimerEvent& WXUNUSED(evt))
 void CamuleApp::OnCoreTimer(CTimerEvent& WXUNUSED(evt))
 {
 	// Former TimerProc section
-	static uint64 msPrev1, msPrev5, msPrevSave, msPrevHist, msPrevOS, msPrevKnownMet;
+	static uint64 msPrevHist, msPrevOS;
 	uint64 msCur = theStats::GetUptimeMillis();
 	TheTime = msCur / 1000;
 
@@ -1152,6 +1232,8 @@ void CamuleApp::OnCoreTimer(CTimerEvent& WXUNUSED(evt))
 		return;
 	}
 
+	CMetricsTimer metricsTimer(CMetrics::SubsystemCoreTimer);
+
 #ifndef AMULE_DAEMON
 	// Check if we should terminate the app
 	if ( g_shutdownSignal ) {
@@ -1180,6 +1262,11 @@ void CamuleApp::OnCoreTimer(CTimerEvent& WXUNUSED(evt))
 
 	uploadqueue->Process();
 	downloadqueue->Process();
+	// Add the shared directories listed meanwhile, if reloading
+	sharedfiles->ContinueReload();
+	// Deliver the list changes of this tick in one go
+	serverlist->FlushNotifications();
+	downloadqueue->FlushNotifications();
 	//theApp->clientcredits->Process();
 	theStats::CalculateRates();
 
@@ -1195,66 +1282,77 @@ void CamuleApp::OnCoreTimer(CTimerEvent& WXUNUSED(evt))
 
 	}
 
+	// Run everything registered on the timer wheel that is due by now
+	timerwheel->Process(GetTickCount64());
 
-	if (msCur-msPrev1 > 1000) {  // approximately every second
-		msPrev1 = msCur;
-		clientcredits->Process();
-		clientlist->Process();
+	// Show the list additions and updates of this tick in ranges
+	const bool moreNotifications = MuleNotify::FlushListNotifications();
+
+	// Special
+	if (msCur - msPrevOS >= thePrefs::GetOSUpdate() * 1000ull) {
+		OnlineSig(); // Added By Bouc7
+		msPrevOS = msCur;
+	}
 
-		// Publish files to server if needed.
-		sharedfiles->Process();
+	// Recomended by lugdunummaster himself - from emule 0.30c
+	serverconnect->KeepConnectionAlive();
 
-		if( Kademlia::CKademlia::IsRunning() ) {
-			Kademlia::CKademlia::Process();
-			if(Kademlia::CKademlia::GetPrefs()->HasLostConnection()) {
-				StopKad();
-				clientudp->Close();
-				clientudp->Open();
-				if (thePrefs::Reconnect()) {
-					StartKad();
-				}
-			}
+	// Without transfers nothing needs a tick of its own, so sleep until
+	// something on the timer wheel is due, at least once a second.
+	if (uploadqueue->GetUploadingList().empty() && uploadqueue->GetWaitingList().empty()
+		&& !downloadqueue->GetDownloadingFileCount() && !sharedfiles->IsReloading()
+		&& !moreNotifications) {
+		const uint32 sleep = timerwheel->GetTimeToNextTimer(GetTickCount64());
+		if (sleep > CORE_TIMER_PERIOD) {
+			core_timer->Delay(sleep);
 		}
+	}
 
-		if( serverconnect->IsConnecting() && !serverconnect->IsSingleConnect() ) {
-			serverconnect->TryAnotherConnectionrequest();
-		}
-		if (serverconnect->IsConnecting()) {
-			serverconnect->CheckForTimeout();
-		}
-		listensocket->UpdateConnectionsStatus();
+	// Disarm recursion protection
+	recurse = false;
+}
 
-	}
 
+void CamuleApp::OnSecondTimer()
+{
+	clientcredits->Process();
+	clientlist->Process();
 
-	if (msCur-msPrev5 > 5000) {  // every 5 seconds
-		msPrev5 = msCur;
-		listensocket->Process();
-	}
+	// Publish files to server if needed.
+	sharedfiles->Process();
 
-	if (msCur-msPrevSave >= 60000) {
-		msPrevSave = msCur;
-		theStats::Save();
+	if( Kademlia::CKademlia::IsRunning() ) {
+		Kademlia::CKademlia::Process();
+		if(Kademlia::CKademlia::GetPrefs()->HasLostConnection()) {
+			StopKad();
+			clientudp->Close();
+			clientudp->Open();
+			if (thePrefs::Reconnect()) {
+				StartKad();
+			}
+		}
 	}
 
-	// Special
-	if (msCur - msPrevOS >= thePrefs::GetOSUpdate() * 1000ull) {
-		OnlineSig(); // Added By Bouc7
-		msPrevOS = msCur;
+	if( serverconnect->IsConnecting() && !serverconnect->IsSingleConnect() ) {
+		serverconnect->TryAnotherConnectionrequest();
 	}
-
-	if (msCur - msPrevKnownMet >= 30*60*1000/*There must be a prefs option for this*/) {
-		// Save Shared Files data
-		knownfiles->Save();
-		msPrevKnownMet = msCur;
+	if (serverconnect->IsConnecting()) {
+		serverconnect->CheckForTimeout();
 	}
+	listensocket->UpdateConnectionsStatus();
+}
 
 
-	// Recomended by lugdunummaster himself - from emule 0.30c
-	serverconnect->KeepConnectionAlive();
+void CamuleApp::OnListenSocketTimer()
+{
+	listensocket->Process();
+}
 
-	// Disarm recursion protection
-	recurse = false;
+
+void CamuleApp::OnKnownFilesSaveTimer()
+{
+	// Save Shared Files data
+	knownfiles->Save();
 }
 
 
@@ -1414,6 +1512,9 @@ void CamuleApp::ShutDown()
 	}
 
 	ECServerHandler->KillAllSockets();
+	if (m_metricsServer) {
+		m_metricsServer->KillAllSockets();
+	}
 
 #ifdef ENABLE_UPNP
 	if (thePrefs::GetUPnPEnabled()) {
@@ -2062,4 +2163,5 @@ DEFINE_LOCAL_EVENT_TYPE(wxEVT_CORE_FINISHED_HTTP_DOWNLOAD)
 DEFINE_LOCAL_EVENT_TYPE(wxEVT_CORE_SOURCE_DNS_DONE)
 DEFINE_LOCAL_EVENT_TYPE(wxEVT_CORE_UDP_DNS_DONE)
 DEFINE_LOCAL_EVENT_TYPE(wxEVT_CORE_SERVER_DNS_DONE)
+DEFINE_LOCAL_EVENT_TYPE(wxEVT_CORE_SECIDENT_DONE)
 // File_checked_for_headers
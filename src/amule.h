@@ -43,6 +43,7 @@
 class CAbstractFile;
 class CKnownFile;
 class ExternalConn;
+class CMetricsServer;
 class CamuleDlg;
 class CPreferences;
 class CDownloadQueue;
@@ -78,6 +79,7 @@ class wxCloseEvent;
 class wxFFileOutputStream;
 class CTimer;
 class CTimerEvent;
+class CTimerWheel;
 class wxSingleInstanceChecker;
 class CHashingEvent;
 class CMuleInternalEvent;
@@ -244,6 +246,8 @@ public:
 
 	// shakraw - new EC code using wxSocketBase
 	ExternalConn*	ECServerHandler;
+	// Prometheus metrics, NULL unless enabled
+	CMetricsServer*	m_metricsServer;
 
 	// return current (valid) public IP or 0 if unknown
 	// If ignorelocal is true, don't use m_localip
@@ -270,6 +274,7 @@ public:
 	CClientUDPSocket*	clientudp;
 	CStatistics*		m_statistics;
 	CIPFilter*		ipfilter;
+	CTimerWheel*		timerwheel;
 	UploadBandwidthThrottler* uploadBandwidthThrottler;
 #ifdef ASIO_SOCKETS
 	CAsioService*		m_AsioService;
@@ -325,10 +330,16 @@ protected:
 	void OnUDPDnsDone(CMuleInternalEvent& evt);
 	void OnSourceDnsDone(CMuleInternalEvent& evt);
 	void OnServerDnsDone(CMuleInternalEvent& evt);
+	void OnSecIdentDone(CMuleInternalEvent& evt);
 
 	void OnTCPTimer(CTimerEvent& evt);
 	void OnCoreTimer(CTimerEvent& evt);
 
+	// Periodic tasks, run from the timer wheel during OnCoreTimer
+	void OnSecondTimer();
+	void OnListenSocketTimer();
+	void OnKnownFilesSaveTimer();
+
 	void OnFinishedHashing(CHashingEvent& evt);
 	void OnFinishedAICHHashing(CHashingEvent& evt);
 	void OnFinishedCompletion(CCompletionEvent& evt);
@@ -107,6 +107,9 @@ BEGIN_EVENT_TABLE(CamuleDaemonApp, wxAppConsole)
 
 	EVT_MULE_INTERNAL(wxEVT_CORE_SERVER_DNS_DONE, -1, CamuleDaemonApp::OnServerDnsDone)
 
+	// Secure ident signatures created or verified
+	EVT_MULE_INTERNAL(wxEVT_CORE_SECIDENT_DONE, -1, CamuleDaemonApp::OnSecIdentDone)
+
 	// Hash ended notifier
 	EVT_MULE_HASHING(CamuleDaemonApp::OnFinishedHashing)
 	EVT_MULE_AICH_HASHING(CamuleDaemonApp::OnFinishedAICHHashing)
@@ -54,6 +54,7 @@ there client on the eMule forum..
 #include "../../MemFile.h"
 #include "../../Preferences.h"
 #include "../../Logger.h"
+#include "../../amule.h"		// Needed for theApp
 
 ////////////////////////////////////////
 using namespace Kademlia;
@@ -68,12 +69,12 @@ CIndexed::CIndexed()
 	m_sfilename = thePrefs::GetConfigDir() + wxT("src_index.dat");
 	m_kfilename = thePrefs::GetConfigDir() + wxT("key_index.dat");
 	m_loadfilename = thePrefs::GetConfigDir() + wxT("load_index.dat");
-	m_lastClean = time(NULL) + (60*30);
 	m_totalIndexSource = 0;
 	m_totalIndexKeyword = 0;
 	m_totalIndexNotes = 0;
 	m_totalIndexLoad = 0;
 	ReadFile();
+	m_cleanTimer = theApp->timerwheel->AddPeriodicTimer(MakeTimerWheelTask(this, &CIndexed::Clean), MIN2MS(30));
 }
 
 void CIndexed::ReadFile()
@@ -246,6 +247,8 @@ void CIndexed::ReadFile()
 
 CIndexed::~CIndexed()
 {
+	theApp->timerwheel->RemoveTimer(m_cleanTimer);
+
 	try
 	{
 		time_t now = time(NULL);
@@ -379,9 +382,6 @@ CIndexed::~CIndexed()
 void CIndexed::Clean()
 {
 	time_t tNow = time(NULL);
-	if (m_lastClean > tNow) {
-		return;
-	}
 
 	uint32_t k_Removed = 0;
 	uint32_t s_Removed = 0;
@@ -468,7 +468,6 @@ void CIndexed::Clean()
 	m_totalIndexSource = s_Total - s_Removed;
 	m_totalIndexKeyword = k_Total - k_Removed;
 	AddDebugLogLineN(logKadIndex, CFormat(wxT("Removed %u keyword out of %u and %u source out of %u")) % k_Removed % k_Total % s_Removed % s_Total);
-	m_lastClean = tNow + MIN2S(30);
 }
 
 bool CIndexed::AddKeyword(const CUInt128& keyID, const CUInt128& sourceID, Kademlia::CKeyEntry* entry, uint8_t& load)
@@ -809,7 +808,6 @@ void CIndexed::SendValidKeywordResult(const CUInt128& keyID, const SSearchTerm*
 			}
 		}
 	}
-	Clean();
 }
 
 void CIndexed::SendValidSourceResult(const CUInt128& keyID, uint32_t ip, uint16_t port, uint16_t startPosition, uint64_t fileSize, const CKadUDPKey& senderKey)
@@ -859,7 +857,6 @@ void CIndexed::SendValidSourceResult(const CUInt128& keyID, uint32_t ip, uint16_
 			}
 		}
 	}
-	Clean();
 }
 
 void CIndexed::SendValidNoteResult(const CUInt128& keyID, uint32_t ip, uint16_t port, uint64_t fileSize, const CKadUDPKey& senderKey)
@@ -42,6 +42,7 @@ there client on the eMule forum..
 
 #include "SearchManager.h"
 #include "Entry.h"
+#include "../../TimerWheel.h"	// Needed for CTimerWheel::TimerID
 
 class wxArrayString;
 
@@ -134,7 +135,8 @@ public:
 	uint32_t m_totalIndexLoad;
 
 private:
-	time_t m_lastClean;
+	//! Runs Clean every 30 minutes.
+	CTimerWheel::TimerID m_cleanTimer;
 	KeyHashMap m_Keyword_map;
 	SrcHashMap m_Sources_map;
 	SrcHashMap m_Notes_map;
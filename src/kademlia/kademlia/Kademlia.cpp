@@ -250,11 +250,6 @@ void CKademlia::Process()
 				}
 			}
 		}
-
-		if (zone->m_nextSmallTimer <= now) {
-			zone->OnSmallTimer();
-			zone->m_nextSmallTimer = MIN2S(1) + now;
-		}
 	}
 
 	// This is a convenient place to add this, although not related to routing
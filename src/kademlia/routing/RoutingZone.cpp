@@ -103,10 +103,8 @@ void CRoutingZone::Init(CRoutingZone *super_zone, int level, const CUInt128& zon
 	// Create a new contact bin as this is a leaf.
 	m_bin = new CRoutingBin();
 
-	// Set timer so that zones closer to the root are processed earlier.
-	m_nextSmallTimer = time(NULL) + m_zoneIndex.Get32BitChunk(3);
-
 	// Start this zone.
+	m_smallTimer = 0;
 	StartTimer();
 
 	// If we are initializing the root node, read in our saved contact list.
@@ -117,6 +115,8 @@ void CRoutingZone::Init(CRoutingZone *super_zone, int level, const CUInt128& zon
 
 CRoutingZone::~CRoutingZone()
 {
+	theApp->timerwheel->RemoveTimer(m_smallTimer);
+
 	// Root node is processed first so that we can write our contact list and delete all branches.
 	if ((m_superZone == NULL) && (m_filename.Length() > 0)) {
 		WriteFile();
@@ -690,11 +690,17 @@ void CRoutingZone::StartTimer()
 	// Start filling the tree, closest bins first.
 	m_nextBigTimer = time(NULL) + SEC(10);
 	CKademlia::AddEvent(this);
+
+	// Set timer so that zones closer to the root are processed earlier.
+	const uint32_t delay = std::min<uint32_t>(m_zoneIndex.Get32BitChunk(3), 0xFFFFFFFF / 1000);
+	m_smallTimer = theApp->timerwheel->AddTimer(MakeTimerWheelTask(this, &CRoutingZone::OnSmallTimer), SEC2MS(delay), MIN2MS(1));
 }
 
 void CRoutingZone::StopTimer()
 {
 	CKademlia::RemoveEvent(this);
+	theApp->timerwheel->RemoveTimer(m_smallTimer);
+	m_smallTimer = 0;
 }
 
 bool CRoutingZone::OnBigTimer() const
@@ -41,6 +41,7 @@ there client on the eMule forum..
 
 #include "Maps.h"
 #include "../utils/UInt128.h"
+#include "../../TimerWheel.h"	// Needed for CTimerWheel::TimerID
 
 class CFileDataIO;
 
@@ -102,7 +103,6 @@ public:
 	bool	 HasOnlyLANNodes() const throw();
 
 	time_t	 m_nextBigTimer;
-	time_t	 m_nextSmallTimer;
 
 private:
 
@@ -131,6 +131,9 @@ private:
 	void StartTimer();
 	void StopTimer();
 
+	//! Runs OnSmallTimer every minute while this zone is a leaf.
+	CTimerWheel::TimerID m_smallTimer;
+
 	void RandomLookup() const;
 
 	void SetAllContactsVerified();
@@ -121,7 +121,10 @@ enum ECOpCodes {
 	EC_OP_CLIENT_SWAP_TO_ANOTHER_FILE   = 0x54,
 	EC_OP_SHARED_FILE_SET_COMMENT       = 0x55,
 	EC_OP_SERVER_SET_STATIC_PRIO        = 0x56,
-	EC_OP_FRIEND                        = 0x57
+	EC_OP_FRIEND                        = 0x57,
+	EC_OP_SUBSCRIBE                     = 0x58,
+	EC_OP_GET_STATSHISTORY              = 0x59,
+	EC_OP_STATSHISTORY                  = 0x5A
 };
 
 enum ECTagNames {
@@ -142,6 +145,7 @@ enum ECTagNames {
 	EC_TAG_CAN_NOTIFY                         = 0x000E,
 	EC_TAG_ECID                               = 0x000F,
 	EC_TAG_KAD_ID                             = 0x0010,
+	EC_TAG_SUBSCRIPTION                       = 0x0011,
 	EC_TAG_CLIENT_NAME                        = 0x0100,
 		EC_TAG_CLIENT_VERSION                     = 0x0101,
 		EC_TAG_CLIENT_MOD                         = 0x0102,
@@ -400,6 +404,10 @@ enum ECTagNames {
 			EC_TAG_STAT_NODE_VALUE                    = 0x1B07,
 			EC_TAG_STAT_VALUE_TYPE                    = 0x1B08,
 			EC_TAG_STATTREE_NODEID                    = 0x1B09,
+			EC_TAG_STATSHISTORY_TIER                  = 0x1B0A,
+			EC_TAG_STATSHISTORY_FROM                  = 0x1B0B,
+			EC_TAG_STATSHISTORY_TO                    = 0x1B0C,
+			EC_TAG_STATSHISTORY_DATA                  = 0x1B0D,
 		EC_TAG_PREFS_SECURITY                     = 0x1C00,
 			EC_TAG_SECURITY_CAN_SEE_SHARES            = 0x1C01,
 			EC_TAG_IPFILTER_CLIENTS                   = 0x1C02,
@@ -464,6 +472,14 @@ enum EcPrefs {
 	EC_PREFS_KADEMLIA       = 0x00002000
 };
 
+enum EcSubscription {
+	EC_SUBSCRIBE_DOWNLOADS  = 0x00000001,
+	EC_SUBSCRIBE_SHARED     = 0x00000002,
+	EC_SUBSCRIBE_SEARCH     = 0x00000004,
+	EC_SUBSCRIBE_STATUS     = 0x00000008,
+	EC_SUBSCRIBE_ALL        = 0x0000000F
+};
+
 #ifdef DEBUG_EC_IMPLEMENTATION
 
 wxString GetDebugNameProtocolVersion(uint16 arg)
@@ -566,6 +582,9 @@ wxString GetDebugNameECOpCodes(uint8 arg)
 		case 0x55: return wxT("EC_OP_SHARED_FILE_SET_COMMENT");
 		case 0x56: return wxT("EC_OP_SERVER_SET_STATIC_PRIO");
 		case 0x57: return wxT("EC_OP_FRIEND");
+		case 0x58: return wxT("EC_OP_SUBSCRIBE");
+		case 0x59: return wxT("EC_OP_GET_STATSHISTORY");
+		case 0x5A: return wxT("EC_OP_STATSHISTORY");
 		default: return CFormat(wxT("unknown %d 0x%x")) % arg % arg;
 	}
 }
@@ -590,6 +609,7 @@ wxString GetDebugNameECTagNames(uint16 arg)
 		case 0x000E: return wxT("EC_TAG_CAN_NOTIFY");
 		case 0x000F: return wxT("EC_TAG_ECID");
 		case 0x0010: return wxT("EC_TAG_KAD_ID");
+		case 0x0011: return wxT("EC_TAG_SUBSCRIPTION");
 		case 0x0100: return wxT("EC_TAG_CLIENT_NAME");
 		case 0x0101: return wxT("EC_TAG_CLIENT_VERSION");
 		case 0x0102: return wxT("EC_TAG_CLIENT_MOD");
@@ -848,6 +868,10 @@ wxString GetDebugNameECTagNames(uint16 arg)
 		case 0x1B07: return wxT("EC_TAG_STAT_NODE_VALUE");
 		case 0x1B08: return wxT("EC_TAG_STAT_VALUE_TYPE");
 		case 0x1B09: return wxT("EC_TAG_STATTREE_NODEID");
+		case 0x1B0A: return wxT("EC_TAG_STATSHISTORY_TIER");
+		case 0x1B0B: return wxT("EC_TAG_STATSHISTORY_FROM");
+		case 0x1B0C: return wxT("EC_TAG_STATSHISTORY_TO");
+		case 0x1B0D: return wxT("EC_TAG_STATSHISTORY_DATA");
 		case 0x1C00: return wxT("EC_TAG_PREFS_SECURITY");
 		case 0x1C01: return wxT("EC_TAG_SECURITY_CAN_SEE_SHARES");
 		case 0x1C02: return wxT("EC_TAG_IPFILTER_CLIENTS");
@@ -930,6 +954,18 @@ wxString GetDebugNameEcPrefs(uint32 arg)
 	}
 }
 
+wxString GetDebugNameEcSubscription(uint32 arg)
+{
+	switch (arg) {
+		case 0x00000001: return wxT("EC_SUBSCRIBE_DOWNLOADS");
+		case 0x00000002: return wxT("EC_SUBSCRIBE_SHARED");
+		case 0x00000004: return wxT("EC_SUBSCRIBE_SEARCH");
+		case 0x00000008: return wxT("EC_SUBSCRIBE_STATUS");
+		case 0x0000000F: return wxT("EC_SUBSCRIBE_ALL");
+		default: return CFormat(wxT("unknown %d 0x%x")) % arg % arg;
+	}
+}
+
 #endif	// DEBUG_EC_IMPLEMENTATION
 
 #endif // __ECCODES_H__
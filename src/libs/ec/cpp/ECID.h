@@ -26,6 +26,7 @@
 #define ECID_H
 
 #include "../../../Types.h"	// Needed for uint32
+#include "../../../MuleAtomic.h"	// Needed for CAtomic
 
 /*
  * Class to create unique IDs for Objects transmitted through EC
@@ -35,12 +36,13 @@ class CECID {
 	// the id
 	uint32 m_ID;
 	// counter to calculate unique ids (defined in ECTag.cpp)
-	static uint32 s_IDCounter;
+	// atomic, as objects are also created by the startup loaders
+	static CAtomic<uint32> s_IDCounter;
 public:
-	CECID()				{ m_ID = ++s_IDCounter; }
+	CECID()				{ m_ID = s_IDCounter.FetchAdd(1) + 1; }
 	CECID(uint32 id)	{ m_ID = id; }
 	uint32 ECID() const	{ return m_ID; }
-	void RenewECID()	{ m_ID = ++s_IDCounter; }
+	void RenewECID()	{ m_ID = s_IDCounter.FetchAdd(1) + 1; }
 };
 
 #endif
@@ -23,7 +23,7 @@
 //
 
 #include "ECPacket.h"	// Needed for ECPacket
-#include "ECSocket.h"	// Needed for CECSocket
+#include "ECTagArena.h"	// Needed for CECPacketView
 
 /**********************************************************
  *							  *
@@ -31,18 +31,10 @@
  *							  *
  **********************************************************/
 
-bool CECPacket::ReadFromSocket(CECSocket& socket)
+void CECPacket::ReadFromView(const CECPacketView& packet)
 {
-	return socket.ReadNumber(&m_opCode, sizeof(ec_opcode_t))
-		&& ReadChildren(socket);
-}
-
-
-bool CECPacket::WritePacket(CECSocket& socket) const
-{
-	if (!socket.WriteNumber(&m_opCode, sizeof(ec_opcode_t))) return false;
-	if (!WriteChildren(socket)) return false;
-	return true;
+	m_opCode = packet.GetOpCode();
+	ReadChildren(packet.GetRoot());
 }
 
 #ifdef __DEBUG__
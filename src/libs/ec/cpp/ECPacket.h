@@ -32,6 +32,7 @@
 #undef KEEP_PARTIAL_PACKETS
 
 class CECSocket;
+class CECPacketView;
 
 /**
  * High level EC packet handler class
@@ -57,11 +58,14 @@ class CECPacket : public CECEmptyTag {
 		}
 		void DebugPrint(bool incoming, uint32 trueSize = 0) const;
 
+		/**
+		 * Replaces the contents with a copy of a parsed packet.
+		 */
+		void ReadFromView(const CECPacketView& packet);
+
 	private:
 		CECPacket()	: CECEmptyTag() {}
 
-		bool ReadFromSocket(CECSocket& socket);
-		bool WritePacket(CECSocket& socket) const;
 		ec_opcode_t	m_opCode;
 };
 
@@ -28,117 +28,27 @@
 #include <sstream>
 #include <iostream>
 #include <algorithm>
+#include <ctime>		// Needed for clock_gettime
+
+#include <wx/stopwatch.h>	// Needed for wxGetLocalTimeMillis
 
 using namespace std;
 
 #include "ECPacket.h"		// Needed for CECPacket
+#include "ECTagArena.h"		// Needed for CECPacketBuilder
 #include "../../../Logger.h"
 #include <common/Format.h>	// Needed for CFormat
 #include "ECLog.h"
 
-#define EC_COMPRESSION_LEVEL	Z_DEFAULT_COMPRESSION
+//! Level to start with, the same as Z_DEFAULT_COMPRESSION.
+#define EC_COMPRESSION_LEVEL	6
+//! Blocked sends shorter than this (ms) don't tell the link speed.
+#define EC_MIN_SPEED_SAMPLE	100
+//! Queue drained without blocking this often: the link keeps up, compress faster.
+#define EC_UNBLOCKED_RUNS	16
 #define EC_MAX_UNCOMPRESSED	1024
-
-#ifndef __GNUC__
-#define __attribute__(x)
-#endif
-
-// If your compiler gives errors on these lines, just remove them.
-int utf8_mbtowc(wchar_t *p, const unsigned char *s, int n) __attribute__((__visibility__("internal")));
-int utf8_wctomb(unsigned char *s, wchar_t wc, int maxlen) __attribute__((__visibility__("internal")));
-int utf8_mb_remain(char c) __attribute__((__pure__));
-
-/*----------=> Import from the Linux kernel <=----------*/
-/*
- * linux/fs/nls_base.c
- */
-
-/*
- * Sample implementation from Unicode home page.
- * http://www.stonehand.com/unicode/standard/fss-utf.html
- */
-struct utf8_table {
-	int     cmask;
-	int     cval;
-	int     shift;
-	uint32_t  lmask;
-	uint32_t  lval;
-};
-
-static const struct utf8_table utf8_table[] =
-{
-    {0x80,  0x00,   0*6,    0x7F,           0,         /* 1 byte sequence */},
-    {0xE0,  0xC0,   1*6,    0x7FF,          0x80,      /* 2 byte sequence */},
-    {0xF0,  0xE0,   2*6,    0xFFFF,         0x800,     /* 3 byte sequence */},
-    {0xF8,  0xF0,   3*6,    0x1FFFFF,       0x10000,   /* 4 byte sequence */},
-    {0xFC,  0xF8,   4*6,    0x3FFFFFF,      0x200000,  /* 5 byte sequence */},
-    {0xFE,  0xFC,   5*6,    0x7FFFFFFF,     0x4000000, /* 6 byte sequence */},
-    {0,     0,      0,      0,              0,         /* end of table    */}
-};
-
-static int utf8_mbtowc(uint32_t *p, const unsigned char *s, int n)
-{
-	uint32_t l;
-	int c0, nc;
-	const struct utf8_table *t;
-
-	nc = 0;
-	c0 = *s;
-	l = c0;
-	for (t = utf8_table; t->cmask; t++) {
-		int c;
-		nc++;
-		if ((c0 & t->cmask) == t->cval) {
-			l &= t->lmask;
-			if (l < t->lval)
-				return -1;
-			*p = l;
-			return nc;
-		}
-		if (n <= nc)
-			return -1;
-		s++;
-		c = (*s ^ 0x80) & 0xFF;
-		if (c & 0xC0)
-			return -1;
-		l = (l << 6) | c;
-	}
-	return -1;
-}
-
-static int utf8_wctomb(unsigned char *s, uint32_t wc, int maxlen)
-{
-	uint32_t l;
-	int c, nc;
-	const struct utf8_table *t;
-
-	l = wc;
-	nc = 0;
-	for (t = utf8_table; t->cmask && maxlen; t++, maxlen--) {
-		nc++;
-		if (l <= t->lmask) {
-			c = t->shift;
-			*s = t->cval | (l >> c);
-			while (c > 0) {
-				c -= 6;
-				s++;
-				*s = 0x80 | ((l >> c) & 0x3F);
-			}
-			return nc;
-		}
-	}
-	return -1;
-}
-/*----------=> End of Import <=----------*/
-
-int utf8_mb_remain(char c)
-{
-	int i;
-	for (i = 0; i < 5; ++i) {
-		if ((c & utf8_table[i].cmask) == utf8_table[i].cval) break;
-	}
-	return i;
-}
+//! Decompressed packets larger than this are broken or malicious.
+#define EC_MAX_INFLATED		(256*1024*1024)
 
 
 void CQueuedData::Write(const void *data, size_t len)
@@ -164,6 +74,16 @@ void CQueuedData::WriteAt(const void *data, size_t len, size_t offset)
 }
 
 
+unsigned char *CQueuedData::Reserve(size_t len)
+{
+	wxASSERT(len <= GetRemLength());
+
+	unsigned char *data = m_wr_ptr;
+	m_wr_ptr += len;
+	return data;
+}
+
+
 void CQueuedData::Read(void *data, size_t len)
 {
 	const size_t canRead = std::min(GetUnreadDataLength(), len);
@@ -262,22 +182,39 @@ size_t CQueuedData::GetUnreadDataLength() const
 
 CECSocket::CECSocket(bool use_events)
 	: m_use_events(use_events),
-	  m_in_ptr(EC_SOCKET_BUFFER_SIZE),
-	  m_out_ptr(EC_SOCKET_BUFFER_SIZE),
 	  m_curr_rx_data(new CQueuedData(EC_SOCKET_BUFFER_SIZE)),
-	  m_curr_tx_data(new CQueuedData(EC_SOCKET_BUFFER_SIZE)),
 	  m_rx_flags(0),
-	  m_tx_flags(0),
 	  // setup initial state: 4 flags + 4 length
 	  m_bytes_needed(EC_HEADER_SIZE),
 	  m_in_header(true),
 	  m_curr_packet_len(0),
+	  m_z_out_init(false),
+	  m_z_in_init(false),
+	  m_z_out_level(EC_COMPRESSION_LEVEL),
+	  m_tx_blocked_since(0),
+	  m_tx_blocked_bytes(0),
+	  m_tx_unblocked_runs(0),
 	  m_my_flags(0x20),
 	  m_haveNotificationSupport(false)
-{}
+{
+	m_z_stats.level = EC_COMPRESSION_LEVEL;
+}
 
 CECSocket::~CECSocket()
 {
+	if (m_z_out_init) {
+		deflateEnd(&m_z_out);
+	}
+	if (m_z_in_init) {
+		inflateEnd(&m_z_in);
+	}
+	if (m_z_stats.packetsDeflated || m_z_stats.packetsInflated) {
+		AddDebugLogLineN(logEC, CFormat(wxT("Compression: %u packets sent (%u ms), %u received (%u ms), %u bytes saved"))
+			% m_z_stats.packetsDeflated % (uint32)(m_z_stats.deflateMicros / 1000)
+			% m_z_stats.packetsInflated % (uint32)(m_z_stats.inflateMicros / 1000)
+			% m_z_stats.GetBytesSaved());
+	}
+
 	while (!m_output_queue.empty()) {
 		CQueuedData *data = m_output_queue.front();
 		m_output_queue.pop_front();
@@ -293,11 +230,22 @@ bool CECSocket::ConnectSocket(uint32_t ip, uint16_t port)
 
 void CECSocket::SendPacket(const CECPacket *packet)
 {
-	uint32 len = WritePacket(packet);
+	// Encoded from the tags of the packet, without copying them
+	CECPacketBuilder builder(*packet);
+	uint32 len = WritePacket(builder);
 	packet->DebugPrint(false, len);
 	OnOutput();
 }
 
+void CECSocket::SendPacket(const CECPacketBuilder& packet)
+{
+	uint32 len = WritePacket(packet);
+	if (ECLogIsEnabled()) {
+		DoECLogLine(CFormat(wxT("> opcode 0x%02x %d")) % packet.GetOpCode() % len);
+	}
+	OnOutput();
+}
+
 const CECPacket *CECSocket::SendRecvPacket(const CECPacket *packet)
 {
 	SendPacket(packet);
@@ -399,10 +347,12 @@ void CECSocket::OnInput()
 					return;
 				}
 			} else {
-				CSmartPtr<const CECPacket> packet(ReadPacket());
+				// The view still refers to the received data after rewinding
+				CECPacketView packet;
+				bool received = ReadPacketView(packet);
 				m_curr_rx_data->Rewind();
-				if (packet.get()) {
-					CSmartPtr<const CECPacket> reply(OnPacketReceived(packet.get(), m_curr_packet_len));
+				if (received) {
+					CSmartPtr<const CECPacket> reply(OnPacketViewReceived(packet, m_curr_packet_len));
 					if (reply.get()) {
 						SendPacket(reply.get());
 					}
@@ -418,9 +368,10 @@ void CECSocket::OnInput()
 
 void CECSocket::OnOutput()
 {
+	const bool hadOutput = !m_output_queue.empty();
 	while (!m_output_queue.empty()) {
 		CQueuedData* data = m_output_queue.front();
-		data->WriteToSocket(this);
+		m_tx_blocked_bytes += data->WriteToSocket(this);
 		if (!data->GetUnreadDataLength()) {
 			m_output_queue.pop_front();
 			delete data;
@@ -432,7 +383,12 @@ void CECSocket::OnOutput()
 				OnError();
 				return;
 			}
-			// Now it's just a blocked socket.
+			// Now it's just a blocked socket: the link is slower than we
+			// produce data, time how long it takes to send the rest
+			if (m_tx_blocked_since == 0) {
+				m_tx_blocked_since = wxGetLocalTimeMillis();
+				m_tx_blocked_bytes = 0;
+			}
 			if ( m_use_events ) {
 				// Event driven logic: return, OnOutput() will be called again later
 				return;
@@ -453,6 +409,17 @@ void CECSocket::OnOutput()
 			}
 		}
 	}
+	if (hadOutput && m_output_queue.empty()) {
+		if (m_tx_blocked_since != 0) {
+			wxLongLong elapsed = wxGetLocalTimeMillis() - m_tx_blocked_since;
+			m_tx_blocked_since = 0;
+			if (elapsed >= EC_MIN_SPEED_SAMPLE) {
+				AdaptCompression(true, (uint32)(m_tx_blocked_bytes * 1000 / (uint64)elapsed.GetValue()));
+			}
+		} else {
+			AdaptCompression(false, 0);
+		}
+	}
 	//
 	// All outstanding data sent to socket
 	// (used for push clients)
@@ -465,44 +432,6 @@ bool CECSocket::DataPending()
 	return !m_output_queue.empty();
 }
 
-//
-// Socket I/O
-//
-
-size_t CECSocket::ReadBufferFromSocket(void *buffer, size_t required_len)
-{
-	wxASSERT(required_len);
-
-	if (m_curr_rx_data->GetUnreadDataLength() < required_len) {
-		// need more data that we have. Looks like nothing will help here
-		AddDebugLogLineN(logEC, CFormat(wxT("ReadBufferFromSocket: not enough data (%d < %d)"))
-			% m_curr_rx_data->GetUnreadDataLength() % required_len);
-		return 0;
-	}
-	m_curr_rx_data->Read(buffer, required_len);
-	return required_len;
-}
-
-void CECSocket::WriteBufferToSocket(const void *buffer, size_t len)
-{
-	unsigned char *wr_ptr = (unsigned char *)buffer;
-	while ( len ) {
-		size_t curr_free = m_curr_tx_data->GetRemLength();
-		if ( len > curr_free ) {
-
-			m_curr_tx_data->Write(wr_ptr, curr_free);
-			len -= curr_free;
-			wr_ptr += curr_free;
-			m_output_queue.push_back(m_curr_tx_data.release());
-			m_curr_tx_data.reset(new CQueuedData(EC_SOCKET_BUFFER_SIZE));
-		} else {
-			m_curr_tx_data->Write(wr_ptr, len);
-			break;
-		}
-	}
-}
-
-
 //
 // ZLib "error handler"
 //
@@ -572,243 +501,242 @@ bool CECSocket::ReadHeader()
 }
 
 
-bool CECSocket::ReadNumber(void *buffer, size_t len)
+//
+// Packet I/O
+//
+
+uint32 CECSocket::WritePacket(const CECPacketBuilder& packet)
 {
-	if (m_rx_flags & EC_FLAG_UTF8_NUMBERS) {
-		unsigned char mb[6];
-		uint32_t wc;
-		if (!ReadBuffer(mb, 1)) return false;
-		int remains = utf8_mb_remain(mb[0]);
-		if (remains) if (!ReadBuffer(&(mb[1]), remains)) return false;
-		if (utf8_mbtowc(&wc, mb, 6) == -1) return false;	// Invalid UTF-8 code sequence
-		switch (len) {
-			case 1: PokeUInt8( buffer,  wc ); break;
-			case 2: RawPokeUInt16( buffer, wc ); break;
-			case 4: RawPokeUInt32( buffer, wc ); break;
-		}
-	} else {
-		if ( !ReadBuffer(buffer, len) ) {
-			return false;
-		}
-		switch (len) {
-			case 2:
-				RawPokeUInt16( buffer, ENDIAN_NTOHS( RawPeekUInt16( buffer ) ) );
-				break;
-			case 4:
-				RawPokeUInt32( buffer, ENDIAN_NTOHL( RawPeekUInt32( buffer ) ) );
-				break;
-		}
+	if (SocketRealError()) {
+		OnError();
+		return 0;
 	}
-	return true;
-}
 
-bool CECSocket::WriteNumber(const void *buffer, size_t len)
-{
-	if (m_tx_flags & EC_FLAG_UTF8_NUMBERS) {
-		unsigned char mb[6];
-		uint32_t wc = 0;
-		int mb_len;
-		switch (len) {
-			case 1: wc = PeekUInt8( buffer ); break;
-			case 2: wc = RawPeekUInt16( buffer ); break;
-			case 4: wc = RawPeekUInt32( buffer ); break;
-			default: return false;
-		}
-		if ((mb_len = utf8_wctomb(mb, wc, 6)) == -1) return false;	// Something is terribly wrong...
-		return WriteBuffer(mb, mb_len);
+	uint32_t flags = 0x20;
+
+	if (packet.GetPacketLength() > EC_MAX_UNCOMPRESSED
+		&& ((m_my_flags & EC_FLAG_ZLIB) > 0)) {
+		flags |= EC_FLAG_ZLIB;
 	} else {
-		char tmp[8];
+		flags |= EC_FLAG_UTF8_NUMBERS;
+	}
+
+	flags &= m_my_flags;
 
-		switch (len) {
-			case 1: PokeUInt8( tmp, PeekUInt8( buffer ) ); break;
-			case 2: RawPokeUInt16( tmp, ENDIAN_NTOHS( RawPeekUInt16( buffer ) ) ); break;
-			case 4: RawPokeUInt32( tmp, ENDIAN_NTOHL( RawPeekUInt32( buffer ) ) ); break;
+	CQueuedData *data = NULL;
+	if (flags & EC_FLAG_ZLIB) {
+		data = DeflatePacket(packet);
+		if (!data) {
+			// don't use zlib if it failed
+			flags &= ~EC_FLAG_ZLIB;
 		}
-		return WriteBuffer(tmp, len);
 	}
+
+	if (!data) {
+		// Encode the packet straight into the output buffer
+		const bool utf8Numbers = (flags & EC_FLAG_UTF8_NUMBERS) != 0;
+		const size_t len = packet.GetEncodedLength(utf8Numbers);
+		data = new CQueuedData(EC_HEADER_SIZE + len);
+		data->Reserve(EC_HEADER_SIZE);
+		packet.Encode(data->Reserve(len), utf8Numbers);
+	}
+
+	// header size is not counted
+	uint32_t packet_len = (uint32_t)data->GetDataLength() - EC_HEADER_SIZE;
+
+	uint32_t tmp_flags = ENDIAN_HTONL(flags);
+	data->WriteAt(&tmp_flags, 4, 0);
+	uint32 packet_len_E = ENDIAN_HTONL(packet_len);
+	data->WriteAt(&packet_len_E, 4, 4);
+
+	m_output_queue.push_back(data);
+	return packet_len;
 }
 
-bool CECSocket::ReadBuffer(void *buffer, size_t len)
+
+//
+// Choose the compression level from the speed of the link.
+//
+// blocked:	the socket blocked while sending, speed is the measured
+//          throughput of the link in bytes/s
+//
+// When the socket doesn't block the link keeps up with us, and time
+// spent compressing is just latency. Otherwise better compression sends
+// the data faster, as long as compressing is still faster than the link.
+//
+void CECSocket::AdaptCompression(bool blocked, uint32 speed)
 {
-	if (m_rx_flags & EC_FLAG_ZLIB) {
-		if ( !m_z.avail_in ) {
-			// no reason for this situation: all packet should be
-			// buffered by now
-			AddDebugLogLineN(logEC, wxT("ReadBuffer: ZLib error"));
-			return false;
-		}
-		m_z.avail_out = (uInt)len;
-		m_z.next_out = (Bytef*)buffer;
-		int zerror = inflate(&m_z, Z_SYNC_FLUSH);
-		if ((zerror != Z_OK) && (zerror != Z_STREAM_END)) {
-			ShowZError(zerror, &m_z);
-			AddDebugLogLineN(logEC, wxT("ReadBuffer: ZLib error"));
-			return false;
-		}
-		return true;
-	} else {
-		// using uncompressed buffered i/o
-		size_t read = ReadBufferFromSocket(buffer, len);
-		if (read == len) {
-			return true;
+	int level = m_z_stats.level;
+
+	if (blocked) {
+		m_tx_unblocked_runs = 0;
+		m_z_stats.linkSpeed = speed;
+		if (speed < 1024 * 1024) {
+			level = Z_BEST_COMPRESSION;
+		} else if (speed < 8 * 1024 * 1024) {
+			level = EC_COMPRESSION_LEVEL;
 		} else {
-			AddDebugLogLineN(logEC, CFormat(wxT("ReadBuffer: %d < %d")) % read % len);
-			return false;
+			level = 3;
+		}
+	} else if (++m_tx_unblocked_runs >= EC_UNBLOCKED_RUNS) {
+		m_tx_unblocked_runs = 0;
+		if (level > Z_BEST_SPEED) {
+			--level;
 		}
 	}
-}
-
-bool CECSocket::WriteBuffer(const void *buffer, size_t len)
-{
-	if (m_tx_flags & EC_FLAG_ZLIB) {
 
-		unsigned char *rd_ptr = (unsigned char *)buffer;
-		do {
-			unsigned int remain_in = EC_SOCKET_BUFFER_SIZE - m_z.avail_in;
-			if ( remain_in >= len ) {
-				memcpy(m_z.next_in+m_z.avail_in, rd_ptr, len);
-				m_z.avail_in += (uInt)len;
-				len = 0;
-			} else {
-				memcpy(m_z.next_in+m_z.avail_in, rd_ptr, remain_in);
-				m_z.avail_in += remain_in;
-				len -= remain_in;
-				rd_ptr += remain_in;
-				// buffer is full, calling zlib
-				do {
-				    m_z.next_out = &m_out_ptr[0];
-				    m_z.avail_out = EC_SOCKET_BUFFER_SIZE;
-					int zerror = deflate(&m_z, Z_NO_FLUSH);
-					if ( zerror != Z_OK ) {
-						AddDebugLogLineN(logEC, wxT("WriteBuffer: ZLib error"));
-						ShowZError(zerror, &m_z);
-						return false;
-					}
-					WriteBufferToSocket(&m_out_ptr[0],
-						EC_SOCKET_BUFFER_SIZE - m_z.avail_out);
-				} while ( m_z.avail_out == 0 );
-				// all input should be used by now
-				wxASSERT(m_z.avail_in == 0);
-				m_z.next_in = &m_in_ptr[0];
-			}
-		} while ( len );
-		return true;
-	} else {
-		// using uncompressed buffered i/o
-		WriteBufferToSocket(buffer, len);
-		return true;
+	if (level != m_z_stats.level) {
+		if (ECLogIsEnabled()) {
+			DoECLogLine(CFormat(wxT("compression level %d, link %u bytes/s")) % level % m_z_stats.linkSpeed);
+		}
+		m_z_stats.level = level;
 	}
 }
 
-bool CECSocket::FlushBuffers()
+
+// Microseconds of processor time used by the calling thread. clock() would
+// also count the time of all other threads of the process.
+static uint64 ThreadMicros()
 {
-	if (m_tx_flags & EC_FLAG_ZLIB) {
-		do {
-		    m_z.next_out = &m_out_ptr[0];
-		    m_z.avail_out = EC_SOCKET_BUFFER_SIZE;
-			int zerror = deflate(&m_z, Z_FINISH);
-			if ( zerror == Z_STREAM_ERROR ) {
-				AddDebugLogLineN(logEC, wxT("FlushBuffers: ZLib error"));
-				ShowZError(zerror, &m_z);
-				return false;
-			}
-			WriteBufferToSocket(&m_out_ptr[0],
-				EC_SOCKET_BUFFER_SIZE - m_z.avail_out);
-		} while ( m_z.avail_out == 0 );
-	}
-	if ( m_curr_tx_data->GetDataLength() ) {
-		m_output_queue.push_back(m_curr_tx_data.release());
-		m_curr_tx_data.reset(new CQueuedData(EC_SOCKET_BUFFER_SIZE));
+#ifdef CLOCK_THREAD_CPUTIME_ID
+	struct timespec now;
+	if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now) == 0) {
+		return now.tv_sec * (uint64)1000000 + now.tv_nsec / 1000;
 	}
-	return true;
+#endif
+	// Wall time where there is no thread clock
+	return (uint64)wxGetLocalTimeMillis().GetValue() * 1000;
 }
 
-//
-// Packet I/O
-//
 
-uint32 CECSocket::WritePacket(const CECPacket *packet)
+CQueuedData *CECSocket::DeflatePacket(const CECPacketBuilder& packet)
 {
-	if (SocketRealError()) {
-		OnError();
-		return 0;
-	}
-	// Check if output queue is empty. If not, memorize the current end.
-	std::list<CQueuedData*>::iterator outputStart = m_output_queue.begin();
-	uint32 outputQueueSize = m_output_queue.size();
-	for (uint32 i = 1; i < outputQueueSize; i++) {
-		++outputStart;
-	}
+	// Numbers are not UTF-8 encoded in compressed packets
+	m_encoded.resize(packet.GetEncodedLength(false));
+	packet.Encode(&m_encoded[0], false);
 
-	uint32_t flags = 0x20;
+	const uint64 start = ThreadMicros();
 
-	if (packet->GetPacketLength() > EC_MAX_UNCOMPRESSED
-		&& ((m_my_flags & EC_FLAG_ZLIB) > 0)) {
-		flags |= EC_FLAG_ZLIB;
+	// The stream is set up once, and only reset for the following packets
+	int zerror;
+	if (!m_z_out_init) {
+		m_z_out.zalloc = Z_NULL;
+		m_z_out.zfree = Z_NULL;
+		m_z_out.opaque = Z_NULL;
+		zerror = deflateInit(&m_z_out, m_z_stats.level);
+		if (zerror != Z_OK) {
+			ShowZError(zerror, &m_z_out);
+			return NULL;
+		}
+		m_z_out_init = true;
+		m_z_out_level = m_z_stats.level;
 	} else {
-		flags |= EC_FLAG_UTF8_NUMBERS;
+		deflateReset(&m_z_out);
+		// Nothing is pending after a reset, so this doesn't flush anything
+		if (m_z_out_level != m_z_stats.level
+			&& deflateParams(&m_z_out, m_z_stats.level, Z_DEFAULT_STRATEGY) == Z_OK) {
+			m_z_out_level = m_z_stats.level;
+		}
 	}
 
-	flags &= m_my_flags;
-	m_tx_flags = flags;
-
-	if (flags & EC_FLAG_ZLIB) {
-		m_z.zalloc = Z_NULL;
-		m_z.zfree = Z_NULL;
-		m_z.opaque = Z_NULL;
-		m_z.avail_in = 0;
-		m_z.next_in = &m_in_ptr[0];
-		int zerror = deflateInit(&m_z, EC_COMPRESSION_LEVEL);
-		if (zerror != Z_OK) {
-			// don't use zlib if init failed
-			flags &= ~EC_FLAG_ZLIB;
-			ShowZError(zerror, &m_z);
-		}
+	// Compressed in one go, into a buffer large enough for any outcome
+	CQueuedData *data = new CQueuedData(EC_HEADER_SIZE + deflateBound(&m_z_out, (uLong)m_encoded.size()));
+	data->Reserve(EC_HEADER_SIZE);
+	m_z_out.next_in = &m_encoded[0];
+	m_z_out.avail_in = (uInt)m_encoded.size();
+	data->ToZlibOutput(m_z_out);
+
+	zerror = deflate(&m_z_out, Z_FINISH);
+	if (zerror != Z_STREAM_END) {
+		AddDebugLogLineN(logEC, wxT("WritePacket: ZLib error"));
+		ShowZError(zerror, &m_z_out);
+		// Set up again for the next packet
+		deflateEnd(&m_z_out);
+		m_z_out_init = false;
+		delete data;
+		return NULL;
 	}
+	data->FromZlibOutput(m_z_out);
 
-	uint32_t tmp_flags = ENDIAN_HTONL(flags);
-	WriteBufferToSocket(&tmp_flags, sizeof(uint32));
+	m_z_stats.packetsDeflated++;
+	m_z_stats.bytesDeflatedIn += m_encoded.size();
+	m_z_stats.bytesDeflatedOut += data->GetDataLength() - EC_HEADER_SIZE;
+	m_z_stats.deflateMicros += ThreadMicros() - start;
 
-	// preallocate 4 bytes in buffer for packet length
-	uint32_t packet_len = 0;
-	WriteBufferToSocket(&packet_len, sizeof(uint32));
+	// free data again after sending huge packets
+	if (m_encoded.size() > EC_SOCKET_BUFFER_SIZE * 10) {
+		std::vector<unsigned char>().swap(m_encoded);
+	}
+	return data;
+}
 
-	packet->WritePacket(*this);
 
-	// Finalize zlib compression and move current data to output queue
-	FlushBuffers();
+bool CECSocket::InflatePacket(size_t& len)
+{
+	const uint64 start = ThreadMicros();
+
+	int zerror;
+	if (!m_z_in_init) {
+		m_z_in.zalloc = Z_NULL;
+		m_z_in.zfree = Z_NULL;
+		m_z_in.opaque = Z_NULL;
+		m_z_in.avail_in = 0;
+		m_z_in.next_in = 0;
 
-	// find the beginning of our data in the output queue
-	if (outputQueueSize) {
-		++outputStart;
+		zerror = inflateInit(&m_z_in);
+		if (zerror != Z_OK) {
+			AddDebugLogLineN(logEC, wxT("ReadPacket: zlib error"));
+			ShowZError(zerror, &m_z_in);
+			cout << "ReadPacket: failed zlib init" << endl;
+			return false;
+		}
+		m_z_in_init = true;
 	} else {
-		outputStart = m_output_queue.begin();
+		inflateReset(&m_z_in);
 	}
-	// now calculate actual size of data
-	for(std::list<CQueuedData*>::iterator it = outputStart; it != m_output_queue.end(); ++it) {
-		packet_len += (uint32_t)(*it)->GetDataLength();
+
+	m_curr_rx_data->ToZlib(m_z_in);
+	const size_t inLen = m_z_in.avail_in;
+
+	// Start with a guess, and grow the buffer until all is decompressed.
+	// Free data again after receiving huge packets.
+	size_t size = std::max<size_t>(EC_SOCKET_BUFFER_SIZE, m_z_in.avail_in * 4);
+	if (m_inflated.size() < size || m_inflated.size() > size + EC_SOCKET_BUFFER_SIZE * 10) {
+		std::vector<unsigned char>(size).swap(m_inflated);
 	}
-	// header size is not counted
-	packet_len -= EC_HEADER_SIZE;
-	// now write actual length at offset 4
-	uint32 packet_len_E = ENDIAN_HTONL(packet_len);
-	(*outputStart)->WriteAt(&packet_len_E, 4, 4);
 
-	if (flags & EC_FLAG_ZLIB) {
-		int zerror = deflateEnd(&m_z);
-		if ( zerror != Z_OK ) {
-			AddDebugLogLineN(logEC, wxT("WritePacket: ZLib error"));
-			ShowZError(zerror, &m_z);
+	len = 0;
+	do {
+		if (len == m_inflated.size()) {
+			if (len >= EC_MAX_INFLATED) {
+				AddDebugLogLineN(logEC, CFormat(wxT("ReadPacket: packet too big: %d")) % len);
+				zerror = Z_BUF_ERROR;
+				break;
+			}
+			m_inflated.resize(len * 2);
 		}
+		m_z_in.next_out = &m_inflated[len];
+		m_z_in.avail_out = (uInt)(m_inflated.size() - len);
+		zerror = inflate(&m_z_in, Z_NO_FLUSH);
+		len = m_inflated.size() - m_z_in.avail_out;
+	} while (zerror == Z_OK);
+
+	if (zerror != Z_STREAM_END) {
+		AddDebugLogLineN(logEC, wxT("ReadPacket: zlib error"));
+		ShowZError(zerror, &m_z_in);
+		return false;
 	}
-	return packet_len;
+
+	m_z_stats.packetsInflated++;
+	m_z_stats.bytesInflatedIn += inLen;
+	m_z_stats.bytesInflatedOut += len;
+	m_z_stats.inflateMicros += ThreadMicros() - start;
+	return true;
 }
 
 
-const CECPacket *CECSocket::ReadPacket()
+bool CECSocket::ReadPacketView(CECPacketView& packet)
 {
-	CECPacket *packet = 0;
-
 	uint32_t flags = m_rx_flags;
 
 	if ( ((flags & 0x60) != 0x20) || (flags & EC_FLAG_UNKNOWN_MASK) ) {
@@ -816,51 +744,51 @@ const CECPacket *CECSocket::ReadPacket()
 		AddDebugLogLineN(logEC, wxT("ReadPacket: protocol error"));
 		cout << "ReadPacket: packet have invalid flags " << flags << endl;
 		CloseSocket();
-		return 0;
+		return false;
 	}
 
-	if (flags & EC_FLAG_ZLIB) {
+	const unsigned char *data = m_curr_rx_data->GetUnreadData();
+	size_t len = m_curr_rx_data->GetUnreadDataLength();
 
-	    m_z.zalloc = Z_NULL;
-	    m_z.zfree = Z_NULL;
-	    m_z.opaque = Z_NULL;
-	    m_z.avail_in = 0;
-	    m_z.next_in = 0;
-
-		int zerror = inflateInit(&m_z);
-		if (zerror != Z_OK) {
-			AddDebugLogLineN(logEC, wxT("ReadPacket: zlib error"));
-			ShowZError(zerror, &m_z);
-			cout << "ReadPacket: failed zlib init" << endl;
+	if (flags & EC_FLAG_ZLIB) {
+		if (!InflatePacket(len)) {
 			CloseSocket();
-			return 0;
+			return false;
 		}
+		data = &m_inflated[0];
 	}
 
-	m_curr_rx_data->ToZlib(m_z);
-	packet = new CECPacket();
-
-	if (!packet->ReadFromSocket(*this)) {
+	if (!packet.Parse(data, len, (flags & EC_FLAG_UTF8_NUMBERS) != 0)) {
 		AddDebugLogLineN(logEC, wxT("ReadPacket: error in packet read"));
 		cout << "ReadPacket: error in packet read" << endl;
-		delete packet;
-		packet = NULL;
 		CloseSocket();
+		return false;
 	}
 
-	if (flags & EC_FLAG_ZLIB) {
-		int zerror = inflateEnd(&m_z);
-		if ( zerror != Z_OK ) {
-			AddDebugLogLineN(logEC, wxT("ReadPacket: zlib error"));
-			ShowZError(zerror, &m_z);
-			cout << "ReadPacket: failed zlib free" << endl;
-			CloseSocket();
-		}
+	return true;
+}
+
+
+const CECPacket *CECSocket::ReadPacket()
+{
+	CECPacketView view;
+	if (!ReadPacketView(view)) {
+		return 0;
 	}
 
+	CECPacket *packet = new CECPacket();
+	packet->ReadFromView(view);
 	return packet;
 }
 
+
+const CECPacket *CECSocket::OnPacketViewReceived(const CECPacketView& packet, uint32 trueSize)
+{
+	CECPacket materialized;
+	materialized.ReadFromView(packet);
+	return OnPacketReceived(&materialized, trueSize);
+}
+
 const CECPacket *CECSocket::OnPacketReceived(const CECPacket *, uint32)
 {
 	return 0;
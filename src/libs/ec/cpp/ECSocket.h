@@ -36,6 +36,7 @@
 
 #include <wx/defs.h>	// Needed for wx/debug.h
 #include <wx/debug.h>	// Needed for wxASSERT
+#include <wx/longlong.h>	// Needed for wxLongLong
 
 #include <common/SmartPtr.h>	// Needed for CSmartPtr
 
@@ -54,8 +55,68 @@ enum ECSocketErrors {
 };
 
 class CECPacket;
+class CECPacketBuilder;
+class CECPacketView;
 class CQueuedData;
 
+/**
+ * Compression counters of an EC connection.
+ */
+struct CECCompressionStats {
+	CECCompressionStats()
+		: packetsDeflated(0), bytesDeflatedIn(0), bytesDeflatedOut(0), deflateMicros(0),
+		  packetsInflated(0), bytesInflatedIn(0), bytesInflatedOut(0), inflateMicros(0),
+		  level(0), linkSpeed(0)
+	{}
+
+	//! Packets sent compressed.
+	uint32 packetsDeflated;
+	//! Size of those packets before and after compression.
+	uint64 bytesDeflatedIn;
+	uint64 bytesDeflatedOut;
+	//! Processor time of the calling thread spent compressing, in microseconds.
+	uint64 deflateMicros;
+
+	//! Compressed packets received.
+	uint32 packetsInflated;
+	//! Size of those packets before and after decompression.
+	uint64 bytesInflatedIn;
+	uint64 bytesInflatedOut;
+	//! Processor time of the calling thread spent decompressing, in microseconds.
+	uint64 inflateMicros;
+
+	//! Compression level currently used for sending.
+	int level;
+	//! Last measured throughput of the link in bytes/s, 0 while unknown.
+	uint32 linkSpeed;
+
+	//! Adds the counters of another connection, leaving level and speed alone.
+	void Add(const CECCompressionStats& other)
+	{
+		packetsDeflated += other.packetsDeflated;
+		bytesDeflatedIn += other.bytesDeflatedIn;
+		bytesDeflatedOut += other.bytesDeflatedOut;
+		deflateMicros += other.deflateMicros;
+		packetsInflated += other.packetsInflated;
+		bytesInflatedIn += other.bytesInflatedIn;
+		bytesInflatedOut += other.bytesInflatedOut;
+		inflateMicros += other.inflateMicros;
+	}
+
+	//! Bytes not sent or received thanks to compression.
+	uint64 GetBytesSaved() const
+	{
+		uint64 saved = 0;
+		if (bytesDeflatedIn > bytesDeflatedOut) {
+			saved += bytesDeflatedIn - bytesDeflatedOut;
+		}
+		if (bytesInflatedOut > bytesInflatedIn) {
+			saved += bytesInflatedOut - bytesInflatedIn;
+		}
+		return saved;
+	}
+};
+
 /*! \class CECSocket
  *
  * \brief Socket handler for External Communications (EC).
@@ -64,9 +125,6 @@ class CQueuedData;
  */
 
 class CECSocket{
-	friend class CECPacket;
-	friend class CECTag;
-
 private:
 	static const unsigned int EC_SOCKET_BUFFER_SIZE = 2048;
 	static const unsigned int EC_HEADER_SIZE = 8;
@@ -75,21 +133,36 @@ private:
 	// Output related data
 	std::list<CQueuedData *> m_output_queue;
 
-	// zlib (deflation) buffers
-	std::vector<unsigned char> m_in_ptr;
-	std::vector<unsigned char> m_out_ptr;
+	// Input related data
 	CSmartPtr<CQueuedData> m_curr_rx_data;
-	CSmartPtr<CQueuedData> m_curr_tx_data;
+	// zlib buffers: decompressed input, uncompressed output
+	std::vector<unsigned char> m_inflated;
+	std::vector<unsigned char> m_encoded;
 
 	// This transfer only
 	uint32_t m_rx_flags;
-	uint32_t m_tx_flags;
 	size_t m_bytes_needed;
 	bool m_in_header;
 
 
 	uint32_t m_curr_packet_len;
-	z_stream m_z;
+
+	// zlib streams, kept for the whole connection and reset for each packet
+	z_stream m_z_out;
+	z_stream m_z_in;
+	bool m_z_out_init;
+	bool m_z_in_init;
+	// level m_z_out was set up with
+	int m_z_out_level;
+
+	// Link throughput measurement: time (ms) the socket blocked first
+	// since the output queue was last empty, or 0, and bytes sent since
+	wxLongLong m_tx_blocked_since;
+	uint64 m_tx_blocked_bytes;
+	// output queue emptied without the socket blocking this many times in a row
+	uint32 m_tx_unblocked_runs;
+
+	CECCompressionStats m_z_stats;
 
 protected:
 	uint32_t m_my_flags;
@@ -104,6 +177,11 @@ public:
 
 	bool HaveNotificationSupport() const { return m_haveNotificationSupport; }
 
+	/**
+	 * Compression counters of this connection.
+	 */
+	const CECCompressionStats& GetCompressionStats() const { return m_z_stats; }
+
 	/**
 	 * Sends an EC packet and returns immediately.
 	 *
@@ -117,6 +195,16 @@ public:
 	 */
 	void SendPacket(const CECPacket *packet);
 
+	/**
+	 * Sends a packet built in place, and returns immediately.
+	 *
+	 * @param packet The packet to be sent.
+	 *
+	 * Like SendPacket(const CECPacket *), but the tags do not
+	 * have to be copied into a CECPacket first.
+	 */
+	void SendPacket(const CECPacketBuilder& packet);
+
 	/**
 	 * Sends an EC packet and waits for a reply.
 	 *
@@ -156,6 +244,22 @@ public:
 	 */
 	virtual const CECPacket *OnPacketReceived(const CECPacket *packet, uint32 trueSize);
 
+	/**
+	 * Event handler function called when a new packet is received,
+	 * before it is copied into a CECPacket.
+	 *
+	 * @param packet The packet that has been received.
+	 * @return The reply packet or \c NULL if no reply needed.
+	 *
+	 * The default implementation copies the packet into a CECPacket and
+	 * calls OnPacketReceived(). Handlers that only read a few tags can
+	 * override this to read them from the view instead.
+	 *
+	 * @note The view refers to the receive buffer, and is only valid
+	 * during this call. Don't call SendRecvPacket() while using it.
+	 */
+	virtual const CECPacket *OnPacketViewReceived(const CECPacketView& packet, uint32 trueSize);
+
 	/**
 	 * Get a message describing the error.
 	 *
@@ -215,21 +319,15 @@ public:
 	bool DataPending();
  private:
 	const CECPacket *ReadPacket();
-	uint32 WritePacket(const CECPacket *packet);
+	bool	ReadPacketView(CECPacketView& packet);
+	uint32	WritePacket(const CECPacketBuilder& packet);
 
-	// These 4 methods are to be used by CECPacket & CECTag
-	bool	ReadNumber(void *buffer, size_t len);
-	bool	ReadBuffer(void *buffer, size_t len);
 	bool	ReadHeader();
 
-	bool	WriteNumber(const void *buffer, size_t len);
-	bool	WriteBuffer(const void *buffer, size_t len);
-
 	// Internal stuff
-	bool	FlushBuffers();
-
-	size_t	ReadBufferFromSocket(void *buffer, size_t len);
-	void	WriteBufferToSocket(const void *buffer, size_t len);
+	bool	InflatePacket(size_t& len);
+	CQueuedData *DeflatePacket(const CECPacketBuilder& packet);
+	void	AdaptCompression(bool blocked, uint32 speed);
 
 	/* virtuals */
 	virtual void WriteDoneAndQueueEmpty() = 0;
@@ -287,6 +385,28 @@ public:
 		m_z.next_in = m_rd_ptr;
 	}
 
+	/*
+	 * Pass the free part of the buffer to zlib for output, and
+	 * take over what was written there.
+	 */
+	void ToZlibOutput(z_stream &m_z)
+	{
+		m_z.avail_out = (uInt)GetRemLength();
+		m_z.next_out = m_wr_ptr;
+	}
+
+	void FromZlibOutput(const z_stream &m_z)
+	{
+		m_wr_ptr = m_z.next_out;
+	}
+
+	/*
+	 * Write len bytes in place: returns where to put them
+	 */
+	unsigned char *Reserve(size_t len);
+
+	const unsigned char *GetUnreadData() const { return m_rd_ptr; }
+
 	uint32 WriteToSocket(CECSocket *sock);
 	uint32 ReadFromSocket(CECSocket *sock, size_t len);
 
@@ -29,7 +29,7 @@
 #endif
 
 #include "ECTag.h"	// Needed for ECTag
-#include "ECSocket.h"	// Needed for CECSocket
+#include "ECTagArena.h"	// Needed for CECTagView
 #include "ECSpecialTags.h"	// Needed for CValueMap
 #include "ECID.h"	// Needed for CECID
 
@@ -412,92 +412,33 @@ void CECTag::swap(CECTag& t2)
 	std::swap(m_tagList, t2.m_tagList);
 }
 
-bool CECTag::ReadFromSocket(CECSocket& socket)
+/**
+ * Copies a tag of a received packet, with its children.
+ *
+ * @param view The tag in the received packet.
+ */
+void CECTag::ReadFromView(const CECTagView& view)
 {
-	ec_tagname_t tmp_tagName;
-	if (!socket.ReadNumber(&tmp_tagName, sizeof(ec_tagname_t))) {
-		return false;
-	}
-	m_tagName = tmp_tagName >> 1;
-	bool hasChildren = (tmp_tagName & 0x01) != 0;
-
-	if (!socket.ReadNumber(&m_dataType, sizeof(ec_tagtype_t))) {
-		return false;
-	}
-
-	if (!socket.ReadNumber(&m_dataLen, sizeof(ec_taglen_t))) {
-		return false;
-	}
-
-	if (hasChildren && !ReadChildren(socket)) {
-		return false;
-	}
-
-	unsigned int tmp_len = m_dataLen;
-	m_dataLen = 0;
-	m_dataLen = tmp_len - GetTagLen();
+	m_tagName = view.GetTagName();
+	m_dataType = view.GetType();
+	m_dataLen = view.GetTagDataLen();
 	if (m_dataLen > 0) {
 		NewData();
-		if (!socket.ReadBuffer(m_tagData, m_dataLen)) {
-			return false;
-		}
+		memcpy(m_tagData, view.GetTagData(), m_dataLen);
 	} else {
 		m_tagData = NULL;
 	}
 
-	return true;
-}
-
-
-bool CECTag::WriteTag(CECSocket& socket) const
-{
-	ec_tagname_t tmp_tagName = (m_tagName << 1) | (m_tagList.empty() ? 0 : 1);
-	ec_tagtype_t type = m_dataType;
-	ec_taglen_t tagLen = GetTagLen();
-	EC_ASSERT(type != EC_TAGTYPE_UNKNOWN);
-
-	if (!socket.WriteNumber(&tmp_tagName, sizeof(ec_tagname_t))) return false;
-	if (!socket.WriteNumber(&type, sizeof(ec_tagtype_t))) return false;
-	if (!socket.WriteNumber(&tagLen, sizeof(ec_taglen_t))) return false;
-
-	if (!m_tagList.empty()) {
-		if (!WriteChildren(socket)) return false;
-	}
-
-	if (m_dataLen > 0) {
-		if (m_tagData != NULL) {	// This is here only to make sure everything, it should not be NULL at this point
-			if (!socket.WriteBuffer(m_tagData, m_dataLen)) return false;
-		}
-	}
-
-	return true;
+	ReadChildren(view);
 }
 
-bool CECTag::ReadChildren(CECSocket& socket)
+void CECTag::ReadChildren(const CECTagView& view)
 {
-	uint16 tmp_tagCount;
-	if (!socket.ReadNumber(&tmp_tagCount, sizeof(uint16))) {
-		return false;
-	}
 	m_tagList.clear();
-	for (int i = 0; i < tmp_tagCount; i++) {
+	for (CECTagView::const_iterator it = view.begin(); it != view.end(); ++it) {
 		m_tagList.push_back(CECTag());
-		CECTag& tag = m_tagList.back();
-		if (!tag.ReadFromSocket(socket)) {
-			return false;
-		}
-	}
-	return true;
-}
-
-bool CECTag::WriteChildren(CECSocket& socket) const
-{
-	uint16 tmp = (uint16)m_tagList.size();
-	if (!socket.WriteNumber(&tmp, sizeof(tmp))) return false;
-	for (const_iterator it = begin(); it != end(); ++it) {
-		if (!it->WriteTag(socket)) return false;
+		m_tagList.back().ReadFromView(*it);
 	}
-	return true;
 }
 
 /**
@@ -1169,6 +1110,6 @@ void CECTag::DebugPrint(int level, bool print_empty) const
  * \sa CECTag(ec_tagname_t, uint64)
  */
 
-uint32 CECID::s_IDCounter = 0;
+CAtomic<uint32> CECID::s_IDCounter(0);
 
 // File_checked_for_headers
@@ -51,7 +51,7 @@ using Kademlia::CUInt128;
 #include "ECTagTypes.h"	// Needed for TagTypes
 
 
-class CECSocket;
+class CECTagView;
 class CValueMap;
 
 /**
@@ -99,6 +99,7 @@ class EC_IPv4_t {
  */
 
 class CECTag {
+	friend class CECPacketBuilder;
 	public:
 		CECTag(ec_tagname_t name, unsigned int length, const void *data);
 		// tag for custom data: just init object, alloc buffer and return pointer
@@ -208,10 +209,8 @@ class CECTag {
 
 		uint8_t GetType() const { return m_dataType; }
 
-		bool		ReadFromSocket(CECSocket& socket);
-		bool		WriteTag(CECSocket& socket) const;
-		bool		ReadChildren(CECSocket& socket);
-		bool		WriteChildren(CECSocket& socket) const;
+		void		ReadFromView(const CECTagView& view);
+		void		ReadChildren(const CECTagView& view);
 
 	private:
 		// To init. the automatic int data
@@ -0,0 +1,646 @@
+//
+// This file is part of the aMule Project.
+//
+// Copyright (c) 2003-2011 aMule Team ( admin@amule.org / http://www.amule.org )
+//
+// Any parts of this program derived from the xMule, lMule or eMule project,
+// or contributed by third-party developers are copyrighted by their
+// respective authors.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA
+//
+
+#include "ECTagArena.h"	// Interface declarations
+
+#include <algorithm>	// Needed for std::find
+#include <cstring>	// Needed for memcpy
+
+#include "ECPacket.h"	// Needed for CECPacket
+
+
+//! Size of the memory blocks holding tag data.
+#define EC_ARENA_BLOCK_SIZE	4096
+//! Data larger than this gets a block of its own.
+#define EC_ARENA_MAX_SHARED	(EC_ARENA_BLOCK_SIZE / 4)
+//! Name, type and length of a tag, as counted in TAGLEN.
+#define EC_TAG_HEADER_SIZE	(sizeof(ec_tagname_t) + sizeof(ec_tagtype_t) + sizeof(ec_taglen_t))
+
+
+/*----------=> Import from the Linux kernel <=----------*/
+/*
+ * linux/fs/nls_base.c
+ */
+
+/*
+ * Sample implementation from Unicode home page.
+ * http://www.stonehand.com/unicode/standard/fss-utf.html
+ */
+struct utf8_table {
+	int     cmask;
+	int     cval;
+	int     shift;
+	uint32_t  lmask;
+	uint32_t  lval;
+};
+
+static const struct utf8_table utf8_table[] =
+{
+    {0x80,  0x00,   0*6,    0x7F,           0,         /* 1 byte sequence */},
+    {0xE0,  0xC0,   1*6,    0x7FF,          0x80,      /* 2 byte sequence */},
+    {0xF0,  0xE0,   2*6,    0xFFFF,         0x800,     /* 3 byte sequence */},
+    {0xF8,  0xF0,   3*6,    0x1FFFFF,       0x10000,   /* 4 byte sequence */},
+    {0xFC,  0xF8,   4*6,    0x3FFFFFF,      0x200000,  /* 5 byte sequence */},
+    {0xFE,  0xFC,   5*6,    0x7FFFFFFF,     0x4000000, /* 6 byte sequence */},
+    {0,     0,      0,      0,              0,         /* end of table    */}
+};
+
+static int utf8_mbtowc(uint32_t *p, const unsigned char *s, int n)
+{
+	uint32_t l;
+	int c0, nc;
+	const struct utf8_table *t;
+
+	nc = 0;
+	c0 = *s;
+	l = c0;
+	for (t = utf8_table; t->cmask; t++) {
+		int c;
+		nc++;
+		if ((c0 & t->cmask) == t->cval) {
+			l &= t->lmask;
+			if (l < t->lval)
+				return -1;
+			*p = l;
+			return nc;
+		}
+		if (n <= nc)
+			return -1;
+		s++;
+		c = (*s ^ 0x80) & 0xFF;
+		if (c & 0xC0)
+			return -1;
+		l = (l << 6) | c;
+	}
+	return -1;
+}
+
+static int utf8_wctomb(unsigned char *s, uint32_t wc, int maxlen)
+{
+	uint32_t l;
+	int c, nc;
+	const struct utf8_table *t;
+
+	l = wc;
+	nc = 0;
+	for (t = utf8_table; t->cmask && maxlen; t++, maxlen--) {
+		nc++;
+		if (l <= t->lmask) {
+			c = t->shift;
+			*s = t->cval | (l >> c);
+			while (c > 0) {
+				c -= 6;
+				s++;
+				*s = 0x80 | ((l >> c) & 0x3F);
+			}
+			return nc;
+		}
+	}
+	return -1;
+}
+/*----------=> End of Import <=----------*/
+
+
+//
+// Numbers are sent in network byte order, or as UTF-8 sequences
+// when the packet has EC_FLAG_UTF8_NUMBERS set.
+//
+
+static size_t NumberLength(uint32 value, size_t size, bool utf8)
+{
+	if (!utf8) {
+		return size;
+	}
+
+	// Lengths of more than 2GB are not sent
+	EC_ASSERT(value <= 0x7FFFFFFF);
+
+	const struct utf8_table *t = utf8_table;
+	size_t len = 1;
+	while (t[1].cmask && value > t->lmask) {
+		++t;
+		++len;
+	}
+	return len;
+}
+
+
+static unsigned char *WriteNumber(unsigned char *buffer, uint32 value, size_t size, bool utf8)
+{
+	if (utf8) {
+		return buffer + utf8_wctomb(buffer, value, 6);
+	}
+
+	for (size_t i = size; i-- > 0; value >>= 8) {
+		buffer[i] = (unsigned char)value;
+	}
+	return buffer + size;
+}
+
+
+static bool ReadNumber(const unsigned char *&pos, const unsigned char *end, size_t size, bool utf8, uint32 &value)
+{
+	if (pos == end) {
+		return false;
+	}
+
+	if (utf8) {
+		int len = utf8_mbtowc(&value, pos, (int)std::min<size_t>(end - pos, 6));
+		if (len == -1) {
+			return false;
+		}
+		pos += len;
+		// Truncated to the size of the field, like before
+		if (size < 4) {
+			value &= (1u << (size * 8)) - 1;
+		}
+	} else {
+		if ((size_t)(end - pos) < size) {
+			return false;
+		}
+		value = 0;
+		for (size_t i = 0; i < size; ++i) {
+			value = (value << 8) | *pos++;
+		}
+	}
+	return true;
+}
+
+
+/**********************************************************
+ *							  *
+ *	CECPacketBuilder class				  *
+ *							  *
+ **********************************************************/
+
+CECPacketBuilder::CECPacketBuilder(ec_opcode_t opCode, EC_DETAIL_LEVEL detail_level)
+{
+	Init(opCode);
+
+	// since EC_DETAIL_FULL is default - no point transmit it
+	if (detail_level != EC_DETAIL_FULL) {
+		AddInt(EC_TAG_DETAIL_LEVEL, detail_level);
+	}
+}
+
+
+CECPacketBuilder::CECPacketBuilder(const CECPacket& packet)
+{
+	Init(packet.GetOpCode());
+
+	for (CECTag::const_iterator it = packet.begin(); it != packet.end(); ++it) {
+		AddTagTree(*it, false);
+	}
+}
+
+
+CECPacketBuilder::~CECPacketBuilder()
+{
+	for (size_t i = 0; i < m_blocks.size(); ++i) {
+		delete [] m_blocks[i];
+	}
+}
+
+
+void CECPacketBuilder::Init(ec_opcode_t opCode)
+{
+	m_opCode = opCode;
+	m_block = NULL;
+	m_blockUsed = 0;
+
+	CECFlatTag packet = { 0, EC_TAGTYPE_UNKNOWN, 0, 1, 0, 0, NULL };
+	m_tags.push_back(packet);
+	m_open.push_back(0);
+}
+
+
+char *CECPacketBuilder::Allocate(uint32 len)
+{
+	if (len > EC_ARENA_MAX_SHARED) {
+		m_blocks.push_back(new char[len]);
+		return m_blocks.back();
+	}
+
+	if (m_block == NULL || m_blockUsed + len > EC_ARENA_BLOCK_SIZE) {
+		m_block = new char[EC_ARENA_BLOCK_SIZE];
+		m_blocks.push_back(m_block);
+		m_blockUsed = 0;
+	}
+
+	char *data = m_block + m_blockUsed;
+	m_blockUsed += len;
+	return data;
+}
+
+
+bool CECPacketBuilder::PushTag(ec_tagname_t name, ec_tagtype_t type, const char *data, uint32 len)
+{
+	EC_ASSERT(type != EC_TAGTYPE_UNKNOWN);
+
+	CECFlatTag& parent = m_tags[m_open.back()];
+	// cannot have more than 64k tags
+	if (parent.children == 0xffff) {
+		return false;
+	}
+	++parent.children;
+
+	CECFlatTag tag = { name, type, 0, (uint32)m_tags.size() + 1, len, len, data };
+	m_tags.push_back(tag);
+	return true;
+}
+
+
+bool CECPacketBuilder::OpenTag(ec_tagname_t name, ec_tagtype_t type, const void *data, uint32 len)
+{
+	char *copy = NULL;
+	if (len) {
+		copy = Allocate(len);
+		memcpy(copy, data, len);
+	}
+
+	if (!PushTag(name, type, copy, len)) {
+		return false;
+	}
+	m_open.push_back(m_tags.size() - 1);
+	return true;
+}
+
+
+void CECPacketBuilder::CloseTag()
+{
+	EC_ASSERT(m_open.size() > 1);
+
+	CECFlatTag& tag = m_tags[m_open.back()];
+	m_open.pop_back();
+
+	tag.next = m_tags.size();
+	m_tags[m_open.back()].len += tag.len + EC_TAG_HEADER_SIZE + (tag.children ? 2 : 0);
+}
+
+
+bool CECPacketBuilder::AddTag(ec_tagname_t name, ec_tagtype_t type, const void *data, uint32 len)
+{
+	if (!OpenTag(name, type, data, len)) {
+		return false;
+	}
+	CloseTag();
+	return true;
+}
+
+
+bool CECPacketBuilder::AddInt(ec_tagname_t name, uint64 data)
+{
+	// Same encoding as CECTag::InitInt()
+	unsigned char buffer[8];
+	uint32 len;
+	ec_tagtype_t type;
+	if (data <= 0xFF) {
+		type = EC_TAGTYPE_UINT8;
+		len = 1;
+	} else if (data <= 0xFFFF) {
+		type = EC_TAGTYPE_UINT16;
+		len = 2;
+	} else if (data <= 0xFFFFFFFF) {
+		type = EC_TAGTYPE_UINT32;
+		len = 4;
+	} else {
+		type = EC_TAGTYPE_UINT64;
+		len = 8;
+	}
+
+	for (uint32 i = len; i-- > 0; data >>= 8) {
+		buffer[i] = (unsigned char)data;
+	}
+	return AddTag(name, type, buffer, len);
+}
+
+
+bool CECPacketBuilder::AddString(ec_tagname_t name, const std::string& data)
+{
+	// Sent with the terminating zero, up to the first zero like CECTag
+	const char *str = data.c_str();
+	return AddTag(name, EC_TAGTYPE_STRING, str, (uint32)strlen(str) + 1);
+}
+
+
+#ifdef USE_WX_EXTENSIONS
+bool CECPacketBuilder::AddString(ec_tagname_t name, const wxString& data)
+{
+	return AddString(name, std::string((const char *)unicode2UTF8(data)));
+}
+#endif
+
+
+bool CECPacketBuilder::AddHash(ec_tagname_t name, const CMD4Hash& data)
+{
+	return AddTag(name, EC_TAGTYPE_HASH16, data.GetHash(), 16);
+}
+
+
+bool CECPacketBuilder::AddTagTree(const CECTag& tag, bool copy)
+{
+	const char *data = tag.m_tagData;
+	if (copy && tag.m_dataLen) {
+		char *buffer = Allocate(tag.m_dataLen);
+		memcpy(buffer, data, tag.m_dataLen);
+		data = buffer;
+	}
+
+	if (!PushTag(tag.m_tagName, tag.m_dataType, data, tag.m_dataLen)) {
+		return false;
+	}
+	m_open.push_back(m_tags.size() - 1);
+
+	for (CECTag::const_iterator it = tag.begin(); it != tag.end(); ++it) {
+		// The tag has no more than 64k children
+		AddTagTree(*it, copy);
+	}
+
+	CloseTag();
+	return true;
+}
+
+
+size_t CECPacketBuilder::GetEncodedLength(bool utf8Numbers) const
+{
+	EC_ASSERT(m_open.size() == 1);
+
+	size_t len = NumberLength(m_opCode, sizeof(ec_opcode_t), utf8Numbers)
+		+ NumberLength(m_tags[0].children, 2, utf8Numbers);
+
+	for (size_t i = 1; i < m_tags.size(); ++i) {
+		const CECFlatTag& tag = m_tags[i];
+		len += NumberLength((tag.name << 1) | (tag.children ? 1 : 0), sizeof(ec_tagname_t), utf8Numbers)
+			+ NumberLength(tag.type, sizeof(ec_tagtype_t), utf8Numbers)
+			+ NumberLength(tag.len, sizeof(ec_taglen_t), utf8Numbers)
+			+ (tag.children ? NumberLength(tag.children, 2, utf8Numbers) : 0)
+			+ tag.dataLen;
+	}
+	return len;
+}
+
+
+void CECPacketBuilder::Encode(unsigned char *buffer, bool utf8Numbers) const
+{
+	EC_ASSERT(m_open.size() == 1);
+
+	buffer = WriteNumber(buffer, m_opCode, sizeof(ec_opcode_t), utf8Numbers);
+	buffer = WriteNumber(buffer, m_tags[0].children, 2, utf8Numbers);
+
+	// Tags whose data follows their children
+	std::vector<uint32> pending;
+
+	for (uint32 i = 1; i <= m_tags.size(); ++i) {
+		while (!pending.empty() && m_tags[pending.back()].next == i) {
+			const CECFlatTag& tag = m_tags[pending.back()];
+			if (tag.dataLen) {
+				memcpy(buffer, tag.data, tag.dataLen);
+				buffer += tag.dataLen;
+			}
+			pending.pop_back();
+		}
+		if (i == m_tags.size()) {
+			break;
+		}
+
+		const CECFlatTag& tag = m_tags[i];
+		buffer = WriteNumber(buffer, (tag.name << 1) | (tag.children ? 1 : 0), sizeof(ec_tagname_t), utf8Numbers);
+		buffer = WriteNumber(buffer, tag.type, sizeof(ec_tagtype_t), utf8Numbers);
+		buffer = WriteNumber(buffer, tag.len, sizeof(ec_taglen_t), utf8Numbers);
+		if (tag.children) {
+			buffer = WriteNumber(buffer, tag.children, 2, utf8Numbers);
+			pending.push_back(i);
+		} else if (tag.dataLen) {
+			memcpy(buffer, tag.data, tag.dataLen);
+			buffer += tag.dataLen;
+		}
+	}
+}
+
+
+/**********************************************************
+ *							  *
+ *	CECTagView class				  *
+ *							  *
+ **********************************************************/
+
+//! Defines the null tag returned by GetTagByName.
+static const CECFlatTag s_theNullTag = { 0, EC_TAGTYPE_UNKNOWN, 0, 1, 0, 0, NULL };
+
+
+CECTagView::CECTagView()
+	: m_tags(&s_theNullTag),
+	  m_index(0)
+{
+}
+
+
+uint64 CECTagView::GetInt() const
+{
+	const CECFlatTag& tag = Tag();
+
+	size_t len;
+	switch (tag.type) {
+		case EC_TAGTYPE_UINT8:	len = 1; break;
+		case EC_TAGTYPE_UINT16:	len = 2; break;
+		case EC_TAGTYPE_UINT32:	len = 4; break;
+		case EC_TAGTYPE_UINT64:	len = 8; break;
+		case EC_TAGTYPE_UNKNOWN:
+			// Empty tag - This is NOT an error.
+			return 0;
+		default:
+			EC_ASSERT(0);
+			return 0;
+	}
+
+	// Received data is not trusted
+	if (tag.dataLen < len) {
+		return 0;
+	}
+
+	uint64 value = 0;
+	for (size_t i = 0; i < len; ++i) {
+		value = (value << 8) | (uint8)tag.data[i];
+	}
+	return value;
+}
+
+
+std::string CECTagView::GetStringDataSTL() const
+{
+	const CECFlatTag& tag = Tag();
+
+	if (tag.type != EC_TAGTYPE_STRING) {
+		EC_ASSERT(tag.type == EC_TAGTYPE_UNKNOWN);
+		return std::string();
+	}
+
+	return std::string(tag.data, std::find(tag.data, tag.data + tag.dataLen, '\0'));
+}
+
+
+#ifdef USE_WX_EXTENSIONS
+wxString CECTagView::GetStringData() const
+{
+	return UTF82unicode(GetStringDataSTL().c_str());
+}
+#endif
+
+
+CMD4Hash CECTagView::GetMD4Data() const
+{
+	const CECFlatTag& tag = Tag();
+
+	if (tag.type != EC_TAGTYPE_HASH16 || tag.dataLen < 16) {
+		EC_ASSERT(tag.type == EC_TAGTYPE_UNKNOWN);
+		return CMD4Hash();
+	}
+
+	return CMD4Hash((const unsigned char *)tag.data);
+}
+
+
+CECTagView CECTagView::GetTagByName(ec_tagname_t name) const
+{
+	for (const_iterator it = begin(); it != end(); ++it) {
+		if (it->GetTagName() == name) {
+			return *it;
+		}
+	}
+	return CECTagView();
+}
+
+
+/**********************************************************
+ *							  *
+ *	CECPacketView class				  *
+ *							  *
+ **********************************************************/
+
+//! A tag whose children are being read.
+struct Frame {
+	uint32 index;
+	uint32 remaining;
+	uint64 childrenLen;
+};
+
+
+bool CECPacketView::Parse(const void *data, size_t len, bool utf8Numbers)
+{
+	m_tags.clear();
+
+	if (!ParseTags((const unsigned char *)data, (const unsigned char *)data + len, utf8Numbers)) {
+		// Not a half-built view
+		m_tags.clear();
+		return false;
+	}
+	return true;
+}
+
+
+bool CECPacketView::ParseTags(const unsigned char *pos, const unsigned char *end, bool utf8Numbers)
+{
+	uint32 value;
+
+	if (!ReadNumber(pos, end, sizeof(ec_opcode_t), utf8Numbers, value)) {
+		return false;
+	}
+	m_opCode = (ec_opcode_t)value;
+
+	if (!ReadNumber(pos, end, 2, utf8Numbers, value)) {
+		return false;
+	}
+	CECFlatTag packet = { 0, EC_TAGTYPE_UNKNOWN, (uint16)value, 0, 0, 0, NULL };
+	m_tags.push_back(packet);
+
+	// The data of a tag follows its children, and its length is only known
+	// when the children are read. Not recursive, the data is not trusted.
+	Frame first = { 0, packet.children, 0 };
+	std::vector<Frame> open(1, first);
+
+	while (true) {
+		Frame& frame = open.back();
+
+		if (frame.remaining == 0) {
+			CECFlatTag& tag = m_tags[frame.index];
+			tag.next = m_tags.size();
+			if (open.size() == 1) {
+				// The packet has no data
+				break;
+			}
+
+			if (frame.childrenLen > tag.len || (uint64)(end - pos) < tag.len - frame.childrenLen) {
+				return false;
+			}
+			tag.dataLen = tag.len - (ec_taglen_t)frame.childrenLen;
+			tag.data = tag.dataLen ? (const char *)pos : NULL;
+			pos += tag.dataLen;
+
+			open.pop_back();
+			open.back().childrenLen += (uint64)tag.len + EC_TAG_HEADER_SIZE + (tag.children ? 2 : 0);
+			continue;
+		}
+		--frame.remaining;
+
+		uint32 name, type, taglen;
+		if (!ReadNumber(pos, end, sizeof(ec_tagname_t), utf8Numbers, name)
+			|| !ReadNumber(pos, end, sizeof(ec_tagtype_t), utf8Numbers, type)
+			|| !ReadNumber(pos, end, sizeof(ec_taglen_t), utf8Numbers, taglen)) {
+			return false;
+		}
+
+		uint32 children = 0;
+		if ((name & 0x01) && !ReadNumber(pos, end, 2, utf8Numbers, children)) {
+			return false;
+		}
+
+		uint32 index = m_tags.size();
+		CECFlatTag tag = { (ec_tagname_t)(name >> 1), (ec_tagtype_t)type, (uint16)children, index + 1, taglen, 0, NULL };
+
+		if (children) {
+			m_tags.push_back(tag);
+			Frame child = { index, children, 0 };
+			open.push_back(child);
+		} else {
+			if ((uint64)(end - pos) < taglen) {
+				return false;
+			}
+			tag.dataLen = taglen;
+			tag.data = taglen ? (const char *)pos : NULL;
+			pos += taglen;
+			m_tags.push_back(tag);
+
+			frame.childrenLen += (uint64)taglen + EC_TAG_HEADER_SIZE;
+		}
+	}
+
+	return true;
+}
+
+
+CECTagView CECPacketView::GetRoot() const
+{
+	return m_tags.empty() ? CECTagView() : CECTagView(&m_tags[0], 0);
+}
+// File_checked_for_headers
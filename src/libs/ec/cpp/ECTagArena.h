@@ -0,0 +1,241 @@
+//
+// This file is part of the aMule Project.
+//
+// Copyright (c) 2003-2011 aMule Team ( admin@amule.org / http://www.amule.org )
+//
+// Any parts of this program derived from the xMule, lMule or eMule project,
+// or contributed by third-party developers are copyrighted by their
+// respective authors.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA
+//
+
+#ifndef ECTAGARENA_H
+#define ECTAGARENA_H
+
+#include "ECTag.h"	// Needed for CECTag
+
+#include <vector>	// Needed for std::vector
+
+class CECPacket;
+
+/**
+ * A tag of a flat tag tree.
+ *
+ * The tags of a packet are stored in one array, each tag followed by its
+ * children, each of them followed by theirs. The first entry stands for
+ * the packet itself.
+ */
+struct CECFlatTag {
+	ec_tagname_t	name;
+	ec_tagtype_t	type;
+	//! Number of direct children.
+	uint16		children;
+	//! Index of the tag following the children of this one.
+	uint32		next;
+	//! Length of data and children, as sent in the TAGLEN field.
+	ec_taglen_t	len;
+	ec_taglen_t	dataLen;
+	const char *	data;
+};
+
+
+/**
+ * Builds an EC packet in a flat tag array.
+ *
+ * Tag data is copied into a few large blocks owned by the builder instead
+ * of one allocation per tag, and CECSocket encodes the packet straight into
+ * its output buffer. Tags are added in the order they are sent:
+ *
+ * \code
+ *	CECPacketBuilder packet(EC_OP_DLOAD_QUEUE);
+ *	packet.OpenTag(EC_TAG_PARTFILE, EC_TAGTYPE_HASH16, hash.GetHash(), 16);
+ *	packet.AddString(EC_TAG_PARTFILE_NAME, name);
+ *	packet.AddInt(EC_TAG_PARTFILE_SIZE_FULL, size);
+ *	packet.CloseTag();
+ *	socket->SendPacket(packet);
+ * \endcode
+ */
+class CECPacketBuilder {
+	public:
+		CECPacketBuilder(ec_opcode_t opCode, EC_DETAIL_LEVEL detail_level = EC_DETAIL_FULL);
+		/**
+		 * Refers to the tags of a CECPacket, without copying their data.
+		 *
+		 * @note The packet must not change or go away while the builder is used.
+		 */
+		explicit CECPacketBuilder(const CECPacket& packet);
+		~CECPacketBuilder();
+
+		/**
+		 * Adds a tag, the tags added until the matching CloseTag() become its children.
+		 *
+		 * @return \b false if the current tag already has 64k children. The tag
+		 * is not opened then, and CloseTag() must not be called for it.
+		 */
+		bool		OpenTag(ec_tagname_t name, ec_tagtype_t type = EC_TAGTYPE_CUSTOM, const void *data = NULL, uint32 len = 0);
+		void		CloseTag();
+
+		// Adding tags without children. These return false like OpenTag().
+		bool		AddTag(ec_tagname_t name, ec_tagtype_t type, const void *data, uint32 len);
+		bool		AddTag(const CECTag& tag)	{ return AddTagTree(tag, true); }
+		bool		AddInt(ec_tagname_t name, uint64 data);
+		bool		AddString(ec_tagname_t name, const std::string& data);
+		#ifdef USE_WX_EXTENSIONS
+		bool		AddString(ec_tagname_t name, const wxString& data);
+		#endif
+		bool		AddHash(ec_tagname_t name, const CMD4Hash& data);
+
+		ec_opcode_t	GetOpCode() const	{ return m_opCode; }
+		//! Same as CECPacket::GetPacketLength().
+		uint32		GetPacketLength() const	{ return m_tags[0].len; }
+
+		//! Number of bytes Encode() writes.
+		size_t		GetEncodedLength(bool utf8Numbers) const;
+		//! Writes the packet, without the flags and length header.
+		void		Encode(unsigned char *buffer, bool utf8Numbers) const;
+
+	private:
+		// Not copyable, tags point into the blocks
+		CECPacketBuilder(const CECPacketBuilder&);
+		CECPacketBuilder& operator=(const CECPacketBuilder&);
+
+		void		Init(ec_opcode_t opCode);
+		char *		Allocate(uint32 len);
+		bool		PushTag(ec_tagname_t name, ec_tagtype_t type, const char *data, uint32 len);
+		bool		AddTagTree(const CECTag& tag, bool copy);
+
+		ec_opcode_t		m_opCode;
+		std::vector<CECFlatTag>	m_tags;
+		//! Indices of the open tags, the packet first.
+		std::vector<uint32>	m_open;
+
+		//! Memory blocks holding the tag data.
+		std::vector<char *>	m_blocks;
+		char *			m_block;
+		uint32			m_blockUsed;
+};
+
+
+/**
+ * Read-only view of a tag in a received packet.
+ *
+ * Views are small values pointing into a CECPacketView, and are valid as
+ * long as it is. Accessors behave like those of CECTag.
+ */
+class CECTagView {
+	friend class CECPacketView;
+	public:
+		class const_iterator;
+
+		//! A null tag, like CECTag::GetTagByNameSafe() returns.
+		CECTagView();
+
+		ec_tagname_t	GetTagName() const	{ return Tag().name; }
+		ec_tagtype_t	GetType() const		{ return Tag().type; }
+		const void *	GetTagData() const	{ return Tag().data; }
+		uint32		GetTagDataLen() const	{ return Tag().dataLen; }
+		uint16		GetTagCount() const	{ return Tag().children; }
+		bool		HasChildTags() const	{ return Tag().children != 0; }
+
+		uint64		GetInt() const;
+		std::string	GetStringDataSTL() const;
+		#ifdef USE_WX_EXTENSIONS
+		wxString	GetStringData() const;
+		#endif
+		CMD4Hash	GetMD4Data() const;
+
+		//! Finds the (first) child tag with given name, or returns a null tag.
+		CECTagView	GetTagByName(ec_tagname_t name) const;
+
+		const_iterator	begin() const;
+		const_iterator	end() const;
+
+	private:
+		CECTagView(const CECFlatTag *tags, uint32 index) : m_tags(tags), m_index(index) {}
+
+		const CECFlatTag& Tag() const	{ return m_tags[m_index]; }
+
+		const CECFlatTag *	m_tags;
+		uint32			m_index;
+};
+
+
+/**
+ * Iterates through the children of a tag.
+ */
+class CECTagView::const_iterator {
+	friend class CECTagView;
+	public:
+		const CECTagView&	operator*() const	{ return m_view; }
+		const CECTagView*	operator->() const	{ return &m_view; }
+		const_iterator&		operator++()	{ m_view.m_index = m_view.Tag().next; return *this; }
+		bool	operator==(const const_iterator& it) const	{ return m_view.m_index == it.m_view.m_index; }
+		bool	operator!=(const const_iterator& it) const	{ return m_view.m_index != it.m_view.m_index; }
+
+	private:
+		const_iterator(const CECFlatTag *tags, uint32 index) : m_view(tags, index) {}
+
+		CECTagView m_view;
+};
+
+
+inline CECTagView::const_iterator CECTagView::begin() const
+{
+	return const_iterator(m_tags, m_index + 1);
+}
+
+inline CECTagView::const_iterator CECTagView::end() const
+{
+	return const_iterator(m_tags, Tag().next);
+}
+
+
+/**
+ * Read-only view of a received packet.
+ *
+ * Parsing indexes the tags in one flat array, tag data is not copied but
+ * points into the received buffer.
+ */
+class CECPacketView {
+	public:
+		CECPacketView() : m_opCode(0) {}
+
+		/**
+		 * Parses a packet, without the flags and length header.
+		 *
+		 * @return \b false if the packet is malformed.
+		 *
+		 * @note The data must stay unchanged while the view is used.
+		 */
+		bool		Parse(const void *data, size_t len, bool utf8Numbers);
+
+		ec_opcode_t	GetOpCode() const	{ return m_opCode; }
+		//! The packet as a nameless tag, with the tags of the packet as children.
+		CECTagView	GetRoot() const;
+
+		CECTagView	GetTagByName(ec_tagname_t name) const	{ return GetRoot().GetTagByName(name); }
+		CECTagView::const_iterator begin() const	{ return GetRoot().begin(); }
+		CECTagView::const_iterator end() const		{ return GetRoot().end(); }
+
+	private:
+		bool		ParseTags(const unsigned char *pos, const unsigned char *end, bool utf8Numbers);
+
+		ec_opcode_t		m_opCode;
+		std::vector<CECFlatTag>	m_tags;
+};
+
+#endif /* ECTAGARENA_H */
+// File_checked_for_headers
@@ -112,6 +112,9 @@ public final static byte EC_OP_CLIENT_SWAP_TO_ANOTHER_FILE   = 0x54;
 public final static byte EC_OP_SHARED_FILE_SET_COMMENT       = 0x55;
 public final static byte EC_OP_SERVER_SET_STATIC_PRIO        = 0x56;
 public final static byte EC_OP_FRIEND                        = 0x57;
+public final static byte EC_OP_SUBSCRIBE                     = 0x58;
+public final static byte EC_OP_GET_STATSHISTORY              = 0x59;
+public final static byte EC_OP_STATSHISTORY                  = 0x5A;
 
 public final static short EC_TAG_STRING                             = 0x0000;
 public final static short EC_TAG_PASSWD_HASH                        = 0x0001;
@@ -130,6 +133,7 @@ public final static short EC_TAG_CAN_UTF8_NUMBERS                   = 0x000D;
 public final static short EC_TAG_CAN_NOTIFY                         = 0x000E;
 public final static short EC_TAG_ECID                               = 0x000F;
 public final static short EC_TAG_KAD_ID                             = 0x0010;
+public final static short EC_TAG_SUBSCRIPTION                       = 0x0011;
 public final static short EC_TAG_CLIENT_NAME                        = 0x0100;
 public final static short 	EC_TAG_CLIENT_VERSION                     = 0x0101;
 public final static short 	EC_TAG_CLIENT_MOD                         = 0x0102;
@@ -388,6 +392,10 @@ public final static short 		EC_TAG_STATTREE_NODE                      = 0x1B06;
 public final static short 		EC_TAG_STAT_NODE_VALUE                    = 0x1B07;
 public final static short 		EC_TAG_STAT_VALUE_TYPE                    = 0x1B08;
 public final static short 		EC_TAG_STATTREE_NODEID                    = 0x1B09;
+public final static short 		EC_TAG_STATSHISTORY_TIER                  = 0x1B0A;
+public final static short 		EC_TAG_STATSHISTORY_FROM                  = 0x1B0B;
+public final static short 		EC_TAG_STATSHISTORY_TO                    = 0x1B0C;
+public final static short 		EC_TAG_STATSHISTORY_DATA                  = 0x1B0D;
 public final static short 	EC_TAG_PREFS_SECURITY                     = 0x1C00;
 public final static short 		EC_TAG_SECURITY_CAN_SEE_SHARES            = 0x1C01;
 public final static short 		EC_TAG_IPFILTER_CLIENTS                   = 0x1C02;
@@ -443,4 +451,10 @@ public final static int EC_PREFS_SECURITY       = 0x00000800;
 public final static int EC_PREFS_CORETWEAKS     = 0x00001000;
 public final static int EC_PREFS_KADEMLIA       = 0x00002000;
 
+public final static int EC_SUBSCRIBE_DOWNLOADS  = 0x00000001;
+public final static int EC_SUBSCRIBE_SHARED     = 0x00000002;
+public final static int EC_SUBSCRIBE_SEARCH     = 0x00000004;
+public final static int EC_SUBSCRIBE_STATUS     = 0x00000008;
+public final static int EC_SUBSCRIBE_ALL        = 0x0000000F;
+
 }
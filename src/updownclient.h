@@ -241,6 +241,10 @@ public:
 	void		SendSignaturePacket();
 	void		ProcessPublicKeyPacket(const uint8_t* pachPacket, uint32 nSize);
 	void		ProcessSignaturePacket(const uint8_t* pachPacket, uint32 nSize);
+	//! Sends the signature created by the crypto worker.
+	void		OnSignatureCreated(const uint8_t* pachSignature, uint8 nSignatureLen, uint8 byChaIPKind);
+	//! Called once the signature received from the client has been checked.
+	void		OnIdentVerified(bool bResult, uint8 byChaIPKind);
 	uint8		GetSecureIdentState();
 
 	void		SendSecIdentStatePacket();
@@ -0,0 +1,238 @@
+#!/usr/bin/perl
+#
+
+## This file is part of the aMule Project
+##
+## Copyright (c) 2003-2011 aMule Team ( admin@amule.org / http://www.amule.org )
+##
+## This program is free software; you can redistribute it and/or
+## modify it under the terms of the GNU General Public License
+## as published by the Free Software Foundation; either
+## version 2 of the License, or (at your option) any later version.
+##
+## This program is distributed in the hope that it will be useful,
+## but WITHOUT ANY WARRANTY; without even the implied warranty of
+## MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+## GNU General Public License for more details.
+##
+## You should have received a copy of the GNU General Public License
+## along with this program; if not, write to the Free Software
+## Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA
+
+# Load test for amuleweb.
+#
+# Opens a number of persistent connections, each in its own process, and
+# sends the given pages over them, optionally pipelining several requests
+# at once. Prints the throughput and the latency percentiles of all
+# requests. A latency is the time from sending a request to having read
+# its whole response, so pipelined requests include the time spent
+# waiting behind the earlier ones.
+#
+# Example, 8 connections of 500 requests, 4 of them in flight at a time:
+#   amuleweb_loadtest.pl --password secret --connections 8 --requests 500 \
+#       --pipeline 4 localhost:4711 /amuleweb-main-dload.php /styles.css
+
+use warnings;
+use strict;
+
+use Getopt::Long;
+use IO::Socket::INET;
+use Time::HiRes qw(time);
+
+my $connections = 4;
+my $requests = 100;
+my $pipeline = 1;
+my $password = '';
+my $help;
+
+GetOptions(
+	'connections=i'	=> \$connections,
+	'requests=i'	=> \$requests,
+	'pipeline=i'	=> \$pipeline,
+	'password=s'	=> \$password,
+	'help'		=> \$help,
+) or $help = 1;
+
+my $server = shift @ARGV;
+my @paths = @ARGV ? @ARGV : ('/');
+
+if ($help || !$server || $connections < 1 || $requests < 1 || $pipeline < 1) {
+	die "Usage: amuleweb_loadtest.pl [--connections N] [--requests N] [--pipeline N]\n"
+	  . "                           [--password PW] host:port [path]+\n";
+}
+
+$server .= ':4711' unless $server =~ /:\d+$/;
+
+
+# Opens a connection, logging in first if a password was given.
+#
+# Returns the socket and the session cookie, if any.
+sub Connect
+{
+	my ($cookie) = @_;
+
+	my $socket = IO::Socket::INET->new(PeerAddr => $server, Proto => 'tcp')
+		or die "Can't connect to $server: $!\n";
+	binmode $socket;
+
+	if ($password ne '' && !defined $cookie) {
+		print $socket Request("/?pass=$password", undef);
+		my ($status, $headers) = ReadResponse($socket);
+		die "Login failed\n" unless defined $status;
+		($cookie) = $headers =~ /^Set-Cookie:\s*(amuleweb_session_id=\d+)/mi;
+		if ($headers =~ /^Connection:\s*close/mi) {
+			close $socket;
+			return Connect($cookie);
+		}
+	}
+
+	return ($socket, $cookie);
+}
+
+
+sub Request
+{
+	my ($path, $cookie) = @_;
+
+	my $request = "GET $path HTTP/1.1\r\nHost: $server\r\nAccept-Encoding: gzip\r\n";
+	$request .= "Cookie: $cookie\r\n" if defined $cookie;
+
+	return $request . "\r\n";
+}
+
+
+# Reads one response.
+#
+# Returns the status code and the headers, or nothing if the connection
+# was closed before a complete response arrived.
+sub ReadResponse
+{
+	my ($socket) = @_;
+
+	local $/ = "\r\n";
+	my $status = <$socket>;
+	return unless defined $status && $status =~ m{^HTTP/\d\.\d (\d+)};
+	my $code = $1;
+
+	my $headers = '';
+	while (defined(my $line = <$socket>)) {
+		last if $line eq "\r\n";
+		$headers .= $line;
+	}
+
+	if ($headers =~ /^Content-Length:\s*(\d+)/mi) {
+		my $left = $1;
+		while ($left > 0) {
+			my $read = read($socket, my $chunk, $left);
+			return unless $read;
+			$left -= $read;
+		}
+	} else {
+		# Without a length the body ends with the connection
+		local $/;
+		my $body = <$socket>;
+	}
+
+	return ($code, $headers);
+}
+
+
+# Runs the requests of one connection.
+#
+# Writes one line per request to the pipe: the latency in seconds, or
+# "error".
+sub RunConnection
+{
+	my ($out) = @_;
+
+	my ($socket, $cookie) = Connect(undef);
+	my $sent = 0;
+
+	while ($sent < $requests) {
+		my $batch = $pipeline < $requests - $sent ? $pipeline : $requests - $sent;
+
+		my $start = time;
+		my $data = '';
+		for my $i (0 .. $batch - 1) {
+			$data .= Request($paths[($sent + $i) % @paths], $cookie);
+		}
+		print $socket $data;
+		$sent += $batch;
+
+		my $closed = 0;
+		for my $i (0 .. $batch - 1) {
+			my ($code, $headers) = ReadResponse($socket);
+			if (!defined $code || $code >= 400) {
+				print $out "error\n";
+				$closed = 1 unless defined $code;
+				next;
+			}
+			print $out time - $start, "\n";
+			$closed = 1 if $headers =~ /^Connection:\s*close/mi;
+		}
+
+		if ($closed) {
+			close $socket;
+			($socket) = Connect($cookie);
+		}
+	}
+
+	close $socket;
+}
+
+
+sub Percentile
+{
+	my ($sorted, $p) = @_;
+
+	my $index = int(@$sorted * $p / 100 + 0.5) - 1;
+	$index = 0 if $index < 0;
+
+	return $sorted->[$index] * 1000;
+}
+
+
+$| = 1;
+my @readers;
+my $start = time;
+
+for (1 .. $connections) {
+	pipe(my $reader, my $writer) or die "Can't create pipe: $!\n";
+	my $pid = fork();
+	die "Can't fork: $!\n" unless defined $pid;
+
+	if (!$pid) {
+		close $reader;
+		RunConnection($writer);
+		close $writer;
+		exit 0;
+	}
+
+	close $writer;
+	push @readers, $reader;
+}
+
+my @latencies;
+my $errors = 0;
+for my $reader (@readers) {
+	while (my $line = <$reader>) {
+		chomp $line;
+		if ($line eq 'error') {
+			++$errors;
+		} else {
+			push @latencies, $line;
+		}
+	}
+	close $reader;
+}
+1 while wait() != -1;
+
+my $elapsed = time - $start;
+die "No request succeeded\n" unless @latencies;
+
+my @sorted = sort { $a <=> $b } @latencies;
+printf "%d connections, %d requests each, %d in flight: %d ok, %d failed in %.2f s, %.1f requests/s\n",
+	$connections, $requests, $pipeline, scalar @sorted, $errors, $elapsed, @sorted / $elapsed;
+printf "Latency in ms: min %.2f, p50 %.2f, p95 %.2f, p99 %.2f, max %.2f\n",
+	$sorted[0] * 1000, Percentile(\@sorted, 50), Percentile(\@sorted, 95),
+	Percentile(\@sorted, 99), $sorted[-1] * 1000;
@@ -35,6 +35,7 @@
 
 #include <wx/tokenzr.h>		// for wxTokenizer
 #include <wx/wfstream.h>
+#include <sys/stat.h>		// Needed for stat
 
 #include <ec/cpp/ECFileConfig.h>	// Needed for CECFileConfig
 #include <ec/cpp/ECSpecialTags.h>
@@ -72,6 +73,44 @@ inline void set_rgb_color_val(unsigned char *start, uint32 val, unsigned char mo
 	start[2] = ( b > mod ) ? (b - mod) : 1;
 }
 
+//
+// Date in format of HTTP headers
+//
+static wxString HttpDate(time_t t)
+{
+	char tmp[64];
+	strftime(tmp, sizeof(tmp), "%a, %d %b %Y %H:%M:%S GMT", gmtime(&t));
+	return wxString(char2unicode(tmp));
+}
+
+//
+// Headers letting the browser validate its cached copy
+//
+static wxString ValidatorHeaders(const wxString &etag, const wxString &last_modified)
+{
+	wxString headers;
+	if ( !etag.IsEmpty() ) {
+		headers += wxT("ETag: ") + etag + wxT("\r\n");
+	}
+	if ( !last_modified.IsEmpty() ) {
+		headers += wxT("Last-Modified: ") + last_modified + wxT("\r\n");
+	}
+	return headers;
+}
+
+//
+// Check if the copy cached by the browser is still valid. If-None-Match
+// takes precedence, as in RFC 7232.
+//
+static bool IsNotModified(const ThreadData &Data, const wxString &etag, const wxString &last_modified)
+{
+	if ( !Data.IfNoneMatch.IsEmpty() ) {
+		return !etag.IsEmpty() &&
+			((Data.IfNoneMatch == wxT("*")) || (Data.IfNoneMatch.Find(etag) != wxNOT_FOUND));
+	}
+	return !last_modified.IsEmpty() && (Data.IfModifiedSince == last_modified);
+}
+
 wxString _SpecialChars(wxString str) {
 	str.Replace(wxT("&"),wxT("&amp;"));
 	str.Replace(wxT("<"),wxT("&lt;"));
@@ -376,19 +415,36 @@ void CScriptWebServer::ProcessImgFileReq(ThreadData Data)
 	if (img && (session->m_loggedin || dynamic_cast<CFileImage*>(img))) {
 		int img_size = 0;
 		unsigned char* img_data = img->RequestData(img_size);
+		wxString validators = ValidatorHeaders(img->GetETag(), img->GetLastModified());
 		// This unicode2char is ok.
-		Data.pSocket->SendContent(unicode2char(img->GetHTTP()), img_data, img_size);
+		if ( IsNotModified(Data, img->GetETag(), img->GetLastModified()) ) {
+			Data.pSocket->SendNotModified(unicode2char(validators));
+		} else {
+			Data.pSocket->SendContent(unicode2char(img->GetHTTP() + validators), img_data, img_size);
+		}
 	} else if (!session->m_loggedin) {
 		webInterface->DebugShow(wxT("**** imgrequest: failed, not logged in\n"));
 		ProcessURL(Data);
 	} else {
 		webInterface->DebugShow(wxT("**** imgrequest: failed\n"));
+		// persistent connection waits for an answer
+		Data.pSocket->SendError("404 Not Found");
 	}
 }
 
+void CWebServerBase::InvalidateContainers()
+{
+	m_ServersInfo.Invalidate();
+	m_SharedFileInfo.Invalidate();
+	m_DownloadFileInfo.Invalidate();
+	m_UploadsInfo.Invalidate();
+	m_SearchInfo.Invalidate();
+}
+
 // send EC request and discard output
 void CWebServerBase::Send_Discard_V2_Request(CECPacket *request)
 {
+	InvalidateContainers();
 	const CECPacket *reply = webInterface->SendRecvMsg_v2(request);
 	const CECTag *tag = NULL;
 	if (reply) {
@@ -553,6 +609,7 @@ bool CWebServerBase::Send_DownloadEd2k_Cmd(wxString link, uint8 cat)
 	CECTag link_tag(EC_TAG_STRING, link);
 	link_tag.AddTag(CECTag(EC_TAG_PARTFILE_CAT, cat));
 	req.AddTag(link_tag);
+	InvalidateContainers();
 	const CECPacket *response = webInterface->SendRecvMsg_v2(&req);
 	bool result = (response->GetOpCode() == EC_OP_FAILED);
 	delete response;
@@ -969,13 +1026,16 @@ unsigned char *CAnyImage::RequestData(int &size)
 void CAnyImage::SetHttpType(wxString ext)
 {
 	m_Http = wxT("Content-Type: ") + ext + wxT("\r\n");
+}
 
-	time_t t = time(NULL);
-	char tmp[255];
-	strftime(tmp, 255, "%a, %d %b %Y %H:%M:%S GMT", gmtime(&t));
-	m_Http += wxT("Last-Modified: ") + wxString(char2unicode(tmp)) + wxT("\r\n");
+void CAnyImage::SetLastModified(time_t mtime)
+{
+	m_LastModified = HttpDate(mtime);
+}
 
-	m_Http += wxT("ETag: ") + MD5Sum(char2unicode(tmp)).GetHash() + wxT("\r\n");
+void CAnyImage::SetETag()
+{
+	m_ETag = wxT("\"") + MD5Sum(m_data, m_size).GetHash() + wxT("\"");
 }
 
 CFileImage::CFileImage(const wxString& name) : CAnyImage(0)
@@ -993,6 +1053,8 @@ CFileImage::CFileImage(const wxString& name) : CAnyImage(0)
 		if ( file_size ) {
 			Realloc(fis.Length());
 			m_size = fis.Read(m_data,file_size);
+			SetETag();
+			SetLastModified(wxFileModificationTime(m_name));
 		} else {
 			printf("CFileImage: file %s have zero length\n", (const char *)unicode2char(m_name));
 		}
@@ -1149,6 +1211,9 @@ CDynPngImage::CDynPngImage(int w, int h) : CAnyImage(w, h)
 		m_row_ptrs[i] = &m_img_data[3*m_width*i];
 	}
 
+	// generated images change, browser must check its copy each time
+	SetHttpType(wxT("image/png"));
+	m_Http += wxT("Cache-Control: no-cache\r\n");
 }
 
 CDynPngImage::~CDynPngImage()
@@ -1166,7 +1231,7 @@ void CDynPngImage::png_write_fn(png_structp png_ptr, png_bytep data, png_size_t
 }
 
 
-unsigned char *CDynPngImage::RequestData(int &size)
+void CDynPngImage::Encode()
 {
 	// write png into buffer
 	png_structp png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, 0, 0, 0);
@@ -1181,6 +1246,13 @@ unsigned char *CDynPngImage::RequestData(int &size)
 	png_write_end(png_ptr, 0);
 	png_destroy_write_struct(&png_ptr, &info_ptr);
 
+	SetETag();
+}
+
+unsigned char *CDynPngImage::RequestData(int &size)
+{
+	Encode();
+
 	return CAnyImage::RequestData(size);
 }
 
@@ -1188,7 +1260,8 @@ CDynProgressImage::CDynProgressImage(int width, int height, wxString &tmpl, Down
 	CAnyImage(width, height),
 	CProgressImage(width, height, tmpl, file),
 	CDynPngImage(width, height),
-	m_modifiers(height)
+	m_modifiers(height),
+	m_EncodedLine(width)
 {
 	m_name = wxT("dyn_") + m_file->sFileHash + wxT(".png");
 }
@@ -1205,8 +1278,6 @@ wxString CDynProgressImage::GetHTML()
 
 void CDynProgressImage::DrawImage()
 {
-	CreateSpan();
-
 	for(int i = 0; i < m_height; i++) {
 			memset(m_row_ptrs[i], 0, 3*m_width);
 	}
@@ -1222,10 +1293,18 @@ void CDynProgressImage::DrawImage()
 
 unsigned char *CDynProgressImage::RequestData(int &size)
 {
-	// create new one
-	DrawImage();
+	//
+	// Gap info is updated on every page refresh, but mostly it does not
+	// change what the bar looks like. Encode only if it does.
+	//
+	CreateSpan();
+	if ( !m_size || memcmp(&m_EncodedLine[0], m_ColorLine, m_width * sizeof(uint32)) ) {
+		memcpy(&m_EncodedLine[0], m_ColorLine, m_width * sizeof(uint32));
+		DrawImage();
+		Encode();
+	}
 
-	return CDynPngImage::RequestData(size);
+	return CAnyImage::RequestData(size);
 }
 
 #else
@@ -1295,6 +1374,7 @@ CStatsData::CStatsData(int size)
 	memset(m_data, 0, m_size*sizeof(int));
 	m_start_index = m_curr_index = 0;
 	m_end_index = size - 1;
+	m_count = 0;
 }
 
 CStatsData::~CStatsData()
@@ -1320,6 +1400,7 @@ void CStatsData::PushSample(uint32 sample)
 	m_start_index = (m_start_index + 1) % m_size;
 	m_end_index = (m_end_index + 1) % m_size;
 	m_data[m_start_index] = sample;
+	m_count++;
 
 	if ( m_max_value < sample ) {
 		m_max_value = sample;
@@ -1383,6 +1464,8 @@ CDynStatisticImage::CDynStatisticImage(int height, bool scale1024, CStatsData *d
 {
 	m_data = data;
 	m_scale1024 = scale1024;
+	m_EncodedCount = 0;
+	m_Encoded = false;
 
 	// actual name doesn't matter, just make it unique
 	m_name = CFormat(wxT("dyn_%p_stat.png")) % data;
@@ -1569,9 +1652,15 @@ void CDynStatisticImage::DrawImage()
 
 unsigned char *CDynStatisticImage::RequestData(int &size)
 {
-	DrawImage();
+	// new samples arrive only when statistics page is refreshed
+	if ( !m_Encoded || (m_EncodedCount != m_data->Count()) ) {
+		m_EncodedCount = m_data->Count();
+		m_Encoded = true;
+		DrawImage();
+		Encode();
+	}
 
-	return CDynPngImage::RequestData(size);
+	return CAnyImage::RequestData(size);
 }
 
 wxString CDynStatisticImage::GetHTML()
@@ -1735,7 +1824,8 @@ CAnyImage *CImageLib::GetImage(const wxString &name)
  * Script-based webserver
  */
 CScriptWebServer::CScriptWebServer(CamulewebApp *webApp, const wxString& templateDir)
-	: CWebServerBase(webApp, templateDir), m_wwwroot(templateDir)
+	: CWebServerBase(webApp, templateDir), m_wwwroot(templateDir),
+	  m_templates(new CPhpTemplateCache)
 {
 	wxString img_tmpl(wxT("<img src=\"%s\" height=\"20\" width=\"%d\" alt=\"%s\">"));
 	m_DownloadFileInfo.LoadImageParams(img_tmpl, 200, 20);
@@ -1752,6 +1842,7 @@ CScriptWebServer::CScriptWebServer(CamulewebApp *webApp, const wxString& templat
 
 CScriptWebServer::~CScriptWebServer()
 {
+	delete m_templates;
 }
 
 char *CScriptWebServer::GetErrorPage(const char *message, long &size)
@@ -1775,26 +1866,88 @@ char *CScriptWebServer::Get_404_Page(long &size)
 		return buf;
 }
 
-char *CScriptWebServer::ProcessHtmlRequest(const char *filename, long &size)
+const CStaticFile *CScriptWebServer::GetStaticFile(const wxString &filename, bool use_gzip)
 {
-	FILE *f = fopen(filename, "r");
-	if ( !f ) {
-		return Get_404_Page(size);
+	struct stat st;
+	if ( stat(unicode2char(filename), &st) != 0 ) {
+		m_static_files.erase(filename);
+		return 0;
 	}
-	if ( fseek(f, 0, SEEK_END) != 0 ) {
+
+	CStaticFile &file = m_static_files[filename];
+	if ( file.m_ETag.IsEmpty() || (file.m_mtime != st.st_mtime) || (file.m_size != st.st_size) ) {
+		FILE *f = fopen(unicode2char(filename), "r");
+		if ( !f ) {
+			m_static_files.erase(filename);
+			return 0;
+		}
+		file.m_data.resize(st.st_size);
+		// fread may actually read less if it is a CR-LF-file in Windows
+		size_t size = st.st_size ? fread(&file.m_data[0], 1, st.st_size, f) : 0;
 		fclose(f);
-		return GetErrorPage("fseek failed", size);
+		file.m_data.resize(size);
+		file.m_gzdata.clear();
+
+		file.m_mtime = st.st_mtime;
+		file.m_size = st.st_size;
+		file.m_ETag = wxT("\"") +
+			MD5Sum((const uint8 *)(size ? &file.m_data[0] : ""), size).GetHash() + wxT("\"");
+		file.m_LastModified = HttpDate(st.st_mtime);
 	}
 
-	size = ftell(f);
-	char *buf = new char [size+1];
-	rewind(f);
-	// fread may actually read less if it is a CR-LF-file in Windows
-	size = fread(buf, 1, size, f);
-	buf[size] = 0;
-	fclose(f);
+	//
+	// Compress once with best ratio, instead of on each request
+	//
+	if ( use_gzip && file.m_gzdata.empty() && !file.m_data.empty() ) {
+		uLongf destLen = file.m_data.size() + 1024;
+		file.m_gzdata.resize(destLen);
+		if ( GzipCompress((Bytef*)&file.m_gzdata[0], &destLen,
+		   (const Bytef*)&file.m_data[0], file.m_data.size(), Z_BEST_COMPRESSION) == Z_OK ) {
+			file.m_gzdata.resize(destLen);
+			file.m_gzETag = file.m_ETag.Left(file.m_ETag.Length() - 1) + wxT("-gz\"");
+		} else {
+			file.m_gzdata.clear();
+		}
+	}
 
-	return buf;
+	return &file;
+}
+
+void CScriptWebServer::ProcessStaticRequest(ThreadData &Data, const wxString &filename, const char *type)
+{
+	bool use_gzip = webInterface->m_UseGzip && Data.AcceptGzip;
+	const CStaticFile *file = GetStaticFile(filename, use_gzip);
+	if ( !file ) {
+		long size;
+		char *buf = Get_404_Page(size);
+		Data.pSocket->SendHttpHeaders("text/html", false, size, Data.SessionID);
+		Data.pSocket->SendData(buf, size);
+		delete [] buf;
+		return;
+	}
+
+	//
+	// The compressed and the plain data are different representations, so
+	// they must not share an ETag, and caches must key them on Accept-Encoding
+	//
+	use_gzip = use_gzip && !file->m_gzdata.empty();
+	const wxString &etag = use_gzip ? file->m_gzETag : file->m_ETag;
+	wxString validators = ValidatorHeaders(etag, file->m_LastModified);
+	if ( webInterface->m_UseGzip ) {
+		validators += wxT("Vary: Accept-Encoding\r\n");
+	}
+	if ( IsNotModified(Data, etag, file->m_LastModified) ) {
+		Data.pSocket->SendNotModified(unicode2char(validators));
+		return;
+	}
+
+	const std::vector<char> &data = use_gzip ? file->m_gzdata : file->m_data;
+
+	wxString headers = wxT("Content-Type: ") + wxString(char2unicode(type)) + wxT("\r\n") + validators;
+	if ( use_gzip ) {
+		headers += wxT("Content-Encoding: gzip\r\n");
+	}
+	Data.pSocket->SendContent(unicode2char(headers), data.empty() ? "" : &data[0], data.size());
 }
 
 char *CScriptWebServer::ProcessPhpRequest(const char *filename, CSession *sess, long &size)
@@ -1805,7 +1958,7 @@ char *CScriptWebServer::ProcessPhpRequest(const char *filename, CSession *sess,
 	}
 
 	CWriteStrBuffer buffer;
-	CPhpFilter(this, sess, filename, &buffer);
+	CPhpFilter(this, sess, filename, &buffer, m_templates);
 
 	size = buffer.Length();
 	char *buf = new char [size+1];
@@ -1923,32 +2076,33 @@ void CScriptWebServer::ProcessURL(ThreadData Data)
 
 	wxString req_file(wxFileName(m_wwwroot, filename).GetFullPath());
 	if (req_file.EndsWith(wxT(".html"))) {
-		httpOut = ProcessHtmlRequest(unicode2char(req_file), httpOutLen);
+		ProcessStaticRequest(Data, req_file, "text/html");
+		return;
 	} else if (req_file.EndsWith(wxT(".php"))) {
 		httpOut = ProcessPhpRequest(unicode2char(req_file), session, httpOutLen);
 	} else if (req_file.EndsWith(wxT(".css"))) {
-		session->m_vars["content_type"] = "text/css";
-		httpOut = ProcessHtmlRequest(unicode2char(req_file), httpOutLen);
+		ProcessStaticRequest(Data, req_file, "text/css");
+		return;
 	} else if (req_file.EndsWith(wxT(".js"))) {
-		session->m_vars["content_type"] = "text/javascript";
-		httpOut = ProcessHtmlRequest(unicode2char(req_file), httpOutLen);
+		ProcessStaticRequest(Data, req_file, "text/javascript");
+		return;
 	} else if (	req_file.EndsWith(wxT(".dtd"))
 				|| req_file.EndsWith(wxT(".xsd"))
 				|| req_file.EndsWith(wxT(".xsl"))) {
-		session->m_vars["content_type"] = "text/xml";
-		httpOut = ProcessHtmlRequest(unicode2char(req_file), httpOutLen);
+		ProcessStaticRequest(Data, req_file, "text/xml");
+		return;
 	} else if (req_file.EndsWith(wxT(".appcache"))
 		   || req_file.EndsWith(wxT(".manifest"))) {
-		session->m_vars["content_type"] = "text/cache-manifest";
-		httpOut = ProcessHtmlRequest(unicode2char(req_file), httpOutLen);
+		ProcessStaticRequest(Data, req_file, "text/cache-manifest");
+		return;
 	} else if (req_file.EndsWith(wxT(".json"))) {
-		session->m_vars["content_type"] = "application/json";
-		httpOut = ProcessHtmlRequest(unicode2char(req_file), httpOutLen);
+		ProcessStaticRequest(Data, req_file, "application/json");
+		return;
 	} else {
 		httpOut = GetErrorPage("aMuleweb doesn't handle the requested file type ", httpOutLen);
 	}
 
-	bool isUseGzip = webInterface->m_UseGzip;
+	bool isUseGzip = webInterface->m_UseGzip && Data.AcceptGzip;
 
 	if (isUseGzip)	{
 		bool bOk = false;
@@ -1972,6 +2126,8 @@ void CScriptWebServer::ProcessURL(ThreadData Data)
 		Data.pSocket->SendHttpHeaders(session->m_vars["content_type"].c_str(), isUseGzip, httpOutLen, Data.SessionID);
 		Data.pSocket->SendData(httpOut, httpOutLen);
 		delete [] httpOut;
+	} else {
+		Data.pSocket->SendError("404 Not Found");
 	}
 }
 
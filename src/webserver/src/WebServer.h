@@ -36,6 +36,7 @@
 #include "WebInterface.h"
 #include <map>				// Needed for std::map
 #include <set>				// Needed for std::set
+#include <vector>			// Needed for std::vector
 #include "RLE.h"
 #include "OtherStructs.h"
 #include <ec/cpp/ECID.h>	// Needed for CECID
@@ -45,6 +46,7 @@
 #endif
 
 #include <wx/datetime.h>	// For DownloadFile::wxtLastSeenComplete
+#include <wx/stopwatch.h>	// Needed for wxGetLocalTimeMillis
 
 #ifdef _MSC_VER
 #define strncasecmp _strnicmp
@@ -182,6 +184,9 @@ class SearchFile : public CECID {
 };
 
 
+// Requests arriving within this time (ms) share the data of one query
+#define WEB_QUERY_COALESCE_TIME	1000
+
 /*!
  * T - type of items in container
  */
@@ -190,6 +195,8 @@ class ItemsContainer {
 	protected:
 		CamulewebApp *m_webApp;
 		std::list<T> m_items;
+		// time of last query, 0 if data is outdated
+		wxLongLong m_lastQuery;
 
 
 		void EraseAll()
@@ -197,7 +204,7 @@ class ItemsContainer {
 			m_items.erase(m_items.begin(), m_items.end());
 		}
 	public:
-		ItemsContainer(CamulewebApp *webApp)
+		ItemsContainer(CamulewebApp *webApp) : m_lastQuery(0)
 		{
 			m_webApp = webApp;
 		}
@@ -222,6 +229,31 @@ class ItemsContainer {
 		 */
 		virtual bool ReQuery() = 0;
 
+		/*!
+		 * Re-query server unless it was done just before. Pages loaded
+		 * together (frames, several tabs or clients) are served from
+		 * the same answer instead of querying the core for each.
+		 */
+		bool Refresh()
+		{
+			wxLongLong now = wxGetLocalTimeMillis();
+			if ( (m_lastQuery != 0) && (now >= m_lastQuery) &&
+				(now - m_lastQuery < WEB_QUERY_COALESCE_TIME) ) {
+				return true;
+			}
+			bool result = ReQuery();
+			m_lastQuery = result ? now : wxLongLong(0);
+			return result;
+		}
+
+		/*!
+		 * Data is outdated, next Refresh() has to query the server
+		 */
+		void Invalidate()
+		{
+			m_lastQuery = 0;
+		}
+
 		typedef typename std::list<T>::iterator ItemIterator;
 		ItemIterator GetBeginIterator()
 		{
@@ -439,15 +471,24 @@ class CAnyImage {
 		int m_size, m_alloc_size;
 		wxString m_Http;
 
+		// validators: hash of content and time of file modification
+		wxString m_ETag;
+		wxString m_LastModified;
+
 		void Realloc(int size);
 
 		void SetHttpType(wxString ext);
+		void SetLastModified(time_t mtime);
+		// must be called whenever m_data changes
+		void SetETag();
 	public:
 		CAnyImage(int size);
 		CAnyImage(int width, int height);
 		virtual ~CAnyImage();
 
 		const wxString& GetHTTP() const { return m_Http; }
+		const wxString& GetETag() const { return m_ETag; }
+		const wxString& GetLastModified() const { return m_LastModified; }
 
 		virtual unsigned char *RequestData(int &size);
 };
@@ -514,6 +555,9 @@ class CDynPngImage : public virtual CAnyImage {
 		png_bytep m_img_data;
 		png_bytep *m_row_ptrs;
 
+		// encode m_img_data into m_data
+		void Encode();
+
 		static void png_write_fn(png_structp png_ptr, png_bytep data, png_size_t length);
 
 };
@@ -523,6 +567,9 @@ class CDynPngImage : public virtual CAnyImage {
 class CDynProgressImage : public virtual CProgressImage, public virtual CDynPngImage {
 		CImage3D_Modifiers m_modifiers;
 
+		// colors of last encoded image
+		std::vector<uint32> m_EncodedLine;
+
 		void DrawImage();
 	public:
 		CDynProgressImage(int w, int h,	wxString &tmpl, DownloadFile *file);
@@ -555,12 +602,15 @@ class CStatsData {
 		uint32 m_max_value;
 		int m_size;
 		int m_start_index, m_end_index, m_curr_index;
+		// number of samples pushed so far
+		uint32 m_count;
 	public:
 		CStatsData(int size);
 		~CStatsData();
 
 		int Size() const { return m_size; }
 		uint32 Max() const { return m_max_value; }
+		uint32 Count() const { return m_count; }
 		uint32 GetFirst();
 		uint32 GetNext();
 
@@ -623,6 +673,10 @@ class CDynStatisticImage : public virtual CDynPngImage {
 		// hope nobody needs "define" for 10 !
 		CNumImageMask *m_digits[10];
 
+		// sample count of m_data when image was encoded
+		uint32 m_EncodedCount;
+		bool m_Encoded;
+
 		// indicates whether data should be divided on 1024 before
 		// drawing graph.
 		bool m_scale1024;
@@ -680,6 +734,11 @@ struct ThreadData {
 	wxString	sURL;
 	int		SessionID;
 	CWebSocket	*pSocket;
+	// conditional request headers, empty if not sent
+	wxString	IfNoneMatch;
+	wxString	IfModifiedSince;
+	// browser accepts gzip content coding
+	bool		AcceptGzip;
 };
 
 #ifndef ASIO_SOCKETS
@@ -724,6 +783,9 @@ class CWebServerBase : public wxEvtHandler {
 		int GzipCompress(Bytef *dest, uLongf *destLen,
 			const Bytef *source, uLong sourceLen, int level);
 
+		// commands change the data, next page must query it again
+		void InvalidateContainers();
+
 		friend class CWebSocket;
 		friend class CPhPLibContext;
 
@@ -789,6 +851,26 @@ class CSession {
 		void LoadVars(CParsedUrl &url);
 };
 
+//
+// Template file which is sent as it is (css, js, html). Kept in memory
+// together with its compressed form, reloaded when the file changes.
+//
+class CStaticFile {
+	public:
+		std::vector<char> m_data;
+		// gzip'ed data, created on first use
+		std::vector<char> m_gzdata;
+		wxString m_ETag;
+		// ETag of the gzip'ed data, a representation of its own
+		wxString m_gzETag;
+		wxString m_LastModified;
+
+		time_t m_mtime;
+		long m_size;
+};
+
+class CPhpTemplateCache;
+
 /*
  * Script based webserver
  */
@@ -796,7 +878,15 @@ class CScriptWebServer : public CWebServerBase {
 		wxString m_wwwroot;
 		wxString m_index;
 
-		char *ProcessHtmlRequest(const char *filename, long &size);
+		// php pages, parsed once
+		CPhpTemplateCache *m_templates;
+
+		// other files, by full path
+		std::map<wxString, CStaticFile> m_static_files;
+
+		// 0 if file can't be read
+		const CStaticFile *GetStaticFile(const wxString &filename, bool use_gzip);
+		void ProcessStaticRequest(ThreadData &Data, const wxString &filename, const char *type);
 		char *ProcessPhpRequest(const char *filename, CSession *sess, long &size);
 
 		char *GetErrorPage(const char *message, long &size);
@@ -32,6 +32,67 @@
 #	include "UPnPBase.h"
 #endif
 
+// Requests with larger headers or content are refused
+#define WEB_MAX_HEADER_SIZE		(64*1024)
+#define WEB_MAX_CONTENT_SIZE	(1024*1024)
+
+
+/*
+ * Find value of a request header, headers end with an empty line.
+ * Returns 0 if header is not there.
+ */
+static const char *FindHeader(const char *pHeader, const char *pEnd, const char *szName)
+{
+	const size_t len = strlen(szName);
+	const char *line = strstr(pHeader, "\r\n");
+	while ( line && line < pEnd ) {
+		line += 2;
+		if ( !strncasecmp(line, szName, len) && line[len] == ':' ) {
+			const char *value = line + len + 1;
+			while ( *value == ' ' || *value == '\t' ) {
+				value++;
+			}
+			return value;
+		}
+		line = strstr(line, "\r\n");
+	}
+	return 0;
+}
+
+
+/*
+ * Value of a request header, up to the end of line
+ */
+static wxString GetHeaderValue(const char *pHeader, const char *szName)
+{
+	const char *pEnd = strstr(pHeader, "\r\n\r\n");
+	const char *value = pEnd ? FindHeader(pHeader, pEnd, szName) : 0;
+	if ( !value ) {
+		return wxEmptyString;
+	}
+	const char *value_end = strstr(value, "\r\n");
+	return wxString(value, wxConvUTF8, value_end - value);
+}
+
+
+/*
+ * HTTP/1.1 connections are persistent unless client says otherwise,
+ * HTTP/1.0 ones only if client asks for it.
+ */
+static bool IsKeepAlive(const char *pHeader, const char *pEnd)
+{
+	const char *connection = FindHeader(pHeader, pEnd, "Connection");
+	if ( connection ) {
+		if ( !strncasecmp(connection, "close", 5) ) {
+			return false;
+		} else if ( !strncasecmp(connection, "keep-alive", 10) ) {
+			return true;
+		}
+	}
+	const char *line_end = strstr(pHeader, "\r\n");
+	return line_end && (line_end - pHeader >= 8) && !strncmp(line_end - 8, "HTTP/1.1", 8);
+}
+
 CWebSocket::CWebSocket(CWebServerBase *parent)
 {
 	m_pHead = 0;
@@ -42,8 +103,8 @@ CWebSocket::CWebSocket(CWebServerBase *parent)
 	m_dwHttpHeaderLen = 0;
 	m_dwHttpContentLen = 0;
 	m_Cookie = 0;
-	m_IsGet = false;
-	m_IsPost = false;
+	m_KeepAlive = false;
+	m_CloseWhenSent = false;
 
 	m_pParent = parent;
 
@@ -88,55 +149,89 @@ void CWebSocket::OnReceive(int)
 
 	m_pBuf[m_dwRecv] = '\0';
 
-
 	//
-	// Check what kind of request is that
-	if ( !m_IsGet && !m_IsPost && m_dwRecv >= 4) {
-		if ( !strncasecmp(m_pBuf, "GET", 3) ) {
-			m_IsGet = true;
-		} else if ( !strncasecmp(m_pBuf, "POST", 4) ) {
-			m_IsPost = true;
-		} else {
+	// Handle every complete request. Clients may send more requests
+	// before they got the answer to the first one (pipelining), they
+	// are answered in order.
+	//
+	uint32 done = 0;
+	while ( (done < m_dwRecv) && !m_CloseWhenSent ) {
+		char *request = m_pBuf + done;
+		uint32 avail = m_dwRecv - done;
+
+		//
+		// Check what kind of request is that
+		bool is_post = false;
+		if ( avail < 5 ) {
+			break;
+		} else if ( !strncasecmp(request, "POST ", 5) ) {
+			is_post = true;
+		} else if ( strncasecmp(request, "GET ", 4) ) {
 			// unknown request - close the socket
-			Close();
+			OnLost();
 			return ;
 		}
-	}
-	//
-	// RFC1945:
-	//
 
-	//
-	// "GET" must have last line empty
-	if ( m_IsGet ) {
-		if ( !strncasecmp(m_pBuf + m_dwRecv - 4, "\r\n\r\n", 4) ) {
-			//
-			// Process request
-			OnRequestReceived(m_pBuf, 0, 0);
+		//
+		// RFC1945:
+		// Headers end with an empty line
+		char *header_end = strstr(request, "\r\n\r\n");
+		if ( !header_end ) {
+			if ( avail > WEB_MAX_HEADER_SIZE ) {
+				OnLost();
+				return ;
+			}
+			break;
 		}
-	}
-	//
-	// "POST" have "Content-Length"
-	if ( m_IsPost ) {
-		char *cont_len = strstr(m_pBuf, "Content-Length");
-		// do we have received all the line ?
-		if ( cont_len && strstr(cont_len, "\r\n\r\n") ) {
-			cont_len += strlen("Content-Length:");
-			// can be white space following
-			while ( isspace(*cont_len) ) cont_len++;
-			int len = atoi(cont_len);
-			if ( !len ) {
-				Close();
+		uint32 header_len = header_end + 4 - request;
+
+		//
+		// "POST" have "Content-Length"
+		uint32 content_len = 0;
+		if ( is_post ) {
+			const char *cont_len = FindHeader(request, header_end, "Content-Length");
+			int len = cont_len ? atoi(cont_len) : -1;
+			if ( (len < 0) || (len > WEB_MAX_CONTENT_SIZE) ) {
+				OnLost();
 				return ;
 			}
-			// do we have all of data ?
-			char *cont = strstr(m_pBuf, "\r\n\r\n");
-			cont += 4;
-			if ( cont - m_pBuf + len <= (int)m_dwRecv ) {
-				OnRequestReceived(m_pBuf, cont, len);
+			content_len = len;
+		}
+		// do we have all of data ?
+		if ( header_len + content_len > avail ) {
+			break;
+		}
+
+		m_KeepAlive = IsKeepAlive(request, header_end);
+
+		// Content may be followed by next request
+		char *next = request + header_len + content_len;
+		char next_char = *next;
+		*next = 0;
+		//
+		// Process request
+		OnRequestReceived(request, is_post ? request + header_len : 0, content_len);
+		*next = next_char;
+
+		done += header_len + content_len;
+
+		if ( !m_KeepAlive ) {
+			m_CloseWhenSent = true;
+			if ( !m_pHead ) {
+				OnLost();
+				return ;
 			}
 		}
 	}
+
+	//
+	// Done processing, keep the start of next request
+	//
+	if ( done ) {
+		m_dwRecv -= done;
+		memmove(m_pBuf, m_pBuf + done, m_dwRecv);
+		m_pBuf[m_dwRecv] = '\0';
+	}
 }
 
 void CWebSocket::OnSend(int)
@@ -163,6 +258,9 @@ void CWebSocket::OnSend(int)
 			}
 		}
 	}
+	if (!m_pHead && m_CloseWhenSent) {
+		OnLost();
+	}
 }
 
 void CWebSocket::OnRequestReceived(char* pHeader, char* pData, uint32 dwDataLen)
@@ -173,15 +271,18 @@ void CWebSocket::OnRequestReceived(char* pHeader, char* pData, uint32 dwDataLen)
 		is_post = true;
 	} else {
 		// invalid request
+		m_KeepAlive = false;
 		return ;
 	}
 	char *path = strchr(pHeader, ' ');
 	if ( !path ) {
+		m_KeepAlive = false;
 		return;
 	}
 	*path++ = 0;
 	pHeader = strchr(path, ' ');
 	if ( !pHeader ) {
+		m_KeepAlive = false;
 		return;
 	}
 	*pHeader++ = 0;
@@ -211,6 +312,17 @@ void CWebSocket::OnRequestReceived(char* pHeader, char* pData, uint32 dwDataLen)
 	}
 	ThreadData Data = { CParsedUrl(sURL), sURL, sessid, this };
 
+	//
+	// Validators of cached copy, if browser has one
+	//
+	Data.IfNoneMatch = GetHeaderValue(pHeader, "If-None-Match");
+	Data.IfModifiedSince = GetHeaderValue(pHeader, "If-Modified-Since");
+
+	//
+	// Compressed content only to browsers asking for it
+	//
+	Data.AcceptGzip = GetHeaderValue(pHeader, "Accept-Encoding").Lower().Find(wxT("gzip")) != wxNOT_FOUND;
+
 	wxString sFile = Data.parsedURL.File();
 	if (sFile.Length() > 4 ) {
 		wxString url_ext = sFile.Right( sFile.Length() - sFile.Find('.', true) ).MakeLower();
@@ -224,17 +336,12 @@ void CWebSocket::OnRequestReceived(char* pHeader, char* pData, uint32 dwDataLen)
 		m_pParent->ProcessURL(Data);
 	}
 
-	//
-	// Done processing, reset state
-	//
-	m_dwRecv = 0;
-	m_IsGet = 0;
-	m_IsPost = 0;
 }
 
 void CWebSocket::SendContent(const char* szStdResponse, const void* pContent, uint32 dwContentSize) {
 	char szBuf[0x1000]; // 0x1000 is safe because it's just used for the header
-	int nLen = snprintf(szBuf, sizeof(szBuf), "HTTP/1.1 200 OK\r\n%sContent-Length: %d\r\n\r\n", szStdResponse, dwContentSize);
+	int nLen = snprintf(szBuf, sizeof(szBuf), "HTTP/1.1 200 OK\r\n%sConnection: %s\r\nContent-Length: %d\r\n\r\n",
+		szStdResponse, (m_KeepAlive ? "keep-alive" : "close"), dwContentSize);
 	SendData(szBuf, nLen);
 	SendData(pContent, dwContentSize);
 }
@@ -253,9 +360,27 @@ void CWebSocket::SendHttpHeaders(const char* szType, bool use_gzip, uint32 conte
 	snprintf(szBuf, sizeof(szBuf), "HTTP/1.1 200 OK\r\nServer: aMule\r\nPragma: no-cache\r\nExpires: 0\r\n"
 		"Cache-Control: no-cache, no-store, must-revalidate\r\n"
 		"%s"
-		"Connection: close\r\nContent-Type: %s\r\n"
+		"Connection: %s\r\nContent-Type: %s\r\n"
 		"Content-Length: %d\r\n%s\r\n",
-		 cookie, szType, content_len, (use_gzip ? "Content-Encoding: gzip\r\n" : ""));
+		 cookie, (m_KeepAlive ? "keep-alive" : "close"), szType, content_len, (use_gzip ? "Content-Encoding: gzip\r\n" : ""));
+
+	SendData(szBuf, strlen(szBuf));
+}
+
+void CWebSocket::SendError(const char* szStatus)
+{
+	char szBuf[0x1000];
+	snprintf(szBuf, sizeof(szBuf), "HTTP/1.1 %s\r\nServer: aMule\r\nConnection: %s\r\nContent-Length: 0\r\n\r\n",
+		szStatus, (m_KeepAlive ? "keep-alive" : "close"));
+
+	SendData(szBuf, strlen(szBuf));
+}
+
+void CWebSocket::SendNotModified(const char* szHeaders)
+{
+	char szBuf[0x1000];
+	snprintf(szBuf, sizeof(szBuf), "HTTP/1.1 304 Not Modified\r\nServer: aMule\r\n%sConnection: %s\r\n\r\n",
+		szHeaders, (m_KeepAlive ? "keep-alive" : "close"));
 
 	SendData(szBuf, strlen(szBuf));
 }
@@ -52,6 +52,10 @@ class CWebSocket : public CLibSocket {
 		void SendContent(const char* szStdResponse, const void* pContent, uint32 dwContentSize);
 		void SendData(const void* pData, uint32 dwDataSize);
 		void SendHttpHeaders(const char * szType, bool use_gzip, uint32 content_len, int session_id);
+		// empty response with given status, like "404 Not Found"
+		void SendError(const char * szStatus);
+		// "304 Not Modified", szHeaders are the validators (ETag etc)
+		void SendNotModified(const char * szHeaders);
 
 		CWebServerBase *m_pParent;
 
@@ -68,7 +72,10 @@ class CWebSocket : public CLibSocket {
 		CChunk *m_pHead; // tails of what has to be sent
 		CChunk *m_pTail;
 
-		bool m_IsGet, m_IsPost;
+		// connection is kept open after the current request
+		bool m_KeepAlive;
+		// close connection when all data is sent
+		bool m_CloseWhenSent;
 		char *m_Cookie;
 		char *m_pBuf;
 		uint32 m_dwBufSize;
@@ -32,6 +32,7 @@
 
 #include "WebServer.h"
 #include <ec/cpp/ECSpecialTags.h>
+#include "ArchSpecific.h"		// Needed for ENDIAN_NTOHL
 
 #include "php_syntree.h"
 #include "php_core_lib.h"
@@ -659,6 +660,81 @@ void php_get_serverinfo(PHP_VALUE_NODE *result)
 	}
 }
 
+/*
+ * Request a range of the statistics history. Params: tier (0=seconds,
+ * 1=minutes, 2=hours), from, to (unix times). Returns hash with the start
+ * time of the first row and one row per period of the tier. Values of
+ * periods without a sample are left unset.
+ */
+void php_get_stats_history(PHP_VALUE_NODE *result)
+{
+	static const char *columns[] = {
+		"speed_down", "speed_up", "connections", "kad_nodes", "uploads", "downloads"
+	};
+	const unsigned column_count = sizeof(columns) / sizeof(columns[0]);
+
+	uint32 params[3];
+	for (int i = 0; i < 3; i++) {
+		char param_name[16];
+		snprintf(param_name, sizeof(param_name), "__param_%d", i);
+		PHP_SCOPE_ITEM *si = get_scope_item(g_current_scope, param_name);
+		if ( !si ) {
+			php_report_error(PHP_ERROR, "Missing argument %d (tier, from, to)", i + 1);
+			return;
+		}
+		cast_value_dnum(&si->var->value);
+		params[i] = si->var->value.int_val;
+	}
+
+	CECPacket req(EC_OP_GET_STATSHISTORY);
+	req.AddTag(CECTag(EC_TAG_STATSHISTORY_TIER, (uint8)params[0]));
+	req.AddTag(CECTag(EC_TAG_STATSHISTORY_FROM, params[1]));
+	req.AddTag(CECTag(EC_TAG_STATSHISTORY_TO, params[2]));
+	const CECPacket *response = CPhPLibContext::g_curr_context->WebServer()->webInterface->SendRecvMsg_v2(&req);
+	if (!response) {
+		return;
+	}
+	if (response->GetOpCode() != EC_OP_STATSHISTORY) {
+		php_report_error(PHP_ERROR, "Invalid statistics history tier %u", params[0]);
+		delete response;
+		return;
+	}
+
+	cast_value_array(result);
+	PHP_VAR_NODE *start = array_get_by_str_key(result, "start");
+	value_value_free(&start->value);
+	start->value.type = PHP_VAL_INT;
+	start->value.int_val = response->GetTagByNameSafe(EC_TAG_STATSHISTORY_FROM)->GetInt();
+
+	PHP_VAR_NODE *rows = array_get_by_str_key(result, "rows");
+	cast_value_array(&rows->value);
+	const CECTag *dataTag = response->GetTagByName(EC_TAG_STATSHISTORY_DATA);
+	if (dataTag) {
+		// Rows of float bits in network byte order, see GetStatsHistory in ExternalConn.cpp
+		const uint32 *data = static_cast<const uint32 *>(dataTag->GetTagData());
+		unsigned row_count = dataTag->GetTagDataLen() / (sizeof(uint32) * column_count);
+		for (unsigned i = 0; i < row_count; i++) {
+			PHP_VAR_NODE *row = array_get_by_int_key(&rows->value, i);
+			cast_value_array(&row->value);
+			for (unsigned j = 0; j < column_count; j++) {
+				uint32 bits = ENDIAN_NTOHL(data[i * column_count + j]);
+				float value;
+				memcpy(&value, &bits, sizeof(value));
+				if (value != value) {
+					// NaN, no sample in this period
+					continue;
+				}
+				PHP_VAR_NODE *cell = array_get_by_str_key(&row->value, columns[j]);
+				value_value_free(&cell->value);
+				cell->value.type = PHP_VAL_FLOAT;
+				cell->value.float_val = value;
+			}
+		}
+	}
+
+	delete response;
+}
+
 
 /*
  * Download ed2k link. Params: link, category (default=0)
@@ -703,7 +779,7 @@ void amule_obj_array_create(const char *class_name, PHP_VALUE_NODE *result)
 	}
 	C *container = T::GetContainerInstance();
 
-	container->ReQuery();
+	container->Refresh();
 
 	typename std::list<T>::const_iterator it = container->GetBeginIterator();
 	while ( it != container->GetEndIterator()) {
@@ -1143,6 +1219,10 @@ PHP_BLTIN_FUNC_DEF amule_lib_funcs[] = {
 		"amule_get_serverinfo",
 		1, php_get_serverinfo,
 	},
+	{
+		"amule_get_stats_history",
+		3, php_get_stats_history,
+	},
 	{
 		"amule_get_version",
 		0, amule_version,
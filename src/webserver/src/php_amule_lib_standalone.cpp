@@ -31,6 +31,7 @@
 #include <map>
 
 #include <sys/types.h>
+#include <sys/time.h>
 #include <regex.h>
 
 #define PACKAGE_VERSION "standalone"
@@ -353,6 +354,28 @@ void php_get_serverinfo(PHP_VALUE_NODE *result)
 	printf("php_get_serverinfo: reset=%d\n", rst);
 }
 
+/*
+ * Request a range of the statistics history. Params: tier, from, to
+ */
+void php_get_stats_history(PHP_VALUE_NODE *result)
+{
+	value_value_free(result);
+
+	int params[3];
+	for (int i = 0; i < 3; i++) {
+		char param_name[16];
+		snprintf(param_name, sizeof(param_name), "__param_%d", i);
+		PHP_SCOPE_ITEM *si = get_scope_item(g_current_scope, param_name);
+		if ( !si ) {
+			php_report_error(PHP_ERROR, "Missing argument %d (tier, from, to)", i + 1);
+			return;
+		}
+		cast_value_dnum(&si->var->value);
+		params[i] = si->var->value.int_val;
+	}
+	printf("php_get_stats_history: tier=%d from=%d to=%d\n", params[0], params[1], params[2]);
+}
+
 
 /*
  * Download ed2k link. Params: link, category (default=0)
@@ -578,6 +601,10 @@ PHP_BLTIN_FUNC_DEF amule_lib_funcs[] = {
 		"amule_get_serverinfo",
 		1, php_get_serverinfo,
 	},
+	{
+		"amule_get_stats_history",
+		3, php_get_stats_history,
+	},
 	{
 		"amule_get_version",
 		0, amule_version,
@@ -601,8 +628,57 @@ void php_init_amule_lib()
 	php_add_native_class("AmuleSearchFile", amule_search_file_prop_get);
 }
 
+static double Now()
+{
+	struct timeval tv;
+	gettimeofday(&tv, 0);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+//
+// Serve same page "count" times, parsing it for each request like
+// before, and from the template cache. First and last page of each
+// run must be the same.
+//
+static int Benchmark(const char *filename, int count)
+{
+	std::string outputs[4];
+	double times[2];
+	for(int cached = 0; cached < 2; cached++) {
+		CPhpTemplateCache cache;
+		double start = Now();
+		for(int i = 0; i < count; i++) {
+			CWriteStrBuffer buffer;
+			CPhpFilter php_filter((CWebServerBase*)0, (CSession *)0, filename, &buffer, cached ? &cache : 0);
+			if ( (i == 0) || (i == count - 1) ) {
+				char *buf = new char [buffer.Length()+1];
+				buffer.CopyAll(buf);
+				outputs[cached * 2 + (i != 0)] = buf;
+				delete [] buf;
+			}
+		}
+		times[cached] = Now() - start;
+	}
+	if ( (outputs[0] != outputs[1]) || (outputs[0] != outputs[2]) || (outputs[0] != outputs[3]) ) {
+		fprintf(stderr, "ERROR: cached template output differs\n");
+		return 1;
+	}
+	fprintf(stderr, "%s: %d requests, parsed each time %.0f req/s, cached %.0f req/s\n",
+		filename, count, count / times[0], count / times[1]);
+	return 0;
+}
+
 int main(int argc, char *argv[])
 {
+	if ( (argc >= 3) && !strcmp(argv[1], "-b") ) {
+		int count = atoi(argv[2]);
+		int result = 0;
+		for(int i = 3; i < argc; i++) {
+			result |= Benchmark(argv[i], count);
+		}
+		return result;
+	}
+
 	const char *filename = ( argc == 2 ) ? argv[1] : "test.php";
 
 	CWriteStrBuffer buffer;
@@ -46,6 +46,7 @@
 #include "php_syntree.h"
 #include "php_core_lib.h"
 #include <stdarg.h>
+#include <sys/stat.h>		// Needed for stat
 
 #ifdef ENABLE_NLS
 #include <libintl.h>
@@ -531,17 +532,26 @@ CPhPLibContext::CPhPLibContext(CWebServerBase *server, const char *file)
 	g_curr_context = this;
 
 	m_server = server;
+	m_curr_str_buffer = 0;
+	m_syn_tree_top = 0;
 
 	php_engine_init();
+
+	m_global_scope = g_global_scope;
+	m_scope_stack = g_scope_stack;
+
 	phpin = fopen(file, "r");
 	if ( !phpin ) {
 		return;
 	}
 
+	// tree of previous context is gone already
+	g_syn_tree_top = 0;
 	phpparse();
 
 	m_syn_tree_top = g_syn_tree_top;
-	m_global_scope = g_global_scope;
+
+	SaveParsedVars();
 }
 
 CPhPLibContext::CPhPLibContext(CWebServerBase *server, char *php_buf, int len)
@@ -549,20 +559,31 @@ CPhPLibContext::CPhPLibContext(CWebServerBase *server, char *php_buf, int len)
 	g_curr_context = this;
 
 	m_server = server;
+	m_curr_str_buffer = 0;
 
 	php_engine_init();
 
 	m_global_scope = g_global_scope;
+	m_scope_stack = g_scope_stack;
 
+	// tree of previous context is gone already
+	g_syn_tree_top = 0;
 	php_set_input_buffer(php_buf, len);
 	phpparse();
 
 	m_syn_tree_top = g_syn_tree_top;
+
+	SaveParsedVars();
 }
 
 CPhPLibContext::~CPhPLibContext()
 {
 	SetContext();
+	for(std::map<PHP_SCOPE_ITEM *, PARSED_VAR>::iterator i = m_parsed_vars.begin(); i != m_parsed_vars.end(); ++i) {
+		var_node_free(i->second.var);
+		value_value_free(&i->second.initial->value);
+		free_var_node(i->second.initial);
+	}
 	php_engine_free();
 }
 
@@ -570,6 +591,67 @@ void CPhPLibContext::SetContext()
 {
 	g_syn_tree_top = m_syn_tree_top;
 	g_global_scope = m_global_scope;
+	g_current_scope = m_global_scope;
+	g_scope_stack = m_scope_stack;
+	g_curr_context = this;
+}
+
+/*
+ * Keep each variable the parser created, together with a copy of its value
+ * (static vars may be initialized). Functions allocate their local vars on
+ * each call, but the nodes in their scope table are used for static ones.
+ */
+void CPhPLibContext::SaveParsedVars()
+{
+	SaveParsedVars(m_global_scope);
+
+	PHP_SCOPE_TABLE_TYPE *scope_map = (PHP_SCOPE_TABLE_TYPE *)m_global_scope;
+	for(PHP_SCOPE_TABLE_TYPE::iterator i = scope_map->begin(); i != scope_map->end(); ++i) {
+		if ( (i->second->type == PHP_SCOPE_FUNC) && !i->second->func->func_decl->is_native ) {
+			SaveParsedVars(i->second->func->func_decl->scope);
+		}
+	}
+}
+
+void CPhPLibContext::SaveParsedVars(PHP_SCOPE_TABLE scope)
+{
+	PHP_SCOPE_TABLE_TYPE *scope_map = (PHP_SCOPE_TABLE_TYPE *)scope;
+	for(PHP_SCOPE_TABLE_TYPE::iterator i = scope_map->begin(); i != scope_map->end(); ++i) {
+		if ( (i->second->type != PHP_SCOPE_VAR) && (i->second->type != PHP_SCOPE_PARAM) ) {
+			continue;
+		}
+		PARSED_VAR parsed;
+		// keep node alive, even when script replaces it by a reference
+		parsed.var = i->second->var;
+		parsed.var->ref_count++;
+		parsed.initial = make_var_node();
+		value_value_assign(&parsed.initial->value, &parsed.var->value);
+		parsed.initial->flags = parsed.var->flags;
+		m_parsed_vars[i->second] = parsed;
+	}
+}
+
+void CPhPLibContext::ResetVars()
+{
+	for(std::map<PHP_SCOPE_ITEM *, PARSED_VAR>::iterator i = m_parsed_vars.begin(); i != m_parsed_vars.end(); ++i) {
+		PHP_SCOPE_ITEM *si = i->first;
+		PHP_VAR_NODE *var = i->second.var;
+		if ( si->var != var ) {
+			var_node_free(si->var);
+			si->var = var;
+			var->ref_count++;
+		}
+		value_value_assign(&var->value, &i->second.initial->value);
+		var->flags = i->second.initial->flags;
+	}
+
+	// vars added after parsing (session vars) start empty
+	PHP_SCOPE_TABLE_TYPE *scope_map = (PHP_SCOPE_TABLE_TYPE *)m_global_scope;
+	for(PHP_SCOPE_TABLE_TYPE::iterator i = scope_map->begin(); i != scope_map->end(); ++i) {
+		if ( (i->second->type == PHP_SCOPE_VAR) && !m_parsed_vars.count(i->second) ) {
+			value_value_free(&i->second->var->value);
+		}
+	}
 }
 
 void CPhPLibContext::Execute(CWriteStrBuffer *buf)
@@ -614,9 +696,18 @@ void CPhPLibContext::Print(const char *str)
 }
 
 
-CPhpFilter::CPhpFilter(CWebServerBase *server, CSession *sess,
-			const char *file, CWriteStrBuffer *buff)
+CPhpTemplate::CPhpTemplate(CWebServerBase *server, const char *file)
+:
+m_loaded(false),
+m_mtime(0),
+m_size(0)
 {
+	struct stat st;
+	if ( stat(file, &st) == 0 ) {
+		m_mtime = st.st_mtime;
+		m_size = st.st_size;
+	}
+
 	FILE *f = fopen(file, "r");
 	if ( !f ) {
 		printf("ERROR: php can not open source file [%s]\n", file);
@@ -637,45 +728,127 @@ CPhpFilter::CPhpFilter(CWebServerBase *server, CSession *sess,
 	char *scan_ptr = buf;
 	char *curr_code_end = buf;
 	while ( strlen(scan_ptr) ) {
+		BLOCK block;
+		block.code = 0;
+
 		scan_ptr = strstr(scan_ptr, "<?php");
 		if ( !scan_ptr ) {
-			buff->Write(curr_code_end);
+			block.text = curr_code_end;
+			m_blocks.push_back(block);
 			break;
 		}
-		if ( scan_ptr != curr_code_end ) {
-			buff->Write(curr_code_end, scan_ptr - curr_code_end);
-		}
+		block.text.assign(curr_code_end, scan_ptr - curr_code_end);
 		curr_code_end = strstr(scan_ptr, "?>");
 		if ( !curr_code_end ) {
+			m_blocks.push_back(block);
 			break;
 		}
 		curr_code_end += 2; // include "?>" in buffer
 
 		int len = curr_code_end - scan_ptr;
 
-		CPhPLibContext *context = new CPhPLibContext(server, scan_ptr, len);
+		block.code = new CPhPLibContext(server, scan_ptr, len);
+		m_blocks.push_back(block);
+
+		scan_ptr = curr_code_end;
+	}
+
+	delete [] buf;
+
+	m_loaded = true;
+}
+
+CPhpTemplate::~CPhpTemplate()
+{
+	for(size_t i = 0; i < m_blocks.size(); i++) {
+		delete m_blocks[i].code;
+	}
+}
+
+void CPhpTemplate::Execute(CSession *sess, CWriteStrBuffer *buff)
+{
+	for(size_t i = 0; i < m_blocks.size(); i++) {
+		const BLOCK &block = m_blocks[i];
+		if ( !block.text.empty() ) {
+			buff->Write(block.text.c_str(), block.text.length());
+		}
+		if ( !block.code ) {
+			continue;
+		}
+
+		block.code->SetContext();
+		block.code->ResetVars();
 
 #ifndef PHP_STANDALONE_EN
 		load_session_vars("HTTP_GET_VARS", sess->m_get_vars);
 		load_session_vars("_SESSION", sess->m_vars);
 #endif
 
-		context->Execute(buff);
+		block.code->Execute(buff);
 
 #ifndef PHP_STANDALONE_EN
 		save_session_vars(sess->m_vars);
 #endif
-
-		delete context;
-
-		scan_ptr = curr_code_end;
 	}
 
 #ifndef PHP_STANDALONE_EN
 	sess->m_get_vars.clear();
 #endif
+}
 
-	delete [] buf;
+
+CPhpTemplateCache::~CPhpTemplateCache()
+{
+	Clear();
+}
+
+CPhpTemplate *CPhpTemplateCache::Get(CWebServerBase *server, const char *file)
+{
+	struct stat st;
+	bool found = stat(file, &st) == 0;
+
+	std::map<std::string, CPhpTemplate *>::iterator it = m_templates.find(file);
+	if ( it != m_templates.end() ) {
+		if ( found && !it->second->IsChanged(st.st_mtime, st.st_size) ) {
+			return it->second;
+		}
+		delete it->second;
+		m_templates.erase(it);
+	}
+
+	CPhpTemplate *tmpl = new CPhpTemplate(server, file);
+	if ( !tmpl->IsLoaded() ) {
+		delete tmpl;
+		return 0;
+	}
+	m_templates[file] = tmpl;
+
+	return tmpl;
+}
+
+void CPhpTemplateCache::Clear()
+{
+	for(std::map<std::string, CPhpTemplate *>::iterator i = m_templates.begin(); i != m_templates.end(); ++i) {
+		delete i->second;
+	}
+	m_templates.clear();
+}
+
+
+CPhpFilter::CPhpFilter(CWebServerBase *server, CSession *sess,
+			const char *file, CWriteStrBuffer *buff, CPhpTemplateCache *cache)
+{
+	if ( cache ) {
+		CPhpTemplate *tmpl = cache->Get(server, file);
+		if ( tmpl ) {
+			tmpl->Execute(sess, buff);
+		}
+	} else {
+		CPhpTemplate tmpl(server, file);
+		if ( tmpl.IsLoaded() ) {
+			tmpl.Execute(sess, buff);
+		}
+	}
 }
 
 
@@ -30,6 +30,9 @@
  */
 #ifdef __cplusplus
 
+#include <ctime>	// Needed for time_t
+#include <vector>	// Needed for std::vector
+
 
 class CWriteStrBuffer {
 		std::list<char *> m_buf_list;
@@ -55,10 +58,25 @@ class CSession;
 class CPhPLibContext {
 		PHP_SYN_NODE *m_syn_tree_top;
 		PHP_SCOPE_TABLE m_global_scope;
+		PHP_SCOPE_STACK m_scope_stack;
 
 		CWriteStrBuffer *m_curr_str_buffer;
 
 		CWebServerBase *m_server;
+
+		// variable as parser left it: node in scope table and copy of its value
+		struct PARSED_VAR {
+			PHP_VAR_NODE *var;
+			PHP_VAR_NODE *initial;
+		};
+		std::map<PHP_SCOPE_ITEM *, PARSED_VAR> m_parsed_vars;
+
+		void SaveParsedVars();
+		void SaveParsedVars(PHP_SCOPE_TABLE scope);
+
+		// Make class non copyable
+		CPhPLibContext(const CPhPLibContext&);
+		CPhPLibContext& operator=(const CPhPLibContext&);
 	public:
 		// parse file and take a "snapshot" of global vars
 		CPhPLibContext(CWebServerBase *server, const char *file);
@@ -67,6 +85,8 @@ class CPhPLibContext {
 
 		// init global vars, so parser/execution can start
 		void SetContext();
+		// restore vars from "snapshot", so code can be executed again
+		void ResetVars();
 		void Execute(CWriteStrBuffer *);
 
 #ifdef __GNUC__
@@ -83,10 +103,55 @@ class CPhPLibContext {
 #endif
 };
 
+/*
+ * Template file split into plain text and parsed php blocks. Parsing
+ * is done once, and same syntax trees are executed for every request.
+ */
+class CPhpTemplate {
+		struct BLOCK {
+			// text sent before the code
+			std::string text;
+			// 0 after last php block
+			CPhPLibContext *code;
+		};
+		std::vector<BLOCK> m_blocks;
+
+		bool m_loaded;
+		time_t m_mtime;
+		long m_size;
+
+		// Make class non copyable
+		CPhpTemplate(const CPhpTemplate&);
+		CPhpTemplate& operator=(const CPhpTemplate&);
+	public:
+		CPhpTemplate(CWebServerBase *server, const char *file);
+		~CPhpTemplate();
+
+		bool IsLoaded() const { return m_loaded; }
+		// file on disk is not the one that was parsed
+		bool IsChanged(time_t mtime, long size) const { return mtime != m_mtime || size != m_size; }
+
+		void Execute(CSession *sess, CWriteStrBuffer *buff);
+};
+
+/*
+ * Parsed templates by file name
+ */
+class CPhpTemplateCache {
+		std::map<std::string, CPhpTemplate *> m_templates;
+	public:
+		~CPhpTemplateCache();
+
+		// template of file, parsed again if file changed. 0 if file can't be read
+		CPhpTemplate *Get(CWebServerBase *server, const char *file);
+		void Clear();
+};
+
 class CPhpFilter {
 	public:
+		// without cache, file is parsed each time
 		CPhpFilter(CWebServerBase *server, CSession *sess,
-			const char *file, CWriteStrBuffer *buff);
+			const char *file, CWriteStrBuffer *buff, CPhpTemplateCache *cache = 0);
 };
 
 #endif // __cplusplus
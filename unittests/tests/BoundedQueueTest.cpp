@@ -0,0 +1,132 @@
+#include <muleunit/test.h>
+
+#include "Types.h"
+#include "BoundedQueue.h"
+#include "MuleThread.h"
+
+#include <vector>
+
+using namespace muleunit;
+
+
+const uint32 producerCount = 4;
+const uint32 itemsPerProducer = 100000;
+
+
+struct CTestItem
+{
+	uint32	producer;
+	uint32	value;
+};
+
+typedef CBoundedQueue<CTestItem> TestQueue;
+
+
+/**
+ * Pushes increasing values, retrying while the queue is full.
+ */
+class CProducer : public CMuleThread
+{
+public:
+	CProducer(TestQueue& queue, uint32 id)
+		: CMuleThread(wxTHREAD_JOINABLE),
+		  m_queue(queue),
+		  m_id(id)
+	{}
+
+protected:
+	virtual void* Entry()
+	{
+		for (uint32 i = 0; i < itemsPerProducer; ++i) {
+			CTestItem item = { m_id, i };
+			while (!m_queue.Push(item)) {
+				Yield();
+			}
+		}
+
+		return NULL;
+	}
+
+private:
+	TestQueue&	m_queue;
+	uint32		m_id;
+};
+
+
+DECLARE_SIMPLE(BoundedQueue);
+
+
+TEST(BoundedQueue, Capacity)
+{
+	TestQueue queue(100);
+	ASSERT_EQUALS(128u, queue.GetCapacity());
+
+	TestQueue small(1);
+	ASSERT_EQUALS(2u, small.GetCapacity());
+}
+
+
+TEST(BoundedQueue, SingleThread)
+{
+	TestQueue queue(8);
+	CTestItem item = { 0, 0 };
+
+	ASSERT_FALSE(queue.Pop(item));
+
+	// Go around the ring a few times
+	for (uint32 lap = 0; lap < 3; ++lap) {
+		for (uint32 i = 0; i < 8; ++i) {
+			CTestItem in = { lap, i };
+			ASSERT_TRUE(queue.Push(in));
+		}
+
+		CTestItem overflow = { lap, 8 };
+		ASSERT_FALSE(queue.Push(overflow));
+		ASSERT_EQUALS(8u, queue.GetCount());
+
+		for (uint32 i = 0; i < 8; ++i) {
+			ASSERT_TRUE(queue.Pop(item));
+			ASSERT_EQUALS(lap, item.producer);
+			ASSERT_EQUALS(i, item.value);
+		}
+
+		ASSERT_FALSE(queue.Pop(item));
+		ASSERT_EQUALS(0u, queue.GetCount());
+	}
+}
+
+
+TEST(BoundedQueue, Producers)
+{
+	TestQueue queue(256);
+
+	std::vector<CProducer*> producers;
+	for (uint32 i = 0; i < producerCount; ++i) {
+		producers.push_back(new CProducer(queue, i));
+		ASSERT_TRUE(producers.back()->Create() == wxTHREAD_NO_ERROR);
+		ASSERT_TRUE(producers.back()->Run() == wxTHREAD_NO_ERROR);
+	}
+
+	// Nothing may be lost or duplicated, and the items of each producer keep their order
+	std::vector<uint32> next(producerCount, 0);
+	uint32 received = 0;
+	while (received < producerCount * itemsPerProducer) {
+		CTestItem item;
+		if (queue.Pop(item)) {
+			ASSERT_TRUE(item.producer < producerCount);
+			ASSERT_EQUALS(next[item.producer], item.value);
+			++next[item.producer];
+			++received;
+		} else {
+			wxThread::Yield();
+		}
+	}
+
+	for (uint32 i = 0; i < producerCount; ++i) {
+		producers[i]->Stop();
+		delete producers[i];
+	}
+
+	CTestItem item;
+	ASSERT_FALSE(queue.Pop(item));
+}
@@ -0,0 +1,205 @@
+#include <muleunit/test.h>
+
+#include <wx/stopwatch.h>
+
+#include "Types.h"
+#include "MD4Hash.h"
+#include "RobinHoodMap.h"
+
+#include <cstdlib>
+#include <map>
+#include <vector>
+
+using namespace muleunit;
+
+
+// Compares the std::multimap indices CClientList used to have with the
+// Robin Hood ones, under the connection churn of a busy client. Not part
+// of 'make check', build and run it on demand with
+// 'make ClientListBenchmark && ./ClientListBenchmark'.
+
+
+const unsigned knownClients = 50000;
+const unsigned connectsPerSecond = 1000;
+const unsigned simulatedSeconds = 600;
+
+
+struct CTestClient
+{
+	CMD4Hash	hash;
+	uint32		ip;
+	uint32		id;
+};
+
+
+CTestClient CreateClient()
+{
+	unsigned char hash[16];
+	for (unsigned i = 0; i < sizeof(hash); ++i) {
+		hash[i] = static_cast<unsigned char>(rand());
+	}
+
+	CTestClient client;
+	client.hash.SetHash(hash);
+	client.ip = ((uint32)rand() << 16) ^ (uint32)rand();
+	// Many clients are firewalled, their ID is not their IP
+	client.id = (rand() % 4) ? client.ip : (uint32)(rand() % 0x1000000);
+
+	return client;
+}
+
+
+/**
+ * The three indices of CClientList, with the values being the position
+ * of the client in the list of known clients.
+ */
+struct CTreeIndices
+{
+	std::multimap<CMD4Hash, uint32>	hashes;
+	std::multimap<uint32, uint32>	ips;
+	std::multimap<uint32, uint32>	ids;
+
+	template <typename KEY>
+	static void Remove(std::multimap<KEY, uint32>& index, const KEY& key, uint32 value)
+	{
+		typedef typename std::multimap<KEY, uint32>::iterator Iterator;
+		std::pair<Iterator, Iterator> range = index.equal_range(key);
+		for (Iterator it = range.first; it != range.second; ++it) {
+			if (it->second == value) {
+				index.erase(it);
+				return;
+			}
+		}
+	}
+
+	template <typename KEY>
+	static size_t Count(const std::multimap<KEY, uint32>& index, const KEY& key)
+	{
+		return index.count(key);
+	}
+
+	void Insert(const CTestClient& client, uint32 pos)
+	{
+		hashes.insert(std::make_pair(client.hash, pos));
+		ips.insert(std::make_pair(client.ip, pos));
+		ids.insert(std::make_pair(client.id, pos));
+	}
+
+	void Remove(const CTestClient& client, uint32 pos)
+	{
+		Remove(hashes, client.hash, pos);
+		Remove(ips, client.ip, pos);
+		Remove(ids, client.id, pos);
+	}
+
+	//! What FindMatchingClient looks up for every connection.
+	size_t Lookup(const CTestClient& client) const
+	{
+		return Count(hashes, client.hash) + Count(ips, client.ip) + Count(ids, client.id);
+	}
+};
+
+
+struct CRobinHoodIndices
+{
+	CRobinHoodMultiMap<CMD4Hash, uint32, CRobinHoodMD4Hash>		hashes;
+	CRobinHoodMultiMap<uint32, uint32, CRobinHoodUInt32Hash>	ips;
+	CRobinHoodMultiMap<uint32, uint32, CRobinHoodUInt32Hash>	ids;
+
+	template <typename MAP, typename KEY>
+	static void Remove(MAP& index, const KEY& key, uint32 value)
+	{
+		for (typename MAP::const_iterator it = index.find(key); it != index.end(); it = index.find_next(it)) {
+			if (it->second == value) {
+				index.erase(it);
+				return;
+			}
+		}
+	}
+
+	template <typename MAP, typename KEY>
+	static size_t Count(const MAP& index, const KEY& key)
+	{
+		return index.count(key);
+	}
+
+	void Insert(const CTestClient& client, uint32 pos)
+	{
+		hashes.insert(client.hash, pos);
+		ips.insert(client.ip, pos);
+		ids.insert(client.id, pos);
+	}
+
+	void Remove(const CTestClient& client, uint32 pos)
+	{
+		Remove(hashes, client.hash, pos);
+		Remove(ips, client.ip, pos);
+		Remove(ids, client.id, pos);
+	}
+
+	size_t Lookup(const CTestClient& client) const
+	{
+		return Count(hashes, client.hash) + Count(ips, client.ip) + Count(ids, client.id);
+	}
+};
+
+
+/**
+ * Runs the churn against the indices.
+ *
+ * Half of the connections come from known clients and are only looked up,
+ * the others from new clients, which replace the oldest known one.
+ *
+ * @return The time taken in ms.
+ */
+template <typename INDICES>
+long RunChurn(size_t& found)
+{
+	srand(1);
+	std::vector<CTestClient> clients;
+	INDICES indices;
+	for (uint32 i = 0; i < knownClients; ++i) {
+		clients.push_back(CreateClient());
+		indices.Insert(clients.back(), i);
+	}
+
+	uint32 oldest = 0;
+	found = 0;
+
+	wxStopWatch time;
+	for (uint32 i = 0; i < simulatedSeconds * connectsPerSecond; ++i) {
+		if (rand() % 2) {
+			found += indices.Lookup(clients[rand() % knownClients]);
+		} else {
+			const CTestClient client = CreateClient();
+			found += indices.Lookup(client);
+
+			indices.Remove(clients[oldest], oldest);
+			clients[oldest] = client;
+			indices.Insert(client, oldest);
+			oldest = (oldest + 1) % knownClients;
+		}
+	}
+
+	return time.Time();
+}
+
+
+DECLARE_SIMPLE(ClientListBenchmark);
+
+
+TEST(ClientListBenchmark, ConnectionChurn)
+{
+	CRobinHoodMD4Hash::SetSeed(1);
+
+	size_t treeFound;
+	const long treeMs = RunChurn<CTreeIndices>(treeFound);
+	size_t robinHoodFound;
+	const long robinHoodMs = RunChurn<CRobinHoodIndices>(robinHoodFound);
+
+	// Both have to see the same clients for the times to be comparable
+	ASSERT_EQUALS(treeFound, robinHoodFound);
+
+	wxPrintf(wxT("\n%u known clients, %u connects/s for %u s: std::multimap %ld ms, Robin Hood %ld ms\n"),
+		knownClients, connectsPerSecond, simulatedSeconds, treeMs, robinHoodMs);
+}
@@ -0,0 +1,80 @@
+#include <muleunit/test.h>
+
+#include "Types.h"
+#include "CountingBloomFilter.h"
+
+using namespace muleunit;
+
+
+DECLARE_SIMPLE(CountingBloomFilter)
+
+
+TEST(CountingBloomFilter, NoFalseNegatives)
+{
+	CCountingBloomFilter filter;
+
+	// Enough keys to overload the filter, which must still never miss one
+	for (uint32 i = 0; i < 10000; ++i) {
+		filter.Add(i * 2654435761u);
+	}
+
+	ASSERT_EQUALS(10000u, filter.GetKeyCount());
+	ASSERT_TRUE(filter.IsOverloaded());
+
+	for (uint32 i = 0; i < 10000; ++i) {
+		ASSERT_TRUE(filter.MayContain(i * 2654435761u));
+	}
+
+	ASSERT_EQUALS(0u, filter.GetRejected());
+}
+
+
+TEST(CountingBloomFilter, Remove)
+{
+	CCountingBloomFilter filter(100);
+
+	filter.Add(0x7F000001);
+	filter.Add(0x7F000001);
+	filter.Add(0x0A000001);
+
+	filter.Remove(0x7F000001);
+	ASSERT_TRUE(filter.MayContain(0x7F000001));
+	ASSERT_TRUE(filter.MayContain(0x0A000001));
+
+	filter.Remove(0x7F000001);
+	filter.Remove(0x0A000001);
+	ASSERT_EQUALS(0u, filter.GetKeyCount());
+	ASSERT_FALSE(filter.MayContain(0x7F000001));
+	ASSERT_FALSE(filter.MayContain(0x0A000001));
+}
+
+
+TEST(CountingBloomFilter, FalsePositiveRate)
+{
+	const uint32 keys = 5000;
+	CCountingBloomFilter filter(keys);
+	ASSERT_TRUE(filter.GetBucketCount() >= keys * 8);
+
+	for (uint32 i = 0; i < keys; ++i) {
+		filter.Add(i);
+	}
+	ASSERT_FALSE(filter.IsOverloaded());
+
+	// Query keys that were never added, as the owner of the filter would
+	for (uint32 i = keys; i < keys + 100000; ++i) {
+		if (filter.MayContain(i)) {
+			filter.ReportFalsePositive();
+		}
+	}
+
+	ASSERT_EQUALS(100000u, filter.GetChecks());
+	ASSERT_EQUALS(100000u, filter.GetRejected() + filter.GetFalsePositives());
+	// Around 3% expected with eight counters per key
+	ASSERT_TRUE(filter.GetFalsePositiveRate() < 0.05);
+
+	// Resetting empties the filter but keeps the statistics
+	filter.Reset(keys);
+	ASSERT_EQUALS(0u, filter.GetKeyCount());
+	ASSERT_FALSE(filter.MayContain(0));
+	ASSERT_EQUALS(100001u, filter.GetChecks());
+}
@@ -0,0 +1,58 @@
+#include <muleunit/test.h>
+
+#include <ec/cpp/ECPacket.h>
+#include <ec/cpp/ECTagArena.h>
+
+#include <cstring>
+#include <vector>
+
+using namespace muleunit;
+
+
+#ifdef __DEBUG__
+#include <ec/cpp/ECLog.h>
+
+// Defined by the applications otherwise
+bool ECLogIsEnabled() { return false; }
+void DoECLogLine(const wxString &) {}
+#endif
+
+
+DECLARE_SIMPLE(ECPacket);
+
+
+TEST(ECPacket, ReadFromView)
+{
+	CECPacketBuilder builder(0x05);
+	builder.OpenTag(0x0100, EC_TAGTYPE_CUSTOM, "ab", 2);
+	builder.AddInt(0x0002, 300);
+	builder.CloseTag();
+	builder.AddString(0x0003, std::string("text"));
+	builder.AddInt(0x0004, 0x123456789ULL);
+
+	for (int utf8 = 0; utf8 < 2; ++utf8) {
+		std::vector<unsigned char> encoded(builder.GetEncodedLength(utf8 != 0));
+		builder.Encode(&encoded[0], utf8 != 0);
+
+		CECPacketView view;
+		ASSERT_TRUE(view.Parse(&encoded[0], encoded.size(), utf8 != 0));
+
+		// Start from a packet with other contents, they must be replaced
+		CECPacket packet(0x01);
+		packet.ReadFromView(view);
+
+		ASSERT_EQUALS(0x05, packet.GetOpCode());
+		ASSERT_EQUALS(3u, packet.GetTagCount());
+		ASSERT_EQUALS(builder.GetPacketLength(), packet.GetPacketLength());
+
+		const CECTag *parent = packet.GetTagByName(0x0100);
+		ASSERT_TRUE(parent != NULL);
+		ASSERT_EQUALS(1u, parent->GetTagCount());
+		ASSERT_EQUALS(2u, parent->GetTagDataLen());
+		ASSERT_TRUE(memcmp("ab", parent->GetTagData(), 2) == 0);
+		ASSERT_EQUALS(300u, parent->GetTagByName(0x0002)->GetInt());
+
+		ASSERT_TRUE(packet.GetTagByName(0x0003)->GetStringDataSTL() == "text");
+		ASSERT_EQUALS(0x123456789ULL, packet.GetTagByName(0x0004)->GetInt());
+	}
+}
@@ -0,0 +1,120 @@
+#include <muleunit/test.h>
+
+#include <ec/cpp/ECTagArena.h>
+
+#include <cstring>
+#include <vector>
+
+using namespace muleunit;
+
+
+/**
+ * A packet with a tag holding data and a child.
+ */
+void BuildSample(CECPacketBuilder& packet)
+{
+	packet.OpenTag(0x0100, EC_TAGTYPE_CUSTOM, "ab", 2);
+	packet.AddInt(0x0002, 300);
+	packet.CloseTag();
+}
+
+
+std::vector<unsigned char> Encode(const CECPacketBuilder& packet, bool utf8Numbers)
+{
+	std::vector<unsigned char> buffer(packet.GetEncodedLength(utf8Numbers));
+	packet.Encode(&buffer[0], utf8Numbers);
+	return buffer;
+}
+
+
+DECLARE_SIMPLE(ECTagArena);
+
+
+TEST(ECTagArena, Encode)
+{
+	CECPacketBuilder packet(0x05);
+	BuildSample(packet);
+
+	// Same as CECTag::GetTagLen() counts
+	ASSERT_EQUALS(20u, packet.GetPacketLength());
+
+	const unsigned char plain[] = {
+		0x05, 0x00, 0x01,
+		0x02, 0x01, 0x01, 0x00, 0x00, 0x00, 0x0B, 0x00, 0x01,
+		0x00, 0x04, 0x03, 0x00, 0x00, 0x00, 0x02, 0x01, 0x2C,
+		0x61, 0x62 };
+	std::vector<unsigned char> encoded = Encode(packet, false);
+	ASSERT_EQUALS(sizeof(plain), encoded.size());
+	ASSERT_TRUE(memcmp(plain, &encoded[0], sizeof(plain)) == 0);
+
+	const unsigned char utf8[] = {
+		0x05, 0x01,
+		0xC8, 0x81, 0x01, 0x0B, 0x01,
+		0x04, 0x03, 0x02, 0x01, 0x2C,
+		0x61, 0x62 };
+	encoded = Encode(packet, true);
+	ASSERT_EQUALS(sizeof(utf8), encoded.size());
+	ASSERT_TRUE(memcmp(utf8, &encoded[0], sizeof(utf8)) == 0);
+}
+
+
+TEST(ECTagArena, Parse)
+{
+	CECPacketBuilder packet(0x05);
+	BuildSample(packet);
+	packet.AddString(0x0003, std::string("text"));
+	packet.AddInt(0x0004, 0x123456789ULL);
+
+	for (int utf8 = 0; utf8 < 2; ++utf8) {
+		std::vector<unsigned char> encoded = Encode(packet, utf8 != 0);
+
+		CECPacketView view;
+		ASSERT_TRUE(view.Parse(&encoded[0], encoded.size(), utf8 != 0));
+		ASSERT_EQUALS(0x05, view.GetOpCode());
+
+		CECTagView parent = view.GetTagByName(0x0100);
+		ASSERT_EQUALS(1, parent.GetTagCount());
+		ASSERT_EQUALS(2u, parent.GetTagDataLen());
+		ASSERT_TRUE(memcmp("ab", parent.GetTagData(), 2) == 0);
+		ASSERT_EQUALS(300u, parent.GetTagByName(0x0002).GetInt());
+
+		ASSERT_TRUE(view.GetTagByName(0x0003).GetStringDataSTL() == "text");
+		ASSERT_EQUALS(0x123456789ULL, view.GetTagByName(0x0004).GetInt());
+
+		// Missing tags read as empty
+		ASSERT_EQUALS(EC_TAGTYPE_UNKNOWN, view.GetTagByName(0x0005).GetType());
+		ASSERT_EQUALS(0u, view.GetTagByName(0x0005).GetInt());
+
+		unsigned count = 0;
+		for (CECTagView::const_iterator it = view.begin(); it != view.end(); ++it) {
+			++count;
+		}
+		ASSERT_EQUALS(3u, count);
+	}
+}
+
+
+TEST(ECTagArena, Malformed)
+{
+	CECPacketBuilder packet(0x05);
+	BuildSample(packet);
+
+	for (int utf8 = 0; utf8 < 2; ++utf8) {
+		std::vector<unsigned char> encoded = Encode(packet, utf8 != 0);
+
+		// Cut anywhere
+		for (size_t len = 0; len < encoded.size(); ++len) {
+			CECPacketView view;
+			ASSERT_FALSE(view.Parse(&encoded[0], len, utf8 != 0));
+			ASSERT_TRUE(view.begin() == view.end());
+		}
+	}
+
+	// Children longer than their parent
+	const unsigned char broken[] = {
+		0x05, 0x00, 0x01,
+		0x02, 0x01, 0x01, 0x00, 0x00, 0x00, 0x02, 0x00, 0x01,
+		0x00, 0x04, 0x03, 0x00, 0x00, 0x00, 0x02, 0x01, 0x2C };
+	CECPacketView view;
+	ASSERT_FALSE(view.Parse(broken, sizeof(broken), false));
+}
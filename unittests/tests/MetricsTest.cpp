@@ -0,0 +1,83 @@
+#include <muleunit/test.h>
+
+#include "Metrics.h"
+
+#include <protocol/Protocols.h>
+
+#include <string>
+
+using namespace muleunit;
+
+
+// Returns true if the text contains the line
+bool HasLine(const std::string& text, const std::string& line)
+{
+	return text.find(line + "\n") != std::string::npos;
+}
+
+
+DECLARE_SIMPLE(Metrics);
+
+
+TEST(Metrics, Writer)
+{
+	std::string out;
+	CMetricsWriter writer(out);
+
+	writer.Family("test_total", "counter", "A test.");
+	writer.Sample("test_total", NULL, (uint64)0);
+	writer.Sample("test_total", "a=\"x\"", (uint64)18446744073709551615ULL);
+	writer.Sample("test_ratio", "", 0.25);
+
+	ASSERT_EQUALS(std::string(
+		"# HELP test_total A test.\n"
+		"# TYPE test_total counter\n"
+		"test_total 0\n"
+		"test_total{a=\"x\"} 18446744073709551615\n"
+		"test_ratio 0.25\n"), out);
+}
+
+
+TEST(Metrics, Histogram)
+{
+	CMetricsHistogram histogram;
+	histogram.Observe(0);
+	histogram.Observe(1);
+	histogram.Observe(2);
+	histogram.Observe(1000);
+	histogram.Observe(100000000);
+
+	std::string out;
+	CMetricsWriter writer(out);
+	histogram.Write(writer, "test_seconds", "s=\"x\"");
+
+	// Buckets are cumulative, bounds are in seconds
+	ASSERT_TRUE(HasLine(out, "test_seconds_bucket{s=\"x\",le=\"1e-06\"} 2"));
+	ASSERT_TRUE(HasLine(out, "test_seconds_bucket{s=\"x\",le=\"4e-06\"} 3"));
+	ASSERT_TRUE(HasLine(out, "test_seconds_bucket{s=\"x\",le=\"0.001024\"} 4"));
+	ASSERT_TRUE(HasLine(out, "test_seconds_bucket{s=\"x\",le=\"4.194304\"} 4"));
+	ASSERT_TRUE(HasLine(out, "test_seconds_bucket{s=\"x\",le=\"+Inf\"} 5"));
+	ASSERT_TRUE(HasLine(out, "test_seconds_sum{s=\"x\"} 100.001003"));
+	ASSERT_TRUE(HasLine(out, "test_seconds_count{s=\"x\"} 5"));
+}
+
+
+TEST(Metrics, Packets)
+{
+	CMetrics::CountPacket(CMetrics::Received, CMetrics::TransportTCP, OP_EDONKEYPROT, 0x01);
+	CMetrics::CountPacket(CMetrics::Received, CMetrics::TransportTCP, OP_EDONKEYPROT, 0x01);
+	CMetrics::CountPacket(CMetrics::Sent, CMetrics::TransportUDP, OP_KADEMLIAHEADER, 0xA0);
+	CMetrics::CountPacket(CMetrics::Sent, CMetrics::TransportUDP, 0x42, 0xFF);
+
+	std::string out;
+	CMetricsWriter writer(out);
+	CMetrics::Write(writer);
+
+	ASSERT_TRUE(HasLine(out, "amule_packets_total{direction=\"received\",transport=\"tcp\",protocol=\"edonkey\",opcode=\"0x01\"} 2"));
+	ASSERT_TRUE(HasLine(out, "amule_packets_total{direction=\"sent\",transport=\"udp\",protocol=\"kad\",opcode=\"0xA0\"} 1"));
+	ASSERT_TRUE(HasLine(out, "amule_packets_total{direction=\"sent\",transport=\"udp\",protocol=\"other\",opcode=\"0xFF\"} 1"));
+
+	// Opcodes never seen are left out
+	ASSERT_TRUE(out.find("opcode=\"0x02\"") == std::string::npos);
+	ASSERT_TRUE(HasLine(out, "amule_latency_seconds_count{subsystem=\"ec\"} 0"));
+}
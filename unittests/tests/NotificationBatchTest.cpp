@@ -0,0 +1,152 @@
+#include <muleunit/test.h>
+
+#include "NotificationBatch.h"
+
+#include <vector>
+
+using namespace muleunit;
+
+
+typedef CNotificationBatch<int> TestBatch;
+
+// What the last flush delivered
+std::vector<int> added;
+std::vector<int> updated;
+unsigned addedCalls = 0;
+unsigned updatedCalls = 0;
+
+
+void OnAdded(const TestBatch::ItemList& items)
+{
+	added.insert(added.end(), items.begin(), items.end());
+	++addedCalls;
+}
+
+
+void OnUpdated(const TestBatch::ItemList& items)
+{
+	updated.insert(updated.end(), items.begin(), items.end());
+	++updatedCalls;
+}
+
+
+bool IsOdd(int value)
+{
+	return value % 2 != 0;
+}
+
+
+DECLARE(NotificationBatch);
+	void setUp() {
+		tearDown();
+	}
+
+	void tearDown() {
+		added.clear();
+		updated.clear();
+		addedCalls = 0;
+		updatedCalls = 0;
+	}
+END_DECLARE;
+
+
+TEST(NotificationBatch, Ranges)
+{
+	TestBatch batch(OnAdded, OnUpdated, 100);
+	for (int i = 0; i < 10; ++i) {
+		batch.Add(i);
+	}
+	batch.Update(20);
+	batch.Update(21);
+	ASSERT_EQUALS(12u, batch.GetCount());
+
+	ASSERT_FALSE(batch.Flush());
+	ASSERT_EQUALS(1u, addedCalls);
+	ASSERT_EQUALS(1u, updatedCalls);
+	ASSERT_EQUALS(10u, added.size());
+	for (int i = 0; i < 10; ++i) {
+		ASSERT_EQUALS(i, added[i]);
+	}
+	ASSERT_EQUALS(2u, updated.size());
+	ASSERT_EQUALS(20, updated[0]);
+	ASSERT_EQUALS(21, updated[1]);
+
+	// Nothing left
+	ASSERT_EQUALS(0u, batch.GetCount());
+	ASSERT_FALSE(batch.Flush());
+	ASSERT_EQUALS(1u, addedCalls);
+	ASSERT_EQUALS(1u, updatedCalls);
+}
+
+
+TEST(NotificationBatch, Coalescing)
+{
+	TestBatch batch(OnAdded, OnUpdated, 100);
+
+	// Repeated additions and updates are delivered once
+	batch.Add(1);
+	batch.Add(1);
+	batch.Update(1);
+	batch.Update(2);
+	batch.Update(2);
+	// An addition replaces a queued update
+	batch.Update(3);
+	batch.Add(3);
+	ASSERT_EQUALS(3u, batch.GetCount());
+
+	batch.Flush();
+	ASSERT_EQUALS(2u, added.size());
+	ASSERT_EQUALS(1, added[0]);
+	ASSERT_EQUALS(3, added[1]);
+	ASSERT_EQUALS(1u, updated.size());
+	ASSERT_EQUALS(2, updated[0]);
+}
+
+
+TEST(NotificationBatch, Remove)
+{
+	TestBatch batch(OnAdded, OnUpdated, 100);
+	for (int i = 0; i < 6; ++i) {
+		batch.Add(i);
+	}
+	batch.Remove(0);
+	batch.Remove(42);
+	batch.RemoveIf(IsOdd);
+	ASSERT_EQUALS(2u, batch.GetCount());
+
+	// Queued anew after a removal, delivered once
+	batch.Add(1);
+
+	batch.Flush();
+	ASSERT_EQUALS(3u, added.size());
+	ASSERT_EQUALS(2, added[0]);
+	ASSERT_EQUALS(4, added[1]);
+	ASSERT_EQUALS(1, added[2]);
+	ASSERT_EQUALS(0u, updatedCalls);
+
+	batch.Add(7);
+	batch.Clear();
+	ASSERT_EQUALS(0u, batch.GetCount());
+	ASSERT_FALSE(batch.Flush());
+	ASSERT_EQUALS(3u, added.size());
+}
+
+
+TEST(NotificationBatch, Limit)
+{
+	TestBatch batch(OnAdded, OnUpdated, 4);
+	for (int i = 0; i < 10; ++i) {
+		batch.Add(i);
+	}
+
+	// The oldest first, at most 4 per flush
+	ASSERT_TRUE(batch.Flush());
+	ASSERT_EQUALS(4u, added.size());
+	ASSERT_EQUALS(3, added[3]);
+	ASSERT_TRUE(batch.Flush());
+	ASSERT_EQUALS(8u, added.size());
+	ASSERT_FALSE(batch.Flush());
+	ASSERT_EQUALS(10u, added.size());
+	ASSERT_EQUALS(9, added[9]);
+	ASSERT_EQUALS(3u, addedCalls);
+}
@@ -0,0 +1,108 @@
+#include <muleunit/test.h>
+
+#include <wx/stopwatch.h>
+
+#include "Types.h"
+#include "RLE.h"
+
+#include <cstdlib>
+#include <vector>
+
+using namespace muleunit;
+
+
+// Compares encoding the gap lists once per client with the shared
+// encoding. Not part of 'make check', build and run it on demand with
+// 'make RLEBenchmark && ./RLEBenchmark'.
+
+
+const unsigned testFiles = 200;
+const unsigned testGaps = 64;
+const unsigned testRounds = 50;
+
+
+/**
+ * Changes a few entries of each gap list, like a running download does.
+ */
+void ChangeGaps(std::vector<ArrayOfUInts64>& files)
+{
+	for (size_t i = 0; i < files.size(); ++i) {
+		ArrayOfUInts64& gaps = files[i];
+		if (gaps.size() >= 2 && rand() % 4 == 0) {
+			gaps.resize(gaps.size() - 2);
+		}
+		if (!gaps.empty()) {
+			gaps[rand() % gaps.size()] += 10240;
+		}
+	}
+}
+
+
+std::vector<ArrayOfUInts64> CreateGaps()
+{
+	std::vector<ArrayOfUInts64> files(testFiles);
+	for (size_t i = 0; i < files.size(); ++i) {
+		for (uint64 j = 0; j < testGaps * 2; ++j) {
+			files[i].push_back(j * 9728000 + i);
+		}
+	}
+
+	return files;
+}
+
+
+DECLARE_SIMPLE(RLEBenchmark);
+
+
+TEST(RLEBenchmark, SharedVsPerClient)
+{
+	const unsigned clientCounts[] = { 1, 4, 16 };
+
+	for (size_t n = 0; n < sizeof(clientCounts) / sizeof(clientCounts[0]); ++n) {
+		const unsigned clients = clientCounts[n];
+
+		srand(1);
+		std::vector<ArrayOfUInts64> files = CreateGaps();
+		std::vector<std::vector<RLE_Data> > legacy(testFiles, std::vector<RLE_Data>(clients));
+
+		wxStopWatch legacyTime;
+		for (unsigned round = 0; round < testRounds; ++round) {
+			ChangeGaps(files);
+			for (size_t i = 0; i < testFiles; ++i) {
+				for (unsigned j = 0; j < clients; ++j) {
+					int len;
+					bool changed;
+					delete[] legacy[i][j].Encode(files[i], len, changed);
+				}
+			}
+		}
+		const long legacyMs = legacyTime.Time();
+
+		srand(1);
+		files = CreateGaps();
+		// Neither is copyable
+		RLE_SharedData* shared = new RLE_SharedData[testFiles];
+		RLE_SharedData::Cursor* cursors = new RLE_SharedData::Cursor[testFiles * clients];
+
+		wxStopWatch sharedTime;
+		for (unsigned round = 0; round < testRounds; ++round) {
+			ChangeGaps(files);
+			for (size_t i = 0; i < testFiles; ++i) {
+				shared[i].Update(files[i]);
+				for (unsigned j = 0; j < clients; ++j) {
+					const uint8* delta;
+					int len;
+					shared[i].GetDelta(cursors[i * clients + j], delta, len);
+				}
+			}
+		}
+		const long sharedMs = sharedTime.Time();
+
+		delete[] cursors;
+		delete[] shared;
+
+		wxPrintf(wxT("\n%u simulated clients, %u files, %u polls: per client %ld ms, shared %ld ms"),
+			clients, testFiles, testRounds, legacyMs, sharedMs);
+	}
+	wxPrintf(wxT("\n"));
+}
@@ -0,0 +1,114 @@
+#include <muleunit/test.h>
+
+#include "Types.h"
+#include "RLE.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+using namespace muleunit;
+
+
+bool SameDelta(const uint8* legacy, int legacyLen, bool legacyChanged, const uint8* shared, int sharedLen, bool sharedChanged)
+{
+	if (legacyChanged != sharedChanged) {
+		return false;
+	} else if (!legacyChanged) {
+		return true;
+	}
+
+	return legacyLen == sharedLen && (!legacyLen || !memcmp(legacy, shared, legacyLen));
+}
+
+
+DECLARE_SIMPLE(RLE);
+
+
+TEST(RLE, SharedMatchesPerClient)
+{
+	const unsigned clients = 5;
+
+	RLE_SharedData shared;
+	RLE_SharedData::Cursor cursors[clients];
+	std::vector<RLE_Data> encoders(clients);
+	std::vector<RLE_Data> decoders(clients);
+
+	srand(1);
+	ArrayOfUInts64 data;
+	for (unsigned round = 0; round < 2000; ++round) {
+		if (rand() % 4 == 0) {
+			data.resize(rand() % 20);
+		} else if (!data.empty()) {
+			data[rand() % data.size()] = (rand() % 3) ? rand() % 1000 : ((uint64)rand() << 40);
+		}
+		shared.Update(data);
+
+		for (unsigned i = 0; i < clients; ++i) {
+			// Clients poll at different rates
+			if (rand() % 3) {
+				continue;
+			}
+
+			// Full update requested
+			if (rand() % 50 == 0) {
+				cursors[i].Reset();
+				encoders[i].ResetEncoder();
+				decoders[i] = RLE_Data();
+			}
+
+			int legacyLen;
+			bool legacyChanged;
+			const uint8* legacy = encoders[i].Encode(data, legacyLen, legacyChanged);
+
+			const uint8* delta;
+			int deltaLen;
+			bool changed = shared.GetDelta(cursors[i], delta, deltaLen);
+
+			ASSERT_TRUE(SameDelta(legacy, legacyLen, legacyChanged, delta, deltaLen, changed));
+			delete[] legacy;
+
+			if (changed) {
+				ArrayOfUInts64 decoded;
+				decoders[i].Decode(delta, deltaLen, decoded);
+				ASSERT_TRUE(decoded == data);
+			}
+		}
+	}
+}
+
+
+TEST(RLE, SharedParts)
+{
+	RLE_SharedData shared;
+	RLE_SharedData::Cursor cursor;
+	RLE_Data legacy;
+
+	const uint8* delta;
+	int deltaLen;
+
+	// Nothing sampled yet
+	ASSERT_FALSE(shared.GetDelta(cursor, delta, deltaLen));
+
+	ArrayOfUInts16 parts(30);
+	for (unsigned round = 0; round < 500; ++round) {
+		// Values above 0xff are limited
+		parts[rand() % parts.size()] = rand() % 400;
+		shared.Update(parts);
+		ASSERT_EQUALS((int)parts.size(), shared.Size());
+
+		int legacyLen;
+		bool legacyChanged;
+		const uint8* encoded = legacy.Encode(parts, legacyLen, legacyChanged);
+
+		bool changed = shared.GetDelta(cursor, delta, deltaLen);
+		ASSERT_TRUE(SameDelta(encoded, legacyLen, legacyChanged, delta, deltaLen, changed));
+		delete[] encoded;
+
+		// Sent already
+		ASSERT_FALSE(shared.GetDelta(cursor, delta, deltaLen));
+	}
+
+	// Same data again is no change
+	ASSERT_FALSE(shared.Update(parts));
+}
@@ -0,0 +1,194 @@
+#include <muleunit/test.h>
+
+#include "Types.h"
+#include "RobinHoodMap.h"
+
+#include <cstring>
+#include <map>
+#include <set>
+
+using namespace muleunit;
+
+
+/**
+ * Maps every key onto the same few buckets, to force long probe sequences.
+ */
+struct CCollidingHash
+{
+	uint32 operator()(uint32 key) const	{ return key & 3; }
+};
+
+typedef CRobinHoodMultiMap<uint32, uint32, CRobinHoodUInt32Hash> TestMap;
+typedef CRobinHoodMultiMap<uint32, uint32, CCollidingHash> CollidingMap;
+
+
+/**
+ * Checks that the map contains exactly the pairs of the reference.
+ */
+template <typename MAP>
+void CheckContents(const MAP& map, const std::multimap<uint32, uint32>& ref)
+{
+	ASSERT_EQUALS(ref.size(), map.size());
+
+	size_t iterated = 0;
+	for (typename MAP::const_iterator it = map.begin(); it != map.end(); ++it) {
+		++iterated;
+	}
+	ASSERT_EQUALS(ref.size(), iterated);
+
+	std::multimap<uint32, uint32>::const_iterator it = ref.begin();
+	while (it != ref.end()) {
+		const uint32 key = it->first;
+		std::multiset<uint32> values;
+		for (; it != ref.end() && it->first == key; ++it) {
+			values.insert(it->second);
+		}
+
+		ASSERT_EQUALS(values.size(), map.count(key));
+		for (typename MAP::const_iterator mit = map.find(key); mit != map.end(); mit = map.find_next(mit)) {
+			ASSERT_EQUALS(key, mit->first);
+			std::multiset<uint32>::iterator found = values.find(mit->second);
+			ASSERT_TRUE(found != values.end());
+			values.erase(found);
+		}
+		ASSERT_TRUE(values.empty());
+	}
+}
+
+
+/**
+ * Removes one pair with the given key and value.
+ */
+template <typename MAP>
+bool ErasePair(MAP& map, uint32 key, uint32 value)
+{
+	for (typename MAP::const_iterator it = map.find(key); it != map.end(); it = map.find_next(it)) {
+		if (it->second == value) {
+			map.erase(it);
+			return true;
+		}
+	}
+
+	return false;
+}
+
+
+DECLARE_SIMPLE(RobinHoodMap)
+
+
+TEST(RobinHoodMap, Empty)
+{
+	TestMap map;
+
+	ASSERT_TRUE(map.empty());
+	ASSERT_EQUALS(0u, map.size());
+	ASSERT_TRUE(map.begin() == map.end());
+	ASSERT_TRUE(map.find(1234) == map.end());
+	ASSERT_EQUALS(0u, map.count(1234));
+}
+
+
+TEST(RobinHoodMap, InsertAndFind)
+{
+	TestMap map;
+	std::multimap<uint32, uint32> ref;
+
+	// Enough entries to grow the table several times
+	for (uint32 i = 0; i < 5000; ++i) {
+		map.insert(i * 7919, i);
+		ref.insert(std::make_pair(i * 7919, i));
+	}
+
+	CheckContents(map, ref);
+	ASSERT_TRUE(map.find(1) == map.end());
+}
+
+
+TEST(RobinHoodMap, Duplicates)
+{
+	TestMap map;
+	std::multimap<uint32, uint32> ref;
+
+	for (uint32 i = 0; i < 300; ++i) {
+		map.insert(i % 10, i);
+		ref.insert(std::make_pair(i % 10, i));
+	}
+
+	CheckContents(map, ref);
+	ASSERT_EQUALS(30u, map.count(3));
+}
+
+
+TEST(RobinHoodMap, Erase)
+{
+	CollidingMap map;
+	std::multimap<uint32, uint32> ref;
+
+	for (uint32 i = 0; i < 200; ++i) {
+		map.insert(i % 17, i);
+		ref.insert(std::make_pair(i % 17, i));
+	}
+
+	// Remove every third pair, all living in the same few probe sequences
+	for (uint32 i = 0; i < 200; i += 3) {
+		ASSERT_TRUE(ErasePair(map, i % 17, i));
+		ASSERT_FALSE(ErasePair(map, i % 17, i));
+
+		std::multimap<uint32, uint32>::iterator it = ref.lower_bound(i % 17);
+		while (it->second != i) {
+			++it;
+		}
+		ref.erase(it);
+	}
+
+	CheckContents(map, ref);
+
+	map.clear();
+	ASSERT_TRUE(map.empty());
+	ASSERT_TRUE(map.begin() == map.end());
+	ASSERT_TRUE(map.find(0) == map.end());
+}
+
+
+/**
+ * Stands in for CMD4Hash, which only has to provide its raw bytes.
+ */
+struct CTestHash
+{
+	unsigned char m_data[16];
+
+	const unsigned char* GetHash() const	{ return m_data; }
+};
+
+
+TEST(RobinHoodMap, SeededHash)
+{
+	CTestHash a, b;
+	for (int i = 0; i < 16; ++i) {
+		a.m_data[i] = b.m_data[i] = static_cast<unsigned char>(i * 7);
+	}
+	// The last byte is folded in as well
+	b.m_data[15] ^= 1;
+
+	CRobinHoodMD4Hash hasher;
+	CRobinHoodMD4Hash::SetSeed(1);
+	const uint32 first = hasher(a);
+	ASSERT_EQUALS(first, hasher(a));
+	ASSERT_TRUE(first != hasher(b));
+
+	// The seed changes where a hash lands
+	CRobinHoodMD4Hash::SetSeed(2);
+	ASSERT_TRUE(first != hasher(a));
+
+	// Hashes with the same words in another order would collide under
+	// any seed if the words were just folded together
+	CTestHash c = a;
+	memcpy(c.m_data, a.m_data + 4, 4);
+	memcpy(c.m_data + 4, a.m_data, 4);
+	for (uint32 seed = 0; seed < 16; ++seed) {
+		CRobinHoodMD4Hash::SetSeed(seed);
+		ASSERT_TRUE(hasher(a) != hasher(c));
+	}
+
+	CRobinHoodMD4Hash::SetSeed(0);
+}
@@ -0,0 +1,156 @@
+#include <muleunit/test.h>
+
+#include <wx/stopwatch.h>
+
+#include "Types.h"
+#include "MD4Hash.h"
+#include "RobinHoodMap.h"
+
+#include <cstdlib>
+#include <vector>
+
+using namespace muleunit;
+
+
+// Compares the linear scan CSearchList::AddToList used to find duplicate
+// results with the hash index it has now, replaying a large search answer.
+// Not part of 'make check', build and run it on demand with
+// 'make SearchListBenchmark && ./SearchListBenchmark'.
+
+
+const unsigned answerCounts[] = { 1000, 5000, 20000, 50000 };
+// One answer in this many repeats an earlier one, as when several
+// servers or Kad nodes know the same file
+const unsigned duplicateRatio = 4;
+
+
+struct CTestResult
+{
+	CMD4Hash	hash;
+	uint64		size;
+};
+
+
+CTestResult CreateResult()
+{
+	unsigned char hash[16];
+	for (unsigned i = 0; i < sizeof(hash); ++i) {
+		hash[i] = static_cast<unsigned char>(rand());
+	}
+
+	CTestResult result;
+	result.hash.SetHash(hash);
+	result.size = ((uint64)rand() << 16) ^ (uint64)rand();
+
+	return result;
+}
+
+
+/**
+ * Creates the answers of a search, some of them repeating earlier ones.
+ */
+std::vector<CTestResult> CreateAnswers(unsigned count)
+{
+	srand(1);
+	std::vector<CTestResult> answers;
+	for (unsigned i = 0; i < count; ++i) {
+		if (!answers.empty() && (unsigned)rand() % duplicateRatio == 0) {
+			answers.push_back(answers[rand() % answers.size()]);
+		} else {
+			answers.push_back(CreateResult());
+		}
+	}
+
+	return answers;
+}
+
+
+/**
+ * What AddToList did before: compare against every result of the search.
+ */
+struct CLinearResults
+{
+	std::vector<const CTestResult*>	results;
+
+	//! Returns true if the answer is a duplicate.
+	bool Add(const CTestResult& answer)
+	{
+		for (size_t i = 0; i < results.size(); ++i) {
+			const CTestResult* item = results[i];
+			if (answer.hash == item->hash && answer.size == item->size) {
+				return true;
+			}
+		}
+
+		results.push_back(&answer);
+		return false;
+	}
+};
+
+
+struct CIndexedResults
+{
+	std::vector<const CTestResult*>	results;
+	CRobinHoodMultiMap<CMD4Hash, const CTestResult*, CRobinHoodMD4Hash>	index;
+
+	bool Add(const CTestResult& answer)
+	{
+		typedef CRobinHoodMultiMap<CMD4Hash, const CTestResult*, CRobinHoodMD4Hash> Index;
+		for (Index::const_iterator it = index.find(answer.hash); it != index.end(); it = index.find_next(it)) {
+			if (answer.size == it->second->size) {
+				return true;
+			}
+		}
+
+		results.push_back(&answer);
+		index.insert(answer.hash, &answer);
+		return false;
+	}
+};
+
+
+/**
+ * Adds all answers to the results.
+ *
+ * @return The time taken in ms.
+ */
+template <typename RESULTS>
+long RunAnswers(const std::vector<CTestResult>& answers, size_t& duplicates)
+{
+	RESULTS results;
+	duplicates = 0;
+
+	wxStopWatch time;
+	for (size_t i = 0; i < answers.size(); ++i) {
+		if (results.Add(answers[i])) {
+			++duplicates;
+		}
+	}
+
+	return time.Time();
+}
+
+
+DECLARE_SIMPLE(SearchListBenchmark);
+
+
+TEST(SearchListBenchmark, DuplicateLookup)
+{
+	CRobinHoodMD4Hash::SetSeed(1);
+
+	for (size_t n = 0; n < sizeof(answerCounts) / sizeof(answerCounts[0]); ++n) {
+		const std::vector<CTestResult> answers = CreateAnswers(answerCounts[n]);
+
+		size_t linearDuplicates;
+		const long linearMs = RunAnswers<CLinearResults>(answers, linearDuplicates);
+		size_t indexedDuplicates;
+		const long indexedMs = RunAnswers<CIndexedResults>(answers, indexedDuplicates);
+
+		// Both have to find the same duplicates for the times to be comparable
+		ASSERT_EQUALS(linearDuplicates, indexedDuplicates);
+
+		wxPrintf(wxT("\n%u answers, %u duplicates: linear scan %ld ms, hash index %ld ms"),
+			answerCounts[n], (unsigned)linearDuplicates, linearMs, indexedMs);
+	}
+	wxPrintf(wxT("\n"));
+}
@@ -0,0 +1,135 @@
+#include <muleunit/test.h>
+
+#include <wx/stopwatch.h>
+
+#include "Types.h"
+#include "ShardedCounter.h"
+#include "MuleThread.h"
+
+#include <vector>
+
+using namespace muleunit;
+
+
+// Compares the sharded counter with the single mutex protected sum
+// CPreciseRateCounter used to have, with a growing number of threads
+// adding to it. Not part of 'make check', build and run it on demand with
+// 'make ShardedCounterBenchmark && ./ShardedCounterBenchmark'.
+
+
+const uint32 threadCounts[] = { 1, 2, 4, 8 };
+const uint32 addsPerThread = 1000000;
+
+
+/**
+ * What CPreciseRateCounter did before: one sum behind a mutex.
+ */
+class CLockedCounter
+{
+public:
+	CLockedCounter()
+		: m_sum(0)
+	{}
+
+	void Add(uint32 value)
+	{
+		wxMutexLocker lock(m_mutex);
+		m_sum += value;
+	}
+
+	uint32 Collect()
+	{
+		wxMutexLocker lock(m_mutex);
+		uint32 sum = m_sum;
+		m_sum = 0;
+		return sum;
+	}
+
+private:
+	wxMutex	m_mutex;
+	uint32	m_sum;
+};
+
+
+/**
+ * Adds the same value over and over, like a socket accounting bytes.
+ */
+template <typename COUNTER>
+class CAdder : public CMuleThread
+{
+public:
+	CAdder(COUNTER& counter, uint32 value)
+		: CMuleThread(wxTHREAD_JOINABLE),
+		  m_counter(counter),
+		  m_value(value)
+	{}
+
+protected:
+	virtual void* Entry()
+	{
+		for (uint32 i = 0; i < addsPerThread; ++i) {
+			m_counter.Add(m_value);
+		}
+
+		return NULL;
+	}
+
+private:
+	COUNTER&	m_counter;
+	uint32		m_value;
+};
+
+
+/**
+ * Runs the adders, collecting meanwhile like the core timer does.
+ *
+ * @return The collected sum.
+ */
+template <typename COUNTER>
+uint32 RunAdders(COUNTER& counter, uint32 threads)
+{
+	std::vector<CAdder<COUNTER>*> adders;
+	for (uint32 i = 0; i < threads; ++i) {
+		adders.push_back(new CAdder<COUNTER>(counter, i + 1));
+		ASSERT_TRUE(adders.back()->Create() == wxTHREAD_NO_ERROR);
+		ASSERT_TRUE(adders.back()->Run() == wxTHREAD_NO_ERROR);
+	}
+
+	uint32 sum = 0;
+	for (uint32 i = 0; i < threads; ++i) {
+		while (adders[i]->IsRunning()) {
+			sum += counter.Collect();
+			wxThread::Sleep(1);
+		}
+		adders[i]->Stop();
+		delete adders[i];
+	}
+
+	return sum + counter.Collect();
+}
+
+
+DECLARE_SIMPLE(ShardedCounterBenchmark);
+
+
+TEST(ShardedCounterBenchmark, MutexVsSharded)
+{
+	for (size_t n = 0; n < sizeof(threadCounts) / sizeof(threadCounts[0]); ++n) {
+		const uint32 threads = threadCounts[n];
+		const uint32 expected = addsPerThread * threads * (threads + 1) / 2;
+
+		CLockedCounter locked;
+		wxStopWatch lockedTime;
+		ASSERT_EQUALS(expected, RunAdders(locked, threads));
+		const long lockedMs = lockedTime.Time();
+
+		CShardedCounter sharded;
+		wxStopWatch shardedTime;
+		ASSERT_EQUALS(expected, RunAdders(sharded, threads));
+		const long shardedMs = shardedTime.Time();
+
+		wxPrintf(wxT("\n%u threads, %u adds each: mutex %ld ms, sharded %ld ms"),
+			threads, addsPerThread, lockedMs, shardedMs);
+	}
+	wxPrintf(wxT("\n"));
+}
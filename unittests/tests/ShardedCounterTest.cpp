@@ -0,0 +1,106 @@
+#include <muleunit/test.h>
+
+#include "Types.h"
+#include "ShardedCounter.h"
+#include "MuleThread.h"
+
+#include <vector>
+
+using namespace muleunit;
+
+
+const uint32 addsPerThread = 1000000;
+
+
+/**
+ * Adds the same value over and over, like a socket accounting bytes.
+ */
+class CAdder : public CMuleThread
+{
+public:
+	CAdder(CShardedCounter& counter, uint32 value)
+		: CMuleThread(wxTHREAD_JOINABLE),
+		  m_counter(counter),
+		  m_value(value)
+	{}
+
+protected:
+	virtual void* Entry()
+	{
+		for (uint32 i = 0; i < addsPerThread; ++i) {
+			m_counter.Add(m_value);
+		}
+
+		return NULL;
+	}
+
+private:
+	CShardedCounter&	m_counter;
+	uint32			m_value;
+};
+
+
+/**
+ * Runs the adders, collecting meanwhile like the core timer does.
+ *
+ * @return The collected sum.
+ */
+uint32 RunAdders(CShardedCounter& counter, uint32 threads)
+{
+	std::vector<CAdder*> adders;
+	for (uint32 i = 0; i < threads; ++i) {
+		adders.push_back(new CAdder(counter, i + 1));
+		ASSERT_TRUE(adders.back()->Create() == wxTHREAD_NO_ERROR);
+		ASSERT_TRUE(adders.back()->Run() == wxTHREAD_NO_ERROR);
+	}
+
+	uint32 sum = 0;
+	for (uint32 i = 0; i < threads; ++i) {
+		while (adders[i]->IsRunning()) {
+			sum += counter.Collect();
+			wxThread::Sleep(1);
+		}
+		adders[i]->Stop();
+		delete adders[i];
+	}
+
+	return sum + counter.Collect();
+}
+
+
+DECLARE_SIMPLE(ShardedCounter);
+
+
+TEST(ShardedCounter, SingleThread)
+{
+	CShardedCounter counter;
+	ASSERT_EQUALS(0u, counter.Collect());
+
+	counter.Add(10);
+	counter.Add(5);
+	ASSERT_EQUALS(15u, counter.Collect());
+	ASSERT_EQUALS(0u, counter.Collect());
+
+	counter.Add(7);
+	counter.Discard();
+	ASSERT_EQUALS(0u, counter.Collect());
+
+	// Shards wrap around
+	for (uint32 i = 0; i < 5; ++i) {
+		counter.Add(0xf0000000u);
+		ASSERT_EQUALS(0xf0000000u, counter.Collect());
+	}
+}
+
+
+TEST(ShardedCounter, Threads)
+{
+	const uint32 threads = 4;
+
+	CShardedCounter counter;
+	uint32 sum = RunAdders(counter, threads);
+
+	// 1 + 2 + ... + threads per round
+	ASSERT_EQUALS(addsPerThread * threads * (threads + 1) / 2, sum);
+}
+
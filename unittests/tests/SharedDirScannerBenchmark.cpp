@@ -0,0 +1,95 @@
+#include <muleunit/test.h>
+
+#include <wx/file.h>
+#include <wx/filefn.h>
+#include <wx/filename.h>
+#include <wx/stopwatch.h>
+
+#include "SharedDirScanner.h"
+
+using namespace muleunit;
+
+
+// Compares listing the shared directories one after the other with the
+// worker threads of CSharedDirScanner. Not part of 'make check', build and
+// run it on demand with 'make SharedDirScannerBenchmark &&
+// ./SharedDirScannerBenchmark'. The difference is largest on network
+// mounts, point it there by running it from a directory on one.
+
+
+const CPath testRoot = CPath(wxT("SharedDirScannerBenchmark.tmp"));
+const unsigned testDirs = 20;
+const unsigned testFilesPerDir = 1000;
+
+
+CPath GetTestDir(unsigned i)
+{
+	return testRoot.JoinPaths(CPath(wxString::Format(wxT("dir%u"), i)));
+}
+
+
+DECLARE(SharedDirScannerBenchmark);
+	void setUp() {
+		tearDown();
+
+		CPath::MakeDir(testRoot);
+		for (unsigned i = 0; i < testDirs; ++i) {
+			const CPath dir = GetTestDir(i);
+			CPath::MakeDir(dir);
+
+			for (unsigned j = 0; j < testFilesPerDir; ++j) {
+				wxFile file;
+				const CPath path = dir.JoinPaths(CPath(wxString::Format(wxT("file%u"), j)));
+				MULE_VALIDATE_STATE(file.Create(path.GetRaw(), true), wxT("Failed to create test file."));
+				file.Write("x", 1);
+			}
+		}
+	}
+
+	void tearDown() {
+		if (testRoot.DirExists()) {
+			wxFileName::Rmdir(testRoot.GetRaw(), wxPATH_RMDIR_RECURSIVE);
+		}
+	}
+
+	std::list<CPath> GetTestDirs() {
+		std::list<CPath> dirs;
+		for (unsigned i = 0; i < testDirs; ++i) {
+			dirs.push_back(GetTestDir(i));
+		}
+
+		return dirs;
+	}
+END_DECLARE;
+
+
+TEST(SharedDirScannerBenchmark, SerialVsThreaded)
+{
+	const std::list<CPath> dirs = GetTestDirs();
+	const double files = testDirs * testFilesPerDir;
+
+	wxStopWatch serial;
+	for (std::list<CPath>::const_iterator it = dirs.begin(); it != dirs.end(); ++it) {
+		CSharedDirScanner::CScannedDir result;
+		CSharedDirScanner::ScanDirectory(*it, false, result);
+		ASSERT_EQUALS(testFilesPerDir, result.files.size());
+	}
+	const long serialTime = serial.Time();
+
+	wxStopWatch parallel;
+	{
+		CSharedDirScanner scanner(dirs, false);
+		scanner.Start();
+
+		CSharedDirScanner::CScannedDir result;
+		while (scanner.GetNextDirectory(result)) {
+			ASSERT_EQUALS(testFilesPerDir, result.files.size());
+		}
+	}
+	const long parallelTime = parallel.Time();
+
+	wxPrintf(wxT("\nSerial: %.0f files/s, %u threads: %.0f files/s\n"),
+		files * 1000 / (serialTime ? serialTime : 1),
+		(unsigned)CSharedDirScanner::SCANNER_THREADS,
+		files * 1000 / (parallelTime ? parallelTime : 1));
+}
@@ -0,0 +1,143 @@
+#include <muleunit/test.h>
+
+#include <wx/file.h>
+#include <wx/filefn.h>
+#include <wx/filename.h>
+#include <wx/utils.h>
+
+#include "SharedDirScanner.h"
+
+using namespace muleunit;
+
+
+const CPath testRoot = CPath(wxT("SharedDirScannerTest.tmp"));
+const unsigned testDirs = 20;
+const unsigned testFilesPerDir = 250;
+
+
+CPath GetTestDir(unsigned i)
+{
+	return testRoot.JoinPaths(CPath(wxString::Format(wxT("dir%u"), i)));
+}
+
+
+void CreateTestFile(const CPath& path, size_t size)
+{
+	wxFile file;
+	MULE_VALIDATE_STATE(file.Create(path.GetRaw(), true), wxT("Failed to create test file."));
+	if (size) {
+		const std::vector<char> data(size, 'x');
+		file.Write(&data[0], size);
+	}
+}
+
+
+DECLARE(SharedDirScanner);
+	void setUp() {
+		tearDown();
+
+		CPath::MakeDir(testRoot);
+		for (unsigned i = 0; i < testDirs; ++i) {
+			const CPath dir = GetTestDir(i);
+			CPath::MakeDir(dir);
+
+			for (unsigned j = 0; j < testFilesPerDir; ++j) {
+				CreateTestFile(dir.JoinPaths(CPath(wxString::Format(wxT("file%u"), j))), j % 7);
+			}
+		}
+
+		// Neither of these should be listed by default
+		CreateTestFile(GetTestDir(0).JoinPaths(CPath(wxT(".hidden"))), 1);
+		CPath::MakeDir(GetTestDir(0).JoinPaths(CPath(wxT("subdir"))));
+	}
+
+	void tearDown() {
+		if (testRoot.DirExists()) {
+			wxFileName::Rmdir(testRoot.GetRaw(), wxPATH_RMDIR_RECURSIVE);
+		}
+	}
+
+	std::list<CPath> GetTestDirs() {
+		std::list<CPath> dirs;
+		for (unsigned i = 0; i < testDirs; ++i) {
+			dirs.push_back(GetTestDir(i));
+		}
+
+		return dirs;
+	}
+END_DECLARE;
+
+
+TEST(SharedDirScanner, ScanDirectory)
+{
+	CSharedDirScanner::CScannedDir result;
+	CSharedDirScanner::ScanDirectory(GetTestDir(0), false, result);
+
+	ASSERT_TRUE(result.opened);
+	ASSERT_EQUALS(GetTestDir(0), result.directory);
+	ASSERT_EQUALS(testFilesPerDir, result.files.size());
+	ASSERT_EQUALS(0u, result.failed.size());
+
+	for (size_t i = 0; i < result.files.size(); ++i) {
+		const CSharedDirScanner::CScannedFile& file = result.files[i];
+		unsigned index = 0;
+		ASSERT_TRUE(file.name.GetRaw().Mid(4).ToUInt(&index));
+		ASSERT_EQUALS(index % 7, file.size);
+		ASSERT_EQUALS(CPath::GetModificationTime(GetTestDir(0).JoinPaths(file.name)), file.mtime);
+	}
+
+	CSharedDirScanner::CScannedDir hidden;
+	CSharedDirScanner::ScanDirectory(GetTestDir(0), true, hidden);
+	ASSERT_EQUALS(testFilesPerDir + 1, hidden.files.size());
+
+	CSharedDirScanner::CScannedDir missing;
+	CSharedDirScanner::ScanDirectory(testRoot.JoinPaths(CPath(wxT("missing"))), false, missing);
+	ASSERT_FALSE(missing.opened);
+	ASSERT_EQUALS(0u, missing.files.size());
+}
+
+
+TEST(SharedDirScanner, Order)
+{
+	const std::list<CPath> dirs = GetTestDirs();
+
+	CSharedDirScanner scanner(dirs, false);
+	scanner.Start();
+
+	// Directories come back in the order they were given, whichever worker listed them
+	CSharedDirScanner::CScannedDir result;
+	for (std::list<CPath>::const_iterator it = dirs.begin(); it != dirs.end(); ++it) {
+		ASSERT_TRUE(scanner.GetNextDirectory(result));
+		ASSERT_EQUALS(*it, result.directory);
+		ASSERT_TRUE(result.opened);
+		ASSERT_EQUALS(testFilesPerDir, result.files.size());
+	}
+
+	ASSERT_FALSE(scanner.GetNextDirectory(result));
+}
+
+
+TEST(SharedDirScanner, NoWait)
+{
+	const std::list<CPath> dirs = GetTestDirs();
+
+	CSharedDirScanner scanner(dirs, false);
+	scanner.Start();
+
+	// Polled like the core timer does, directories still come back in order
+	std::list<CPath>::const_iterator it = dirs.begin();
+	CSharedDirScanner::CScannedDir result;
+	while (!scanner.IsFinished()) {
+		if (scanner.GetNextDirectory(result, false)) {
+			ASSERT_TRUE(it != dirs.end());
+			ASSERT_EQUALS(*it, result.directory);
+			ASSERT_EQUALS(testFilesPerDir, result.files.size());
+			++it;
+		} else {
+			wxMilliSleep(1);
+		}
+	}
+
+	ASSERT_TRUE(it == dirs.end());
+	ASSERT_FALSE(scanner.GetNextDirectory(result, false));
+}
@@ -0,0 +1,167 @@
+#include <muleunit/test.h>
+
+#include "StatsHistory.h"
+
+#include <vector>
+
+using namespace muleunit;
+
+
+const CPath testFile = CPath(wxT("StatsHistoryTest.tmp"));
+// A minute boundary, some time in 2020
+const uint32 testStart = 1600000020;
+
+
+// NaN is the only value not equal to itself
+bool IsMissing(float value)
+{
+	return value != value;
+}
+
+
+void RecordSeconds(CStatsHistory& history, uint32 start, uint32 count)
+{
+	for (uint32 i = 0; i < count; ++i) {
+		float values[CStatsHistory::ColCount];
+		for (unsigned col = 0; col < CStatsHistory::ColCount; ++col) {
+			values[col] = (float)(i + col);
+		}
+		history.Record(start + i, values);
+	}
+}
+
+
+DECLARE(StatsHistory);
+	void setUp() {
+		tearDown();
+	}
+
+	void tearDown() {
+		if (testFile.FileExists()) {
+			CPath::RemoveFile(testFile);
+		}
+	}
+END_DECLARE;
+
+
+TEST(StatsHistory, Seconds)
+{
+	CStatsHistory history;
+	RecordSeconds(history, testStart, 100);
+
+	std::vector<float> rows;
+	ASSERT_EQUALS(testStart + 10, history.GetRange(CStatsHistory::TierSeconds, testStart + 10, testStart + 19, rows));
+	ASSERT_EQUALS(10u * CStatsHistory::ColCount, rows.size());
+	for (unsigned i = 0; i < 10; ++i) {
+		for (unsigned col = 0; col < CStatsHistory::ColCount; ++col) {
+			ASSERT_EQUALS((float)(10 + i + col), rows[i * CStatsHistory::ColCount + col]);
+		}
+	}
+
+	// Nothing recorded before and after
+	history.GetRange(CStatsHistory::TierSeconds, testStart - 1, testStart + 100, rows);
+	ASSERT_EQUALS(102u * CStatsHistory::ColCount, rows.size());
+	ASSERT_TRUE(IsMissing(rows[0]));
+	ASSERT_EQUALS(0.0f, rows[CStatsHistory::ColCount]);
+	ASSERT_TRUE(IsMissing(rows[rows.size() - 1]));
+
+	history.GetRange(CStatsHistory::TierSeconds, testStart + 1, testStart, rows);
+	ASSERT_TRUE(rows.empty());
+}
+
+
+TEST(StatsHistory, Averages)
+{
+	CStatsHistory history;
+	RecordSeconds(history, testStart, 150);
+
+	std::vector<float> rows;
+	ASSERT_EQUALS(testStart, history.GetRange(CStatsHistory::TierMinutes, testStart + 5, testStart + 149, rows));
+	ASSERT_EQUALS(3u * CStatsHistory::ColCount, rows.size());
+
+	// Average of 0..59, 60..119, and 120..149 so far
+	ASSERT_EQUALS(29.5f, rows[0]);
+	ASSERT_EQUALS(89.5f, rows[CStatsHistory::ColCount]);
+	ASSERT_EQUALS(134.5f, rows[2 * CStatsHistory::ColCount]);
+	ASSERT_EQUALS(135.5f, rows[2 * CStatsHistory::ColCount + 1]);
+
+	// The hour is still being averaged
+	ASSERT_EQUALS(testStart - testStart % 3600, history.GetRange(CStatsHistory::TierHours, testStart, testStart, rows));
+	ASSERT_EQUALS((unsigned)CStatsHistory::ColCount, rows.size());
+	ASSERT_EQUALS(74.5f, rows[0]);
+}
+
+
+TEST(StatsHistory, Wrap)
+{
+	CStatsHistory history;
+	const uint32 capacity = CStatsHistory::GetCapacity(CStatsHistory::TierSeconds);
+	RecordSeconds(history, testStart, capacity + 10);
+
+	// Cut off at the old end
+	std::vector<float> rows;
+	const uint32 last = testStart + capacity + 9;
+	ASSERT_EQUALS(last - capacity + 1, history.GetRange(CStatsHistory::TierSeconds, 0, last, rows));
+	ASSERT_EQUALS(capacity * CStatsHistory::ColCount, rows.size());
+	ASSERT_EQUALS(10.0f, rows[0]);
+	ASSERT_EQUALS((float)(capacity + 9), rows[rows.size() - CStatsHistory::ColCount]);
+
+	// Overwritten slots are not reported for their old time
+	history.GetRange(CStatsHistory::TierSeconds, testStart, testStart + 9, rows);
+	ASSERT_EQUALS(10u * CStatsHistory::ColCount, rows.size());
+	for (size_t i = 0; i < rows.size(); ++i) {
+		ASSERT_TRUE(IsMissing(rows[i]));
+	}
+}
+
+
+TEST(StatsHistory, Persistence)
+{
+	{
+		CStatsHistory history;
+		ASSERT_TRUE(history.Open(testFile));
+		RecordSeconds(history, testStart, 90);
+		history.Close();
+	}
+
+	CStatsHistory history;
+	ASSERT_TRUE(history.Open(testFile));
+
+	std::vector<float> rows;
+	history.GetRange(CStatsHistory::TierSeconds, testStart + 89, testStart + 89, rows);
+	ASSERT_EQUALS(89.0f, rows[0]);
+
+	// The running average goes on across restarts
+	RecordSeconds(history, testStart + 120, 1);
+	history.GetRange(CStatsHistory::TierMinutes, testStart + 60, testStart + 60, rows);
+	ASSERT_EQUALS(74.5f, rows[0]);
+}
+
+
+TEST(StatsHistory, PartialFlush)
+{
+	const uint32 capacity = CStatsHistory::GetCapacity(CStatsHistory::TierSeconds);
+	// The range flushed second wraps around the end of the seconds tier
+	const uint32 wrap = testStart - testStart % capacity + capacity;
+
+	CStatsHistory history;
+	ASSERT_TRUE(history.Open(testFile));
+	RecordSeconds(history, testStart, 90);
+	ASSERT_TRUE(history.Flush());
+	RecordSeconds(history, wrap - 30, 60);
+	ASSERT_TRUE(history.Flush());
+
+	CStatsHistory reopened;
+	ASSERT_TRUE(reopened.Open(testFile));
+
+	std::vector<float> expected;
+	std::vector<float> rows;
+	for (unsigned tier = 0; tier < CStatsHistory::TierCount; ++tier) {
+		const CStatsHistory::Tier t = (CStatsHistory::Tier)tier;
+		ASSERT_EQUALS(history.GetRange(t, testStart, wrap + 29, expected), reopened.GetRange(t, testStart, wrap + 29, rows));
+		ASSERT_EQUALS(expected.size(), rows.size());
+		for (size_t i = 0; i < rows.size(); ++i) {
+			ASSERT_TRUE(IsMissing(expected[i]) ? IsMissing(rows[i]) : expected[i] == rows[i]);
+		}
+	}
+}
@@ -0,0 +1,164 @@
+#include <muleunit/test.h>
+
+#include "Types.h"
+#include "TimerWheel.h"
+
+#include <vector>
+
+using namespace muleunit;
+
+
+/**
+ * Records the time at which it was run.
+ */
+class CRecordingTask : public CTimerWheelTask
+{
+public:
+	CRecordingTask(const uint64* now, std::vector<uint64>* runs)
+		: m_now(now),
+		  m_runs(runs)
+	{}
+
+	virtual void Run()	{ m_runs->push_back(*m_now); }
+
+private:
+	const uint64*		m_now;
+	std::vector<uint64>*	m_runs;
+};
+
+
+/**
+ * Removes a timer (possibly its own) when run.
+ */
+class CRemovingTask : public CTimerWheelTask
+{
+public:
+	CRemovingTask(CTimerWheel* wheel, CTimerWheel::TimerID* target, uint32* count)
+		: m_wheel(wheel),
+		  m_target(target),
+		  m_count(count)
+	{}
+
+	virtual void Run() {
+		++*m_count;
+		m_wheel->RemoveTimer(*m_target);
+	}
+
+private:
+	CTimerWheel*		m_wheel;
+	CTimerWheel::TimerID*	m_target;
+	uint32*			m_count;
+};
+
+
+DECLARE_SIMPLE(TimerWheel)
+
+
+TEST(TimerWheel, OneShot)
+{
+	uint64 now = 1000000;
+	CTimerWheel wheel(now);
+
+	// Delays chosen to end up in each of the levels of the wheel
+	const uint32 delays[] = { 0, 50, 999, 3300, 250000, 3600000, 86400000 };
+	const uint32 count = sizeof(delays) / sizeof(delays[0]);
+	std::vector<uint64> runs[count];
+
+	for (uint32 i = 0; i < count; ++i) {
+		wheel.AddTimer(new CRecordingTask(&now, &runs[i]), delays[i]);
+	}
+
+	ASSERT_EQUALS(count, wheel.GetTimerCount());
+
+	const uint64 start = now;
+	while (now < start + 86400000 + 1000) {
+		now += 100;
+		wheel.Process(now);
+	}
+
+	for (uint32 i = 0; i < count; ++i) {
+		ASSERT_EQUALS(1u, runs[i].size());
+		// Never early, and at most a core tick late
+		ASSERT_TRUE(runs[i][0] >= start + delays[i]);
+		ASSERT_TRUE(runs[i][0] <= start + delays[i] + 150);
+	}
+
+	ASSERT_EQUALS(0u, wheel.GetTimerCount());
+}
+
+
+TEST(TimerWheel, Periodic)
+{
+	uint64 now = 0;
+	CTimerWheel wheel(now);
+	std::vector<uint64> runs;
+
+	wheel.AddPeriodicTimer(new CRecordingTask(&now, &runs), 1000);
+
+	while (now < 10500) {
+		now += 100;
+		wheel.Process(now);
+	}
+
+	ASSERT_EQUALS(10u, runs.size());
+	for (uint32 i = 1; i < runs.size(); ++i) {
+		ASSERT_TRUE(runs[i] - runs[i - 1] >= 1000);
+	}
+
+	// A long stall must not cause a burst of catch-up runs
+	runs.clear();
+	now += 60000;
+	wheel.Process(now);
+	ASSERT_EQUALS(1u, runs.size());
+}
+
+
+TEST(TimerWheel, Remove)
+{
+	uint64 now = 0;
+	CTimerWheel wheel(now);
+	std::vector<uint64> runs;
+
+	CTimerWheel::TimerID id = wheel.AddTimer(new CRecordingTask(&now, &runs), 500);
+	ASSERT_TRUE(wheel.RemoveTimer(id));
+	ASSERT_FALSE(wheel.RemoveTimer(id));
+
+	now += 1000;
+	wheel.Process(now);
+	ASSERT_EQUALS(0u, runs.size());
+	ASSERT_EQUALS(0u, wheel.GetTimerCount());
+}
+
+
+TEST(TimerWheel, RemoveFromTask)
+{
+	uint64 now = 0;
+	CTimerWheel wheel(now);
+	uint32 count = 0;
+
+	// A periodic task removing itself only runs once
+	CTimerWheel::TimerID self = 0;
+	self = wheel.AddPeriodicTimer(new CRemovingTask(&wheel, &self, &count), 100);
+
+	for (uint32 i = 0; i < 10; ++i) {
+		now += 100;
+		wheel.Process(now);
+	}
+
+	ASSERT_EQUALS(1u, count);
+	ASSERT_EQUALS(0u, wheel.GetTimerCount());
+}
+
+
+TEST(TimerWheel, TimeToNextTimer)
+{
+	uint64 now = 0;
+	CTimerWheel wheel(now);
+	std::vector<uint64> runs;
+
+	wheel.AddTimer(new CRecordingTask(&now, &runs), 1000);
+
+	uint32 next = wheel.GetTimeToNextTimer(now);
+	ASSERT_TRUE(next > 0);
+	ASSERT_TRUE(next <= 1050);
+}